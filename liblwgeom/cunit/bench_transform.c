@@ -0,0 +1,136 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/*
+** Throughput of ptarray_transform, which hands runs of points to
+** pj_transform, against transforming one point at a time with
+** point4d_transform, on long linestrings.
+**
+** Usage: bench_transform [npoints [nloops]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "liblwgeom_internal.h"
+
+static const char *srs_ll = "+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs";
+static const char *srs_utm = "+proj=utm +zone=33 +ellps=WGS84 +datum=WGS84 +units=m +no_defs";
+
+void lwgeom_init_allocators(void)
+{
+	lwgeom_install_default_allocators();
+}
+
+static POINTARRAY *
+bench_line(int npoints, int hasz)
+{
+	POINTARRAY *pa = ptarray_construct_empty(hasz, 0, npoints);
+	POINT4D p;
+	int i;
+
+	/* A walk across the middle of UTM zone 33 */
+	for ( i = 0; i < npoints; i++ )
+	{
+		p.x = 12.0 + 6.0 * i / npoints;
+		p.y = 40.0 + 10.0 * ((i * 7919) % npoints) / npoints;
+		p.z = 100.0;
+		p.m = 0.0;
+		ptarray_append_point(pa, &p, LW_TRUE);
+	}
+	return pa;
+}
+
+static double
+bench_per_point(POINTARRAY *pa, projPJ inpj, projPJ outpj)
+{
+	clock_t start = clock();
+	POINT4D p;
+	int i;
+
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		getPoint4d_p(pa, i, &p);
+		point4d_transform(&p, inpj, outpj);
+		ptarray_set_point4d(pa, i, &p);
+	}
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double
+bench_batched(POINTARRAY *pa, projPJ inpj, projPJ outpj)
+{
+	clock_t start = clock();
+
+	ptarray_transform(pa, inpj, outpj);
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char **argv)
+{
+	int npoints = 1000000;
+	int nloops = 3;
+	int hasz, i;
+	projPJ ll, utm;
+
+	if ( argc > 1 ) npoints = atoi(argv[1]);
+	if ( argc > 2 ) nloops = atoi(argv[2]);
+	if ( npoints < 1 || nloops < 1 )
+	{
+		fprintf(stderr, "Usage: %s [npoints [nloops]]\n", argv[0]);
+		return 1;
+	}
+
+	ll = lwproj_from_string(srs_ll);
+	utm = lwproj_from_string(srs_utm);
+	if ( ! ll || ! utm )
+	{
+		fprintf(stderr, "%s: could not initialize projections\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d points, best of %d\n", npoints, nloops);
+	printf("%-6s %-10s %12s %12s\n", "dims", "direction", "per-point/s", "batched/s");
+
+	for ( hasz = 0; hasz < 2; hasz++ )
+	{
+		double fwd[2] = { 1e99, 1e99 };
+		double inv[2] = { 1e99, 1e99 };
+
+		for ( i = 0; i < nloops; i++ )
+		{
+			POINTARRAY *pa = bench_line(npoints, hasz);
+			double t;
+
+			t = bench_per_point(pa, ll, utm);
+			if ( t < fwd[0] ) fwd[0] = t;
+			t = bench_per_point(pa, utm, ll);
+			if ( t < inv[0] ) inv[0] = t;
+
+			t = bench_batched(pa, ll, utm);
+			if ( t < fwd[1] ) fwd[1] = t;
+			t = bench_batched(pa, utm, ll);
+			if ( t < inv[1] ) inv[1] = t;
+
+			ptarray_free(pa);
+		}
+
+		printf("%-6s %-10s %12.0f %12.0f\n", hasz ? "XYZ" : "XY", "ll->utm",
+		       npoints / fwd[0], npoints / fwd[1]);
+		printf("%-6s %-10s %12.0f %12.0f\n", hasz ? "XYZ" : "XY", "utm->ll",
+		       npoints / inv[0], npoints / inv[1]);
+	}
+
+	pj_free(ll);
+	pj_free(utm);
+	return 0;
+}
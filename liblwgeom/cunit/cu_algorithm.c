@@ -774,6 +774,69 @@ static void test_geohash(void)
 	lwfree(geohash);
 }
 
+static void test_hilbert(void)
+{
+	uint32_t x[256], y[256];
+	int seen[256];
+	uint64_t d;
+	uint32_t i, j;
+	GBOX extent, box;
+
+	/* The order 1 curve */
+	CU_ASSERT_EQUAL(hilbert_xy2d(0, 0, 1), 0);
+	CU_ASSERT_EQUAL(hilbert_xy2d(0, 1, 1), 1);
+	CU_ASSERT_EQUAL(hilbert_xy2d(1, 1, 1), 2);
+	CU_ASSERT_EQUAL(hilbert_xy2d(1, 0, 1), 3);
+
+	/* Every cell of the order 4 grid once, each one next to the one before */
+	memset(seen, 0, sizeof(seen));
+	for ( i = 0; i < 16; i++ )
+	{
+		for ( j = 0; j < 16; j++ )
+		{
+			d = hilbert_xy2d(i, j, 4);
+			CU_ASSERT(d < 256);
+			if ( d >= 256 ) return;
+			seen[d]++;
+			x[d] = i;
+			y[d] = j;
+		}
+	}
+	for ( d = 0; d < 256; d++ )
+	{
+		CU_ASSERT_EQUAL(seen[d], 1);
+		if ( d > 0 )
+			CU_ASSERT_EQUAL(abs((int)x[d] - (int)x[d-1]) + abs((int)y[d] - (int)y[d-1]), 1);
+	}
+	CU_ASSERT_EQUAL(x[255], 15);
+	CU_ASSERT_EQUAL(y[255], 0);
+
+	/* Finest grid, the corners of the extent are the ends of the curve */
+	extent.xmin = -100; extent.xmax = 300;
+	extent.ymin = 10;   extent.ymax = 20;
+	box.xmin = box.xmax = -100;
+	box.ymin = box.ymax = 10;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent), 0);
+	box.xmin = box.xmax = 300;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent), ((uint64_t)1 << 62) - 1);
+
+	/* Outside of the extent is clamped to it */
+	box.xmin = 350; box.xmax = 450;
+	box.ymin = 0;   box.ymax = 10;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent), ((uint64_t)1 << 62) - 1);
+
+	/* The key is the one of the centre of the box */
+	box.xmin = -100; box.xmax = 300;
+	box.ymin = 10;   box.ymax = 10;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent),
+	                hilbert_xy2d((1u << 30) - 1, 0, HILBERT_MAX_ORDER));
+
+	/* Flat extents don't divide by zero */
+	extent.ymin = extent.ymax = 15;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent),
+	                hilbert_xy2d((1u << 30) - 1, 0, HILBERT_MAX_ORDER));
+}
+
 static void test_isclosed(void)
 {
 	LWGEOM *geom;
@@ -878,6 +941,101 @@ static void test_isclosed(void)
 	lwgeom_free(geom);
 }
 
+/*
+** The vector point in ring kernels must give the same answers as the
+** scalar one, on rings of every dimensionality, with points on the
+** vertices and edges, and zero length edges.
+*/
+static void test_ptarray_contains_point_2d(void)
+{
+	const char *wkt[] =
+	{
+		"POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 8,8 8,8 2,2 2))",
+		"POLYGON((0 0,4 0,4 0,8 0,8 4,6 6,4 4,2 6,0 4,0 0))",
+		"POLYGON Z ((0 0 1,9 1 2,5 5 3,9 9 4,1 9 5,3 5 6,0 0 1))",
+		"POLYGON ZM ((0 0 1 2,7 0 1 2,7 3 1 2,3 3 1 2,3 5 1 2,7 5 1 2,7 8 1 2,0 8 1 2,0 0 1 2))",
+		"POLYGON((0 0,0.5 0.25,1 0,1 1,0.5 0.75,0 1,0 0))"
+	};
+	const int nwkt = sizeof(wkt) / sizeof(char*);
+	POINT2D pts[23 * 23];
+	int expected[23 * 23];
+	int crossings[23 * 23];
+	int results[23 * 23];
+	int i, j, w, kernel, npts;
+
+	/* On a 0.5 grid around the rings, and then some */
+	npts = 0;
+	for ( i = 0; i < 23; i++ )
+		for ( j = 0; j < 23; j++ )
+		{
+			pts[npts].x = -1.0 + 0.5 * i;
+			pts[npts].y = -1.0 + 0.5 * j;
+			npts++;
+		}
+
+	for ( w = 0; w < nwkt; w++ )
+	{
+		LWPOLY *poly = (LWPOLY*)lwgeom_from_wkt(wkt[w], LW_PARSER_CHECK_NONE);
+		int r;
+
+		for ( r = 0; r < poly->nrings; r++ )
+		{
+			POINTARRAY *ring = poly->rings[r];
+
+			lw_inring_set_kernel(LW_INRING_SCALAR);
+			for ( i = 0; i < npts; i++ )
+			{
+				expected[i] = ptarray_contains_point_2d(ring, &pts[i]);
+				crossings[i] = ptarray_crossings_2d(ring, &pts[i]);
+			}
+
+			for ( kernel = LW_INRING_SSE2; kernel <= LW_INRING_AVX; kernel++ )
+			{
+				/* Not all CPUs have all the kernels, test what we have */
+				if ( lw_inring_set_kernel(kernel) != kernel )
+					continue;
+
+				for ( i = 0; i < npts; i++ )
+				{
+					CU_ASSERT_EQUAL(ptarray_contains_point_2d(ring, &pts[i]), expected[i]);
+					CU_ASSERT_EQUAL(ptarray_crossings_2d(ring, &pts[i]), crossings[i]);
+				}
+
+				/* Every batch size, for the leftovers of the vector loops */
+				for ( j = 0; j < 9; j++ )
+				{
+					memset(results, 0, sizeof(results));
+					ptarray_contains_points_2d(ring, pts + j, npts - j, results);
+					for ( i = 0; i < npts - j; i++ )
+						CU_ASSERT_EQUAL(results[i], expected[i + j]);
+				}
+			}
+		}
+		lwpoly_free(poly);
+	}
+	lw_inring_set_kernel(-1);
+
+	/* Known answers, on the shell of the first polygon */
+	{
+		LWPOLY *poly = (LWPOLY*)lwgeom_from_wkt(wkt[0], LW_PARSER_CHECK_NONE);
+		POINT2D pt;
+
+		pt.x = 5; pt.y = 5;
+		CU_ASSERT_EQUAL(ptarray_contains_point_2d(poly->rings[0], &pt), 1);
+		CU_ASSERT_EQUAL(ptarray_contains_point_2d(poly->rings[1], &pt), 1);
+		pt.x = 10; pt.y = 3;
+		CU_ASSERT_EQUAL(ptarray_contains_point_2d(poly->rings[0], &pt), 0);
+		pt.x = 0; pt.y = 0;
+		CU_ASSERT_EQUAL(ptarray_contains_point_2d(poly->rings[0], &pt), 0);
+		pt.x = 11; pt.y = 5;
+		CU_ASSERT_EQUAL(ptarray_contains_point_2d(poly->rings[0], &pt), -1);
+		CU_ASSERT_EQUAL(pt_in_ring_2d(&pt, poly->rings[0]), 0);
+		pt.x = 1; pt.y = 5;
+		CU_ASSERT_EQUAL(pt_in_ring_2d(&pt, poly->rings[0]), 1);
+		lwpoly_free(poly);
+	}
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -897,7 +1055,9 @@ CU_TestInfo algorithms_tests[] =
 	PG_TEST(test_geohash_point),
 	PG_TEST(test_geohash_precision),
 	PG_TEST(test_geohash),
+	PG_TEST(test_hilbert),
 	PG_TEST(test_isclosed),
+	PG_TEST(test_ptarray_contains_point_2d),
 	CU_TEST_INFO_NULL
 };
 CU_SuiteInfo algorithms_suite = {"PostGIS Computational Geometry Suite",  init_cg_suite,  clean_cg_suite, algorithms_tests};
@@ -777,6 +777,81 @@ static void test_lwgeom_is_empty(void)
 
 }
 
+/*
+ * The iterator has to agree with the deserialized geometry
+ */
+static void do_test_gserialized_iterator(const char *wkt)
+{
+	LWGEOM *geom = lwgeom_from_wkt(wkt, LW_PARSER_CHECK_NONE);
+	GSERIALIZED *g = gserialized_from_lwgeom(geom, 0, NULL);
+	GBOX box1, box2;
+	POINT4D p;
+	int ret1, ret2;
+
+	CU_ASSERT_EQUAL(gserialized_count_vertices(g), lwgeom_count_vertices(geom));
+	CU_ASSERT_EQUAL(gserialized_is_empty(g), lwgeom_is_empty(geom));
+	CU_ASSERT_EQUAL(gserialized_peek_first_point(g, &p), lwgeom_count_vertices(geom) ? LW_SUCCESS : LW_FAILURE);
+
+	ret1 = gserialized_get_gbox_p(g, &box1);
+	ret2 = lwgeom_calculate_gbox(geom, &box2);
+	CU_ASSERT_EQUAL(ret1, ret2);
+	if ( ret1 == LW_SUCCESS )
+	{
+		gbox_float_round(&box2);
+		CU_ASSERT(gbox_same(&box1, &box2));
+	}
+
+	lwfree(g);
+	lwgeom_free(geom);
+}
+
+static void test_gserialized_iterator(void)
+{
+	GSERIALIZED_ITERATOR it;
+	LWGEOM *geom;
+	GSERIALIZED *g;
+	POINTARRAY *pa;
+	POINT4D p;
+	int n = 0;
+
+	do_test_gserialized_iterator("POINT(1 2)");
+	do_test_gserialized_iterator("POINT EMPTY");
+	do_test_gserialized_iterator("LINESTRING(0 0 1,1 1 2,2 0 3)");
+	do_test_gserialized_iterator("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 8,8 8,8 2,2 2))");
+	do_test_gserialized_iterator("POLYGON((0 0 0 1,10 0 0 1,10 10 0 1,0 0 0 1))");
+	do_test_gserialized_iterator("MULTIPOINT(-1 -1,-1 2.5,2 2,2 -1)");
+	do_test_gserialized_iterator("MULTIPOLYGON(((-1 -1,-1 2.5,211 2,2 -1,-1 -1),(0 0,0 1,1 1,1 0,0 0)),EMPTY,((5 5,5 6,6 6,5 5)))");
+	do_test_gserialized_iterator("GEOMETRYCOLLECTION(POINT EMPTY,LINESTRING(1 1,2 2),GEOMETRYCOLLECTION(POLYGON((0 0,1 0,1 1,0 0)),POINT(9 9)))");
+	do_test_gserialized_iterator("GEOMETRYCOLLECTION(POINT EMPTY)");
+	do_test_gserialized_iterator("GEOMETRYCOLLECTION(GEOMETRYCOLLECTION EMPTY, POINT EMPTY, LINESTRING EMPTY, POLYGON EMPTY, MULTIPOINT EMPTY, MULTILINESTRING EMPTY, MULTIPOLYGON EMPTY, GEOMETRYCOLLECTION(MULTIPOLYGON EMPTY))");
+	do_test_gserialized_iterator("CIRCULARSTRING(0 0,1 1,2 0)");
+	do_test_gserialized_iterator("TIN(((0 0 0,0 0 1,0 1 0,0 0 0)),((0 0 0,0 1 0,1 1 0,0 0 0)))");
+
+	geom = lwgeom_from_wkt("GEOMETRYCOLLECTION(POINT EMPTY,LINESTRING EMPTY,MULTIPOINT(EMPTY,3 4))", LW_PARSER_CHECK_NONE);
+	g = gserialized_from_lwgeom(geom, 0, NULL);
+	CU_ASSERT_EQUAL(gserialized_peek_first_point(g, &p), LW_SUCCESS);
+	CU_ASSERT_EQUAL(p.x, 3);
+	CU_ASSERT_EQUAL(p.y, 4);
+	lwfree(g);
+	lwgeom_free(geom);
+
+	/* Rings come out in order, numbered from the shell */
+	geom = lwgeom_from_wkt("MULTIPOLYGON(((0 0,10 0,10 10,0 0),(1 1,2 1,2 2,1 1)),((20 0,30 0,30 10,20 0)))", LW_PARSER_CHECK_NONE);
+	g = gserialized_from_lwgeom(geom, 0, NULL);
+	gserialized_iterator_init(&it, g);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		CU_ASSERT_EQUAL(it.type, POLYGONTYPE);
+		CU_ASSERT_EQUAL(it.ring, n == 1 ? 1 : 0);
+		CU_ASSERT_EQUAL(pa->npoints, 4);
+		CU_ASSERT(FLAGS_GET_READONLY(pa->flags));
+		n++;
+	}
+	CU_ASSERT_EQUAL(n, 3);
+	lwfree(g);
+	lwgeom_free(geom);
+}
+
 /*
  * Test lwgeom_same
  */
@@ -895,6 +970,7 @@ CU_TestInfo libgeom_tests[] =
 	PG_TEST(test_lwgeom_force_clockwise),
 	PG_TEST(test_lwgeom_calculate_gbox),
 	PG_TEST(test_lwgeom_is_empty),
+	PG_TEST(test_gserialized_iterator),
 	PG_TEST(test_lwgeom_same),
 	CU_TEST_INFO_NULL
 };
@@ -99,6 +99,67 @@ static void test_mindistance2d_tolerance(void)
 
 }
 
+static void do_test_gserialized_distance2d_point(char *in1, char *in2, double tolerance)
+{
+	LWGEOM *lw1 = lwgeom_from_wkt(in1, LW_PARSER_CHECK_NONE);
+	LWGEOM *lw2 = lwgeom_from_wkt(in2, LW_PARSER_CHECK_NONE);
+	GSERIALIZED *g1 = gserialized_from_lwgeom(lw1, 0, NULL);
+	GSERIALIZED *g2 = gserialized_from_lwgeom(lw2, 0, NULL);
+	double expected = lwgeom_mindistance2d_tolerance(lw1, lw2, tolerance);
+	double distance;
+
+	CU_ASSERT_EQUAL(gserialized_distance2d_point(g1, g2, tolerance, &distance), LW_SUCCESS);
+	/* Both stop at the first distance under the tolerance, not the same one */
+	if ( expected <= tolerance )
+	{
+		CU_ASSERT(distance <= tolerance);
+	}
+	else
+	{
+		CU_ASSERT_DOUBLE_EQUAL(distance, expected, 1e-12);
+	}
+
+	lwfree(g1);
+	lwfree(g2);
+	lwgeom_free(lw1);
+	lwgeom_free(lw2);
+}
+
+static void test_gserialized_distance2d_point(void)
+{
+	const char *mpoly = "MULTIPOLYGON(((0 0,10 0,10 10,0 10,0 0),(2 2,2 8,8 8,8 2,2 2)),((20 0,30 0,30 10,20 10,20 0)))";
+	LWGEOM *lw1, *lw2;
+	GSERIALIZED *g1, *g2;
+	double distance;
+
+	do_test_gserialized_distance2d_point("POINT(0 0)", "POINT(3 4)", 0.0);
+	do_test_gserialized_distance2d_point("POINT(1 1)", "MULTIPOINT(5 5,3 1,EMPTY)", 0.0);
+	do_test_gserialized_distance2d_point("LINESTRING(0 0,10 0,10 10)", "POINT(5 3)", 0.0);
+	do_test_gserialized_distance2d_point("POINT(12 5)", "MULTILINESTRING((0 0,10 0),(11 0,11 20))", 0.0);
+	do_test_gserialized_distance2d_point("POINT(1 1)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(5 4)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(5 5)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(15 5)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(25 5)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(-3 -4)", (char*)mpoly, 0.0);
+	do_test_gserialized_distance2d_point("POINT(15 5)", (char*)mpoly, 5.0);
+	do_test_gserialized_distance2d_point("POINT(5 5)", "POLYGON((0 0,10 0,10 10,0 10,0 0),(1 1,1 9,9 9,9 1,1 1),(4 4,4 6,6 6,6 4,4 4))", 0.0);
+	do_test_gserialized_distance2d_point("POINT(5 5)", "POLYGON EMPTY", 0.0);
+	do_test_gserialized_distance2d_point("POINT EMPTY", "LINESTRING(0 0,1 1)", 0.0);
+
+	/* No point, or something the iterator doesn't measure */
+	lw1 = lwgeom_from_wkt("LINESTRING(0 0,1 1)", LW_PARSER_CHECK_NONE);
+	lw2 = lwgeom_from_wkt("GEOMETRYCOLLECTION(POINT(0 0))", LW_PARSER_CHECK_NONE);
+	g1 = gserialized_from_lwgeom(lw1, 0, NULL);
+	g2 = gserialized_from_lwgeom(lw2, 0, NULL);
+	CU_ASSERT_EQUAL(gserialized_distance2d_point(g1, g1, 0.0, &distance), LW_FAILURE);
+	CU_ASSERT_EQUAL(gserialized_distance2d_point(g1, g2, 0.0, &distance), LW_FAILURE);
+	lwfree(g1);
+	lwfree(g2);
+	lwgeom_free(lw1);
+	lwgeom_free(lw2);
+}
+
 static void test_rect_tree_contains_point(void)
 {
 	LWPOLY *poly;
@@ -351,6 +412,7 @@ test_lwgeom_locate_along(void)
 CU_TestInfo measures_tests[] =
 {
 	PG_TEST(test_mindistance2d_tolerance),
+	PG_TEST(test_gserialized_distance2d_point),
 	PG_TEST(test_rect_tree_contains_point),
 	PG_TEST(test_rect_tree_intersects_tree),
 	PG_TEST(test_lwgeom_segmentize2d),
@@ -374,6 +374,56 @@ static void test_ptarray_desegmentize()
 	
 }
 
+static void test_ptarray_transform(void)
+{
+	projPJ ll, merc;
+	POINTARRAY *pa, *pa_ref;
+	POINT4D p, q;
+	int i, hasz;
+	int npoints = 2500; /* more than one run of pj_transform */
+
+	ll = lwproj_from_string("+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs");
+	merc = lwproj_from_string("+proj=merc +lon_0=0 +k=1 +x_0=0 +y_0=0 +ellps=WGS84 +datum=WGS84 +units=m +no_defs");
+
+	for ( hasz = 0; hasz < 2; hasz++ )
+	{
+		pa = ptarray_construct_empty(hasz, 1, npoints);
+		for ( i = 0; i < npoints; i++ )
+		{
+			p.x = -170.0 + i * 0.1;
+			p.y = -80.0 + i * 0.05;
+			p.z = i;
+			p.m = -i;
+			ptarray_append_point(pa, &p, LW_TRUE);
+		}
+		pa_ref = ptarray_clone_deep(pa);
+
+		/* The whole array at once matches one point at a time */
+		CU_ASSERT_EQUAL(ptarray_transform(pa, ll, merc), LW_SUCCESS);
+		for ( i = 0; i < npoints; i++ )
+		{
+			getPoint4d_p(pa_ref, i, &p);
+			point4d_transform(&p, ll, merc);
+			getPoint4d_p(pa, i, &q);
+			CU_ASSERT_DOUBLE_EQUAL(q.x, p.x, 0.000001);
+			CU_ASSERT_DOUBLE_EQUAL(q.y, p.y, 0.000001);
+			CU_ASSERT_DOUBLE_EQUAL(q.m, -i, 0.000001);
+		}
+
+		/* And back */
+		CU_ASSERT_EQUAL(ptarray_transform(pa, merc, ll), LW_SUCCESS);
+		getPoint4d_p(pa, npoints - 1, &q);
+		CU_ASSERT_DOUBLE_EQUAL(q.x, -170.0 + (npoints - 1) * 0.1, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(q.y, -80.0 + (npoints - 1) * 0.05, 0.000001);
+
+		ptarray_free(pa);
+		ptarray_free(pa_ref);
+	}
+
+	pj_free(ll);
+	pj_free(merc);
+}
+
 /*
 ** Used by the test harness to register the tests in this file.
 */
@@ -385,6 +435,7 @@ CU_TestInfo ptarray_tests[] =
 	PG_TEST(test_ptarray_isccw),
 	PG_TEST(test_ptarray_desegmentize),
 	PG_TEST(test_ptarray_insert_point),
+	PG_TEST(test_ptarray_transform),
 	CU_TEST_INFO_NULL
 };
 CU_SuiteInfo ptarray_suite = {"ptarray", NULL, NULL, ptarray_tests };
@@ -32,6 +32,22 @@ static void test_stringbuffer_append(void)
 	CU_ASSERT_STRING_EQUAL("hello world", str);
 }
 
+static void test_stringbuffer_append_len(void)
+{
+	stringbuffer_t *sb;
+	const char *str;
+
+	sb = stringbuffer_create_with_size(2);
+	stringbuffer_append_len(sb, "ab\0cd", 5);
+	stringbuffer_append(sb, "ef");
+	str = stringbuffer_getstring(sb);
+
+	CU_ASSERT_EQUAL(stringbuffer_getlength(sb), 7);
+	CU_ASSERT_EQUAL(memcmp(str, "ab\0cdef", 8), 0);
+
+	stringbuffer_destroy(sb);
+}
+
 static void test_stringbuffer_aprintf(void)
 {
 	stringbuffer_t *sb;
@@ -53,6 +69,7 @@ static void test_stringbuffer_aprintf(void)
 CU_TestInfo stringbuffer_tests[] =
 {
 	PG_TEST(test_stringbuffer_append),
+	PG_TEST(test_stringbuffer_append_len),
 	PG_TEST(test_stringbuffer_aprintf),
 	CU_TEST_INFO_NULL
 };
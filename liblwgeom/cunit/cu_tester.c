@@ -32,6 +32,7 @@ extern CU_SuiteInfo wkb_in_suite;
 extern CU_SuiteInfo libgeom_suite;
 extern CU_SuiteInfo split_suite;
 extern CU_SuiteInfo geodetic_suite;
+extern CU_SuiteInfo tree_suite;
 extern CU_SuiteInfo geos_suite;
 extern CU_SuiteInfo homogenize_suite;
 extern CU_SuiteInfo stringbuffer_suite;
@@ -67,6 +68,7 @@ int main(int argc, char *argv[])
 		libgeom_suite,
 		split_suite,
 		geodetic_suite,
+		tree_suite,
 		geos_suite,
 		stringbuffer_suite,
 		surface_suite,
@@ -0,0 +1,212 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CUnit/Basic.h"
+
+#include "liblwgeom_internal.h"
+#include "lwgeodetic.h"
+#include "lwgeodetic_tree.h"
+#include "cu_tester.h"
+
+
+static void test_tree_circ_create(void)
+{
+	LWLINE *g;
+	CIRC_NODE *c;
+	/* Line with 4 edges */
+	g = lwgeom_as_lwline(lwgeom_from_wkt("LINESTRING(0 88,0 89,0 90,180 89,180 88)", LW_PARSER_CHECK_NONE));
+	c = circ_tree_new(g->points);
+	/* One leaf per edge, all under a single parent */
+	CU_ASSERT_EQUAL(c->num_nodes, 4);
+	/* The parent circle contains every leaf circle */
+	CU_ASSERT(c->radius >= c->nodes[0]->radius);
+	CU_ASSERT(c->radius >= c->nodes[3]->radius);
+	circ_tree_free(c);
+	lwline_free(g);
+
+	/* Single point gives a single zero-radius leaf */
+	g = lwgeom_as_lwline(lwgeom_from_wkt("LINESTRING(10 10,10 10)", LW_PARSER_CHECK_NONE));
+	c = circ_tree_new(g->points);
+	CU_ASSERT_EQUAL(c->num_nodes, 0);
+	CU_ASSERT_DOUBLE_EQUAL(c->radius, 0.0, 0.0000001);
+	circ_tree_free(c);
+	lwline_free(g);
+}
+
+
+static void test_tree_circ_pip(void)
+{
+	LWGEOM *lwg;
+	CIRC_NODE *c;
+	POINT2D pt;
+
+	lwg = lwgeom_from_wkt("POLYGON((0 0,0 1,1 1,1 0,0 0))", LW_PARSER_CHECK_NONE);
+	c = lwgeom_calculate_circ_tree(lwg);
+	CU_ASSERT_EQUAL(c->geom_type, POLYGONTYPE);
+
+	/* Inside */
+	pt.x = 0.5; pt.y = 0.5;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_TRUE);
+	/* Outside */
+	pt.x = 1.5; pt.y = 0.5;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_FALSE);
+	/* On a vertex */
+	pt.x = 1.0; pt.y = 1.0;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_TRUE);
+	/* On an edge */
+	pt.x = 0.0; pt.y = 0.5;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_TRUE);
+	circ_tree_free(c);
+	lwgeom_free(lwg);
+
+	/* Hole */
+	lwg = lwgeom_from_wkt("POLYGON((0 0,0 10,10 10,10 0,0 0),(4 4,6 4,6 6,4 6,4 4))", LW_PARSER_CHECK_NONE);
+	c = lwgeom_calculate_circ_tree(lwg);
+	pt.x = 5.0; pt.y = 5.0;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_FALSE);
+	pt.x = 2.0; pt.y = 5.0;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_TRUE);
+	circ_tree_free(c);
+	lwgeom_free(lwg);
+
+	/* Lines never contain anything */
+	lwg = lwgeom_from_wkt("LINESTRING(0 0,0 10,10 10,10 0,0 0)", LW_PARSER_CHECK_NONE);
+	c = lwgeom_calculate_circ_tree(lwg);
+	pt.x = 5.0; pt.y = 5.0;
+	CU_ASSERT_EQUAL(circ_tree_contains_point(c, &pt), LW_FALSE);
+	circ_tree_free(c);
+	lwgeom_free(lwg);
+}
+
+static void test_tree_circ_pip_random(void)
+{
+	LWGEOM *lwg;
+	LWPOLY *poly;
+	POINTARRAY *pa;
+	CIRC_NODE *c;
+	POINT4D p;
+	POINT2D pt;
+	int i, npoints = 500;
+	int mismatches = 0;
+
+	/* Star shaped ring with a lot of vertices */
+	pa = ptarray_construct_empty(0, 0, npoints + 1);
+	for ( i = 0; i < npoints; i++ )
+	{
+		double a = 2.0 * M_PI * i / npoints;
+		double r = (i % 2) ? 10.0 : 4.0;
+		p.x = 20.0 + r * cos(a);
+		p.y = 40.0 + r * sin(a);
+		p.z = p.m = 0.0;
+		ptarray_append_point(pa, &p, LW_TRUE);
+	}
+	getPoint4d_p(pa, 0, &p);
+	ptarray_append_point(pa, &p, LW_TRUE);
+	poly = lwpoly_construct_empty(SRID_UNKNOWN, 0, 0);
+	lwpoly_add_ring(poly, pa);
+	lwg = lwpoly_as_lwgeom(poly);
+	c = lwgeom_calculate_circ_tree(lwg);
+
+	srand(1);
+	for ( i = 0; i < 2000; i++ )
+	{
+		pt.x = 8.0 + 24.0 * rand() / RAND_MAX;
+		pt.y = 28.0 + 24.0 * rand() / RAND_MAX;
+		if ( circ_tree_contains_point(c, &pt) != lwpoly_covers_point2d(poly, &pt) )
+			mismatches++;
+	}
+	CU_ASSERT_EQUAL(mismatches, 0);
+
+	circ_tree_free(c);
+	lwgeom_free(lwg);
+}
+
+static void test_tree_circ_distance(void)
+{
+	LWGEOM *lwg1, *lwg2;
+	CIRC_NODE *c1, *c2;
+	SPHEROID s;
+	double d1, d2;
+	int i;
+	static const char *wkt[][2] =
+	{
+		{ "POINT(0 0)", "POINT(1 1)" },
+		{ "LINESTRING(0 0,10 0,10 10)", "POINT(5 5)" },
+		{ "LINESTRING(0 0,10 0)", "LINESTRING(5 -5,5 5)" },
+		{ "POLYGON((0 0,0 10,10 10,10 0,0 0))", "POINT(5 5)" },
+		{ "POLYGON((0 0,0 10,10 10,10 0,0 0))", "POINT(15 5)" },
+		{ "POLYGON((0 0,0 10,10 10,10 0,0 0),(4 4,6 4,6 6,4 6,4 4))", "POINT(5 5)" },
+		{ "POLYGON((0 0,0 10,10 10,10 0,0 0))", "LINESTRING(20 -20,20 20,30 30)" },
+		{ "MULTIPOLYGON(((0 0,0 1,1 1,1 0,0 0)),((20 20,20 21,21 21,21 20,20 20)))", "POINT(20.5 20.5)" },
+		{ "POLYGON((0 0,0 10,10 10,10 0,0 0))", "MULTIPOINT(30 30,2 2)" },
+		{ "POLYGON((-120 50,-110 50,-110 60,-120 60,-120 50))", "POLYGON((-100 30,-90 30,-90 40,-100 40,-100 30))" },
+		{ "LINESTRING(179 10,-179 10)", "POINT(180 12)" }
+	};
+
+	spheroid_init(&s, WGS84_MAJOR_AXIS, WGS84_MINOR_AXIS);
+
+	for ( i = 0; i < sizeof(wkt) / sizeof(wkt[0]); i++ )
+	{
+		lwg1 = lwgeom_from_wkt(wkt[i][0], LW_PARSER_CHECK_NONE);
+		lwg2 = lwgeom_from_wkt(wkt[i][1], LW_PARSER_CHECK_NONE);
+		c1 = lwgeom_calculate_circ_tree(lwg1);
+		c2 = lwgeom_calculate_circ_tree(lwg2);
+
+		/* Spheroid, exact */
+		d1 = lwgeom_distance_spheroid(lwg1, lwg2, &s, 0.0);
+		d2 = circ_tree_distance_tree(c1, c2, &s, 0.0);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.0001);
+		if ( fabs(d1 - d2) > 0.0001 )
+			printf("\n%s / %s: %.12g != %.12g\n", wkt[i][0], wkt[i][1], d1, d2);
+
+		/* Argument order doesn't matter */
+		d2 = circ_tree_distance_tree(c2, c1, &s, 0.0);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.0001);
+
+		circ_tree_free(c1);
+		circ_tree_free(c2);
+		lwgeom_free(lwg1);
+		lwgeom_free(lwg2);
+	}
+
+	/* Sphere, with a threshold */
+	s.a = s.b = s.radius;
+	lwg1 = lwgeom_from_wkt("LINESTRING(0 0,1 0,2 0,3 0,4 0,5 0,6 0,7 0,8 0,9 0,10 0)", LW_PARSER_CHECK_NONE);
+	lwg2 = lwgeom_from_wkt("POINT(5 1)", LW_PARSER_CHECK_NONE);
+	c1 = lwgeom_calculate_circ_tree(lwg1);
+	c2 = lwgeom_calculate_circ_tree(lwg2);
+	d1 = lwgeom_distance_spheroid(lwg1, lwg2, &s, 0.0);
+	d2 = circ_tree_distance_tree(c1, c2, &s, 0.0);
+	CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.0001);
+	/* Early exit answers are under the threshold */
+	d2 = circ_tree_distance_tree(c1, c2, &s, 200000.0);
+	CU_ASSERT(d2 <= 200000.0);
+	circ_tree_free(c1);
+	circ_tree_free(c2);
+	lwgeom_free(lwg1);
+	lwgeom_free(lwg2);
+}
+
+
+/*
+** Used by test harness to register the tests in this file.
+*/
+CU_TestInfo tree_tests[] =
+{
+	PG_TEST(test_tree_circ_create),
+	PG_TEST(test_tree_circ_pip),
+	PG_TEST(test_tree_circ_pip_random),
+	PG_TEST(test_tree_circ_distance),
+	CU_TEST_INFO_NULL
+};
+CU_SuiteInfo tree_suite = {"Spherical Tree Suite",  NULL,  NULL, tree_tests};
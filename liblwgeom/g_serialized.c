@@ -101,12 +101,16 @@ GSERIALIZED* gserialized_copy(const GSERIALIZED *g)
 int gserialized_is_empty(const GSERIALIZED *g)
 {
 	uint8_t *p = (uint8_t*)g;
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+	uint32_t type;
 	int i;
 	assert(g);
 
 	p += 8; /* Skip varhdr and srid/flags */
 	if( FLAGS_GET_BBOX(g->flags) )
 		p += gbox_serialized_size(g->flags); /* Skip the box */
+	type = lw_get_uint32_t(p);
 	p += 4; /* Skip type number */
 	
 	/* For point/line/circstring this is npoints */
@@ -114,11 +118,21 @@ int gserialized_is_empty(const GSERIALIZED *g)
 	/* For collections this is ngeoms */
 	memcpy(&i, p, sizeof(int));
 	
-	/* If it is non-zero, it's not empty */
-	if ( i > 0 )
+	/* If it is zero, it's empty */
+	if ( i == 0 )
+		return LW_TRUE;
+	if ( ! lwtype_is_collection(type) )
 		return LW_FALSE;
-	else
-		return LW_TRUE;	
+
+	/* A collection is empty if all its elements are */
+	gserialized_iterator_init(&it, g);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		/* A polygon with rings is not empty, even if they are */
+		if ( pa->npoints > 0 || it.type == POLYGONTYPE )
+			return LW_FALSE;
+	}
+	return LW_TRUE;
 }
 
 char* gserialized_to_string(const GSERIALIZED *g)
@@ -251,10 +265,18 @@ int gserialized_read_gbox_p(const GSERIALIZED *g, GBOX *gbox)
 * Read the bounding box off a serialization and calculate one if
 * it is not already there.
 */
+static int gserialized_calculate_gbox_cartesian(const GSERIALIZED *g, GBOX *gbox);
+
 int gserialized_get_gbox_p(const GSERIALIZED *geom, GBOX *box)
 {
 	LWGEOM *lwgeom;
 	int ret = gserialized_read_gbox_p(geom, box);
+	/* Linear cartesian geometries can be read in place */
+	if ( LW_FAILURE == ret && ! FLAGS_GET_GEODETIC(geom->flags) &&
+	     LW_SUCCESS == gserialized_calculate_gbox_cartesian(geom, box) ) {
+		gbox_float_round(box);
+		return LW_SUCCESS;
+	}
 	if ( LW_FAILURE == ret ) {
 		/* See http://trac.osgeo.org/postgis/ticket/1023 */
 		lwgeom = lwgeom_from_gserialized(geom);
@@ -266,6 +288,161 @@ int gserialized_get_gbox_p(const GSERIALIZED *geom, GBOX *box)
 }
 
 
+/***********************************************************************
+* Read-only walk over the coordinates of a GSERIALIZED.
+*/
+
+void gserialized_iterator_init(GSERIALIZED_ITERATOR *it, const GSERIALIZED *g)
+{
+	assert(g);
+
+	it->ptr = (uint8_t*)g->data;
+	if ( FLAGS_GET_BBOX(g->flags) )
+		it->ptr += gbox_serialized_size(g->flags);
+	it->nring_ptr = NULL;
+	it->pending = 1;
+	it->nrings = 0;
+	it->type = 0;
+	it->ring = 0;
+
+	it->flags = gflags(FLAGS_GET_Z(g->flags), FLAGS_GET_M(g->flags), 0);
+	it->pa.flags = it->flags;
+	FLAGS_SET_READONLY(it->pa.flags, 1); /* We don't own this memory, so we can't alter or free it. */
+	it->pa.npoints = it->pa.maxpoints = 0;
+	it->pa.serialized_pointlist = NULL;
+}
+
+/* Point the current array at the next npoints ordinates */
+static POINTARRAY* gserialized_iterator_array(GSERIALIZED_ITERATOR *it, uint32_t npoints)
+{
+	it->pa.npoints = it->pa.maxpoints = npoints;
+	it->pa.serialized_pointlist = it->ptr;
+	it->ptr += sizeof(double) * FLAGS_NDIMS(it->flags) * npoints;
+	return &(it->pa);
+}
+
+POINTARRAY* gserialized_iterator_next(GSERIALIZED_ITERATOR *it)
+{
+	uint32_t type, count;
+
+	while ( 1 )
+	{
+		/* Next ring of the current polygon */
+		if ( it->nrings > 0 )
+		{
+			count = lw_get_uint32_t(it->nring_ptr);
+			it->nring_ptr += 4;
+			it->nrings--;
+			it->ring++;
+			return gserialized_iterator_array(it, count);
+		}
+
+		if ( it->pending == 0 )
+			return NULL;
+
+		/*
+		 * Every geometry starts with its type and a count. The elements
+		 * of a collection follow it, so we only need to remember how
+		 * many geometries are left to read, not where they come from.
+		 */
+		type = lw_get_uint32_t(it->ptr);
+		count = lw_get_uint32_t(it->ptr + 4);
+		it->ptr += 8;
+		it->pending--;
+
+		switch (type)
+		{
+		case POINTTYPE:
+		case LINETYPE:
+		case CIRCSTRINGTYPE:
+		case TRIANGLETYPE:
+			it->type = type;
+			it->ring = 0;
+			return gserialized_iterator_array(it, count);
+		case POLYGONTYPE:
+			/* The ring sizes come first, padded to a double boundary */
+			it->type = type;
+			it->ring = -1;
+			it->nrings = count;
+			it->nring_ptr = it->ptr;
+			it->ptr += 4 * count;
+			if ( count % 2 )
+				it->ptr += 4;
+			break;
+		default:
+			if ( ! lwtype_is_collection(type) )
+			{
+				lwerror("gserialized_iterator_next: unknown geometry type: %d - %s", type, lwtype_name(type));
+				return NULL;
+			}
+			it->pending += count;
+			break;
+		}
+	}
+}
+
+int gserialized_count_vertices(const GSERIALIZED *g)
+{
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+	int npoints = 0;
+
+	gserialized_iterator_init(&it, g);
+	while ( (pa = gserialized_iterator_next(&it)) )
+		npoints += pa->npoints;
+
+	return npoints;
+}
+
+int gserialized_peek_first_point(const GSERIALIZED *g, POINT4D *out_point)
+{
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+
+	gserialized_iterator_init(&it, g);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		if ( pa->npoints > 0 )
+			return getPoint4d_p(pa, 0, out_point);
+	}
+	return LW_FAILURE;
+}
+
+/**
+* Box of the linear geometries, LW_FAILURE for the empty ones and
+* those with arcs, which need more than their vertices.
+*/
+static int gserialized_calculate_gbox_cartesian(const GSERIALIZED *g, GBOX *gbox)
+{
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+	GBOX tmp;
+	int first = LW_TRUE;
+
+	gserialized_iterator_init(&it, g);
+	tmp.flags = gbox->flags = it.flags;
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		if ( it.type == CIRCSTRINGTYPE )
+			return LW_FAILURE;
+		/* Holes are inside the shell */
+		if ( pa->npoints == 0 || it.ring > 0 )
+			continue;
+		if ( first )
+		{
+			ptarray_calculate_gbox_cartesian(pa, gbox);
+			first = LW_FALSE;
+		}
+		else
+		{
+			ptarray_calculate_gbox_cartesian(pa, &tmp);
+			gbox_merge(&tmp, gbox);
+		}
+	}
+	return first ? LW_FAILURE : LW_SUCCESS;
+}
+
+
 /***********************************************************************
 * Calculate the GSERIALIZED size for an LWGEOM.
 */
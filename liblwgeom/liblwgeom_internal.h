@@ -214,6 +214,22 @@ double lw_segment_side(const POINT2D *p1, const POINT2D *p2, const POINT2D *q);
 */
 int lw_segment_envelope_intersects(const POINT2D *p1, const POINT2D *p2, const POINT2D *q1, const POINT2D *q2);
 
+/*
+* Point in ring kernels, in decreasing order of portability.
+* lw_inring_set_kernel picks the one used by pt_in_ring_2d and
+* ptarray_contains_point(s)_2d, or the best one the CPU supports if
+* asked for more, and returns the one it picked.
+*/
+#define LW_INRING_SCALAR 0
+#define LW_INRING_SSE2 1
+#define LW_INRING_AVX 2
+int lw_inring_set_kernel(int kernel);
+
+/*
+* Number of edges of the ring crossed by the ray going right from the point.
+*/
+int ptarray_crossings_2d(const POINTARRAY *ring, const POINT2D *pt);
+
 /*
 * Get/Set an enumeratoed ordinate. (x,y,z,m)
 */
@@ -252,6 +268,12 @@ LWCOLLECTION *lwpoint_clip_to_ordinate_range(const LWPOINT *mpoint, char ordinat
 int lwgeom_geohash_precision(GBOX bbox, GBOX *bounds);
 char *geohash_point(double longitude, double latitude, int precision);
 
+/*
+* Hilbert curve index of a grid cell, on grids of up to 2^31 by 2^31 cells
+*/
+#define HILBERT_MAX_ORDER 31
+uint64_t hilbert_xy2d(uint32_t x, uint32_t y, int order);
+
 /*
 * Point comparisons
 */
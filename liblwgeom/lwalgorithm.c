@@ -469,6 +469,68 @@ char *lwgeom_geohash(const LWGEOM *lwgeom, int precision)
 	return geohash_point(lon, lat, precision);
 }
 
+/*
+** Distance of cell (x, y) along the Hilbert curve that fills a grid of
+** 2^order by 2^order cells, starting from (0, 0) and ending at
+** (2^order - 1, 0). Cells close along the curve are close in the plane.
+*/
+uint64_t hilbert_xy2d(uint32_t x, uint32_t y, int order)
+{
+	uint64_t d = 0;
+	uint32_t s, t, n;
+	uint32_t rx, ry;
+
+	if ( order < 1 || order > HILBERT_MAX_ORDER )
+	{
+		lwerror("hilbert_xy2d: order %d is out of range", order);
+		return 0;
+	}
+
+	n = (uint32_t)1 << (order - 1);
+	for ( s = n; s > 0; s >>= 1 )
+	{
+		rx = (x & s) ? 1 : 0;
+		ry = (y & s) ? 1 : 0;
+		d += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant, so the lower bits see the curve upright */
+		if ( ry == 0 )
+		{
+			if ( rx == 1 )
+			{
+				x = ~x;
+				y = ~y;
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
+
+/*
+** Hilbert key of the centre of the box, on the finest grid that keeps
+** the key in 62 bits, laid over the extent. Centres outside of the
+** extent are clamped to its edges, so any extent gives a usable order.
+*/
+uint64_t gbox_hilbert_key(const GBOX *box, const GBOX *extent)
+{
+	const double cells = (double)(((uint32_t)1 << HILBERT_MAX_ORDER) - 1);
+	double cx = box->xmin + (box->xmax - box->xmin) / 2.0;
+	double cy = box->ymin + (box->ymax - box->ymin) / 2.0;
+	double width = extent->xmax - extent->xmin;
+	double height = extent->ymax - extent->ymin;
+	double fx = 0.0, fy = 0.0;
+
+	if ( width > 0.0 )
+		fx = FP_MIN(FP_MAX((cx - extent->xmin) / width, 0.0), 1.0);
+	if ( height > 0.0 )
+		fy = FP_MIN(FP_MAX((cy - extent->ymin) / height, 0.0), 1.0);
+
+	return hilbert_xy2d((uint32_t)(fx * cells), (uint32_t)(fy * cells), HILBERT_MAX_ORDER);
+}
+
 
 
 
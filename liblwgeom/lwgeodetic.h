@@ -9,6 +9,9 @@
  *
  **********************************************************************/
 
+#ifndef _LWGEODETIC_H
+#define _LWGEODETIC_H 1
+
 #include "liblwgeom_internal.h"
 
 /* For NAN */
@@ -104,3 +107,5 @@ double latitude_radians_normalize(double lat);
 double spheroid_distance(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b, const SPHEROID *spheroid);
 double spheroid_direction(const GEOGRAPHIC_POINT *r, const GEOGRAPHIC_POINT *s, const SPHEROID *spheroid);
 int spheroid_project(const GEOGRAPHIC_POINT *r, const SPHEROID *spheroid, double distance, double azimuth, GEOGRAPHIC_POINT *g);
+
+#endif /* _LWGEODETIC_H */
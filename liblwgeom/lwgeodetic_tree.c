@@ -0,0 +1,819 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+
+#include "liblwgeom_internal.h"
+#include "lwgeodetic_tree.h"
+#include "lwgeom_log.h"
+
+
+/**
+* Internal nodes have their point references set to NULL.
+*/
+static inline int
+circ_node_is_leaf(const CIRC_NODE* node)
+{
+	return (node->num_nodes == 0);
+}
+
+/**
+* Initialize a geographic point from a POINT2D in degrees.
+*/
+static inline void
+circ_point_init(const POINT2D* pt, GEOGRAPHIC_POINT* g)
+{
+	geographic_point_init(pt->x, pt->y, g);
+}
+
+/**
+* Normalize a vector in place, returning LW_FALSE if it has no length.
+*/
+static int
+circ_normalize(POINT3D* p)
+{
+	double d = sqrt(p->x*p->x + p->y*p->y + p->z*p->z);
+	if ( FP_IS_ZERO(d) )
+		return LW_FALSE;
+	p->x /= d;
+	p->y /= d;
+	p->z /= d;
+	return LW_TRUE;
+}
+
+/**
+* Create a leaf node for the edge starting at point i of the array.
+* The bounding circle is centered on the edge midpoint and has a
+* radius of half the edge length.
+*/
+static CIRC_NODE*
+circ_node_leaf_new(const POINTARRAY* pa, int i)
+{
+	POINT2D *p1, *p2;
+	POINT3D q1, q2, c;
+	GEOGRAPHIC_POINT g1, g2, gc;
+	CIRC_NODE *node;
+	double diameter;
+
+	p1 = (POINT2D*)getPoint_internal(pa, i);
+	p2 = (POINT2D*)getPoint_internal(pa, i+1);
+	circ_point_init(p1, &g1);
+	circ_point_init(p2, &g2);
+
+	diameter = sphere_distance(&g1, &g2);
+
+	/* Zero length edge, doesn't get a node */
+	if ( FP_IS_ZERO(diameter) )
+		return NULL;
+
+	geog2cart(&g1, &q1);
+	geog2cart(&g2, &q2);
+	c.x = q1.x + q2.x;
+	c.y = q1.y + q2.y;
+	c.z = q1.z + q2.z;
+
+	node = lwalloc(sizeof(CIRC_NODE));
+	if ( circ_normalize(&c) )
+	{
+		cart2geog(&c, &gc);
+		node->center = gc;
+		node->radius = diameter / 2.0;
+	}
+	else
+	{
+		/* Antipodal edge, fall back to a circle that surely covers it */
+		node->center = g1;
+		node->radius = diameter;
+	}
+	node->num_nodes = 0;
+	node->nodes = NULL;
+	node->edge_num = i;
+	node->geom_type = 0;
+	node->pt_outside.x = node->pt_outside.y = 0.0;
+	node->p1 = p1;
+	node->p2 = p2;
+	return node;
+}
+
+/**
+* Create a zero-radius leaf node for a single point.
+*/
+static CIRC_NODE*
+circ_node_leaf_point_new(const POINTARRAY* pa)
+{
+	CIRC_NODE *node = lwalloc(sizeof(CIRC_NODE));
+	node->p1 = node->p2 = (POINT2D*)getPoint_internal(pa, 0);
+	circ_point_init(node->p1, &(node->center));
+	node->radius = 0.0;
+	node->num_nodes = 0;
+	node->nodes = NULL;
+	node->edge_num = 0;
+	node->geom_type = 0;
+	node->pt_outside.x = node->pt_outside.y = 0.0;
+	return node;
+}
+
+/**
+* Given two bounding circles, calculate the smallest circle
+* on the sphere that contains both of them.
+*/
+static void
+circ_center_merge(const GEOGRAPHIC_POINT* c1, double r1, const GEOGRAPHIC_POINT* c2, double r2, GEOGRAPHIC_POINT* c, double* r)
+{
+	POINT3D q1, q2, q;
+	double d = sphere_distance(c1, c2);
+	double r_new, t;
+
+	/* One circle contains the other */
+	if ( d + r2 <= r1 )
+	{
+		*c = *c1;
+		*r = r1;
+		return;
+	}
+	if ( d + r1 <= r2 )
+	{
+		*c = *c2;
+		*r = r2;
+		return;
+	}
+
+	r_new = (d + r1 + r2) / 2.0;
+
+	/* Nearly antipodal centers, the circle has to cover everything */
+	if ( r_new >= M_PI || FP_IS_ZERO(sin(d)) )
+	{
+		*c = *c1;
+		*r = M_PI;
+		return;
+	}
+
+	/* Slide from c1 towards c2 along the great circle joining them */
+	t = r_new - r1;
+	geog2cart(c1, &q1);
+	geog2cart(c2, &q2);
+	q.x = (q1.x * sin(d - t) + q2.x * sin(t)) / sin(d);
+	q.y = (q1.y * sin(d - t) + q2.y * sin(t)) / sin(d);
+	q.z = (q1.z * sin(d - t) + q2.z * sin(t)) / sin(d);
+	circ_normalize(&q);
+	cart2geog(&q, c);
+	*r = r_new;
+}
+
+/**
+* Create an interior node over the given children, with a
+* bounding circle that contains all of the child circles.
+*/
+static CIRC_NODE*
+circ_node_internal_new(CIRC_NODE** c, int num_nodes)
+{
+	CIRC_NODE *node;
+	GEOGRAPHIC_POINT center;
+	double radius;
+	int i;
+
+	if ( num_nodes < 1 )
+		return NULL;
+
+	center = c[0]->center;
+	radius = c[0]->radius;
+	for ( i = 1; i < num_nodes; i++ )
+		circ_center_merge(&center, radius, &(c[i]->center), c[i]->radius, &center, &radius);
+
+	node = lwalloc(sizeof(CIRC_NODE));
+	node->center = center;
+	/* Cover any rounding in the incremental merge */
+	node->radius = FP_MIN(radius + FP_TOLERANCE, M_PI);
+	node->num_nodes = num_nodes;
+	node->nodes = c;
+	node->edge_num = -1;
+	node->geom_type = 0;
+	node->pt_outside.x = node->pt_outside.y = 0.0;
+	node->p1 = node->p2 = NULL;
+	return node;
+}
+
+/**
+* Build a tree bottom-up from an array of nodes, grouping consecutive
+* runs of CIRC_NODE_SIZE nodes under new parents until only a single
+* root remains. Consecutive edges are spatially coherent, so grouping
+* in input order gives reasonably tight circles.
+*/
+static CIRC_NODE*
+circ_nodes_merge(CIRC_NODE** nodes, int num_nodes)
+{
+	CIRC_NODE **inodes = NULL;
+	int num_children = num_nodes;
+	int inode_num = 0;
+	int num_parents = 0;
+	int j;
+
+	while ( num_children > 1 )
+	{
+		for ( j = 0; j < num_children; j++ )
+		{
+			inode_num = (j % CIRC_NODE_SIZE);
+			if ( inode_num == 0 )
+				inodes = lwalloc(sizeof(CIRC_NODE*) * CIRC_NODE_SIZE);
+
+			inodes[inode_num] = nodes[j];
+
+			if ( inode_num == CIRC_NODE_SIZE - 1 )
+				nodes[num_parents++] = circ_node_internal_new(inodes, CIRC_NODE_SIZE);
+		}
+
+		/* Clean up any remaining nodes... */
+		if ( inode_num == 0 )
+		{
+			/* Promote solo nodes without merging */
+			nodes[num_parents++] = inodes[0];
+			lwfree(inodes);
+		}
+		else if ( inode_num < CIRC_NODE_SIZE - 1 )
+		{
+			/* Merge spare nodes */
+			nodes[num_parents++] = circ_node_internal_new(inodes, inode_num + 1);
+		}
+
+		num_children = num_parents;
+		num_parents = 0;
+	}
+
+	/* Return a reference to the head of the tree */
+	return nodes[0];
+}
+
+/**
+* Build a tree of nodes from a point array, one node per edge.
+* The leaves reference the coordinates of the array directly, so
+* the array must not be freed while the tree is in use.
+*/
+CIRC_NODE*
+circ_tree_new(const POINTARRAY* pa)
+{
+	int num_edges;
+	int i, j;
+	CIRC_NODE **nodes;
+	CIRC_NODE *node;
+	CIRC_NODE *tree;
+
+	/* Can't do anything with no points */
+	if ( pa->npoints < 1 )
+		return NULL;
+
+	/* Special handling for a single point */
+	if ( pa->npoints == 1 )
+		return circ_node_leaf_point_new(pa);
+
+	/* First create a flat list of nodes, one per edge. */
+	num_edges = pa->npoints - 1;
+	nodes = lwalloc(sizeof(CIRC_NODE*) * num_edges);
+	j = 0;
+	for ( i = 0; i < num_edges; i++ )
+	{
+		node = circ_node_leaf_new(pa, i);
+		if ( node ) /* Not zero length? */
+			nodes[j++] = node;
+	}
+
+	/* Special case: only zero-length edges. Make a point node. */
+	if ( j == 0 )
+	{
+		lwfree(nodes);
+		return circ_node_leaf_point_new(pa);
+	}
+
+	/* Merge the node list pairwise up into a tree */
+	tree = circ_nodes_merge(nodes, j);
+
+	/* Free the old list structure, leaving the tree in place */
+	lwfree(nodes);
+
+	return tree;
+}
+
+/**
+* Free the nodes of a tree. The point arrays referenced by
+* the leaves are not touched.
+*/
+void
+circ_tree_free(CIRC_NODE* node)
+{
+	int i;
+	if ( ! node )
+		return;
+
+	for ( i = 0; i < node->num_nodes; i++ )
+		circ_tree_free(node->nodes[i]);
+
+	if ( node->nodes )
+		lwfree(node->nodes);
+	lwfree(node);
+}
+
+void
+circ_tree_print(const CIRC_NODE* node, int depth)
+{
+	int i;
+
+	if ( circ_node_is_leaf(node) )
+	{
+		printf("%*s[%d] C(%.5g %.5g) R(%.5g) ((%.5g %.5g),(%.5g,%.5g))\n",
+		       3*depth + 6, "NODE", node->edge_num,
+		       node->center.lon, node->center.lat,
+		       node->radius,
+		       node->p1->x, node->p1->y,
+		       node->p2->x, node->p2->y
+		      );
+	}
+	else
+	{
+		printf("%*s C(%.5g %.5g) R(%.5g) T(%d)\n",
+		       3*depth + 6, "NODE",
+		       node->center.lon, node->center.lat,
+		       node->radius, node->geom_type
+		      );
+	}
+	for ( i = 0; i < node->num_nodes; i++ )
+		circ_tree_print(node->nodes[i], depth + 1);
+}
+
+static CIRC_NODE*
+lwpoint_calculate_circ_tree(const LWPOINT* lwpoint)
+{
+	CIRC_NODE* node = circ_tree_new(lwpoint->point);
+	if ( node )
+		node->geom_type = lwpoint->type;
+	return node;
+}
+
+static CIRC_NODE*
+lwline_calculate_circ_tree(const LWLINE* lwline)
+{
+	CIRC_NODE* node = circ_tree_new(lwline->points);
+	if ( node )
+		node->geom_type = lwline->type;
+	return node;
+}
+
+/**
+* A polygon gets a root node over all of its rings, tagged with the
+* polygon type and carrying a point guaranteed to be outside the
+* polygon, for use as the far end of the stab line in containment tests.
+*/
+static CIRC_NODE*
+lwpoly_calculate_circ_tree(const LWPOLY* lwpoly)
+{
+	int i = 0, j = 0;
+	CIRC_NODE** nodes;
+	CIRC_NODE* node;
+	GBOX gbox;
+
+	/* One ring? Handle it like a line. */
+	if ( lwpoly->nrings == 1 )
+	{
+		node = circ_tree_new(lwpoly->rings[0]);
+		/* We can't wrap a leaf into a polygon root, so give it a parent */
+		if ( node && circ_node_is_leaf(node) )
+		{
+			nodes = lwalloc(sizeof(CIRC_NODE*));
+			nodes[0] = node;
+			node = circ_node_internal_new(nodes, 1);
+		}
+	}
+	else
+	{
+		/* Calculate a tree for each non-trivial ring of the polygon */
+		nodes = lwalloc(lwpoly->nrings * sizeof(CIRC_NODE*));
+		for ( i = 0; i < lwpoly->nrings; i++ )
+		{
+			node = circ_tree_new(lwpoly->rings[i]);
+			if ( node )
+				nodes[j++] = node;
+		}
+		/* Put the trees into a single parent node, one child per ring */
+		node = circ_node_internal_new(nodes, j);
+		if ( ! node )
+			lwfree(nodes);
+	}
+
+	if ( ! node )
+		return NULL;
+
+	/* Give the tree root type and outside point information */
+	node->geom_type = lwpoly->type;
+	gbox.flags = 0;
+	lwgeom_calculate_gbox_geodetic((LWGEOM*)lwpoly, &gbox);
+	gbox_pt_outside(&gbox, &(node->pt_outside));
+
+	return node;
+}
+
+/**
+* A collection gets a root node over the trees of all its components,
+* grouped in runs of CIRC_NODE_SIZE so that large multi-geometries
+* still have a logarithmic search depth.
+*/
+static CIRC_NODE*
+lwcollection_calculate_circ_tree(const LWCOLLECTION* lwcol)
+{
+	int i = 0, j = 0;
+	CIRC_NODE** nodes;
+	CIRC_NODE* node;
+
+	/* One geometry? Done! */
+	if ( lwcol->ngeoms == 1 )
+		return lwgeom_calculate_circ_tree(lwcol->geoms[0]);
+
+	/* Calculate a tree for each sub-geometry */
+	nodes = lwalloc(lwcol->ngeoms * sizeof(CIRC_NODE*));
+	for ( i = 0; i < lwcol->ngeoms; i++ )
+	{
+		node = lwgeom_calculate_circ_tree(lwcol->geoms[i]);
+		if ( node )
+			nodes[j++] = node;
+	}
+
+	if ( j == 0 )
+	{
+		lwfree(nodes);
+		return NULL;
+	}
+
+	node = circ_nodes_merge(nodes, j);
+	lwfree(nodes);
+
+	/* Don't overwrite the type of a lone polygon or line */
+	if ( j > 1 )
+		node->geom_type = lwcol->type;
+
+	return node;
+}
+
+/**
+* Build a tree over every edge of the geometry. Returns NULL for
+* empty geometries and types that have no geodetic support.
+*/
+CIRC_NODE*
+lwgeom_calculate_circ_tree(const LWGEOM* lwgeom)
+{
+	if ( lwgeom_is_empty(lwgeom) )
+		return NULL;
+
+	switch ( lwgeom->type )
+	{
+	case POINTTYPE:
+		return lwpoint_calculate_circ_tree((LWPOINT*)lwgeom);
+	case LINETYPE:
+		return lwline_calculate_circ_tree((LWLINE*)lwgeom);
+	case POLYGONTYPE:
+		return lwpoly_calculate_circ_tree((LWPOLY*)lwgeom);
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+		return lwcollection_calculate_circ_tree((LWCOLLECTION*)lwgeom);
+	default:
+		LWDEBUGF(3, "unable to calculate spherical index tree for type %s", lwtype_name(lwgeom->type));
+		return NULL;
+	}
+}
+
+/**
+* Count the ring edges under the node that the stab line crosses.
+* Crossings are counted with a half-open rule on the side of the
+* stab plane (vertices on the plane count as being on the positive
+* side) so that a stab line passing exactly through a vertex is
+* counted once, or not at all if it only grazes the ring.
+* Sets on_boundary if the start of the stab line is on an edge.
+*/
+static int
+circ_tree_stab_crossings(const CIRC_NODE* node, const GEOGRAPHIC_EDGE* stab, const GEOGRAPHIC_POINT* stab_center, double stab_radius, const POINT3D* stab_normal, int* on_boundary)
+{
+	GEOGRAPHIC_EDGE e;
+	GEOGRAPHIC_POINT g;
+	POINT3D q1, q2;
+	int side1, side2;
+	int crossings = 0;
+	int i;
+
+	/* Circles don't overlap, no edges down here can cross */
+	if ( sphere_distance(&(node->center), stab_center) > node->radius + stab_radius + FP_TOLERANCE )
+		return 0;
+
+	if ( ! circ_node_is_leaf(node) )
+	{
+		for ( i = 0; i < node->num_nodes; i++ )
+		{
+			crossings += circ_tree_stab_crossings(node->nodes[i], stab, stab_center, stab_radius, stab_normal, on_boundary);
+			if ( *on_boundary )
+				return crossings;
+		}
+		return crossings;
+	}
+
+	/* Point leaves are not ring edges */
+	if ( node->p1 == node->p2 )
+		return 0;
+
+	circ_point_init(node->p1, &(e.start));
+	circ_point_init(node->p2, &(e.end));
+
+	/* Test point on the ring boundary? That counts as covered. */
+	if ( geographic_point_equals(&(stab->start), &(e.start)) ||
+	     geographic_point_equals(&(stab->start), &(e.end)) ||
+	     edge_contains_point(&e, &(stab->start)) )
+	{
+		*on_boundary = LW_TRUE;
+		return 0;
+	}
+
+	geog2cart(&(e.start), &q1);
+	geog2cart(&(e.end), &q2);
+	side1 = (q1.x*stab_normal->x + q1.y*stab_normal->y + q1.z*stab_normal->z) >= 0.0;
+	side2 = (q2.x*stab_normal->x + q2.y*stab_normal->y + q2.z*stab_normal->z) >= 0.0;
+
+	/* Both ends on the same side of the stab plane, no crossing */
+	if ( side1 == side2 )
+		return 0;
+
+	return edge_intersection(&e, stab, &g) ? 1 : 0;
+}
+
+/**
+* Point-in-polygon test for a polygon root node, using a stab line
+* from the test point to the precomputed outside point and only
+* visiting the edges whose bounding circles touch that line.
+*/
+static int
+circ_tree_polygon_contains_point(const CIRC_NODE* node, const POINT2D* pt)
+{
+	GEOGRAPHIC_EDGE stab;
+	GEOGRAPHIC_POINT stab_center;
+	POINT3D q1, q2, c, normal;
+	double stab_radius;
+	int on_boundary = LW_FALSE;
+	int crossings;
+
+	circ_point_init(pt, &(stab.start));
+	circ_point_init(&(node->pt_outside), &(stab.end));
+
+	geog2cart(&(stab.start), &q1);
+	geog2cart(&(stab.end), &q2);
+	c.x = q1.x + q2.x;
+	c.y = q1.y + q2.y;
+	c.z = q1.z + q2.z;
+	stab_radius = sphere_distance(&(stab.start), &(stab.end)) / 2.0;
+	if ( circ_normalize(&c) )
+	{
+		cart2geog(&c, &stab_center);
+	}
+	else
+	{
+		stab_center = stab.start;
+		stab_radius = M_PI;
+	}
+
+	robust_cross_product(&(stab.start), &(stab.end), &normal);
+	circ_normalize(&normal);
+
+	crossings = circ_tree_stab_crossings(node, &stab, &stab_center, stab_radius, &normal, &on_boundary);
+
+	LWDEBUGF(4, "stab line crossings %d, on boundary %d", crossings, on_boundary);
+
+	if ( on_boundary )
+		return LW_TRUE;
+
+	/* An odd number of crossings implies containment! */
+	return (crossings % 2) ? LW_TRUE : LW_FALSE;
+}
+
+/**
+* Returns LW_TRUE if any polygon indexed by the tree covers the point
+* (point inside or on the boundary), LW_FALSE otherwise. Trees of
+* puntal and lineal geometries never contain anything.
+*/
+int
+circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt)
+{
+	GEOGRAPHIC_POINT g;
+	int i;
+
+	if ( ! node )
+		return LW_FALSE;
+
+	/* Point is outside the bounding cap, so it can't be in a polygon */
+	/* under this node, as long as the cap is no bigger than a hemisphere */
+	circ_point_init(pt, &g);
+	if ( node->radius < M_PI_2 && sphere_distance(&g, &(node->center)) > node->radius + FP_TOLERANCE )
+		return LW_FALSE;
+
+	if ( node->geom_type == POLYGONTYPE )
+		return circ_tree_polygon_contains_point(node, pt);
+
+	/* Rings, lines and points stop the search */
+	if ( circ_node_is_leaf(node) || node->geom_type == LINETYPE || node->geom_type == POINTTYPE )
+		return LW_FALSE;
+
+	for ( i = 0; i < node->num_nodes; i++ )
+	{
+		if ( circ_tree_contains_point(node->nodes[i], pt) )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+/**
+* Returns LW_TRUE if any component of the geometry indexed by n2 has
+* a vertex covered by a polygon indexed by n1. Any component that does
+* not cross the boundary of n1 is either entirely inside or entirely
+* outside, so testing one vertex per component is enough.
+*/
+static int
+circ_tree_contains_any_component(const CIRC_NODE* n1, const CIRC_NODE* n2)
+{
+	int i;
+
+	/* Reached a single component (or ring, or leaf)? Test one of its points. */
+	if ( circ_node_is_leaf(n2) || n2->geom_type == POINTTYPE || n2->geom_type == LINETYPE || n2->geom_type == POLYGONTYPE )
+	{
+		const CIRC_NODE* leaf = n2;
+		while ( ! circ_node_is_leaf(leaf) )
+			leaf = leaf->nodes[0];
+		return circ_tree_contains_point(n1, leaf->p1);
+	}
+
+	for ( i = 0; i < n2->num_nodes; i++ )
+	{
+		if ( circ_tree_contains_any_component(n1, n2->nodes[i]) )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+/**
+* Exact spherical distance between the contents of two leaves.
+*/
+static double
+circ_leaf_distance(const CIRC_NODE* n1, const CIRC_NODE* n2, GEOGRAPHIC_POINT* closest1, GEOGRAPHIC_POINT* closest2)
+{
+	GEOGRAPHIC_EDGE e1, e2;
+	GEOGRAPHIC_POINT g;
+	int is_point1 = (n1->p1 == n1->p2);
+	int is_point2 = (n2->p1 == n2->p2);
+
+	circ_point_init(n1->p1, &(e1.start));
+	circ_point_init(n1->p2, &(e1.end));
+	circ_point_init(n2->p1, &(e2.start));
+	circ_point_init(n2->p2, &(e2.end));
+
+	if ( is_point1 && is_point2 )
+	{
+		*closest1 = e1.start;
+		*closest2 = e2.start;
+		return sphere_distance(&(e1.start), &(e2.start));
+	}
+	if ( is_point1 )
+	{
+		*closest1 = e1.start;
+		return edge_distance_to_point(&e2, &(e1.start), closest2);
+	}
+	if ( is_point2 )
+	{
+		*closest2 = e2.start;
+		return edge_distance_to_point(&e1, &(e2.start), closest1);
+	}
+	if ( edge_intersection(&e1, &e2, &g) )
+	{
+		*closest1 = *closest2 = g;
+		return 0.0;
+	}
+	return edge_distance_to_edge(&e1, &e2, closest1, closest2);
+}
+
+static int
+circ_distance_order_cmp(const void *a, const void *b)
+{
+	double m1 = ((const DISTANCE_ORDER*)a)->measure;
+	double m2 = ((const DISTANCE_ORDER*)b)->measure;
+	return (m1 < m2) ? -1 : ((m1 > m2) ? 1 : 0);
+}
+
+/**
+* Branch-and-bound search for the closest pair of leaves. Pairs of
+* nodes whose circles are further apart than the best distance found
+* so far are pruned, and the search stops as soon as a distance under
+* the threshold turns up.
+*/
+static double
+circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, double threshold, double* min_dist, GEOGRAPHIC_POINT* closest1, GEOGRAPHIC_POINT* closest2)
+{
+	double d, d_min;
+	int i;
+
+	d = sphere_distance(&(n1->center), &(n2->center));
+	d_min = FP_MAX(0.0, d - n1->radius - n2->radius);
+
+	/* Nothing down here can beat what we already have */
+	if ( d_min > *min_dist )
+		return MAXFLOAT;
+
+	if ( circ_node_is_leaf(n1) && circ_node_is_leaf(n2) )
+	{
+		GEOGRAPHIC_POINT c1, c2;
+		double d_leaf = circ_leaf_distance(n1, n2, &c1, &c2);
+		if ( d_leaf < *min_dist )
+		{
+			*min_dist = d_leaf;
+			*closest1 = c1;
+			*closest2 = c2;
+		}
+		return d_leaf;
+	}
+	else
+	{
+		/* Descend into the larger (non-leaf) node first */
+		int descend1 = ( ! circ_node_is_leaf(n1) ) && ( circ_node_is_leaf(n2) || n1->radius >= n2->radius );
+		const CIRC_NODE* parent = descend1 ? n1 : n2;
+		const CIRC_NODE* other = descend1 ? n2 : n1;
+		DISTANCE_ORDER order[CIRC_NODE_SIZE];
+		DISTANCE_ORDER *ordered = order;
+		double d_best = MAXFLOAT;
+
+		if ( parent->num_nodes > CIRC_NODE_SIZE )
+			ordered = lwalloc(sizeof(DISTANCE_ORDER) * parent->num_nodes);
+
+		/* Visit the children closest to the other node first, */
+		/* to tighten the bound as early as possible */
+		for ( i = 0; i < parent->num_nodes; i++ )
+		{
+			ordered[i].measure = sphere_distance(&(parent->nodes[i]->center), &(other->center)) - parent->nodes[i]->radius;
+			ordered[i].index = i;
+		}
+		qsort(ordered, parent->num_nodes, sizeof(DISTANCE_ORDER), circ_distance_order_cmp);
+
+		for ( i = 0; i < parent->num_nodes; i++ )
+		{
+			const CIRC_NODE* child = parent->nodes[ordered[i].index];
+			double d_child;
+
+			if ( descend1 )
+				d_child = circ_tree_distance_tree_internal(child, other, threshold, min_dist, closest1, closest2);
+			else
+				d_child = circ_tree_distance_tree_internal(other, child, threshold, min_dist, closest1, closest2);
+
+			d_best = FP_MIN(d_best, d_child);
+
+			/* Close enough, the caller doesn't need anything better */
+			if ( *min_dist <= threshold )
+				break;
+		}
+
+		if ( ordered != order )
+			lwfree(ordered);
+
+		return d_best;
+	}
+}
+
+/**
+* Distance between the geometries indexed by two trees, in the units
+* of the spheroid. Polygons containing any part of the other geometry
+* give a zero distance. The search returns early once a distance under
+* the threshold is found, which is all ST_DWithin needs; pass zero
+* to get the exact minimum distance.
+*/
+double
+circ_tree_distance_tree(const CIRC_NODE* n1, const CIRC_NODE* n2, const SPHEROID* spheroid, double threshold)
+{
+	double min_dist = MAXFLOAT;
+	double threshold_radians;
+	int use_sphere = (spheroid->a == spheroid->b ? 1 : 0);
+	GEOGRAPHIC_POINT closest1, closest2;
+
+	/* Polygon containing some part of the other geometry? Distance is zero. */
+	if ( circ_tree_contains_any_component(n1, n2) || circ_tree_contains_any_component(n2, n1) )
+		return 0.0;
+
+	/* On the spheroid, stop well enough below the tolerance that the */
+	/* spheroid correction can't push the answer back over it */
+	threshold_radians = (use_sphere ? threshold : 0.95 * threshold) / spheroid->radius;
+
+	circ_tree_distance_tree_internal(n1, n2, threshold_radians, &min_dist, &closest1, &closest2);
+
+	if ( use_sphere )
+		return spheroid->radius * min_dist;
+
+	/* Crossing edges, or very close points, are zero on any spheroid */
+	if ( FP_IS_ZERO(min_dist) )
+		return 0.0;
+
+	return spheroid_distance(&closest1, &closest2, spheroid);
+}
@@ -0,0 +1,55 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#ifndef _LWGEODETIC_TREE_H
+#define _LWGEODETIC_TREE_H 1
+
+#include "lwgeodetic.h"
+
+/**
+* Maximum number of children under an interior node
+* of the circular tree.
+*/
+#define CIRC_NODE_SIZE 8
+
+/**
+* Node of a spherical bounding-circle tree. Leaf nodes hold one
+* edge (or one point) of the input, by reference, so the source
+* POINTARRAY has to outlive the tree. Interior nodes hold up
+* to CIRC_NODE_SIZE children, except for the roots of polygons
+* and collections, which hold one child per ring or component.
+*/
+typedef struct circ_node
+{
+	GEOGRAPHIC_POINT center; /* center of the bounding circle */
+	double radius;           /* radius of the bounding circle, in radians */
+	int num_nodes;           /* number of children, zero for leaves */
+	struct circ_node** nodes;
+	int edge_num;            /* index of the leaf edge in its point array */
+	int geom_type;           /* geometry type on component roots, zero otherwise */
+	POINT2D pt_outside;      /* guaranteed outside point, on polygon roots */
+	POINT2D* p1;             /* start of the leaf edge */
+	POINT2D* p2;             /* end of the leaf edge, == p1 for point leaves */
+} CIRC_NODE;
+
+/* Build a tree over the edges of a point array, references the array */
+CIRC_NODE* circ_tree_new(const POINTARRAY* pa);
+/* Build a tree over all the edges of a geometry, NULL for unsupported types */
+CIRC_NODE* lwgeom_calculate_circ_tree(const LWGEOM* lwgeom);
+/* Free a tree, but not the point arrays it references */
+void circ_tree_free(CIRC_NODE* node);
+/* Print the tree structure, for debugging */
+void circ_tree_print(const CIRC_NODE* node, int depth);
+/* Return LW_TRUE if any polygon in the tree covers the point */
+int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt);
+/* Distance between the geometries of two trees, with early exit under the threshold */
+double circ_tree_distance_tree(const CIRC_NODE* n1, const CIRC_NODE* n2, const SPHEROID *spheroid, double threshold);
+
+#endif /* _LWGEODETIC_TREE_H */
@@ -32,22 +32,132 @@ to_dec(POINT4D *pt)
 	pt->y *= 180.0/M_PI;
 }
 
+/**
+ * Scale the X and Y of npoints interleaved coordinates, ndims
+ * doubles apart. A plain strided loop the compiler can unroll.
+ */
+static void
+coords_scale_xy(double *coords, int npoints, int ndims, double factor)
+{
+	int i;
+	int n = npoints * ndims;
+
+	for ( i = 0; i < n; i += ndims )
+	{
+		coords[i] *= factor;
+		coords[i+1] *= factor;
+	}
+}
+
+/**
+ * Report a PROJ.4 failure for the given (untransformed) point
+ */
+static void
+transform_error(int pj_errno_val, double x, double y, double z)
+{
+	char *pj_errstr = pj_strerrno(pj_errno_val);
+	if ( ! pj_errstr )
+		pj_errstr = "";
+
+	if (pj_errno_val == -38)
+	{
+		lwnotice("PostGIS was unable to transform the point because either no grid shift files were found, or the point does not lie within the range for which the grid shift is defined. Refer to the ST_Transform() section of the PostGIS manual for details on how to configure PostGIS to alter this behaviour.");
+	}
+	lwerror("transform: couldn't project point (%g %g %g): %s (%d)",
+	        x, y, z, pj_errstr, pj_errno_val);
+}
+
+/**
+ * Number of points handed to pj_transform in one call by
+ * ptarray_transform.
+ */
+#define PTARRAY_TRANSFORM_RUN 1024
+
 /**
  * Transform given POINTARRAY
  * from inpj projection to outpj projection
+ *
+ * The coordinates are transformed in place, a run of points at a
+ * time: pj_transform takes the stride between the interleaved X, Y
+ * and Z values, so there is no need to unpack them. Each run is
+ * copied first, to report the original coordinates of a point that
+ * fails, as in a multi-point call pj_transform only flags those with
+ * HUGE_VAL instead of returning an error.
  */
 int
 ptarray_transform(POINTARRAY *pa, projPJ inpj, projPJ outpj)
 {
-  int i;
-	POINT4D p;
+	int i, j, n;
+	int ndims = FLAGS_NDIMS(pa->flags);
+	int has_z = FLAGS_GET_Z(pa->flags);
+	int in_latlong = pj_is_latlong(inpj);
+	int out_latlong = pj_is_latlong(outpj);
+	int runsize = pa->npoints < PTARRAY_TRANSFORM_RUN ? pa->npoints : PTARRAY_TRANSFORM_RUN;
+	double *orig, *zbuf = NULL;
+	double *coords, *z;
+	int pj_errno_val;
+
+	if ( pa->npoints < 1 )
+		return LW_SUCCESS;
+
+	LWDEBUGF(4, "transforming %d points from '%s' to '%s'", pa->npoints, pj_get_def(inpj,0), pj_get_def(outpj,0));
+
+	orig = lwalloc(sizeof(double) * ndims * runsize);
 
-  for ( i = 0; i < pa->npoints; i++ )
-  {
-    getPoint4d_p(pa, i, &p);
-    if ( ! point4d_transform(&p, inpj, outpj) ) return LW_FAILURE;
-    ptarray_set_point4d(pa, i, &p);
-  }
+	/*
+	 * PROJ.4 wants a Z to shift datums, give it zeros with the same
+	 * stride as X and Y, like point4d_transform does for 2D points.
+	 */
+	if ( ! has_z )
+		zbuf = lwalloc(sizeof(double) * ndims * runsize);
+
+	for ( i = 0; i < pa->npoints; i += n )
+	{
+		n = pa->npoints - i < runsize ? pa->npoints - i : runsize;
+		coords = (double*)getPoint_internal(pa, i);
+
+		memcpy(orig, coords, sizeof(double) * ndims * n);
+		if ( has_z )
+		{
+			z = coords + 2;
+		}
+		else
+		{
+			memset(zbuf, 0, sizeof(double) * ndims * n);
+			z = zbuf;
+		}
+
+		if ( in_latlong )
+			coords_scale_xy(coords, n, ndims, M_PI/180.0);
+
+		/* Perform the transform */
+		pj_errno_val = pj_transform(inpj, outpj, n, ndims, coords, coords + 1, z);
+
+		/* Look for the points PROJ.4 gave up on */
+		for ( j = 0; j < n; j++ )
+		{
+			if ( coords[j * ndims] == HUGE_VAL )
+				break;
+		}
+		if ( pj_errno_val || j < n )
+		{
+			if ( ! pj_errno_val )
+				pj_errno_val = *pj_get_errno_ref();
+			if ( j == n )
+				j = 0;
+			/* Only the Z of a 3D array was copied */
+			transform_error(pj_errno_val, orig[j * ndims], orig[j * ndims + 1], has_z ? orig[j * ndims + 2] : 0.0);
+			lwfree(orig);
+			if ( zbuf ) lwfree(zbuf);
+			return LW_FAILURE;
+		}
+
+		if ( out_latlong )
+			coords_scale_xy(coords, n, ndims, 180.0/M_PI);
+	}
+
+	lwfree(orig);
+	if ( zbuf ) lwfree(zbuf);
 
 	return LW_SUCCESS;
 }
@@ -137,19 +247,8 @@ point4d_transform(POINT4D *pt, projPJ srcpj, projPJ dstpj)
 
 	if (*pj_errno_ref != 0)
 	{
-		if (*pj_errno_ref == -38)
-		{
-			lwnotice("PostGIS was unable to transform the point because either no grid shift files were found, or the point does not lie within the range for which the grid shift is defined. Refer to the ST_Transform() section of the PostGIS manual for details on how to configure PostGIS to alter this behaviour.");
-			lwerror("transform: couldn't project point (%g %g %g): %s (%d)", 
-			        orig_pt.x, orig_pt.y, orig_pt.z, pj_strerrno(*pj_errno_ref), *pj_errno_ref);
-			return 0;
-		}
-		else
-		{
-			lwerror("transform: couldn't project point (%g %g %g): %s (%d)",
-			        orig_pt.x, orig_pt.y, orig_pt.z, pj_strerrno(*pj_errno_ref), *pj_errno_ref);
-			return 0;
-		}
+		transform_error(*pj_errno_ref, orig_pt.x, orig_pt.y, orig_pt.z);
+		return 0;
 	}
 
 	if (pj_is_latlong(dstpj)) to_dec(pt);
@@ -0,0 +1,447 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include "liblwgeom_internal.h"
+#include "lwgeom_log.h"
+
+/*
+** Point in ring kernels.
+**
+** Two tests walk every edge of a ring:
+**
+** - the crossing number of pt_in_ring_2d counts the edges crossed by
+**   a ray going right from the point,
+** - the winding number of ptarray_contains_point_2d, which follows the
+**   rules of the point_in_ring of the backend and also reports points
+**   lying on an edge.
+**
+** The edges don't depend on one another, so on x86-64 we evaluate two
+** of them at once with SSE2, or four with AVX when the CPU (and the
+** OS) support it, and count the lanes that matched. The vector kernels
+** do the same floating point operations, in the same order, as the
+** scalar ones, so they all give the same answers.
+**
+** The ordinates are read straight off the point list, whatever its
+** dimensionality, as x and y are always next to one another.
+*/
+
+#if defined(__GNUC__) && defined(__x86_64__) && \
+    ( defined(__clang__) || __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) )
+#define INRING_X86 1
+#include <immintrin.h>
+#endif
+
+/* Tolerance of the winding number test, see FP_CONTAINS_BOTTOM */
+#define INRING_TOL FP_TOLERANCE
+/* Squared length under which an edge is ignored by the winding number test */
+#define INRING_ZERO_LENGTH (1e-12*1e-12)
+
+typedef int (*inring_crossings_fn)(const double *xy, int stride, int nedges, double px, double py);
+typedef int (*inring_winding_fn)(const double *xy, int stride, int nedges, double px, double py, int *boundary);
+
+typedef struct
+{
+	const char *name;
+	inring_crossings_fn crossings;
+	inring_winding_fn winding;
+}
+INRING_KERNEL;
+
+/* Result of the winding number test */
+static inline int
+inring_result(int wn, int boundary)
+{
+	if ( boundary )
+		return 0;
+	return wn ? 1 : -1;
+}
+
+
+/***********************************************************************
+** Scalar kernels, the reference for the others.
+*/
+
+static int
+inring_crossings_scalar(const double *xy, int stride, int nedges, double px, double py)
+{
+	int cn = 0;
+	int i;
+
+	for ( i = 0; i < nedges; i++ )
+	{
+		const double *v1 = xy + i * stride;
+		const double *v2 = v1 + stride;
+
+		/* an upward or a downward crossing */
+		if ( ((v1[1] <= py) && (v2[1] > py)) || ((v1[1] > py) && (v2[1] <= py)) )
+		{
+			double vt = (py - v1[1]) / (v2[1] - v1[1]);
+
+			/* a valid crossing of y=py right of px */
+			if ( px < v1[0] + vt * (v2[0] - v1[0]) )
+				cn++;
+		}
+	}
+	return cn;
+}
+
+static int
+inring_winding_scalar(const double *xy, int stride, int nedges, double px, double py, int *boundary)
+{
+	int wn = 0;
+	int i;
+
+	*boundary = LW_FALSE;
+	for ( i = 0; i < nedges; i++ )
+	{
+		double x1 = xy[i * stride];
+		double y1 = xy[i * stride + 1];
+		double x2 = xy[(i + 1) * stride];
+		double y2 = xy[(i + 1) * stride + 1];
+		double dx = x2 - x1;
+		double dy = y2 - y1;
+		double side;
+
+		/* too high or too low to touch the point */
+		if ( FP_MIN(y1, y2) - INRING_TOL > py || py > FP_MAX(y1, y2) )
+			continue;
+
+		/* zero length segments are ignored */
+		if ( dx * dx + dy * dy < INRING_ZERO_LENGTH )
+			continue;
+
+		side = dx * (py - y1) - (px - x1) * dy;
+
+		/* a point on the boundary of a ring is not contained */
+		if ( side == 0.0 &&
+		     ! ( FP_MAX(x1, x2) < px || FP_MIN(x1, x2) > px ||
+		         FP_MAX(y1, y2) < py || FP_MIN(y1, y2) > py ) )
+		{
+			*boundary = LW_TRUE;
+			return 0;
+		}
+
+		/* rising and left of the point, or falling and right of it */
+		if ( FP_CONTAINS_BOTTOM(y1, py, y2) && side > 0 )
+			wn++;
+		else if ( FP_CONTAINS_BOTTOM(y2, py, y1) && side < 0 )
+			wn--;
+	}
+	return wn;
+}
+
+
+#ifdef INRING_X86
+
+/* Number of bits set in a lane mask */
+static const int inring_bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+/***********************************************************************
+** SSE2 kernels, two edges per step.
+*/
+
+/* Loads the x and y of two consecutive points */
+#define SSE2_LOAD_XY(p, stride, x, y) do { \
+	__m128d a_ = _mm_loadu_pd(p); \
+	__m128d b_ = _mm_loadu_pd((p) + (stride)); \
+	x = _mm_unpacklo_pd(a_, b_); \
+	y = _mm_unpackhi_pd(a_, b_); \
+	} while (0)
+
+__attribute__((target("sse2")))
+static int
+inring_crossings_sse2(const double *xy, int stride, int nedges, double px, double py)
+{
+	const __m128d vpx = _mm_set1_pd(px);
+	const __m128d vpy = _mm_set1_pd(py);
+	__m128d x1, y1, x2, y2, cross, xi;
+	int cn = 0;
+	int i;
+
+	for ( i = 0; i + 2 <= nedges; i += 2 )
+	{
+		SSE2_LOAD_XY(xy + i * stride, stride, x1, y1);
+		SSE2_LOAD_XY(xy + (i + 1) * stride, stride, x2, y2);
+
+		cross = _mm_or_pd(_mm_and_pd(_mm_cmple_pd(y1, vpy), _mm_cmpgt_pd(y2, vpy)),
+		                  _mm_and_pd(_mm_cmpgt_pd(y1, vpy), _mm_cmple_pd(y2, vpy)));
+		if ( ! _mm_movemask_pd(cross) )
+			continue;
+		/* Lanes that don't cross may divide by zero, they are masked out */
+		xi = _mm_div_pd(_mm_sub_pd(vpy, y1), _mm_sub_pd(y2, y1));
+		xi = _mm_add_pd(x1, _mm_mul_pd(xi, _mm_sub_pd(x2, x1)));
+		cn += inring_bits[_mm_movemask_pd(_mm_and_pd(cross, _mm_cmplt_pd(vpx, xi)))];
+	}
+	return cn + inring_crossings_scalar(xy + i * stride, stride, nedges - i, px, py);
+}
+
+/*
+** Winding number of the edges (x1,y1)-(x2,y2) around (px,py): the lane
+** masks of the edges with the point on them, rising past it, and
+** falling past it.
+*/
+#define SSE2_WINDING(x1, y1, x2, y2, px, py, on, up, down) do { \
+	__m128d dx_ = _mm_sub_pd(x2, x1); \
+	__m128d dy_ = _mm_sub_pd(y2, y1); \
+	__m128d valid_ = _mm_cmpnlt_pd(_mm_add_pd(_mm_mul_pd(dx_, dx_), _mm_mul_pd(dy_, dy_)), _mm_set1_pd(INRING_ZERO_LENGTH)); \
+	__m128d side_ = _mm_sub_pd(_mm_mul_pd(dx_, _mm_sub_pd(py, y1)), _mm_mul_pd(_mm_sub_pd(px, x1), dy_)); \
+	__m128d tol_ = _mm_set1_pd(INRING_TOL); \
+	__m128d zero_ = _mm_setzero_pd(); \
+	on = _mm_and_pd(_mm_and_pd(valid_, _mm_cmpeq_pd(side_, zero_)), \
+	     _mm_and_pd(_mm_and_pd(_mm_cmpnlt_pd(_mm_max_pd(x1, x2), px), _mm_cmpngt_pd(_mm_min_pd(x1, x2), px)), \
+	                _mm_and_pd(_mm_cmpnlt_pd(_mm_max_pd(y1, y2), py), _mm_cmpngt_pd(_mm_min_pd(y1, y2), py)))); \
+	up = _mm_and_pd(_mm_and_pd(valid_, _mm_cmpgt_pd(side_, zero_)), \
+	     _mm_and_pd(_mm_cmple_pd(_mm_sub_pd(y1, tol_), py), _mm_cmplt_pd(_mm_add_pd(py, tol_), y2))); \
+	down = _mm_and_pd(_mm_and_pd(valid_, _mm_cmplt_pd(side_, zero_)), \
+	       _mm_and_pd(_mm_cmple_pd(_mm_sub_pd(y2, tol_), py), _mm_cmplt_pd(_mm_add_pd(py, tol_), y1))); \
+	} while (0)
+
+/*
+** Lanes of the edges that may wind around, or touch, the point: the
+** rest are too high or too low, as in inring_winding_scalar.
+*/
+#define SSE2_NEAR(y1, y2, py) \
+	_mm_and_pd(_mm_cmple_pd(_mm_sub_pd(_mm_min_pd(y1, y2), _mm_set1_pd(INRING_TOL)), py), \
+	           _mm_cmple_pd(py, _mm_max_pd(y1, y2)))
+
+__attribute__((target("sse2")))
+static int
+inring_winding_sse2(const double *xy, int stride, int nedges, double px, double py, int *boundary)
+{
+	const __m128d vpx = _mm_set1_pd(px);
+	const __m128d vpy = _mm_set1_pd(py);
+	__m128d x1, y1, x2, y2, on, up, down;
+	int wn = 0;
+	int i;
+
+	for ( i = 0; i + 2 <= nedges; i += 2 )
+	{
+		SSE2_LOAD_XY(xy + i * stride, stride, x1, y1);
+		SSE2_LOAD_XY(xy + (i + 1) * stride, stride, x2, y2);
+		if ( ! _mm_movemask_pd(SSE2_NEAR(y1, y2, vpy)) )
+			continue;
+		SSE2_WINDING(x1, y1, x2, y2, vpx, vpy, on, up, down);
+
+		if ( _mm_movemask_pd(on) )
+		{
+			*boundary = LW_TRUE;
+			return 0;
+		}
+		wn += inring_bits[_mm_movemask_pd(up)] - inring_bits[_mm_movemask_pd(down)];
+	}
+	return wn + inring_winding_scalar(xy + i * stride, stride, nedges - i, px, py, boundary);
+}
+
+
+/***********************************************************************
+** AVX kernels, four edges per step.
+*/
+
+/* Loads the x and y of four consecutive points */
+#define AVX_LOAD_XY(p, stride, x, y) do { \
+	__m256d a_ = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(p)), _mm_loadu_pd((p) + 2 * (stride)), 1); \
+	__m256d b_ = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd((p) + (stride))), _mm_loadu_pd((p) + 3 * (stride)), 1); \
+	x = _mm256_unpacklo_pd(a_, b_); \
+	y = _mm256_unpackhi_pd(a_, b_); \
+	} while (0)
+
+__attribute__((target("avx")))
+static int
+inring_crossings_avx(const double *xy, int stride, int nedges, double px, double py)
+{
+	const __m256d vpx = _mm256_set1_pd(px);
+	const __m256d vpy = _mm256_set1_pd(py);
+	__m256d x1, y1, x2, y2, cross, xi;
+	int cn = 0;
+	int i;
+
+	for ( i = 0; i + 4 <= nedges; i += 4 )
+	{
+		AVX_LOAD_XY(xy + i * stride, stride, x1, y1);
+		AVX_LOAD_XY(xy + (i + 1) * stride, stride, x2, y2);
+
+		cross = _mm256_or_pd(_mm256_and_pd(_mm256_cmp_pd(y1, vpy, _CMP_LE_OS), _mm256_cmp_pd(y2, vpy, _CMP_GT_OS)),
+		                     _mm256_and_pd(_mm256_cmp_pd(y1, vpy, _CMP_GT_OS), _mm256_cmp_pd(y2, vpy, _CMP_LE_OS)));
+		if ( ! _mm256_movemask_pd(cross) )
+			continue;
+		/* Lanes that don't cross may divide by zero, they are masked out */
+		xi = _mm256_div_pd(_mm256_sub_pd(vpy, y1), _mm256_sub_pd(y2, y1));
+		xi = _mm256_add_pd(x1, _mm256_mul_pd(xi, _mm256_sub_pd(x2, x1)));
+		cn += inring_bits[_mm256_movemask_pd(_mm256_and_pd(cross, _mm256_cmp_pd(vpx, xi, _CMP_LT_OS)))];
+	}
+	return cn + inring_crossings_scalar(xy + i * stride, stride, nedges - i, px, py);
+}
+
+/* Same as SSE2_WINDING, four lanes at a time */
+#define AVX_WINDING(x1, y1, x2, y2, px, py, on, up, down) do { \
+	__m256d dx_ = _mm256_sub_pd(x2, x1); \
+	__m256d dy_ = _mm256_sub_pd(y2, y1); \
+	__m256d valid_ = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(dx_, dx_), _mm256_mul_pd(dy_, dy_)), _mm256_set1_pd(INRING_ZERO_LENGTH), _CMP_NLT_US); \
+	__m256d side_ = _mm256_sub_pd(_mm256_mul_pd(dx_, _mm256_sub_pd(py, y1)), _mm256_mul_pd(_mm256_sub_pd(px, x1), dy_)); \
+	__m256d tol_ = _mm256_set1_pd(INRING_TOL); \
+	__m256d zero_ = _mm256_setzero_pd(); \
+	on = _mm256_and_pd(_mm256_and_pd(valid_, _mm256_cmp_pd(side_, zero_, _CMP_EQ_OQ)), \
+	     _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(_mm256_max_pd(x1, x2), px, _CMP_NLT_US), _mm256_cmp_pd(_mm256_min_pd(x1, x2), px, _CMP_NGT_US)), \
+	                   _mm256_and_pd(_mm256_cmp_pd(_mm256_max_pd(y1, y2), py, _CMP_NLT_US), _mm256_cmp_pd(_mm256_min_pd(y1, y2), py, _CMP_NGT_US)))); \
+	up = _mm256_and_pd(_mm256_and_pd(valid_, _mm256_cmp_pd(side_, zero_, _CMP_GT_OS)), \
+	     _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(y1, tol_), py, _CMP_LE_OS), _mm256_cmp_pd(_mm256_add_pd(py, tol_), y2, _CMP_LT_OS))); \
+	down = _mm256_and_pd(_mm256_and_pd(valid_, _mm256_cmp_pd(side_, zero_, _CMP_LT_OS)), \
+	       _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(y2, tol_), py, _CMP_LE_OS), _mm256_cmp_pd(_mm256_add_pd(py, tol_), y1, _CMP_LT_OS))); \
+	} while (0)
+
+#define AVX_NEAR(y1, y2, py) \
+	_mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(_mm256_min_pd(y1, y2), _mm256_set1_pd(INRING_TOL)), py, _CMP_LE_OS), \
+	              _mm256_cmp_pd(py, _mm256_max_pd(y1, y2), _CMP_LE_OS))
+
+__attribute__((target("avx")))
+static int
+inring_winding_avx(const double *xy, int stride, int nedges, double px, double py, int *boundary)
+{
+	const __m256d vpx = _mm256_set1_pd(px);
+	const __m256d vpy = _mm256_set1_pd(py);
+	__m256d x1, y1, x2, y2, on, up, down;
+	int wn = 0;
+	int i;
+
+	for ( i = 0; i + 4 <= nedges; i += 4 )
+	{
+		AVX_LOAD_XY(xy + i * stride, stride, x1, y1);
+		AVX_LOAD_XY(xy + (i + 1) * stride, stride, x2, y2);
+		if ( ! _mm256_movemask_pd(AVX_NEAR(y1, y2, vpy)) )
+			continue;
+		AVX_WINDING(x1, y1, x2, y2, vpx, vpy, on, up, down);
+
+		if ( _mm256_movemask_pd(on) )
+		{
+			*boundary = LW_TRUE;
+			return 0;
+		}
+		wn += inring_bits[_mm256_movemask_pd(up)] - inring_bits[_mm256_movemask_pd(down)];
+	}
+	return wn + inring_winding_scalar(xy + i * stride, stride, nedges - i, px, py, boundary);
+}
+
+#endif /* INRING_X86 */
+
+
+/***********************************************************************
+** Kernel selection
+*/
+
+static const INRING_KERNEL inring_kernels[] =
+{
+	{ "scalar", inring_crossings_scalar, inring_winding_scalar },
+#ifdef INRING_X86
+	{ "sse2", inring_crossings_sse2, inring_winding_sse2 },
+	{ "avx", inring_crossings_avx, inring_winding_avx }
+#endif
+};
+
+/* Kernel in use, picked on first use */
+static const INRING_KERNEL *inring_kernel = NULL;
+
+/* Best kernel this CPU can run */
+static int
+inring_best_kernel(void)
+{
+#ifdef INRING_X86
+	__builtin_cpu_init();
+	/* Also checks that the OS saves the AVX registers */
+	if ( __builtin_cpu_supports("avx") )
+		return LW_INRING_AVX;
+	/* Always there on x86-64 */
+	return LW_INRING_SSE2;
+#else
+	return LW_INRING_SCALAR;
+#endif
+}
+
+int
+lw_inring_set_kernel(int kernel)
+{
+	int best = inring_best_kernel();
+
+	if ( kernel < LW_INRING_SCALAR || kernel > best )
+		kernel = best;
+
+	inring_kernel = &(inring_kernels[kernel]);
+	LWDEBUGF(3, "lw_inring_set_kernel: using the %s kernel", inring_kernel->name);
+	return kernel;
+}
+
+static inline const INRING_KERNEL *
+inring_get_kernel(void)
+{
+	if ( ! inring_kernel )
+		lw_inring_set_kernel(-1);
+	return inring_kernel;
+}
+
+
+/***********************************************************************
+** Entry points
+*/
+
+int
+ptarray_crossings_2d(const POINTARRAY *ring, const POINT2D *pt)
+{
+	if ( ring->npoints < 2 )
+		return 0;
+
+	return inring_get_kernel()->crossings((const double*)getPoint_internal(ring, 0),
+	                                      FLAGS_NDIMS(ring->flags), ring->npoints - 1,
+	                                      pt->x, pt->y);
+}
+
+int
+ptarray_contains_point_2d(const POINTARRAY *ring, const POINT2D *pt)
+{
+	int boundary = LW_FALSE;
+	int wn;
+
+	if ( ring->npoints < 2 )
+		return -1;
+
+	wn = inring_get_kernel()->winding((const double*)getPoint_internal(ring, 0),
+	                                  FLAGS_NDIMS(ring->flags), ring->npoints - 1,
+	                                  pt->x, pt->y, &boundary);
+	return inring_result(wn, boundary);
+}
+
+void
+ptarray_contains_points_2d(const POINTARRAY *ring, const POINT2D *pts, int npoints, int *results)
+{
+	const INRING_KERNEL *kernel = inring_get_kernel();
+	const double *xy;
+	int stride, boundary, wn;
+	int i;
+
+	if ( ring->npoints < 2 )
+	{
+		for ( i = 0; i < npoints; i++ )
+			results[i] = -1;
+		return;
+	}
+
+	xy = (const double*)getPoint_internal(ring, 0);
+	stride = FLAGS_NDIMS(ring->flags);
+
+	/*
+	 * The edges are vectorized rather than the points: most edges of a
+	 * large ring are far above or below any given point, and whole
+	 * groups of them are skipped at once, which four points rarely
+	 * allow.
+	 */
+	for ( i = 0; i < npoints; i++ )
+	{
+		wn = kernel->winding(xy, stride, ring->npoints - 1, pts[i].x, pts[i].y, &boundary);
+		results[i] = inring_result(wn, boundary);
+	}
+}
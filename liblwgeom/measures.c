@@ -172,6 +172,116 @@ lwgeom_mindistance2d_tolerance(LWGEOM *lw1, LWGEOM *lw2, double tolerance)
 }
 
 
+/**
+	Min distance between a point and a linear or polygonal geometry,
+	read straight off their serializations. Returns LW_FAILURE if
+	neither argument is a point, or the other one is of a type that
+	needs the full deserialization (curves, collections).
+*/
+int
+gserialized_distance2d_point(const GSERIALIZED *g1, const GSERIALIZED *g2, double tolerance, double *distance)
+{
+	const GSERIALIZED *gpoint = g1;
+	const GSERIALIZED *gother = g2;
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+	POINT4D p4d;
+	POINT2D p;
+	DISTPTS thedl;
+	int inside = LW_FALSE;
+	int skip = LW_FALSE;
+
+	LWDEBUG(2, "gserialized_distance2d_point is called");
+
+	if ( gserialized_get_type(gpoint) != POINTTYPE )
+	{
+		gpoint = g2;
+		gother = g1;
+	}
+	if ( gserialized_get_type(gpoint) != POINTTYPE )
+		return LW_FAILURE;
+
+	switch ( gserialized_get_type(gother) )
+	{
+	case POINTTYPE:
+	case LINETYPE:
+	case POLYGONTYPE:
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+		break;
+	default:
+		return LW_FAILURE;
+	}
+
+	thedl.mode = DIST_MIN;
+	thedl.distance = MAXFLOAT;
+	thedl.tolerance = tolerance;
+	thedl.twisted = 1;
+
+	/* Nothing to measure from */
+	if ( gserialized_peek_first_point(gpoint, &p4d) == LW_FAILURE )
+	{
+		*distance = thedl.distance;
+		return LW_SUCCESS;
+	}
+	p.x = p4d.x;
+	p.y = p4d.y;
+
+	gserialized_iterator_init(&it, gother);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		/* A new polygon, or something else after a polygon */
+		if ( it.ring <= 0 )
+		{
+			if ( inside )
+				break;
+			skip = LW_FALSE;
+		}
+		if ( skip || pa->npoints == 0 )
+			continue;
+
+		if ( it.type == POINTTYPE )
+		{
+			POINT2D q;
+			getPoint2d_p(pa, 0, &q);
+			lw_dist2d_pt_pt(&p, &q, &thedl);
+		}
+		else if ( it.type != POLYGONTYPE )
+		{
+			lw_dist2d_pt_ptarray(&p, pa, &thedl);
+		}
+		else if ( it.ring == 0 )
+		{
+			/* Outside the shell, the rest of the polygon is further */
+			if ( ! pt_in_ring_2d(&p, pa) )
+			{
+				lw_dist2d_pt_ptarray(&p, pa, &thedl);
+				skip = LW_TRUE;
+			}
+			else
+				inside = LW_TRUE;
+		}
+		else if ( pt_in_ring_2d(&p, pa) )
+		{
+			/* Inside a hole, so that hole is the closest boundary */
+			lw_dist2d_pt_ptarray(&p, pa, &thedl);
+			inside = LW_FALSE;
+			skip = LW_TRUE;
+		}
+
+		if ( thedl.distance <= thedl.tolerance )
+			break;
+	}
+
+	/* Inside a polygon, and none of its holes */
+	if ( inside )
+		thedl.distance = 0.0;
+
+	*distance = thedl.distance;
+	return LW_SUCCESS;
+}
+
 /*------------------------------------------------------------------------------------------------------------
 End of Initializing functions
 --------------------------------------------------------------------------------------------------------------*/
@@ -1208,9 +1318,6 @@ int
 pt_in_ring_2d(const POINT2D *p, const POINTARRAY *ring)
 {
 	int cn = 0;    /* the crossing number counter */
-	int i;
-	POINT2D v1, v2;
-
 	POINT2D first, last;
 
 	getPoint2d_p(ring, 0, &first);
@@ -1226,34 +1333,8 @@ pt_in_ring_2d(const POINT2D *p, const POINTARRAY *ring)
 	LWDEBUGF(2, "pt_in_ring_2d called with point: %g %g", p->x, p->y);
 	/* printPA(ring); */
 
-	/* loop through all edges of the polygon */
-	getPoint2d_p(ring, 0, &v1);
-	for (i=0; i<ring->npoints-1; i++)
-	{
-		double vt;
-		getPoint2d_p(ring, i+1, &v2);
-
-		/* edge from vertex i to vertex i+1 */
-		if
-		(
-		    /* an upward crossing */
-		    ((v1.y <= p->y) && (v2.y > p->y))
-		    /* a downward crossing */
-		    || ((v1.y > p->y) && (v2.y <= p->y))
-		)
-		{
-
-			vt = (double)(p->y - v1.y) / (v2.y - v1.y);
-
-			/* P.x <intersect */
-			if (p->x < v1.x + vt * (v2.x - v1.x))
-			{
-				/* a valid crossing of y=p.y right of p.x */
-				++cn;
-			}
-		}
-		v1 = v2;
-	}
+	/* count the crossings of the ray going right from p */
+	cn = ptarray_crossings_2d(ring, p);
 
 	LWDEBUGF(3, "pt_in_ring_2d returning %d", cn&1);
 
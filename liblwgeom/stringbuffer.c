@@ -134,6 +134,19 @@ stringbuffer_append(stringbuffer_t *s, const char *a)
 	s->str_end += alen;
 }
 
+/**
+* Append len bytes, which may include nulls, to the stringbuffer_t.
+* Use stringbuffer_getlength() rather than strlen() to size the result.
+*/
+void 
+stringbuffer_append_len(stringbuffer_t *s, const char *a, size_t len)
+{
+	stringbuffer_makeroom(s, len + 1);
+	memcpy(s->str_end, a, len);
+	s->str_end += len;
+	*(s->str_end) = '\0';
+}
+
 /**
 * Returns a reference to the internal string being managed by
 * the stringbuffer. The current string will be null-terminated
@@ -197,10 +197,17 @@ lwgeom_init_allocators(void)
 	lwnotice_var = pg_notice;
 }
 
-/**
-* Utility method to call the serialization and then set the
-* PgSQL varsize header appropriately with the serialized size.
-*/
+GenericCacheCollection*
+GetGenericCacheCollection(FunctionCallInfoData *fcinfo)
+{
+	GenericCacheCollection* cache = fcinfo->flinfo->fn_extra;
+	if ( ! cache )
+	{
+		cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(GenericCacheCollection));
+		fcinfo->flinfo->fn_extra = cache;
+	}
+	return cache;
+}
 
 /**
 * Utility method to call the serialization and then set the
@@ -80,6 +80,27 @@ extern void pg_unparser_errhint(LWGEOM_UNPARSER_RESULT *lwg_unparser_result);
         } while(0);
 
 
+/*
+** Call-site caches. The geometry caches all want to hang off
+** fcinfo->flinfo->fn_extra, so fn_extra holds a collection with one
+** slot for each kind of cache. (Projections are cached per backend,
+** see lwgeom_transform.c.)
+*/
+#define GEOM_CACHE_ENTRY 0
+#define NUM_CACHE_ENTRIES 1
+
+typedef struct
+{
+	void *entry[NUM_CACHE_ENTRIES];
+}
+GenericCacheCollection;
+
+/**
+* Get the cache collection of the current call site, creating
+* an empty one in the function memory context if needed.
+*/
+GenericCacheCollection* GetGenericCacheCollection(FunctionCallInfoData *fcinfo);
+
 /*
 ** GSERIALIED prototypes used outside the index functions
 */
@@ -19,6 +19,7 @@
 #include "executor/spi.h"
 #include "access/hash.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
 
 /* PostGIS headers */
 #include "../postgis_config.h"
@@ -37,313 +38,146 @@
 int pj_transform_nodatum(projPJ srcdefn, projPJ dstdefn, long point_count, int point_offset, double *x, double *y, double *z );
 
 
-/* PROJ 4 lookup transaction cache methods */
-#define PROJ4_CACHE_ITEMS	8
-
 /*
- * PROJ 4 backend hash table initial hash size
- * (since 16 is the default portal hash table size, and we would
- * typically have 2 entries per portal
- * then we shall use a default size of 32)
+ * PROJ 4 backend cache initial hash size. The hash grows past this
+ * as needed, up to postgis.proj_cache_size entries.
  */
 #define PROJ4_BACKEND_HASH_SIZE	32
 
-
-/* An entry in the PROJ4 SRS cache */
-typedef struct struct_PROJ4SRSCacheItem
-{
-	int srid;
-	projPJ projection;
-	MemoryContext projection_mcxt;
-}
-PROJ4SRSCacheItem;
-
-/** The portal cache: it's contents and cache context
- */
-typedef struct struct_PROJ4PortalCache
-{
-	PROJ4SRSCacheItem PROJ4SRSCache[PROJ4_CACHE_ITEMS];
-	int PROJ4SRSCacheCount;
-	MemoryContext PROJ4SRSCacheContext;
-}
-PROJ4PortalCache;
+/* Value of the postgis.proj_cache_size setting */
+int proj_cache_size = PROJ_CACHE_SIZE_DEFAULT;
 
 /**
- * Backend projPJ hash table
+ * Backend projection cache
  *
- * This hash table stores a key/value pair of MemoryContext/projPJ objects.
- * Whenever we create a projPJ object using pj_init(), we create a separate
- * MemoryContext as a child context of the current executor context.
- * The MemoryContext/projPJ object is stored in this hash table so
- * that when PROJ4SRSCacheDelete() is called during query cleanup, we can
- * lookup the projPJ object based upon the MemoryContext parameter and hence
- * pj_free() it.
+ * Projections are looked up by SRID in a hash table that lives as long
+ * as the backend, so a query does not need to go back to spatial_ref_sys
+ * and pj_init() for SRIDs an earlier query of the session already used.
+ * When the table is full the least recently used projection is
+ * pj_free()'d to make room.
+ *
+ * Changes to spatial_ref_sys fire a trigger that sends a relcache
+ * invalidation for the table to every backend. The callback only flags
+ * the cache, which is flushed the next time a projection is requested:
+ * a caller may still be holding projPJ pointers when the invalidation
+ * messages are processed (in the middle of an SPI lookup, for example).
  */
-static HTAB *PJHash = NULL;
-
-typedef struct struct_PJHashEntry
+typedef struct struct_PROJ4SRSCacheItem
 {
-	MemoryContext ProjectionContext;
+	int srid; /* hash key, must be first */
 	projPJ projection;
+	uint64 last_used; /* value of PROJ4SRSClock at the last lookup */
 }
-PJHashEntry;
+PROJ4SRSCacheItem;
 
+static HTAB *PROJ4SRSHash = NULL;
+static uint64 PROJ4SRSClock = 0;
+static bool PROJ4SRSHashInvalid = false;
 
-/* PJ Hash API */
-uint32 mcxt_ptr_hash(const void *key, Size keysize);
+/* Oid of spatial_ref_sys, as found by the last SPI lookup */
+static Oid PROJ4SRSRelid = InvalidOid;
 
-static HTAB *CreatePJHash(void);
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection);
-static projPJ GetPJHashEntry(MemoryContext mcxt);
-static void DeletePJHashEntry(MemoryContext mcxt);
+/* Backend totals, reported by postgis_proj_cache_stats() */
+static PROJ4CacheStats PROJ4SRSStats = { 0, 0, 0, 0, 0 };
 
 /* Internal Cache API */
-static PROJ4PortalCache *GetPROJ4SRSCache(FunctionCallInfo fcinfo) ;
-static bool IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
-static projPJ GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
-static void AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid);
-static void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
+static void CreatePROJ4SRSHash(void);
+static void FlushPROJ4SRSHash(void);
+static void PROJ4SRSRelcacheCallback(Datum arg, Oid relid);
+static PROJ4SRSCacheItem *GetPROJ4SRSCacheItem(int srid);
+static PROJ4SRSCacheItem *AddToPROJ4SRSCache(int srid, int other_srid);
+static void DeleteFromPROJ4SRSCache(int srid);
+static void EvictFromPROJ4SRSCache(int other_srid);
 
 /* Search path for PROJ.4 library */
 static bool IsPROJ4LibPathSet = false;
 void SetPROJ4LibPath(void);
 
-/* Memory context cache functions */
-static void PROJ4SRSCacheInit(MemoryContext context);
-static void PROJ4SRSCacheDelete(MemoryContext context);
-static void PROJ4SRSCacheReset(MemoryContext context);
-static bool PROJ4SRSCacheIsEmpty(MemoryContext context);
-static void PROJ4SRSCacheStats(MemoryContext context, int level);
-#ifdef MEMORY_CONTEXT_CHECKING
-static void PROJ4SRSCacheCheck(MemoryContext context);
-#endif
-
-
-/* Memory context definition must match the current version of PostgreSQL */
-static MemoryContextMethods PROJ4SRSCacheContextMethods =
-{
-	NULL,
-	NULL,
-	NULL,
-	PROJ4SRSCacheInit,
-	PROJ4SRSCacheReset,
-	PROJ4SRSCacheDelete,
-	NULL,
-	PROJ4SRSCacheIsEmpty,
-	PROJ4SRSCacheStats
-#ifdef MEMORY_CONTEXT_CHECKING
-	,PROJ4SRSCacheCheck
-#endif
-};
-
 
 static void
-PROJ4SRSCacheInit(MemoryContext context)
+CreatePROJ4SRSHash(void)
 {
-	/*
-	 * Do nothing as the cache is initialised when the transform()
-	 * function is first called
-	 */
-}
-
-static void
-PROJ4SRSCacheDelete(MemoryContext context)
-{
-	projPJ projection;
-
-	/* Lookup the projPJ pointer in the global hash table so we can free it */
-	projection = GetPJHashEntry(context);
-
-	if (!projection)
-		elog(ERROR, "PROJ4SRSCacheDelete: Trying to delete non-existant projection object with MemoryContext key (%p)", (void *)context);
-
-	POSTGIS_DEBUGF(3, "deleting projection object (%p) with MemoryContext key (%p)", projection, context);
-
-	/* Free it */
-	pj_free(projection);
+	HASHCTL ctl;
 
-	/* Remove the hash entry as it is no longer needed */
-	DeletePJHashEntry(context);
-}
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(int);
+	ctl.entrysize = sizeof(PROJ4SRSCacheItem);
+	/* Older PostgreSQL versions default to string_hash */
+	ctl.hash = tag_hash;
 
-static void
-PROJ4SRSCacheReset(MemoryContext context)
-{
-	/*
-	 * Do nothing, but we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
-}
+	PROJ4SRSHash = hash_create("PostGIS PROJ4 Backend SRID Hash", PROJ4_BACKEND_HASH_SIZE, &ctl, (HASH_ELEM | HASH_FUNCTION));
 
-static bool
-PROJ4SRSCacheIsEmpty(MemoryContext context)
-{
 	/*
-	 * Always return false since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
+	 * The hash is never destroyed, so this only happens once per
+	 * backend, and callbacks can't be unregistered anyway.
 	 */
-	return FALSE;
+	CacheRegisterRelcacheCallback(PROJ4SRSRelcacheCallback, (Datum) 0);
 }
 
+/**
+ * Relcache invalidation callback. InvalidOid means the whole relcache
+ * is being reset (after an invalidation queue overflow), in which case
+ * we can't know whether spatial_ref_sys changed.
+ */
 static void
-PROJ4SRSCacheStats(MemoryContext context, int level)
-{
-	/*
-	 * Simple stats display function - we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
-
-	fprintf(stderr, "%s: PROJ4 context\n", context->name);
-}
-
-#ifdef MEMORY_CONTEXT_CHECKING
-static void
-PROJ4SRSCacheCheck(MemoryContext context)
+PROJ4SRSRelcacheCallback(Datum arg, Oid relid)
 {
-	/*
-	 * Do nothing - stub required for when PostgreSQL is compiled
-	 * with MEMORY_CONTEXT_CHECKING defined
-	 */
+	if ( relid == InvalidOid || relid == PROJ4SRSRelid )
+		PROJ4SRSHashInvalid = true;
 }
-#endif
-
-
-/*
- * PROJ4 projPJ Hash Table functions
- */
-
 
 /**
- * A version of tag_hash - we specify this here as the implementation
- * has changed over the years....
+ * pj_free() all the cached projections and empty the hash.
  */
-
-uint32 mcxt_ptr_hash(const void *key, Size keysize)
-{
-	uint32 hashval;
-
-	hashval = DatumGetUInt32(hash_any(key, keysize));
-
-	return hashval;
-}
-
-
-static HTAB *CreatePJHash(void)
-{
-	HASHCTL ctl;
-
-	ctl.keysize = sizeof(MemoryContext);
-	ctl.entrysize = sizeof(PJHashEntry);
-	ctl.hash = mcxt_ptr_hash;
-
-	return hash_create("PostGIS PROJ4 Backend projPJ MemoryContext Hash", PROJ4_BACKEND_HASH_SIZE, &ctl, (HASH_ELEM | HASH_FUNCTION));
-}
-
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection)
+static void
+FlushPROJ4SRSHash(void)
 {
-	bool found;
-	void **key;
-	PJHashEntry *he;
+	HASH_SEQ_STATUS status;
+	PROJ4SRSCacheItem *item;
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+	POSTGIS_DEBUGF(3, "flushing %ld entries from the projection cache", hash_get_num_entries(PROJ4SRSHash));
 
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_ENTER, &found);
-	if (!found)
-	{
-		/* Insert the entry into the new hash element */
-		he->ProjectionContext = mcxt;
-		he->projection = projection;
-	}
-	else
+	/* Removing the element just returned by hash_seq_search is allowed */
+	hash_seq_init(&status, PROJ4SRSHash);
+	while ( (item = (PROJ4SRSCacheItem *) hash_seq_search(&status)) != NULL )
 	{
-		elog(ERROR, "AddPJHashEntry: PROJ4 projection object already exists for this MemoryContext (%p)",
-		     (void *)mcxt);
+		pj_free(item->projection);
+		hash_search(PROJ4SRSHash, &(item->srid), HASH_REMOVE, NULL);
 	}
-}
-
-static projPJ GetPJHashEntry(MemoryContext mcxt)
-{
-	void **key;
-	PJHashEntry *he;
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
-
-	/* Return the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_FIND, NULL);
-
-	return he->projection;
+	PROJ4SRSStats.invalidations++;
 }
 
-
-static void DeletePJHashEntry(MemoryContext mcxt)
+/**
+ * Return the cache entry of a SRID, or NULL if it isn't cached,
+ * marking it as the most recently used.
+ */
+static PROJ4SRSCacheItem *
+GetPROJ4SRSCacheItem(int srid)
 {
-	void **key;
-	PJHashEntry *he;
+	PROJ4SRSCacheItem *item;
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+	item = (PROJ4SRSCacheItem *) hash_search(PROJ4SRSHash, &srid, HASH_FIND, NULL);
+	if ( item )
+		item->last_used = ++PROJ4SRSClock;
 
-	/* Delete the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_REMOVE, NULL);
-
-	he->projection = NULL;
-
-	if (!he)
-		elog(ERROR, "DeletePJHashEntry: There was an error removing the PROJ4 projection object from this MemoryContext (%p)", (void *)mcxt);
+	return item;
 }
 
 bool
-IsInPROJ4Cache(Proj4Cache PROJ4Cache, int srid) {
-	return IsInPROJ4SRSCache((PROJ4PortalCache *)PROJ4Cache, srid) ;
-}
-
-/*
- * Per-cache management functions
- */
-
-static bool
-IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
+IsInPROJ4Cache(Proj4Cache PROJ4Cache, int srid)
 {
-	/*
-	 * Return true/false depending upon whether the item
-	 * is in the SRS cache.
-	 */
-
-	int i;
-
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-			return 1;
-	}
-
-	/* Otherwise not found */
-	return 0;
+	return hash_search((HTAB *)PROJ4Cache, &srid, HASH_FIND, NULL) != NULL;
 }
 
 projPJ GetProjectionFromPROJ4Cache(Proj4Cache cache, int srid)
 {
-	return GetProjectionFromPROJ4SRSCache((PROJ4PortalCache *)cache, srid) ;
-}
-
-/**
- * Return the projection object from the cache (we should
- * already have checked it exists using IsInPROJ4SRSCache first)
- */
-static projPJ
-GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
-{
-	int i;
+	PROJ4SRSCacheItem *item = GetPROJ4SRSCacheItem(srid);
 
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-			return PROJ4Cache->PROJ4SRSCache[i].projection;
-	}
+	if ( ! item )
+		return NULL;
 
-	return NULL;
+	return item->projection;
 }
 
 char* GetProj4StringSPI(int srid)
@@ -361,7 +195,7 @@ char* GetProj4StringSPI(int srid)
 	}
 
 	/* Execute the lookup query */
-	snprintf(proj4_spi_buffer, 255, "SELECT proj4text FROM spatial_ref_sys WHERE srid = %d LIMIT 1", srid);
+	snprintf(proj4_spi_buffer, 255, "SELECT proj4text, tableoid FROM spatial_ref_sys WHERE srid = %d LIMIT 1", srid);
 	spi_result = SPI_exec(proj4_spi_buffer, 1);
 
 	/* Read back the PROJ4 text */
@@ -372,6 +206,12 @@ char* GetProj4StringSPI(int srid)
 		SPITupleTable *tuptable = SPI_tuptable;
 		HeapTuple tuple = tuptable->vals[0];
 		char *proj4text = SPI_getvalue(tuple, tupdesc, 1);
+		bool isnull;
+		Datum relid = SPI_getbinval(tuple, tupdesc, 2, &isnull);
+
+		/* Remember which table to watch for invalidations */
+		if ( ! isnull )
+			PROJ4SRSRelid = DatumGetObjectId(relid);
 
 		if ( proj4text )
 		{
@@ -464,22 +304,55 @@ static char* GetProj4String(int srid)
 	}
 }
 
-void AddToPROJ4Cache(Proj4Cache cache, int srid, int other_srid) {
-	AddToPROJ4SRSCache((PROJ4PortalCache *)cache, srid, other_srid) ;
+void AddToPROJ4Cache(Proj4Cache cache, int srid, int other_srid)
+{
+	AddToPROJ4SRSCache(srid, other_srid);
 }
 
 
 /**
- * Add an entry to the local PROJ4 SRS cache. If we need to wrap around then
- * we must make sure the entry we choose to delete does not contain other_srid
- * which is the definition for the other half of the transformation.
+ * Drop the least recently used projection of the cache, leaving the
+ * one of other_srid alone, as it is the other half of the
+ * transformation being set up.
  */
 static void
-AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid)
+EvictFromPROJ4SRSCache(int other_srid)
 {
-	MemoryContext PJMemoryContext;
+	HASH_SEQ_STATUS status;
+	PROJ4SRSCacheItem *item;
+	PROJ4SRSCacheItem *oldest = NULL;
+
+	hash_seq_init(&status, PROJ4SRSHash);
+	while ( (item = (PROJ4SRSCacheItem *) hash_seq_search(&status)) != NULL )
+	{
+		if ( item->srid == other_srid )
+			continue;
+		if ( ! oldest || item->last_used < oldest->last_used )
+			oldest = item;
+	}
+
+	if ( ! oldest )
+		return;
+
+	POSTGIS_DEBUGF(3, "choosing to remove item from projection cache with SRID %d", oldest->srid);
+
+	DeleteFromPROJ4SRSCache(oldest->srid);
+	PROJ4SRSStats.evictions++;
+}
+
+/**
+ * Add an entry to the backend PROJ4 SRS cache. If the cache is full
+ * we drop the least recently used entries first, making sure we don't
+ * drop the one of other_srid, which is the definition for the other
+ * half of the transformation.
+ */
+static PROJ4SRSCacheItem *
+AddToPROJ4SRSCache(int srid, int other_srid)
+{
+	PROJ4SRSCacheItem *item;
 	projPJ projection = NULL;
 	char *proj_str = NULL;
+	bool found;
 
 	/*
 	** Turn the SRID number into a proj4 string, by reading from spatial_ref_sys
@@ -503,92 +376,51 @@ AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid)
 		    proj_str, pj_errstr);
 	}
 
-	/*
-	 * If the cache is already full then find the first entry
-	 * that doesn't contain other_srid and use this as the
-	 * subsequent value of PROJ4SRSCacheCount
-	 */
-	if (PROJ4Cache->PROJ4SRSCacheCount == PROJ4_CACHE_ITEMS)
+	/* Make room, the setting may have been lowered since the last call */
+	while ( hash_get_num_entries(PROJ4SRSHash) >= proj_cache_size )
 	{
-		bool found = false;
-		int i;
-
-		for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-		{
-			if (PROJ4Cache->PROJ4SRSCache[i].srid != other_srid && found == false)
-			{
-				POSTGIS_DEBUGF(3, "choosing to remove item from query cache with SRID %d and index %d", PROJ4Cache->PROJ4SRSCache[i].srid, i);
-
-				DeleteFromPROJ4SRSCache(PROJ4Cache, PROJ4Cache->PROJ4SRSCache[i].srid);
-				PROJ4Cache->PROJ4SRSCacheCount = i;
-
-				found = true;
-			}
-		}
+		long nentries = hash_get_num_entries(PROJ4SRSHash);
+		EvictFromPROJ4SRSCache(other_srid);
+		if ( hash_get_num_entries(PROJ4SRSHash) == nentries )
+			break;
 	}
 
-	/*
-	 * Now create a memory context for this projection and
-	 * store it in the backend hash
-	 */
-	POSTGIS_DEBUGF(3, "adding SRID %d with proj4text \"%s\" to query cache at index %d", srid, proj_str, PROJ4Cache->PROJ4SRSCacheCount);
-
-	PJMemoryContext = MemoryContextCreate(T_AllocSetContext, 8192,
-	                                      &PROJ4SRSCacheContextMethods,
-	                                      PROJ4Cache->PROJ4SRSCacheContext,
-	                                      "PostGIS PROJ4 PJ Memory Context");
+	POSTGIS_DEBUGF(3, "adding SRID %d with proj4text \"%s\" to projection cache", srid, proj_str);
 
-	/* Create the backend hash if it doesn't already exist */
-	if (!PJHash)
-		PJHash = CreatePJHash();
+	item = (PROJ4SRSCacheItem *) hash_search(PROJ4SRSHash, &srid, HASH_ENTER, &found);
+	if ( found )
+		pj_free(item->projection);
+	item->srid = srid;
+	item->projection = projection;
+	item->last_used = ++PROJ4SRSClock;
 
-	/*
-	 * Add the MemoryContext to the backend hash so we can
-	 * clean up upon portal shutdown
-	 */
-	POSTGIS_DEBUGF(3, "adding projection object (%p) to hash table with MemoryContext key (%p)", projection, PJMemoryContext);
-
-	AddPJHashEntry(PJMemoryContext, projection);
-
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].srid = srid;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection = projection;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection_mcxt = PJMemoryContext;
-	PROJ4Cache->PROJ4SRSCacheCount++;
+	PROJ4SRSStats.misses++;
 
 	/* Free the projection string */
 	pfree(proj_str);
 
+	return item;
 }
 
-void DeleteFromPROJ4Cache(Proj4Cache cache, int srid) {
-	DeleteFromPROJ4SRSCache((PROJ4PortalCache *)cache, srid) ;
+void DeleteFromPROJ4Cache(Proj4Cache cache, int srid)
+{
+	DeleteFromPROJ4SRSCache(srid);
 }
 
 
-static void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
+static void DeleteFromPROJ4SRSCache(int srid)
 {
-	/*
-	 * Delete the SRID entry from the cache
-	 */
+	PROJ4SRSCacheItem *item;
 
-	int i;
+	item = (PROJ4SRSCacheItem *) hash_search(PROJ4SRSHash, &srid, HASH_FIND, NULL);
+	if ( ! item )
+		return;
 
-	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-	{
-		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
-		{
-			POSTGIS_DEBUGF(3, "removing query cache entry with SRID %d at index %d", srid, i);
-
-			/*
-			 * Zero out the entries and free the PROJ4 handle
-			 * by deleting the memory context
-			 */
-			MemoryContextDelete(PROJ4Cache->PROJ4SRSCache[i].projection_mcxt);
-			PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
-			PROJ4Cache->PROJ4SRSCache[i].projection_mcxt = NULL;
-			PROJ4Cache->PROJ4SRSCache[i].srid = SRID_UNKNOWN;
-		}
-	}
+	POSTGIS_DEBUGF(3, "removing projection cache entry with SRID %d", srid);
+
+	/* Free the PROJ4 handle, then the entry */
+	pj_free(item->projection);
+	hash_search(PROJ4SRSHash, &srid, HASH_REMOVE, NULL);
 }
 
 
@@ -634,79 +466,75 @@ void SetPROJ4LibPath(void)
 	}
 }
 
-Proj4Cache GetPROJ4Cache(FunctionCallInfo fcinfo) {
-	return (Proj4Cache)GetPROJ4SRSCache(fcinfo) ;
-}
-
-static PROJ4PortalCache *GetPROJ4SRSCache(FunctionCallInfo fcinfo)
+/**
+ * Return the backend projection cache, creating it on first use and
+ * flushing it if spatial_ref_sys changed since the last call.
+ */
+Proj4Cache GetPROJ4Cache(FunctionCallInfo fcinfo)
 {
-	PROJ4PortalCache *PROJ4Cache ;
-
-	/*
-	 * If we have not already created PROJ4 cache for this portal
-	 * then create it
-	 */
-	if (fcinfo->flinfo->fn_extra == NULL)
+	if ( ! PROJ4SRSHash )
 	{
-		MemoryContext old_context;
-
-		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-		PROJ4Cache = palloc(sizeof(PROJ4PortalCache));
-		MemoryContextSwitchTo(old_context);
-
-		if (PROJ4Cache)
-		{
-			int i;
-
-			POSTGIS_DEBUGF(3, "Allocating PROJ4Cache for portal with transform() MemoryContext %p", fcinfo->flinfo->fn_mcxt);
-			/* Put in any required defaults */
-			for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
-			{
-				PROJ4Cache->PROJ4SRSCache[i].srid = SRID_UNKNOWN;
-				PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
-				PROJ4Cache->PROJ4SRSCache[i].projection_mcxt = NULL;
-			}
-			PROJ4Cache->PROJ4SRSCacheCount = 0;
-			PROJ4Cache->PROJ4SRSCacheContext = fcinfo->flinfo->fn_mcxt;
-
-			/* Store the pointer in fcinfo->flinfo->fn_extra */
-			fcinfo->flinfo->fn_extra = PROJ4Cache;
-		}
+		POSTGIS_DEBUG(3, "creating the backend projection cache");
+		CreatePROJ4SRSHash();
 	}
-	else
+	else if ( PROJ4SRSHashInvalid )
 	{
-		/* Use the existing cache */
-		PROJ4Cache = fcinfo->flinfo->fn_extra;
+		FlushPROJ4SRSHash();
 	}
+	PROJ4SRSHashInvalid = false;
+
+	return (Proj4Cache)PROJ4SRSHash;
+}
 
-	return PROJ4Cache ;
+/**
+ * Flag the cache of this backend as stale, for the next call to flush it.
+ */
+void InvalidatePROJ4Cache(void)
+{
+	PROJ4SRSHashInvalid = true;
+}
+
+void GetPROJ4CacheStats(PROJ4CacheStats *stats)
+{
+	*stats = PROJ4SRSStats;
+	stats->entries = PROJ4SRSHash ? hash_get_num_entries(PROJ4SRSHash) : 0;
 }
 
 
 int
 GetProjectionsUsingFCInfo(FunctionCallInfo fcinfo, int srid1, int srid2, projPJ *pj1, projPJ *pj2)
 {
-	Proj4Cache *proj_cache = NULL;
+	Proj4Cache proj_cache = NULL;
+	PROJ4SRSCacheItem *item1, *item2;
 
 	/* Set the search path if we haven't already */
 	SetPROJ4LibPath();
 
-	/* get or initialize the cache for this round */
+	/* get or initialize the cache */
 	proj_cache = GetPROJ4Cache(fcinfo);
 	if ( !proj_cache )
 		return LW_FAILURE;
 
 	/* Add the output srid to the cache if it's not already there */
-	if (!IsInPROJ4Cache(proj_cache, srid1))
-		AddToPROJ4Cache(proj_cache, srid1, srid2);
+	item1 = GetPROJ4SRSCacheItem(srid1);
+	if ( item1 )
+		PROJ4SRSStats.hits++;
+	else
+		item1 = AddToPROJ4SRSCache(srid1, srid2);
 
-	/* Add the input srid to the cache if it's not already there */
-	if (!IsInPROJ4Cache(proj_cache, srid2))
-		AddToPROJ4Cache(proj_cache, srid2, srid1);
+	/*
+	 * Add the input srid to the cache if it's not already there.
+	 * That never evicts srid1, so item1 is still valid.
+	 */
+	item2 = GetPROJ4SRSCacheItem(srid2);
+	if ( item2 )
+		PROJ4SRSStats.hits++;
+	else
+		item2 = AddToPROJ4SRSCache(srid2, srid1);
 
 	/* Get the projections */
-	*pj1 = GetProjectionFromPROJ4Cache(proj_cache, srid1);
-	*pj2 = GetProjectionFromPROJ4Cache(proj_cache, srid2);
+	*pj1 = item1->projection;
+	*pj2 = item2->projection;
 
 	return LW_SUCCESS;
 }
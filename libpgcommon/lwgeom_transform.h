@@ -25,6 +25,27 @@ void SetPROJ4LibPath(void) ;
  */
 typedef void *Proj4Cache ;
 
+/**
+ * Number of projections kept by the backend cache
+ * (the postgis.proj_cache_size setting).
+ */
+#define PROJ_CACHE_SIZE_DEFAULT 64
+#define PROJ_CACHE_SIZE_MAX 4096
+extern int proj_cache_size;
+
+/**
+ * Backend projection cache statistics, since the backend started.
+ */
+typedef struct
+{
+	int64 hits;          /* SRID found in the cache */
+	int64 misses;        /* SRID looked up in spatial_ref_sys and pj_init'ed */
+	int64 evictions;     /* projection dropped to make room */
+	int64 invalidations; /* cache flushed after a change to spatial_ref_sys */
+	int entries;         /* projections currently cached */
+}
+PROJ4CacheStats;
+
 void SetPROJ4LibPath(void);
 Proj4Cache GetPROJ4Cache(FunctionCallInfo fcinfo) ;
 bool IsInPROJ4Cache(Proj4Cache cache, int srid) ;
@@ -34,6 +55,8 @@ projPJ GetProjectionFromPROJ4Cache(Proj4Cache cache, int srid);
 int GetProjectionsUsingFCInfo(FunctionCallInfo fcinfo, int srid1, int srid2, projPJ *pj1, projPJ *pj2);
 int spheroid_init_from_srid(FunctionCallInfo fcinfo, int srid, SPHEROID *s);
 void srid_is_latlong(FunctionCallInfo fcinfo, int srid);
+void InvalidatePROJ4Cache(void);
+void GetPROJ4CacheStats(PROJ4CacheStats *stats);
 
 /**
  * Builtin SRID values
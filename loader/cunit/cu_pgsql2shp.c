@@ -17,6 +17,7 @@
 /* Test functions */
 void test_ShpDumperCreate(void);
 void test_ShpDumperDestroy(void);
+void test_ShpDumperGetFetchSize(void);
 
 SHPDUMPERCONFIG *dumper_config;
 SHPDUMPERSTATE *dumper_state;
@@ -36,7 +37,8 @@ CU_pSuite register_pgsql2shp_suite(void)
 
 	if (
 	    (NULL == CU_add_test(pSuite, "test_ShpDumperCreate()", test_ShpDumperCreate)) ||
-	    (NULL == CU_add_test(pSuite, "test_ShpDumperDestroy()", test_ShpDumperDestroy))
+	    (NULL == CU_add_test(pSuite, "test_ShpDumperDestroy()", test_ShpDumperDestroy)) ||
+	    (NULL == CU_add_test(pSuite, "test_ShpDumperGetFetchSize()", test_ShpDumperGetFetchSize))
 	)
 	{
 		CU_cleanup_registry();
@@ -70,9 +72,64 @@ void test_ShpDumperCreate(void)
 	dumper_state = ShpDumperCreate(dumper_config);
 	CU_ASSERT_PTR_NOT_NULL(dumper_state);
 	CU_ASSERT_EQUAL(dumper_state->config->fetchsize, 100);
+	CU_ASSERT_EQUAL(dumper_state->fetchsize, 100);
 }
 
 void test_ShpDumperDestroy(void)
 {
 	ShpDumperDestroy(dumper_state);
 }
+
+/* Build a result set of nrows rows of one column of width bytes */
+static PGresult *
+make_result(int nrows, int width)
+{
+	PGresult *res;
+	PGresAttDesc att;
+	char *value;
+	int i;
+
+	memset(&att, 0, sizeof(PGresAttDesc));
+	att.name = "_geox";
+	att.typid = 17;
+	att.typlen = -1;
+	att.atttypmod = -1;
+
+	res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+	PQsetResultAttrs(res, 1, &att);
+
+	value = malloc(width + 1);
+	memset(value, 'x', width);
+	value[width] = '\0';
+
+	for (i = 0; i < nrows; i++)
+		PQsetvalue(res, i, 0, value, width);
+
+	free(value);
+
+	return res;
+}
+
+void test_ShpDumperGetFetchSize(void)
+{
+	PGresult *res;
+
+	/* An empty batch keeps the size */
+	res = make_result(0, 0);
+	CU_ASSERT_EQUAL(ShpDumperGetFetchSize(res, 100), 100);
+	PQclear(res);
+
+	/* Rows of 1023 bytes make batches of about SHPDUMPER_FETCH_BYTES */
+	res = make_result(10, 1023);
+	CU_ASSERT_EQUAL(ShpDumperGetFetchSize(res, 100), SHPDUMPER_FETCH_BYTES / 1024);
+	PQclear(res);
+
+	/* Narrow rows are capped, wide rows still fetch a few at a time */
+	res = make_result(10, 0);
+	CU_ASSERT_EQUAL(ShpDumperGetFetchSize(res, 100), SHPDUMPER_FETCH_MAX);
+	PQclear(res);
+
+	res = make_result(2, SHPDUMPER_FETCH_BYTES);
+	CU_ASSERT_EQUAL(ShpDumperGetFetchSize(res, 100), SHPDUMPER_FETCH_MIN);
+	PQclear(res);
+}
@@ -17,6 +17,15 @@
 /* Test functions */
 void test_ShpLoaderCreate(void);
 void test_ShpLoaderDestroy(void);
+void test_copy_binary_numeric(void);
+void test_copy_binary_date(void);
+void test_polygon_rings(void);
+
+/* Binary COPY encoders of shp2pgsql-core.c */
+int copy_binary_numeric(stringbuffer_t *sb, const char *str);
+int copy_binary_date(stringbuffer_t *sb, const char *str);
+/* Polygon assembly of shp2pgsql-core.c */
+int GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size);
 
 SHPLOADERCONFIG *loader_config;
 SHPLOADERSTATE *loader_state;
@@ -36,7 +45,10 @@ CU_pSuite register_shp2pgsql_suite(void)
 
 	if (
 	    (NULL == CU_add_test(pSuite, "test_ShpLoaderCreate()", test_ShpLoaderCreate)) ||
-	    (NULL == CU_add_test(pSuite, "test_ShpLoaderDestroy()", test_ShpLoaderDestroy))
+	    (NULL == CU_add_test(pSuite, "test_ShpLoaderDestroy()", test_ShpLoaderDestroy)) ||
+	    (NULL == CU_add_test(pSuite, "test_copy_binary_numeric()", test_copy_binary_numeric)) ||
+	    (NULL == CU_add_test(pSuite, "test_copy_binary_date()", test_copy_binary_date)) ||
+	    (NULL == CU_add_test(pSuite, "test_polygon_rings()", test_polygon_rings))
 	)
 	{
 		CU_cleanup_registry();
@@ -76,3 +88,181 @@ void test_ShpLoaderDestroy(void)
 {
 	ShpLoaderDestroy(loader_state);
 }
+
+void test_copy_binary_numeric(void)
+{
+	stringbuffer_t *sb = stringbuffer_create();
+
+	/* Length, 2 digits of weight 0, negative, 2 decimals: 12, 5000 */
+	const char expected[] = { 0, 0, 0, 12, 0, 2, 0, 0, 0x40, 0, 0, 2, 0, 12, 0x13, (char)0x88 };
+	/* Length, 1 digit of weight 2, positive, no decimals: 150 */
+	const char expected_exp[] = { 0, 0, 0, 10, 0, 1, 0, 2, 0, 0, 0, 0, 0, (char)150 };
+	/* Length, no digits, positive, 3 decimals */
+	const char expected_zero[] = { 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 3 };
+
+	CU_ASSERT_EQUAL(copy_binary_numeric(sb, " -12.50"), 1);
+	CU_ASSERT_EQUAL(stringbuffer_getlength(sb), sizeof(expected));
+	CU_ASSERT_EQUAL(memcmp(stringbuffer_getstring(sb), expected, sizeof(expected)), 0);
+
+	stringbuffer_clear(sb);
+	CU_ASSERT_EQUAL(copy_binary_numeric(sb, "1.5E+10"), 1);
+	CU_ASSERT_EQUAL(stringbuffer_getlength(sb), sizeof(expected_exp));
+	CU_ASSERT_EQUAL(memcmp(stringbuffer_getstring(sb), expected_exp, sizeof(expected_exp)), 0);
+
+	stringbuffer_clear(sb);
+	CU_ASSERT_EQUAL(copy_binary_numeric(sb, "-0.000"), 1);
+	CU_ASSERT_EQUAL(stringbuffer_getlength(sb), sizeof(expected_zero));
+	CU_ASSERT_EQUAL(memcmp(stringbuffer_getstring(sb), expected_zero, sizeof(expected_zero)), 0);
+
+	CU_ASSERT_EQUAL(copy_binary_numeric(sb, "1.2.3"), 0);
+	CU_ASSERT_EQUAL(copy_binary_numeric(sb, "*****"), 0);
+
+	stringbuffer_destroy(sb);
+}
+
+void test_copy_binary_date(void)
+{
+	stringbuffer_t *sb = stringbuffer_create();
+
+	/* Days since 2000-01-01 */
+	const char expected[] = { 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 4, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, 0, 0, 0, 4, 0, 0, 0, 59 };
+
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "20000101"), 1);
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "19991231"), 1);
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "20000229"), 1);
+	CU_ASSERT_EQUAL(stringbuffer_getlength(sb), sizeof(expected));
+	CU_ASSERT_EQUAL(memcmp(stringbuffer_getstring(sb), expected, sizeof(expected)), 0);
+
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "19000229"), 0);
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "2000011"), 0);
+	CU_ASSERT_EQUAL(copy_binary_date(sb, "00000000"), 0);
+
+	stringbuffer_destroy(sb);
+}
+
+/* Square ring parts for test_polygon_rings, and their WKT */
+static int ring_nparts, ring_nvertices;
+static int ring_starts[64];
+static double ring_x[320], ring_y[320];
+
+static void
+add_square(double x0, double y0, double x1, double y1, int clockwise)
+{
+	double xs[5], ys[5];
+	int i;
+
+	xs[0] = x0; ys[0] = y0;
+	xs[2] = x1; ys[2] = y1;
+	xs[4] = x0; ys[4] = y0;
+	if (clockwise)
+	{
+		xs[1] = x0; ys[1] = y1;
+		xs[3] = x1; ys[3] = y0;
+	}
+	else
+	{
+		xs[1] = x1; ys[1] = y0;
+		xs[3] = x0; ys[3] = y1;
+	}
+
+	ring_starts[ring_nparts++] = ring_nvertices;
+	for (i = 0; i < 5; i++)
+	{
+		ring_x[ring_nvertices] = xs[i];
+		ring_y[ring_nvertices] = ys[i];
+		ring_nvertices++;
+	}
+}
+
+static void
+append_square_wkt(stringbuffer_t *sb, int part)
+{
+	int i, v = ring_starts[part];
+
+	stringbuffer_append(sb, "(");
+	for (i = 0; i < 5; i++)
+		stringbuffer_aprintf(sb, "%s%g %g", i ? "," : "", ring_x[v + i], ring_y[v + i]);
+	stringbuffer_append(sb, ")");
+}
+
+/*
+** Holes go into the first outer ring, in shape order, that contains
+** either of their first two vertexes, whatever the envelope index of
+** the outer rings returns them in. Holes within no outer ring become
+** outer rings, after the others, and can take holes of their own.
+*/
+void test_polygon_rings(void)
+{
+	SHPLOADERCONFIG config;
+	SHPLOADERSTATE state;
+	SHPObject *obj;
+	stringbuffer_t *sb;
+	char *wkt;
+	size_t size;
+	int i;
+
+	ring_nparts = ring_nvertices = 0;
+	add_square(40, 60, 60, 80, 1);      /* 0: island */
+	add_square(45, 65, 55, 75, 0);      /* 1: hole of the island */
+	add_square(0, 0, 100, 100, 1);      /* 2: shell around the island */
+	add_square(10, 10, 20, 20, 0);      /* 3: hole of the shell */
+	add_square(30, 50, 70, 90, 0);      /* 4: lake of the island, in the shell */
+	add_square(200, 200, 210, 210, 0);  /* 5: orphan hole */
+	add_square(202, 202, 204, 204, 0);  /* 6: hole within the orphan */
+	/* 7-26: enough outer rings for the index to have several levels */
+	for (i = 0; i < 20; i++)
+		add_square(300 + 10 * i, 0, 305 + 10 * i, 5, 1);
+	add_square(461, 1, 462, 2, 0);      /* 27: hole of ring 23 */
+
+	obj = SHPCreateObject(SHPT_POLYGON, -1, ring_nparts, ring_starts, NULL,
+	                      ring_nvertices, ring_x, ring_y, NULL, NULL);
+
+	memset(&config, 0, sizeof(SHPLOADERCONFIG));
+	set_loader_config_defaults(&config);
+	config.use_wkt = 1;
+	memset(&state, 0, sizeof(SHPLOADERSTATE));
+	state.config = &config;
+
+	CU_ASSERT_EQUAL(GeneratePolygonGeometry(&state, obj, &wkt, &size), SHPLOADEROK);
+
+	/*
+	** The hole of the island is also within the shell, which the index
+	** returns first, but the island comes first in the shape. The lake
+	** goes into the shell, the only ring around its first vertex.
+	*/
+	sb = stringbuffer_create();
+	stringbuffer_append(sb, "MULTIPOLYGON((");
+	append_square_wkt(sb, 0);
+	stringbuffer_append(sb, ",");
+	append_square_wkt(sb, 1);
+	stringbuffer_append(sb, "),(");
+	append_square_wkt(sb, 2);
+	stringbuffer_append(sb, ",");
+	append_square_wkt(sb, 3);
+	stringbuffer_append(sb, ",");
+	append_square_wkt(sb, 4);
+	stringbuffer_append(sb, ")");
+	for (i = 7; i < 27; i++)
+	{
+		stringbuffer_append(sb, ",(");
+		append_square_wkt(sb, i);
+		if (i == 23)
+		{
+			stringbuffer_append(sb, ",");
+			append_square_wkt(sb, 27);
+		}
+		stringbuffer_append(sb, ")");
+	}
+	stringbuffer_append(sb, ",(");
+	append_square_wkt(sb, 5);
+	stringbuffer_append(sb, ",");
+	append_square_wkt(sb, 6);
+	stringbuffer_append(sb, "))");
+
+	CU_ASSERT_STRING_EQUAL(wkt, stringbuffer_getstring(sb));
+
+	stringbuffer_destroy(sb);
+	free(wkt);
+	SHPDestroyObject(obj);
+	free(config.encoding);
+}
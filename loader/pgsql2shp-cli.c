@@ -18,6 +18,7 @@
  **********************************************************************/
 
 #include "pgsql2shp-core.h"
+#include "pgsql2shp-dump.h"
 #include "../postgis_config.h"
 
 
@@ -37,6 +38,8 @@ usage()
 	printf(_("  -u <user>  Connect to the database as the specified user.\n" ));
 	printf(_("  -g <geometry_column> Specify the geometry column to be exported.\n" ));
 	printf(_("  -b Use a binary cursor.\n" ));
+	printf(_("  -j <jobs> Number of parallel connections and worker threads to dump\n"
+	         "     with, each fetching ranges of the table through a binary cursor.\n" ));
 	printf(_("  -r Raw mode. Do not assume table has been created by the loader. This would\n"
 	         "     not unescape attribute names and will not skip the 'gid' attribute.\n" ));
 	printf(_("  -k Keep PostgreSQL identifiers case.\n" ));
@@ -56,6 +59,7 @@ main(int argc, char **argv)
 	SHPDUMPERSTATE *state;
 
 	int ret, c, i;
+	int jobs = 1;
 
 	/* If no options are specified, display usage */
 	if (argc == 1)
@@ -68,7 +72,7 @@ main(int argc, char **argv)
 	config = malloc(sizeof(SHPDUMPERCONFIG));
 	set_dumper_config_defaults(config);
 
-	while ((c = pgis_getopt(argc, argv, "bf:h:du:p:P:g:rkm:")) != EOF)
+	while ((c = pgis_getopt(argc, argv, "bf:h:du:p:P:g:rkm:j:")) != EOF)
 	{
 		switch (c)
 		{
@@ -106,6 +110,14 @@ main(int argc, char **argv)
 		case 'k':
 			config->keep_fieldname_case = 1;
 			break;
+		case 'j':
+			jobs = atoi(pgis_optarg);
+			if (jobs < 1 || jobs > DUMPER_MAX_JOBS)
+			{
+				fprintf(stderr, "The number of jobs must be between 1 and %d\n", DUMPER_MAX_JOBS);
+				exit(1);
+			}
+			break;
 		case '?':
 			usage();
 			exit(0);
@@ -162,6 +174,18 @@ main(int argc, char **argv)
 		}
 	}
 
+#ifndef HAVE_PTHREAD
+	if (jobs > 1)
+	{
+		fprintf(stderr, "Parallel dumping is not supported on this platform, dumping with one connection\n");
+		jobs = 1;
+	}
+#endif
+
+	/* The workers of a parallel dump fetch through binary cursors */
+	if (jobs > 1)
+		config->binary = 1;
+
 	state = ShpDumperCreate(config);
 
 	ret = ShpDumperConnectDatabase(state);
@@ -198,27 +222,40 @@ main(int argc, char **argv)
 	fprintf(stdout, _("Dumping: "));
 	fflush(stdout);
 
-	for (i = 0; i < ShpDumperGetRecordCount(state); i++)
+	if (jobs > 1)
 	{
-		/* Mimic existing behaviour */
-		if (!(state->currow % state->config->fetchsize))
-		{
-			fprintf(stdout, "X");
-			fflush(stdout);
-		}
-
-		ret = ShpLoaderGenerateShapeRow(state);
+		ret = ShpDumperDumpTable(state, jobs);
 		if (ret != SHPDUMPEROK)
 		{
 			fprintf(stderr, "%s\n", state->message);
 			fflush(stderr);
-	
-			if (ret == SHPDUMPERERR)
-				exit(1);
+			exit(1);
+		}
+	}
+	else
+	{
+		for (i = 0; i < ShpDumperGetRecordCount(state); i++)
+		{
+			/* Mimic existing behaviour */
+			if (!(state->currow % state->config->fetchsize))
+			{
+				fprintf(stdout, "X");
+				fflush(stdout);
+			}
+
+			ret = ShpLoaderGenerateShapeRow(state);
+			if (ret != SHPDUMPEROK)
+			{
+				fprintf(stderr, "%s\n", state->message);
+				fflush(stderr);
+		
+				if (ret == SHPDUMPERERR)
+					exit(1);
+			}
 		}
 	}
 
-	fprintf(stdout, _(" [%d rows].\n"), ShpDumperGetRecordCount(state));
+	fprintf(stdout, _(" [%d rows].\n"), state->currow);
 	fflush(stdout);
 
 	ret = ShpDumperCloseTable(state);
@@ -64,9 +64,6 @@ static int projFileCreate(SHPDUMPERSTATE *state);
  */
 static char * goodDBFValue(char *in, char fieldType);
 
-/** @brief Binary to hexewkb conversion function */
-char *convert_bytes_to_hex(uint8_t *ewkb, size_t size);
-
 
 static SHPObject *
 create_point(SHPDUMPERSTATE *state, LWPOINT *lwpoint)
@@ -683,19 +680,6 @@ goodDBFValue(char *in, char fieldType)
 	}
 }
 
-char *convert_bytes_to_hex(uint8_t *ewkb, size_t size)
-{
-	int i;
-	char *hexewkb;
-
-	/* Convert the byte stream to a hex string using liblwgeom's deparse_hex function */
-	hexewkb = malloc(size * 2 + 1);
-	for (i=0; i<size; ++i) deparse_hex(ewkb[i], &hexewkb[i * 2]);
-	hexewkb[size * 2] = '\0';
-
-	return hexewkb;
-}
-
 /**
  * @brief Creates ESRI .prj file for this shp output
  * 		It looks in the spatial_ref_sys table and outputs the srtext field for this data
@@ -1242,6 +1226,10 @@ ShpDumperCreate(SHPDUMPERCONFIG *config)
 	state->geo_col_name = NULL;
 	state->fetch_query = NULL;
 	state->main_scan_query = NULL;
+	state->main_scan_from = 0;
+	state->gidfound = 0;
+	state->fetchsize = config->fetchsize;
+	state->fetchres = NULL;
 	state->dbffieldnames = NULL;
 	state->dbffieldtypes = NULL;
 	state->pgfieldnames = NULL;
@@ -1897,11 +1885,7 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 	
 	state->main_scan_query = malloc(1024 + j);
 	
-	sprintf(state->main_scan_query, "DECLARE cur ");
-	if (state->config->binary)
-		strcat(state->main_scan_query, "BINARY ");
-
-	strcat(state->main_scan_query, "CURSOR FOR SELECT ");
+	sprintf(state->main_scan_query, "SELECT ");
 
 	for (i = 0; i < state->fieldcount; i++)
 	{
@@ -1928,11 +1912,11 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 		{
 			if (state->pgis_major_version > 0)
 			{
-				sprintf(buf, "ST_asEWKB(ST_SetSRID(\"%s\"::geometry, 0), 'XDR')", state->geo_col_name);
+				sprintf(buf, "ST_asEWKB(ST_SetSRID(\"%s\"::geometry, 0), 'XDR') AS _geoX", state->geo_col_name);
 			}
 			else
 			{
-				sprintf(buf, "asbinary(\"%s\"::geometry, 'XDR')",
+				sprintf(buf, "asbinary(\"%s\"::geometry, 'XDR') AS _geoX",
 					state->geo_col_name);
 			}
 		}
@@ -1954,21 +1938,18 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 
 	if (state->schema)
 	{
-		sprintf(buf, " FROM \"%s\".\"%s\"", state->schema, state->table);
+		sprintf(buf, " FROM \"%s\".\"%s\" AS %s", state->schema, state->table, SHPDUMPER_TABLE_ALIAS);
 	}
 	else
 	{
-		sprintf(buf, " FROM \"%s\"", state->table);
+		sprintf(buf, " FROM \"%s\" AS %s", state->table, SHPDUMPER_TABLE_ALIAS);
 	}
 
+	state->main_scan_from = strlen(state->main_scan_query);
 	strcat(state->main_scan_query, buf);
 
 	/* Order by 'gid' (if found) */
-	if (gidfound)
-	{
-		sprintf(buf, " ORDER BY \"gid\"");
-		strcat(state->main_scan_query, buf);
-	}
+	state->gidfound = gidfound;
 
 	/* Now we've finished with the result set, we can dispose of it */
 	PQclear(res);
@@ -1990,7 +1971,13 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 	PQclear(res);
 
 	/* Execute the main scan query */
-	res = PQexec(state->conn, state->main_scan_query);
+	query = malloc(64 + strlen(state->main_scan_query));
+	sprintf(query, "DECLARE cur %sCURSOR FOR %s%s", state->config->binary ? "BINARY " : "",
+		state->main_scan_query, state->gidfound ? SHPDUMPER_ORDER_BY_GID : "");
+
+	res = PQexec(state->conn, query);
+	free(query);
+
 	if (!res || PQresultStatus(res) != PGRES_COMMAND_OK)
 	{
 		snprintf(state->message, SHPDUMPERMSGLEN, _("Error executing main scan query: %s"), PQresultErrorMessage(res));
@@ -2008,7 +1995,7 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 
 	/* Generate the fetch query */
 	state->fetch_query = malloc(256);
-	sprintf(state->fetch_query, "FETCH %d FROM cur", state->config->fetchsize);
+	sprintf(state->fetch_query, "FETCH %d FROM cur", state->fetchsize);
 
 	return SHPDUMPEROK;
 }
@@ -2017,14 +2004,8 @@ ShpDumperOpenTable(SHPDUMPERSTATE *state)
 /* Append the next row to the output shapefile */
 int ShpLoaderGenerateShapeRow(SHPDUMPERSTATE *state)
 {
-	char *hexewkb = NULL;
-	unsigned char *hexewkb_binary = NULL;
-	size_t hexewkb_len;
-	char *val;
 	SHPObject *obj = NULL;
-	LWGEOM *lwgeom;
-
-	int i, geocolnum = 0;
+	int ret;
 
 	/* If we try to go pass the end of the table, fail immediately */
 	if (state->currow > state->rowcount)
@@ -2051,14 +2032,191 @@ int ShpLoaderGenerateShapeRow(SHPDUMPERSTATE *state)
 
 		state->curresrow = 0;
 		state->currescount = PQntuples(state->fetchres);
+
+		/* Size the next batch on the width of the rows of this one */
+		state->fetchsize = ShpDumperGetFetchSize(state->fetchres, state->fetchsize);
+		sprintf(state->fetch_query, "FETCH %d FROM cur", state->fetchsize);
 	}
 
-	/* Grab the id of the geo column if we have one */
+	/* Convert the geo field, if present */
 	if (state->geo_col_name)
-		geocolnum = PQfnumber(state->fetchres, "_geoX");
+	{
+		ret = ShpDumperGenerateShape(state, state->fetchres, state->curresrow, &obj);
+		if (ret != SHPDUMPEROK)
+		{
+			PQclear(state->fetchres);
+			return ret;
+		}
+	}
+
+	/* Write out the fields and the shape */
+	ret = ShpDumperWriteRow(state, state->fetchres, state->curresrow, obj);
+
+	if (obj)
+		SHPDestroyObject(obj);
+
+	if (ret != SHPDUMPEROK)
+	{
+		PQclear(state->fetchres);
+		return ret;
+	}
+
+	/* Increment ready for next time */
+	state->curresrow++;
 
-	/* Process the next record within the batch. First write out all of 
-	the non-geo fields */
+	return SHPDUMPEROK;
+}
+
+
+/*
+ * Return the number of rows of the next FETCH batch, so that it holds about
+ * SHPDUMPER_FETCH_BYTES given the average width of the rows of res.
+ */
+int
+ShpDumperGetFetchSize(PGresult *res, int fetchsize)
+{
+	double bytes = 0;
+	int nrows = PQntuples(res);
+	int nfields = PQnfields(res);
+	int i, j;
+
+	/* Nothing to go by */
+	if (nrows == 0)
+		return fetchsize;
+
+	for (i = 0; i < nrows; i++)
+		for (j = 0; j < nfields; j++)
+			bytes += PQgetlength(res, i, j);
+
+	/* Count a byte per row so that empty rows don't divide by zero */
+	fetchsize = SHPDUMPER_FETCH_BYTES / (bytes / nrows + 1);
+
+	if (fetchsize < SHPDUMPER_FETCH_MIN)
+		fetchsize = SHPDUMPER_FETCH_MIN;
+	if (fetchsize > SHPDUMPER_FETCH_MAX)
+		fetchsize = SHPDUMPER_FETCH_MAX;
+
+	return fetchsize;
+}
+
+
+/*
+ * Convert the geo* value of a row of a result set of the main scan query
+ * into a shape, which is NULL if the value is NULL. The shape must be
+ * freed with SHPDestroyObject.
+ */
+int
+ShpDumperGenerateShape(SHPDUMPERSTATE *state, PGresult *res, int row, SHPObject **obj)
+{
+	unsigned char *wkb_binary = NULL;
+	size_t wkb_len;
+	char *val;
+	LWGEOM *lwgeom;
+	int geocolnum;
+
+	*obj = NULL;
+
+	/* Grab the id of the geo column */
+	geocolnum = PQfnumber(res, "_geoX");
+
+	/* Handle NULL shapes */
+	if (PQgetisnull(res, row, geocolnum))
+		return SHPDUMPEROK;
+
+	/* Get the value from the result set */
+	val = PQgetvalue(res, row, geocolnum);
+
+	if (!state->config->binary)
+	{
+		if (state->pgis_major_version > 0)
+		{
+			LWDEBUG(4, "PostGIS >= 1.0, non-binary cursor");
+
+			/* Input is bytea encoded text field, so it must be unescaped
+			into the binary EWKB */
+			wkb_binary = PQunescapeBytea((unsigned char *)val, &wkb_len);
+			lwgeom = lwgeom_from_wkb(wkb_binary, wkb_len, LW_PARSER_CHECK_NONE);
+			PQfreemem(wkb_binary);
+		}
+		else
+		{
+			LWDEBUG(4, "PostGIS < 1.0, non-binary cursor");
+
+			/* Input is already hexewkb string */
+			lwgeom = lwgeom_from_hexwkb(val, LW_PARSER_CHECK_NONE);
+		}
+	}
+	else /* binary */
+	{
+		LWDEBUG(4, "PostGIS (any version) using binary cursor");
+
+		/* Input is binary field, which is the EWKB itself */
+		wkb_len = PQgetlength(res, row, geocolnum);
+		lwgeom = lwgeom_from_wkb((uint8_t *)val, wkb_len, LW_PARSER_CHECK_NONE);
+	}
+
+	/* Deserialize the LWGEOM */
+	if (!lwgeom)
+	{
+		snprintf(state->message, SHPDUMPERMSGLEN, _("Error parsing EWKB for record %d"), state->currow);
+		return SHPDUMPERERR;
+	}
+
+	/* Call the relevant method depending upon the geometry type */
+	LWDEBUGF(4, "geomtype: %s\n", lwtype_name(lwgeom->type));
+
+	switch (lwgeom->type)
+	{
+	case POINTTYPE:
+		*obj = create_point(state, lwgeom_as_lwpoint(lwgeom));
+		break;
+
+	case MULTIPOINTTYPE:
+		*obj = create_multipoint(state, lwgeom_as_lwmpoint(lwgeom));
+		break;
+
+	case POLYGONTYPE:
+		*obj = create_polygon(state, lwgeom_as_lwpoly(lwgeom));
+		break;
+
+	case MULTIPOLYGONTYPE:
+		*obj = create_multipolygon(state, lwgeom_as_lwmpoly(lwgeom));
+		break;
+
+	case LINETYPE:
+		*obj = create_linestring(state, lwgeom_as_lwline(lwgeom));
+		break;
+
+	case MULTILINETYPE:
+		*obj = create_multilinestring(state, lwgeom_as_lwmline(lwgeom));
+		break;
+
+	default:
+		snprintf(state->message, SHPDUMPERMSGLEN, _("Unknown WKB type (%d) for record %d"), lwgeom->type, state->currow);
+		lwgeom_free(lwgeom);
+		return SHPDUMPERERR;
+	}
+
+	/* Free the original geometry */
+	lwgeom_free(lwgeom);
+
+	return SHPDUMPEROK;
+}
+
+
+/*
+ * Write the non-geo fields of a row of a result set of the main scan query
+ * to the DBF file and, if there is a geo column, the shape generated from
+ * it to the shapefile, as record state->currow.
+ */
+int
+ShpDumperWriteRow(SHPDUMPERSTATE *state, PGresult *res, int row, SHPObject *obj)
+{
+	SHPObject *nullobj;
+	char *val;
+	int i;
+
+	/* Write out all of the non-geo fields */
 	for (i = 0; i < state->fieldcount; i++)
 	{
 		/*
@@ -2068,13 +2226,13 @@ int ShpLoaderGenerateShapeRow(SHPDUMPERSTATE *state)
 		* nulls unless paying the acquisition
 		* of a bug in long integer values
 		*/
-		if (PQgetisnull(state->fetchres, state->curresrow, i))
+		if (PQgetisnull(res, row, i))
 		{
 			val = nullDBFValue(state->dbffieldtypes[i]);
 		}
 		else
 		{
-			val = PQgetvalue(state->fetchres, state->curresrow, i);
+			val = PQgetvalue(res, row, i);
 			val = goodDBFValue(val, state->dbffieldtypes[i]);
 		}
 
@@ -2082,132 +2240,36 @@ int ShpLoaderGenerateShapeRow(SHPDUMPERSTATE *state)
 		if (!DBFWriteAttributeDirectly(state->dbf, state->currow, i, val))
 		{
 			snprintf(state->message, SHPDUMPERMSGLEN, _("Error: record %d could not be created"), state->currow);
-			PQclear(state->fetchres);
 			return SHPDUMPERERR;
 		}
 	}
 
-	/* Now process the geo field, if present */
+	/* Now write the shape, if there is a geo field */
 	if (state->geo_col_name)
 	{
-		/* Handle NULL shapes */
-		if (PQgetisnull(state->fetchres, state->curresrow, geocolnum))
+		if (obj)
 		{
-			obj = SHPCreateSimpleObject(SHPT_NULL, 0, NULL, NULL, NULL);
 			if (SHPWriteObject(state->shp, -1, obj) == -1)
 			{
-				snprintf(state->message, SHPDUMPERMSGLEN, _("Error writing NULL shape for record %d"), state->currow);
-				PQclear(state->fetchres);
-				SHPDestroyObject(obj);
+				snprintf(state->message, SHPDUMPERMSGLEN, _("Error writing shape %d"), state->currow);
 				return SHPDUMPERERR;
 			}
-			SHPDestroyObject(obj);
 		}
 		else
 		{
-			/* Get the value from the result set */
-			val = PQgetvalue(state->fetchres, state->curresrow, geocolnum);
-
-			if (!state->config->binary)
-			{
-				if (state->pgis_major_version > 0)
-				{
-					LWDEBUG(4, "PostGIS >= 1.0, non-binary cursor");
-
-					/* Input is bytea encoded text field, so it must be unescaped and
-					then converted to hexewkb string */
-					hexewkb_binary = PQunescapeBytea((unsigned char *)val, &hexewkb_len);
-					hexewkb = convert_bytes_to_hex(hexewkb_binary, hexewkb_len);
-				}
-				else
-				{
-					LWDEBUG(4, "PostGIS < 1.0, non-binary cursor");
-
-					/* Input is already hexewkb string, so we can just
-					copy directly to hexewkb */
-					hexewkb_len = PQgetlength(state->fetchres, state->curresrow, geocolnum);
-					hexewkb = malloc(hexewkb_len + 1);
-					strncpy(hexewkb, val, hexewkb_len + 1);
-				}
-			}
-			else /* binary */
-			{
-				LWDEBUG(4, "PostGIS (any version) using binary cursor");
-
-				/* Input is binary field - must convert to hexewkb string */
-				hexewkb_len = PQgetlength(state->fetchres, state->curresrow, geocolnum);
-				hexewkb = convert_bytes_to_hex((unsigned char *)val, hexewkb_len);
-			}
-
-			LWDEBUGF(4, "HexEWKB - length: %d  value: %s", strlen(hexewkb), hexewkb);
-
-			/* Deserialize the LWGEOM */
-			lwgeom = lwgeom_from_hexwkb(hexewkb, LW_PARSER_CHECK_NONE);
-			if (!lwgeom)
-			{
-				snprintf(state->message, SHPDUMPERMSGLEN, _("Error parsing HEXEWKB for record %d"), state->currow);
-				PQclear(state->fetchres);
-				return SHPDUMPERERR;
-			}
-	
-			/* Call the relevant method depending upon the geometry type */
-			LWDEBUGF(4, "geomtype: %s\n", lwtype_name(lwgeom->type));
-	
-			switch (lwgeom->type)
+			/* Handle NULL shapes */
+			nullobj = SHPCreateSimpleObject(SHPT_NULL, 0, NULL, NULL, NULL);
+			if (SHPWriteObject(state->shp, -1, nullobj) == -1)
 			{
-			case POINTTYPE:
-				obj = create_point(state, lwgeom_as_lwpoint(lwgeom));
-				break;
-	
-			case MULTIPOINTTYPE:
-				obj = create_multipoint(state, lwgeom_as_lwmpoint(lwgeom));
-				break;
-	
-			case POLYGONTYPE:
-				obj = create_polygon(state, lwgeom_as_lwpoly(lwgeom));
-				break;
-	
-			case MULTIPOLYGONTYPE:
-				obj = create_multipolygon(state, lwgeom_as_lwmpoly(lwgeom));
-				break;
-	
-			case LINETYPE:
-				obj = create_linestring(state, lwgeom_as_lwline(lwgeom));
-				break;
-	
-			case MULTILINETYPE:
-				obj = create_multilinestring(state, lwgeom_as_lwmline(lwgeom));
-				break;
-	
-			default:
-				snprintf(state->message, SHPDUMPERMSGLEN, _("Unknown WKB type (%d) for record %d"), lwgeom->type, state->currow);
-				PQclear(state->fetchres);
-				SHPDestroyObject(obj);
-				return SHPDUMPERERR;
-			}
-	
-			/* Free both the original and geometries */
-			lwgeom_free(lwgeom);
-
-			/* Write the shape out to the file */
-			if (SHPWriteObject(state->shp, -1, obj) == -1)
-			{
-				snprintf(state->message, SHPDUMPERMSGLEN, _("Error writing shape %d"), state->currow);
-				PQclear(state->fetchres);
-				SHPDestroyObject(obj);
+				snprintf(state->message, SHPDUMPERMSGLEN, _("Error writing NULL shape for record %d"), state->currow);
+				SHPDestroyObject(nullobj);
 				return SHPDUMPERERR;
 			}
-
-			SHPDestroyObject(obj);
-
-			/* Free the hexewkb (and temporary bytea unescaped string if used) */
-			if (hexewkb) free(hexewkb);
-			if (hexewkb_binary) PQfreemem(hexewkb_binary);
+			SHPDestroyObject(nullobj);
 		}
 	}
 
 	/* Increment ready for next time */
-	state->curresrow++;
 	state->currow++;
 
 	return SHPDUMPEROK;
@@ -43,6 +43,25 @@
 #define SHPDUMPERWARN		1
 
 
+/*
+ * Cursor batches aim for SHPDUMPER_FETCH_BYTES of row data, the number of
+ * rows of each FETCH adapting to the width of the rows of the previous one
+ */
+
+#define SHPDUMPER_FETCH_BYTES	(4 * 1024 * 1024)
+#define SHPDUMPER_FETCH_MIN	10
+#define SHPDUMPER_FETCH_MAX	100000
+
+
+/*
+ * The scan orders on the gid column of the table through its alias, as
+ * in binary mode the output column of the same name is its text form
+ */
+
+#define SHPDUMPER_TABLE_ALIAS	"_dumptbl"
+#define SHPDUMPER_ORDER_BY_GID	" ORDER BY " SHPDUMPER_TABLE_ALIAS ".\"gid\""
+
+
 /*
  * Structure to hold the dumper configuration options 
  */
@@ -82,7 +101,7 @@ typedef struct shp_dumper_config
 	/* 0=do not keep fieldname case, 1=keep fieldname case */
 	int keep_fieldname_case;
 
-	/* Number of rows to fetch in a cursor batch */
+	/* Number of rows to fetch in the first cursor batch */
 	int fetchsize;
 
 	/* Name of the column map file if specified */
@@ -163,9 +182,15 @@ typedef struct shp_dumper_state
 	/* Number of rows in source database table */
 	int rowcount;
 
-	/* The main query being used for the table scan */
+	/* The main query being used for the table scan, without its ordering */
 	char *main_scan_query;
 
+	/* Offset of the FROM clause at the end of main_scan_query */
+	int main_scan_from;
+
+	/* 1 if the table has a gid column, which orders the scan */
+	int gidfound;
+
 	/* The current row number */
 	int currow;
 
@@ -181,6 +206,9 @@ typedef struct shp_dumper_state
 	/* The query being used to fetch records from the table */
 	char *fetch_query;
 
+	/* The number of rows of the next FETCH batch */
+	int fetchsize;
+
 	/* Last (error) message */
 	char message[SHPDUMPERMSGLEN];
 
@@ -206,5 +234,8 @@ int ShpDumperConnectDatabase(SHPDUMPERSTATE *state);
 int ShpDumperOpenTable(SHPDUMPERSTATE *state);
 int ShpDumperGetRecordCount(SHPDUMPERSTATE *state);
 int ShpLoaderGenerateShapeRow(SHPDUMPERSTATE *state);
+int ShpDumperGetFetchSize(PGresult *res, int fetchsize);
+int ShpDumperGenerateShape(SHPDUMPERSTATE *state, PGresult *res, int row, SHPObject **obj);
+int ShpDumperWriteRow(SHPDUMPERSTATE *state, PGresult *res, int row, SHPObject *obj);
 int ShpDumperCloseTable(SHPDUMPERSTATE *state);
 void ShpDumperDestroy(SHPDUMPERSTATE *state);
@@ -0,0 +1,756 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/*
+ * Parallel dumping for pgsql2shp.
+ *
+ * The table is cut into ranges of about DUMPER_CHUNK_ROWS rows: ranges of
+ * gid when the table has one, which also keeps the dump in gid order, or
+ * ranges of heap pages of plain tables without children otherwise. Views
+ * and inheritance parents without a gid are dumped over the main
+ * connection alone, as their rows are not all in their own pages.
+ *
+ * A pool of workers hands the ranges out to each other, each one fetching
+ * its range through a binary cursor over its own connection and converting
+ * the geometries into shapes, while the main thread writes the ranges to
+ * the SHP/SHX/DBF files in order.
+ *
+ * The workers share the snapshot of the main connection on servers that
+ * can export it (9.2 and above), so the dump is consistent even when the
+ * table is being written to.
+ */
+
+#include "../postgis_config.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pgsql2shp-core.h"
+#include "pgsql2shp-dump.h"
+
+
+/* A range of the table */
+typedef struct
+{
+	/* Condition selecting the rows of the range */
+	char *where;
+	/* FETCH batches of the range */
+	PGresult **results;
+	int nresults;
+	/* Shapes converted from all the rows of the batches, NULL for NULL geometries */
+	SHPObject **shapes;
+	int nrows;
+	/* Set once the range has been fetched and converted */
+	int done;
+}
+DUMPCHUNK;
+
+/* State shared between the workers and the writer of a dump */
+typedef struct
+{
+	/* Query the ranges select their rows from */
+	char *scan;
+	DUMPCHUNK *chunks;
+	int nchunks;
+	/* Next range to hand out */
+	int next;
+	/* Number of ranges written so far */
+	int written;
+	/* Number of ranges that may be handed out past the one being written */
+	int ahead;
+	/* Set when a worker or the writer fails, so the others stop */
+	int failed;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+}
+DUMPSHARED;
+
+/* One worker of a dump */
+typedef struct
+{
+	/* Copy of the dumper state, with its own connection */
+	SHPDUMPERSTATE state;
+	DUMPSHARED *shared;
+	/* SHPDUMPEROK, or SHPDUMPERERR with the reason in state.message */
+	int ret;
+}
+DUMPWORKER;
+
+
+/* Run a statement, returning its result or NULL with the message set on failure */
+static PGresult *
+dump_exec(SHPDUMPERSTATE *state, PGconn *conn, const char *sql)
+{
+	PGresult *res;
+
+	res = PQexec(conn, sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK && PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		snprintf(state->message, SHPDUMPERMSGLEN, _("Failed to run SQL: %s"), PQerrorMessage(conn));
+		PQclear(res);
+		return NULL;
+	}
+
+	return res;
+}
+
+
+/* Add a range selected by a condition to the list of ranges */
+static void
+dump_add_chunk(DUMPSHARED *shared, int *maxchunks, const char *where)
+{
+	DUMPCHUNK *chunk;
+
+	if (shared->nchunks == *maxchunks)
+	{
+		*maxchunks *= 2;
+		shared->chunks = realloc(shared->chunks, sizeof(DUMPCHUNK) * *maxchunks);
+	}
+
+	chunk = &shared->chunks[shared->nchunks++];
+	memset(chunk, 0, sizeof(DUMPCHUNK));
+	chunk->where = strdup(where);
+}
+
+
+/*
+ * Cut a table with a gid column into ranges of DUMPER_CHUNK_ROWS gids, taking
+ * every DUMPER_CHUNK_ROWS-th gid as a bound so that skewed keys still make
+ * even ranges. The gids are compared as literals, so any ordered type works.
+ */
+static int
+dump_gid_chunks(SHPDUMPERSTATE *state, DUMPSHARED *shared, int *maxchunks, const char *from)
+{
+	PGresult *res;
+	char *query, *where, *bound, *prev = NULL;
+	int i, error;
+
+	query = malloc(256 + strlen(from));
+	sprintf(query, "SELECT \"gid\" FROM (SELECT \"gid\", row_number() OVER (ORDER BY \"gid\") AS n "
+	        "FROM %s WHERE \"gid\" IS NOT NULL) AS g WHERE n %% %d = 0 ORDER BY n", from, DUMPER_CHUNK_ROWS);
+
+	res = dump_exec(state, state->conn, query);
+	free(query);
+	if (!res)
+		return SHPDUMPERERR;
+
+	where = malloc(64);
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		bound = malloc(2 * PQgetlength(res, i, 0) + 1);
+		PQescapeStringConn(state->conn, bound, PQgetvalue(res, i, 0), PQgetlength(res, i, 0), &error);
+
+		where = realloc(where, 64 + strlen(bound) + (prev ? strlen(prev) : 0));
+		if (prev)
+			sprintf(where, "\"gid\" > '%s' AND \"gid\" <= '%s'", prev, bound);
+		else
+			sprintf(where, "\"gid\" <= '%s'", bound);
+
+		dump_add_chunk(shared, maxchunks, where);
+
+		free(prev);
+		prev = bound;
+	}
+
+	/* The rows past the last bound, and then those without a gid, which sort last */
+	where = realloc(where, 64 + (prev ? strlen(prev) : 0));
+	if (prev)
+		sprintf(where, "\"gid\" > '%s'", prev);
+	else
+		sprintf(where, "\"gid\" IS NOT NULL");
+
+	dump_add_chunk(shared, maxchunks, where);
+	dump_add_chunk(shared, maxchunks, "\"gid\" IS NULL");
+
+	free(prev);
+	free(where);
+	PQclear(res);
+
+	return SHPDUMPEROK;
+}
+
+
+/*
+ * Whether the relation is a plain table without children, whose rows are
+ * all in its own heap pages, setting *plain.
+ */
+static int
+dump_is_plain_table(SHPDUMPERSTATE *state, const char *from, int *plain)
+{
+	PGresult *res;
+	char *query, *esc_from;
+	int error;
+
+	esc_from = malloc(2 * strlen(from) + 1);
+	PQescapeStringConn(state->conn, esc_from, from, strlen(from), &error);
+
+	query = malloc(256 + strlen(esc_from));
+	sprintf(query, "SELECT relkind = 'r' AND NOT EXISTS (SELECT 1 FROM pg_inherits WHERE inhparent = c.oid) "
+	        "FROM pg_class c WHERE c.oid = '%s'::regclass", esc_from);
+	free(esc_from);
+
+	res = dump_exec(state, state->conn, query);
+	free(query);
+	if (!res)
+		return SHPDUMPERERR;
+
+	*plain = (PQntuples(res) == 1 && !strcmp(PQgetvalue(res, 0, 0), "t"));
+	PQclear(res);
+
+	return SHPDUMPEROK;
+}
+
+
+/*
+ * Cut a plain table without a gid column into ranges of heap pages holding
+ * about DUMPER_CHUNK_ROWS rows. The rows of a range are selected by listing every
+ * tuple identifier its pages can hold, which the server answers with a TID
+ * scan rather than with a sequential scan of the whole table.
+ */
+static int
+dump_page_chunks(SHPDUMPERSTATE *state, DUMPSHARED *shared, int *maxchunks, const char *from)
+{
+	PGresult *res;
+	char *query, *esc_from;
+	char where[256];
+	int npages, maxtuples, chunkpages, first, error;
+
+	esc_from = malloc(2 * strlen(from) + 1);
+	PQescapeStringConn(state->conn, esc_from, from, strlen(from), &error);
+
+	query = malloc(256 + strlen(esc_from));
+	sprintf(query, "SELECT pg_relation_size('%s'::regclass) / current_setting('block_size')::int, "
+	        "(current_setting('block_size')::int - 24) / 28", esc_from);
+	free(esc_from);
+
+	res = dump_exec(state, state->conn, query);
+	free(query);
+	if (!res)
+		return SHPDUMPERERR;
+
+	/* Pages of the table, and the most tuples a page can hold */
+	npages = atoi(PQgetvalue(res, 0, 0));
+	maxtuples = atoi(PQgetvalue(res, 0, 1));
+	PQclear(res);
+
+	chunkpages = 1;
+	if (state->rowcount > 0)
+		chunkpages = (int)((double)npages * DUMPER_CHUNK_ROWS / state->rowcount);
+	if (chunkpages < 1)
+		chunkpages = 1;
+
+	for (first = 0; first < npages; first += chunkpages)
+	{
+		snprintf(where, sizeof(where), "ctid = ANY (ARRAY(SELECT ('(' || p || ',' || t || ')')::tid "
+		         "FROM generate_series(%d, %d) AS p, generate_series(1, %d) AS t))",
+		         first, (first + chunkpages < npages ? first + chunkpages : npages) - 1, maxtuples);
+
+		dump_add_chunk(shared, maxchunks, where);
+	}
+
+	return SHPDUMPEROK;
+}
+
+
+/*
+ * Hand out the next range, returning 0 when there are none left. With
+ * threads, waits while the writer is too far behind.
+ */
+static int
+dump_next_chunk(DUMPSHARED *shared, int *chunk)
+{
+	int ret = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&shared->lock);
+
+	while (!shared->failed && shared->next < shared->nchunks && shared->next >= shared->written + shared->ahead)
+		pthread_cond_wait(&shared->cond, &shared->lock);
+#endif
+
+	if (!shared->failed && shared->next < shared->nchunks)
+	{
+		*chunk = shared->next++;
+		ret = 1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&shared->lock);
+#endif
+
+	return ret;
+}
+
+
+/* Mark a range as fetched, or the dump as failed, and wake up the others */
+static void
+dump_signal(DUMPSHARED *shared, DUMPCHUNK *chunk, int failed)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&shared->lock);
+#endif
+
+	if (chunk)
+		chunk->done = 1;
+	if (failed)
+		shared->failed = 1;
+
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&shared->cond);
+	pthread_mutex_unlock(&shared->lock);
+#endif
+}
+
+
+/* Fetch the rows of a range through a binary cursor and convert their geometries */
+static int
+dump_fetch_chunk(DUMPWORKER *worker, DUMPCHUNK *chunk)
+{
+	SHPDUMPERSTATE *state = &worker->state;
+	PGresult *res;
+	char *query;
+	char fetch[64];
+	int i, nrows;
+
+	query = malloc(64 + strlen(worker->shared->scan) + strlen(chunk->where));
+	sprintf(query, "DECLARE dumpcur BINARY CURSOR FOR %s WHERE %s%s", worker->shared->scan,
+	        chunk->where, state->gidfound ? SHPDUMPER_ORDER_BY_GID : "");
+
+	res = dump_exec(state, state->conn, query);
+	free(query);
+	if (!res)
+		return SHPDUMPERERR;
+	PQclear(res);
+
+	while (1)
+	{
+		sprintf(fetch, "FETCH %d FROM dumpcur", state->fetchsize);
+
+		res = dump_exec(state, state->conn, fetch);
+		if (!res)
+			return SHPDUMPERERR;
+
+		nrows = PQntuples(res);
+		if (nrows == 0)
+		{
+			PQclear(res);
+			break;
+		}
+
+		chunk->results = realloc(chunk->results, sizeof(PGresult *) * (chunk->nresults + 1));
+		chunk->results[chunk->nresults++] = res;
+
+		chunk->shapes = realloc(chunk->shapes, sizeof(SHPObject *) * (chunk->nrows + nrows));
+		for (i = 0; i < nrows; i++)
+		{
+			chunk->shapes[chunk->nrows] = NULL;
+
+			if (state->geo_col_name)
+			{
+				/* Rows are numbered within the range in messages */
+				state->currow = chunk->nrows;
+				if (ShpDumperGenerateShape(state, res, i, &chunk->shapes[chunk->nrows]) != SHPDUMPEROK)
+					return SHPDUMPERERR;
+			}
+
+			chunk->nrows++;
+		}
+
+		/* Size the next batch on the width of the rows of this one */
+		state->fetchsize = ShpDumperGetFetchSize(res, state->fetchsize);
+	}
+
+	res = dump_exec(state, state->conn, "CLOSE dumpcur");
+	if (!res)
+		return SHPDUMPERERR;
+	PQclear(res);
+
+	return SHPDUMPEROK;
+}
+
+
+/* Free the fetched rows and shapes of a range */
+static void
+dump_free_chunk(DUMPCHUNK *chunk)
+{
+	int i;
+
+	for (i = 0; i < chunk->nrows; i++)
+	{
+		if (chunk->shapes[i])
+			SHPDestroyObject(chunk->shapes[i]);
+	}
+
+	for (i = 0; i < chunk->nresults; i++)
+		PQclear(chunk->results[i]);
+
+	free(chunk->results);
+	free(chunk->shapes);
+	chunk->results = NULL;
+	chunk->shapes = NULL;
+	chunk->nresults = chunk->nrows = 0;
+}
+
+
+/* Write the rows of a fetched range to the output files, then free them */
+static int
+dump_write_chunk(SHPDUMPERSTATE *state, DUMPCHUNK *chunk)
+{
+	int i, j, row = 0;
+	int ret = SHPDUMPEROK;
+
+	for (i = 0; ret == SHPDUMPEROK && i < chunk->nresults; i++)
+	{
+		for (j = 0; ret == SHPDUMPEROK && j < PQntuples(chunk->results[i]); j++, row++)
+			ret = ShpDumperWriteRow(state, chunk->results[i], j, chunk->shapes[row]);
+	}
+
+	dump_free_chunk(chunk);
+
+	return ret;
+}
+
+
+/* Body of a worker: fetch and convert ranges until there are none left or the dump fails */
+static void *
+dump_worker(void *arg)
+{
+	DUMPWORKER *worker = (DUMPWORKER *)arg;
+	DUMPSHARED *shared = worker->shared;
+	int chunk;
+
+	while (dump_next_chunk(shared, &chunk))
+	{
+		if (dump_fetch_chunk(worker, &shared->chunks[chunk]) != SHPDUMPEROK)
+		{
+			char buf[SHPDUMPERMSGLEN];
+
+			snprintf(buf, SHPDUMPERMSGLEN, _("Error dumping range %d of %d: %s"), chunk + 1, shared->nchunks, worker->state.message);
+			strcpy(worker->state.message, buf);
+
+			worker->ret = SHPDUMPERERR;
+			dump_signal(shared, NULL, 1);
+			break;
+		}
+
+		dump_signal(shared, &shared->chunks[chunk], 0);
+	}
+
+	return NULL;
+}
+
+
+/* Fetch and write the ranges one after the other, with the first worker */
+static int
+dump_serial(SHPDUMPERSTATE *state, DUMPWORKER *worker)
+{
+	DUMPSHARED *shared = worker->shared;
+	int i;
+
+	for (i = 0; i < shared->nchunks; i++)
+	{
+		if (dump_fetch_chunk(worker, &shared->chunks[i]) != SHPDUMPEROK)
+		{
+			strcpy(state->message, worker->state.message);
+			return SHPDUMPERERR;
+		}
+
+		if (dump_write_chunk(state, &shared->chunks[i]) != SHPDUMPEROK)
+			return SHPDUMPERERR;
+	}
+
+	return SHPDUMPEROK;
+}
+
+
+/* Fetch and write all the rows through the cursor of the main connection */
+static int
+dump_main_cursor(SHPDUMPERSTATE *state)
+{
+	while (state->currow < state->rowcount)
+	{
+		if (ShpLoaderGenerateShapeRow(state) == SHPDUMPERERR)
+			return SHPDUMPERERR;
+	}
+
+	return SHPDUMPEROK;
+}
+
+
+/* Open a worker connection, with the session settings and snapshot of the main one */
+static PGconn *
+dump_connect(SHPDUMPERSTATE *state, const char *snapshot)
+{
+	PGconn *conn;
+	PGresult *res;
+	char *connstring, *query;
+
+	connstring = ShpDumperGetConnectionStringFromConn(state->config->conn);
+	conn = PQconnectdb(connstring);
+	free(connstring);
+
+	if (PQstatus(conn) == CONNECTION_BAD)
+	{
+		snprintf(state->message, SHPDUMPERMSGLEN, "%s", PQerrorMessage(conn));
+		PQfinish(conn);
+		return NULL;
+	}
+
+	/* Set datestyle to ISO */
+	res = dump_exec(state, conn, "SET DATESTYLE='ISO'");
+	if (!res)
+	{
+		PQfinish(conn);
+		return NULL;
+	}
+	PQclear(res);
+
+	/* A cursor can only be defined inside a transaction block */
+	res = dump_exec(state, conn, "BEGIN ISOLATION LEVEL REPEATABLE READ");
+	if (!res)
+	{
+		PQfinish(conn);
+		return NULL;
+	}
+	PQclear(res);
+
+	/* See the rows as the main connection sees them */
+	if (snapshot)
+	{
+		query = malloc(64 + strlen(snapshot));
+		sprintf(query, "SET TRANSACTION SNAPSHOT '%s'", snapshot);
+
+		res = dump_exec(state, conn, query);
+		free(query);
+
+		if (!res)
+		{
+			PQfinish(conn);
+			return NULL;
+		}
+		PQclear(res);
+	}
+
+	return conn;
+}
+
+
+int
+ShpDumperDumpTable(SHPDUMPERSTATE *state, int jobs)
+{
+	DUMPSHARED shared;
+	DUMPWORKER *workers;
+	PGresult *res;
+	char *from, *snapshot = NULL;
+	int ret = SHPDUMPEROK;
+	int i, maxchunks, plain, nworkers = 0;
+#ifdef HAVE_PTHREAD
+	pthread_t *threads;
+	int nthreads;
+#endif
+
+	/*
+	 * A user query is dumped from a temporary table, which the other
+	 * connections cannot see, so it goes through the main cursor instead.
+	 */
+	if (state->config->usrquery || !state->config->binary)
+		return dump_main_cursor(state);
+
+	from = malloc(8 + 2 * strlen(state->table) + (state->schema ? 2 * strlen(state->schema) : 0));
+	if (state->schema)
+		sprintf(from, "\"%s\".\"%s\"", state->schema, state->table);
+	else
+		sprintf(from, "\"%s\"", state->table);
+
+	/* Without a gid, only the pages of a plain table can be cut into ranges */
+	if (!state->gidfound)
+	{
+		if (dump_is_plain_table(state, from, &plain) != SHPDUMPEROK)
+		{
+			free(from);
+			return SHPDUMPERERR;
+		}
+
+		if (!plain)
+		{
+			free(from);
+			return dump_main_cursor(state);
+		}
+	}
+
+#ifndef HAVE_PTHREAD
+	jobs = 1;
+#endif
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > DUMPER_MAX_JOBS)
+		jobs = DUMPER_MAX_JOBS;
+
+	/* Export the snapshot of the main connection, for the others to share */
+	if (jobs > 1 && PQserverVersion(state->conn) >= 90200)
+	{
+		res = dump_exec(state, state->conn, "SELECT pg_export_snapshot()");
+		if (!res)
+		{
+			free(from);
+			return SHPDUMPERERR;
+		}
+
+		snapshot = strdup(PQgetvalue(res, 0, 0));
+		PQclear(res);
+	}
+
+	/* Cut the table into ranges */
+	maxchunks = 16;
+	shared.chunks = malloc(sizeof(DUMPCHUNK) * maxchunks);
+	shared.nchunks = 0;
+
+	if (state->gidfound)
+	{
+		shared.scan = strdup(state->main_scan_query);
+		ret = dump_gid_chunks(state, &shared, &maxchunks, from);
+	}
+	else
+	{
+		/* The tuple identifiers of the pages are only those of the table itself */
+		shared.scan = malloc(32 + strlen(state->main_scan_query) + strlen(from));
+		sprintf(shared.scan, "%.*s FROM ONLY %s AS %s", state->main_scan_from, state->main_scan_query,
+		        from, SHPDUMPER_TABLE_ALIAS);
+		ret = dump_page_chunks(state, &shared, &maxchunks, from);
+	}
+
+	free(from);
+
+	shared.next = 0;
+	shared.written = 0;
+	shared.ahead = DUMPER_CHUNKS_AHEAD * jobs;
+	shared.failed = 0;
+
+	workers = calloc(jobs, sizeof(DUMPWORKER));
+
+	/*
+	 * Set up the workers before starting any of them, so a connection
+	 * failure stops the dump before a row is written. A single worker
+	 * shares the main connection, and its transaction.
+	 */
+	for (nworkers = 0; ret == SHPDUMPEROK && nworkers < jobs; nworkers++)
+	{
+		DUMPWORKER *worker = &workers[nworkers];
+
+		worker->state = *state;
+		worker->shared = &shared;
+		worker->ret = SHPDUMPEROK;
+
+		if (jobs > 1)
+		{
+			worker->state.conn = dump_connect(state, snapshot);
+			if (!worker->state.conn)
+				ret = SHPDUMPERERR;
+		}
+	}
+
+	if (ret == SHPDUMPEROK)
+	{
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init(&shared.lock, NULL);
+		pthread_cond_init(&shared.cond, NULL);
+
+		threads = malloc(sizeof(pthread_t) * jobs);
+		for (nthreads = 0; nthreads < jobs; nthreads++)
+		{
+			if (pthread_create(&threads[nthreads], NULL, dump_worker, &workers[nthreads]) != 0)
+			{
+				/* Finish with the threads we have */
+				break;
+			}
+		}
+
+		if (nthreads == 0)
+		{
+			/* Not even one thread: do the work here */
+			ret = dump_serial(state, &workers[0]);
+		}
+		else
+		{
+			/* Write the ranges in order as the workers complete them */
+			for (i = 0; i < shared.nchunks; i++)
+			{
+				DUMPCHUNK *chunk = &shared.chunks[i];
+
+				pthread_mutex_lock(&shared.lock);
+				while (!shared.failed && !chunk->done)
+					pthread_cond_wait(&shared.cond, &shared.lock);
+				pthread_mutex_unlock(&shared.lock);
+
+				if (!chunk->done)
+					break;
+
+				if (dump_write_chunk(state, chunk) != SHPDUMPEROK)
+				{
+					dump_signal(&shared, NULL, 1);
+					ret = SHPDUMPERERR;
+					break;
+				}
+
+				pthread_mutex_lock(&shared.lock);
+				shared.written++;
+				pthread_cond_broadcast(&shared.cond);
+				pthread_mutex_unlock(&shared.lock);
+			}
+
+			while (nthreads-- > 0)
+				pthread_join(threads[nthreads], NULL);
+
+			/* Report the first failure of a worker */
+			for (i = 0; ret == SHPDUMPEROK && i < jobs; i++)
+			{
+				if (workers[i].ret != SHPDUMPEROK)
+				{
+					strcpy(state->message, workers[i].state.message);
+					ret = SHPDUMPERERR;
+				}
+			}
+		}
+		free(threads);
+
+		pthread_cond_destroy(&shared.cond);
+		pthread_mutex_destroy(&shared.lock);
+#else
+		ret = dump_serial(state, &workers[0]);
+#endif
+	}
+
+	/* Close the worker connections */
+	if (jobs > 1)
+	{
+		for (i = 0; i < nworkers; i++)
+		{
+			if (workers[i].state.conn)
+				PQfinish(workers[i].state.conn);
+		}
+	}
+	free(workers);
+
+	/* Free the ranges, including any left unwritten after a failure */
+	for (i = 0; i < shared.nchunks; i++)
+	{
+		dump_free_chunk(&shared.chunks[i]);
+		free(shared.chunks[i].where);
+	}
+	free(shared.chunks);
+	free(shared.scan);
+	free(snapshot);
+
+	return ret;
+}
@@ -0,0 +1,28 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/* Requires pgsql2shp-core.h */
+
+/* Number of rows in each range of the table a worker fetches and converts in one go */
+#define DUMPER_CHUNK_ROWS 10000
+
+/* Number of ranges per job that may be fetched ahead of the one being written */
+#define DUMPER_CHUNKS_AHEAD 2
+
+/* Upper limit on the number of parallel connections */
+#define DUMPER_MAX_JOBS 64
+
+/*
+ * Dump all the rows of a table opened with ShpDumperOpenTable, fetching
+ * ranges of it over jobs parallel connections with binary cursors, so the
+ * state must have been opened with config->binary set. Returns
+ * SHPDUMPEROK, or SHPDUMPERERR with the reason in state->message.
+ */
+int ShpDumperDumpTable(SHPDUMPERSTATE *state, int jobs);
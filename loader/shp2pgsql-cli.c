@@ -16,6 +16,7 @@
 #include "../postgis_config.h"
 
 #include "shp2pgsql-core.h"
+#include "shp2pgsql-load.h"
 #include "../liblwgeom/liblwgeom.h" /* for SRID_UNKNOWN */
 
 static void
@@ -58,6 +59,14 @@ usage()
 	printf(_( "  -X <tablespace> Specify the tablespace for the table's indexes.\n"
                   "      This applies to the primary key, and the spatial index if\n"
                   "      the -I flag is used.\n" ));
+	printf(_( "  -L <conninfo> Load straight into the database described by the libpq\n"
+	          "      connection string (e.g. \"dbname=gis host=localhost\") using COPY,\n"
+	          "      instead of printing SQL.\n" ));
+	printf(_( "  -j <jobs> Number of parallel connections and worker threads to\n"
+	          "      load with, for use with -L.\n" ));
+	printf(_( "  -B  Use binary COPY, sending geometries as raw WKB, for use with -L.\n"
+	          "      In append mode the table columns must have the types shp2pgsql\n"
+	          "      would create.\n" ));
 	printf(_( "  -?  Display this help screen.\n" ));
 }
 
@@ -68,6 +77,8 @@ main (int argc, char **argv)
 	SHPLOADERCONFIG *config;
 	SHPLOADERSTATE *state;
 	char *header, *footer, *record;
+	char *conninfo = NULL;
+	int jobs = 1;
 	int c;
 	int ret, i;
 
@@ -89,7 +100,7 @@ main (int argc, char **argv)
 	set_loader_config_defaults(config);
 
 	/* Keep the flag list alphabetic so it's easy to see what's left. */
-	while ((c = pgis_getopt(argc, argv, "acdeg:iknps:t:wDGIN:ST:W:X:")) != EOF)
+	while ((c = pgis_getopt(argc, argv, "acdeg:ij:knps:t:wBDGIL:N:ST:W:X:")) != EOF)
 	{
 		switch (c)
 		{
@@ -100,6 +111,10 @@ main (int argc, char **argv)
 			config->opt = c;
 			break;
 
+		case 'B':
+			config->binary = 1;
+			break;
+
 		case 'D':
 			config->dump_format = 1;
 			break;
@@ -217,6 +232,19 @@ main (int argc, char **argv)
 			config->usetransaction = 0;
 			break;
 
+		case 'L':
+			conninfo = pgis_optarg;
+			break;
+
+		case 'j':
+			jobs = atoi(pgis_optarg);
+			if (jobs < 1 || jobs > LOADER_MAX_JOBS)
+			{
+				fprintf(stderr, "The number of jobs must be between 1 and %d\n", LOADER_MAX_JOBS);
+				exit(1);
+			}
+			break;
+
 		case '?':
 			usage();
 			exit(0);
@@ -240,6 +268,38 @@ main (int argc, char **argv)
 		exit(1);
 	}
 
+	if (conninfo && config->shp_sr_id != SRID_UNKNOWN)
+	{
+		fprintf(stderr, "Invalid argument combination - cannot use -L with -s FROM_SRID:TO_SRID\n");
+		exit(1);
+	}
+
+	if (config->binary && !conninfo)
+	{
+		fprintf(stderr, "Invalid argument combination - -B requires -L\n");
+		exit(1);
+	}
+
+	if (config->binary && config->use_wkt)
+	{
+		fprintf(stderr, "Invalid argument combination - cannot use both -B and -w\n");
+		exit(1);
+	}
+
+	if (jobs > 1 && !conninfo)
+	{
+		fprintf(stderr, "Invalid argument combination - -j requires -L\n");
+		exit(1);
+	}
+
+#ifndef HAVE_PTHREAD
+	if (jobs > 1)
+	{
+		fprintf(stderr, "Parallel loading is not supported on this platform, loading with one connection\n");
+		jobs = 1;
+	}
+#endif
+
 	/* Determine the shapefile name from the next argument, if no shape file, exit. */
 	if (pgis_optind < argc)
 	{
@@ -331,93 +391,106 @@ main (int argc, char **argv)
 		fprintf(stderr, "Postgis type: %s[%d]\n", state->pgtype, state->pgdims);
 	}
 
-	/* Print the header to stdout */
-	ret = ShpLoaderGetSQLHeader(state, &header);
-	if (ret != SHPLOADEROK)
+	/* Either load straight into the database... */
+	if (conninfo)
 	{
-		fprintf(stderr, "%s\n", state->message);
-
-		if (ret == SHPLOADERERR)
+		ret = ShpLoaderLoadDatabase(state, conninfo, jobs);
+		if (ret != SHPLOADEROK)
+		{
+			fprintf(stderr, "%s\n", state->message);
 			exit(1);
+		}
 	}
-
-	printf("%s", header);
-	free(header);
-
-	/* If we are not in "prepare" mode, go ahead and write out the data. */
-	if ( state->config->opt != 'p' )
+	else
 	{
-
-		/* If in COPY mode, output the COPY statement */
-		if (state->config->dump_format)
+		/* ...or print the SQL for psql to run, starting with the header */
+		ret = ShpLoaderGetSQLHeader(state, &header);
+		if (ret != SHPLOADEROK)
 		{
-			ret = ShpLoaderGetSQLCopyStatement(state, &header);
-			if (ret != SHPLOADEROK)
-			{
-				fprintf(stderr, "%s\n", state->message);
+			fprintf(stderr, "%s\n", state->message);
 
-				if (ret == SHPLOADERERR)
-					exit(1);
-			}
-
-			printf("%s", header);
-			free(header);
+			if (ret == SHPLOADERERR)
+				exit(1);
 		}
 
-		/* Main loop: iterate through all of the records and send them to stdout */
-		for (i = 0; i < ShpLoaderGetRecordCount(state); i++)
+		printf("%s", header);
+		free(header);
+
+		/* If we are not in "prepare" mode, go ahead and write out the data. */
+		if ( state->config->opt != 'p' )
 		{
-			ret = ShpLoaderGenerateSQLRowStatement(state, i, &record);
 
-			switch (ret)
+			/* If in COPY mode, output the COPY statement */
+			if (state->config->dump_format)
 			{
-			case SHPLOADEROK:
-				/* Simply display the geometry */
-				printf("%s\n", record);
-				free(record);
-				break;
+				ret = ShpLoaderGetSQLCopyStatement(state, &header);
+				if (ret != SHPLOADEROK)
+				{
+					fprintf(stderr, "%s\n", state->message);
 
-			case SHPLOADERERR:
-				/* Display the error message then stop */
-				fprintf(stderr, "%s\n", state->message);
-				exit(1);
-				break;
+					if (ret == SHPLOADERERR)
+						exit(1);
+				}
 
-			case SHPLOADERWARN:
-				/* Display the warning, but continue */
-				fprintf(stderr, "%s\n", state->message);
-				printf("%s\n", record);
-				free(record);
-				break;
+				printf("%s", header);
+				free(header);
+			}
 
-			case SHPLOADERRECDELETED:
-				/* Record is marked as deleted - ignore */
-				break;
+			/* Main loop: iterate through all of the records and send them to stdout */
+			for (i = 0; i < ShpLoaderGetRecordCount(state); i++)
+			{
+				ret = ShpLoaderGenerateSQLRowStatement(state, i, &record);
 
-			case SHPLOADERRECISNULL:
-				/* Record is NULL and should be ignored according to NULL policy */
-				break;
+				switch (ret)
+				{
+				case SHPLOADEROK:
+					/* Simply display the geometry */
+					printf("%s\n", record);
+					free(record);
+					break;
+
+				case SHPLOADERERR:
+					/* Display the error message then stop */
+					fprintf(stderr, "%s\n", state->message);
+					exit(1);
+					break;
+
+				case SHPLOADERWARN:
+					/* Display the warning, but continue */
+					fprintf(stderr, "%s\n", state->message);
+					printf("%s\n", record);
+					free(record);
+					break;
+
+				case SHPLOADERRECDELETED:
+					/* Record is marked as deleted - ignore */
+					break;
+
+				case SHPLOADERRECISNULL:
+					/* Record is NULL and should be ignored according to NULL policy */
+					break;
+				}
 			}
-		}
 
-		/* If in COPY mode, terminate the COPY statement */
-		if (state->config->dump_format)
-			printf("\\.\n");
+			/* If in COPY mode, terminate the COPY statement */
+			if (state->config->dump_format)
+				printf("\\.\n");
 
-	}
+		}
 
-	/* Print the footer to stdout */
-	ret = ShpLoaderGetSQLFooter(state, &footer);
-	if (ret != SHPLOADEROK)
-	{
-		fprintf(stderr, "%s\n", state->message);
+		/* Print the footer to stdout */
+		ret = ShpLoaderGetSQLFooter(state, &footer);
+		if (ret != SHPLOADEROK)
+		{
+			fprintf(stderr, "%s\n", state->message);
 
-		if (ret == SHPLOADERERR)
-			exit(1);
-	}
+			if (ret == SHPLOADERERR)
+				exit(1);
+		}
 
-	printf("%s", footer);
-	free(footer);
+		printf("%s", footer);
+		free(footer);
+	}
 
 
 	/* Free the state object */
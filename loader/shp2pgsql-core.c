@@ -20,20 +20,39 @@
 #include "../liblwgeom/lwgeom_log.h" /* for LWDEBUG macros */
 
 
-/* Internal ring/point structures */
-typedef struct struct_point
-{
-	double x, y, z, m;
-} Point;
-
+/* Internal ring structures */
 typedef struct struct_ring
 {
-	Point *list;		/* list of points */
+	int start;		/* index of the first vertex in the shape */
+	int n;			/* number of vertexes */
+	double xmin, ymin;	/* envelope of the ring */
+	double xmax, ymax;
 	struct struct_ring *next;
-	int n;			/* number of points in list */
 	unsigned int linked; 	/* number of "next" rings */
 } Ring;
 
+typedef struct struct_ringbox
+{
+	double xmin, ymin, xmax, ymax;
+} RingBox;
+
+/* Number of entries grouped under each node of the outer ring index */
+#define RINGINDEX_NODE_SIZE 16
+
+/*
+ * Packed R-tree over the envelopes of the outer rings of a shape. Level 0
+ * holds the rings themselves in Sort-Tile-Recursive order, and node i of
+ * level l covers entries [i * RINGINDEX_NODE_SIZE, (i + 1) * RINGINDEX_NODE_SIZE)
+ * of level l - 1, so no child pointers are needed.
+ */
+typedef struct struct_ringindex
+{
+	Ring **rings;		/* outer rings in index order */
+	int nlevels;
+	int *count;		/* number of entries at each level */
+	RingBox **box;		/* envelopes of the entries at each level */
+} RingIndex;
+
 
 /*
  * Internal functions
@@ -47,12 +66,23 @@ int utf8(const char *fromcode, char *inputbuf, char **outputbuf);
 char *escape_copy_string(char *str);
 char *escape_insert_string(char *str);
 
-int GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int force_multi);
-int GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry);
-int PIP(Point P, Point *V, int n);
+char *GenerateGeometryOutput(SHPLOADERSTATE *state, LWGEOM *lwgeom, size_t *size);
+int GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size, int force_multi);
+int GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size);
+int PIP(double x, double y, const double *X, const double *Y, int n);
+RingIndex *RingIndexBuild(Ring **rings, int nrings);
+void RingIndexFree(RingIndex *index);
+int RingIndexSearch(RingIndex *index, const RingBox *pts, Ring **found);
 int FindPolygons(SHPObject *obj, Ring ***Out);
 void ReleasePolygons(Ring **polys, int npolys);
-int GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry);
+int GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size);
+
+void copy_binary_int16(stringbuffer_t *sb, int value);
+void copy_binary_int32(stringbuffer_t *sb, int value);
+int copy_binary_numeric(stringbuffer_t *sb, const char *str);
+int copy_binary_date(stringbuffer_t *sb, const char *str);
+int copy_binary_value(SHPLOADERSTATE *state, stringbuffer_t *sb, int field, const char *val);
+int GenerateRowStatement(SHPLOADERSTATE *state, int item, char **strrecord, size_t *size);
 
 /* Append variadic formatted string to a stringbuffer */
 void
@@ -239,12 +269,28 @@ escape_insert_string(char *str)
 }
 
 
+/**
+ * @brief Write lwgeom in the output form of the configuration: hex EWKB, EWKT, or raw EWKB
+ * for binary COPY. Returns an allocated buffer of *size bytes (plus a null for the text forms).
+ */
+char *
+GenerateGeometryOutput(SHPLOADERSTATE *state, LWGEOM *lwgeom, size_t *size)
+{
+	if (state->config->binary)
+		return (char *)lwgeom_to_wkb(lwgeom, WKB_EXTENDED, size);
+	else if (state->config->use_wkt)
+		return lwgeom_to_wkt(lwgeom, WKT_EXTENDED, WKT_PRECISION, size);
+	else
+		return lwgeom_to_hexwkb(lwgeom, WKB_EXTENDED, size);
+}
+
+
 /**
  * @brief Generate an allocated geometry string for shapefile object obj using the state parameters
  * if "force_multi" is true, single points will instead be created as multipoints with a single vertice.
  */
 int
-GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, int force_multi)
+GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size, int force_multi)
 {
 	LWGEOM **lwmultipoints;
 	LWGEOM *lwgeom = NULL;
@@ -255,7 +301,6 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, in
 	int u;
 
 	char *mem;
-	size_t mem_length;
 
 	FLAGS_SET_Z(dims, state->has_z);
 	FLAGS_SET_M(dims, state->has_m);
@@ -297,14 +342,7 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, in
 		lwfree(lwmultipoints);
 	}
 
-	if (state->config->use_wkt)
-	{
-		mem = lwgeom_to_wkt(lwgeom, WKT_EXTENDED, WKT_PRECISION, &mem_length);
-	}
-	else
-	{
-		mem = lwgeom_to_hexwkb(lwgeom, WKB_EXTENDED, &mem_length);
-	}
+	mem = GenerateGeometryOutput(state, lwgeom, size);
 
 	if ( !mem )
 	{
@@ -326,7 +364,7 @@ GeneratePointGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, in
  * @brief Generate an allocated geometry string for shapefile object obj using the state parameters
  */
 int
-GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
+GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size)
 {
 
 	LWGEOM **lwmultilinestrings;
@@ -335,7 +373,6 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 	int dims = 0;
 	int u, v, start_vertex, end_vertex;
 	char *mem;
-	size_t mem_length;
 
 
 	FLAGS_SET_Z(dims, state->has_z);
@@ -395,10 +432,7 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 		lwfree(lwmultilinestrings);
 	}
 
-	if (!state->config->use_wkt)
-		mem = lwgeom_to_hexwkb(lwgeom, WKB_EXTENDED, &mem_length);
-	else
-		mem = lwgeom_to_wkt(lwgeom, WKT_EXTENDED, WKT_PRECISION, &mem_length);
+	mem = GenerateGeometryOutput(state, lwgeom, size);
 
 	if ( !mem )
 	{
@@ -417,25 +451,26 @@ GenerateLineStringGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometr
 
 
 /**
- * @brief PIP(): crossing number test for a point in a polygon
- *      input:   P = a point,
- *               V[] = vertex points of a polygon V[n+1] with V[n]=V[0]
+ * @brief PIP(): crossing number test for a point in a ring
+ *      input:   x, y = a point,
+ *               X[], Y[] = vertex coordinates of a ring of n vertexes
+ *               with the last vertex equal to the first
  * @return   0 = outside, 1 = inside
  */
 int
-PIP(Point P, Point *V, int n)
+PIP(double x, double y, const double *X, const double *Y, int n)
 {
 	int cn = 0;    /* the crossing number counter */
 	int i;
 
-	/* loop through all edges of the polygon */
+	/* loop through all edges of the ring */
 	for (i = 0; i < n-1; i++)      /* edge from V[i] to V[i+1] */
 	{
-		if (((V[i].y <= P.y) && (V[i + 1].y > P.y))    /* an upward crossing */
-		        || ((V[i].y > P.y) && (V[i + 1].y <= P.y)))   /* a downward crossing */
+		/* an upward or a downward crossing */
+		if ((Y[i] <= y) != (Y[i + 1] <= y))
 		{
-			double vt = (float)(P.y - V[i].y) / (V[i + 1].y - V[i].y);
-			if (P.x < V[i].x + vt * (V[i + 1].x - V[i].x)) /* P.x < intersect */
+			double vt = (y - Y[i]) / (Y[i + 1] - Y[i]);
+			if (x < X[i] + vt * (X[i + 1] - X[i])) /* P.x < intersect */
 				++cn;   /* a valid crossing of y=P.y right of P.x */
 		}
 	}
@@ -444,6 +479,209 @@ PIP(Point P, Point *V, int n)
 }
 
 
+/* Order rings by the centre of their envelope, on X or on Y */
+static int
+ring_cmp_x(const void *a, const void *b)
+{
+	const Ring *ra = *(const Ring **)a;
+	const Ring *rb = *(const Ring **)b;
+	double ca = ra->xmin + ra->xmax;
+	double cb = rb->xmin + rb->xmax;
+
+	return (ca < cb) ? -1 : (ca > cb) ? 1 : 0;
+}
+
+static int
+ring_cmp_y(const void *a, const void *b)
+{
+	const Ring *ra = *(const Ring **)a;
+	const Ring *rb = *(const Ring **)b;
+	double ca = ra->ymin + ra->ymax;
+	double cb = rb->ymin + rb->ymax;
+
+	return (ca < cb) ? -1 : (ca > cb) ? 1 : 0;
+}
+
+/* Order rings as they appear in the shape */
+static int
+ring_cmp_start(const void *a, const void *b)
+{
+	const Ring *ra = *(const Ring **)a;
+	const Ring *rb = *(const Ring **)b;
+
+	return ra->start - rb->start;
+}
+
+
+/**
+ * @brief Build a packed R-tree over the envelopes of nrings rings
+ *
+ * The rings are sorted into vertical slices on the X centre of their
+ * envelope, each slice is sorted on the Y centre, and every
+ * RINGINDEX_NODE_SIZE consecutive entries are then grouped under one node
+ * of the level above until a single level fits in one node.
+ */
+RingIndex *
+RingIndexBuild(Ring **rings, int nrings)
+{
+	RingIndex *index;
+	int nleaves, nslices, slice_size;
+	int i, l;
+
+	index = (RingIndex *)malloc(sizeof(RingIndex));
+	index->rings = (Ring **)malloc(sizeof(Ring *) * (nrings > 0 ? nrings : 1));
+	memcpy(index->rings, rings, sizeof(Ring *) * nrings);
+
+	/* Sort-Tile-Recursive ordering of the rings */
+	nleaves = (nrings + RINGINDEX_NODE_SIZE - 1) / RINGINDEX_NODE_SIZE;
+	nslices = 1;
+	while (nslices * nslices < nleaves)
+		nslices++;
+	slice_size = nslices * RINGINDEX_NODE_SIZE;
+
+	qsort(index->rings, nrings, sizeof(Ring *), ring_cmp_x);
+	for (i = 0; i < nrings; i += slice_size)
+	{
+		int n = (nrings - i < slice_size) ? nrings - i : slice_size;
+		qsort(index->rings + i, n, sizeof(Ring *), ring_cmp_y);
+	}
+
+	/* Count the levels */
+	index->nlevels = 1;
+	for (i = nrings; i > RINGINDEX_NODE_SIZE; i = (i + RINGINDEX_NODE_SIZE - 1) / RINGINDEX_NODE_SIZE)
+		index->nlevels++;
+
+	index->count = (int *)malloc(sizeof(int) * index->nlevels);
+	index->box = (RingBox **)malloc(sizeof(RingBox *) * index->nlevels);
+
+	/* Level 0 is the envelopes of the rings themselves */
+	index->count[0] = nrings;
+	index->box[0] = (RingBox *)malloc(sizeof(RingBox) * (nrings > 0 ? nrings : 1));
+	for (i = 0; i < nrings; i++)
+	{
+		index->box[0][i].xmin = index->rings[i]->xmin;
+		index->box[0][i].ymin = index->rings[i]->ymin;
+		index->box[0][i].xmax = index->rings[i]->xmax;
+		index->box[0][i].ymax = index->rings[i]->ymax;
+	}
+
+	/* Each node of the upper levels covers the envelopes of its children */
+	for (l = 1; l < index->nlevels; l++)
+	{
+		int nchildren = index->count[l - 1];
+		RingBox *children = index->box[l - 1];
+
+		index->count[l] = (nchildren + RINGINDEX_NODE_SIZE - 1) / RINGINDEX_NODE_SIZE;
+		index->box[l] = (RingBox *)malloc(sizeof(RingBox) * index->count[l]);
+
+		for (i = 0; i < nchildren; i++)
+		{
+			RingBox *node = &index->box[l][i / RINGINDEX_NODE_SIZE];
+
+			if (i % RINGINDEX_NODE_SIZE == 0)
+			{
+				*node = children[i];
+				continue;
+			}
+
+			if (children[i].xmin < node->xmin) node->xmin = children[i].xmin;
+			if (children[i].ymin < node->ymin) node->ymin = children[i].ymin;
+			if (children[i].xmax > node->xmax) node->xmax = children[i].xmax;
+			if (children[i].ymax > node->ymax) node->ymax = children[i].ymax;
+		}
+	}
+
+	return index;
+}
+
+
+void
+RingIndexFree(RingIndex *index)
+{
+	int l;
+
+	for (l = 0; l < index->nlevels; l++)
+		free(index->box[l]);
+
+	free(index->box);
+	free(index->count);
+	free(index->rings);
+	free(index);
+}
+
+
+/* Does the envelope contain either of the two points of pts? */
+static int
+ringbox_contains(const RingBox *box, const RingBox *pts)
+{
+	return (box->xmin <= pts->xmin && pts->xmin <= box->xmax &&
+	        box->ymin <= pts->ymin && pts->ymin <= box->ymax) ||
+	       (box->xmin <= pts->xmax && pts->xmax <= box->xmax &&
+	        box->ymin <= pts->ymax && pts->ymax <= box->ymax);
+}
+
+static int
+ringindex_search_node(RingIndex *index, int level, int node, const RingBox *pts, Ring **found, int nfound)
+{
+	int i, first, last;
+
+	if (!ringbox_contains(&index->box[level][node], pts))
+		return nfound;
+
+	if (level == 0)
+	{
+		found[nfound] = index->rings[node];
+		return nfound + 1;
+	}
+
+	first = node * RINGINDEX_NODE_SIZE;
+	last = first + RINGINDEX_NODE_SIZE;
+	if (last > index->count[level - 1])
+		last = index->count[level - 1];
+
+	for (i = first; i < last; i++)
+		nfound = ringindex_search_node(index, level - 1, i, pts, found, nfound);
+
+	return nfound;
+}
+
+
+/**
+ * @brief Find the rings whose envelope contains either of two points
+ *
+ * The two points are passed as the (xmin, ymin) and (xmax, ymax) corners
+ * of pts. The matching rings are stored in found, which must have room
+ * for all the indexed rings, in the order they appear in the shape.
+ *
+ * @return the number of rings found
+ */
+int
+RingIndexSearch(RingIndex *index, const RingBox *pts, Ring **found)
+{
+	int top = index->nlevels - 1;
+	int i, nfound = 0;
+
+	for (i = 0; i < index->count[top]; i++)
+		nfound = ringindex_search_node(index, top, i, pts, found, nfound);
+
+	if (nfound > 1)
+		qsort(found, nfound, sizeof(Ring *), ring_cmp_start);
+
+	return nfound;
+}
+
+
+/**
+ * @brief Split the parts of a polygon shape into outer rings, each followed
+ * by the linked list of the holes within it
+ *
+ * The rings reference the vertexes of obj rather than copying them. Each
+ * hole is matched against an envelope index of the outer rings, so only
+ * the outer rings whose envelope contains the hole are tested point in
+ * ring. Among those, the hole goes into the first in shape order.
+ *
+ * @return the number of outer rings stored in *Out
+ */
 int
 FindPolygons(SHPObject *obj, Ring ***Out)
 {
@@ -452,6 +690,9 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 	Ring **Inner;    /* Pointers to Inner rings */
 	int in_index=0;  /* Count of Inner rings */
 	int pi; /* part index */
+	int nindexed; /* Count of Outer rings in the index */
+	RingIndex *index;
+	Ring **found;    /* Candidate Outer rings of a hole */
 
 #if POSTGIS_DEBUG_LEVEL > 0
 	static int call = -1;
@@ -470,7 +711,6 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 		int vi; /* vertex index */
 		int vs; /* start index */
 		int ve; /* end index */
-		int nv; /* number of vertex */
 		double area = 0.0;
 		Ring *ring;
 
@@ -482,15 +722,14 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 
 		vs = obj->panPartStart[pi];
 
-		/* Compute number of vertexes */
-		nv = ve - vs;
-
 		/* Allocate memory for a ring */
 		ring = (Ring *)malloc(sizeof(Ring));
-		ring->list = (Point *)malloc(sizeof(Point) * nv);
-		ring->n = nv;
+		ring->start = vs;
+		ring->n = ve - vs;
 		ring->next = NULL;
 		ring->linked = 0;
+		ring->xmin = ring->xmax = obj->padfX[vs];
+		ring->ymin = ring->ymax = obj->padfY[vs];
 
 		/* Iterate over ring vertexes */
 		for (vi = vs; vi < ve; vi++)
@@ -499,21 +738,15 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 			if (vn == ve)
 				vn = vs;
 
-			ring->list[vi - vs].x = obj->padfX[vi];
-			ring->list[vi - vs].y = obj->padfY[vi];
-			ring->list[vi - vs].z = obj->padfZ[vi];
-			ring->list[vi - vs].m = obj->padfM[vi];
+			if (obj->padfX[vi] < ring->xmin) ring->xmin = obj->padfX[vi];
+			if (obj->padfX[vi] > ring->xmax) ring->xmax = obj->padfX[vi];
+			if (obj->padfY[vi] < ring->ymin) ring->ymin = obj->padfY[vi];
+			if (obj->padfY[vi] > ring->ymax) ring->ymax = obj->padfY[vi];
 
 			area += (obj->padfX[vi] * obj->padfY[vn]) -
 			        (obj->padfY[vi] * obj->padfX[vn]);
 		}
 
-		/* Close the ring with first vertex  */
-		/*ring->list[vi].x = obj->padfX[vs]; */
-		/*ring->list[vi].y = obj->padfY[vs]; */
-		/*ring->list[vi].z = obj->padfZ[vs]; */
-		/*ring->list[vi].m = obj->padfM[vs]; */
-
 		/* Clockwise (or single-part). It's an Outer Ring ! */
 		if (area < 0.0 || obj->nParts == 1)
 		{
@@ -530,31 +763,42 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 
 	LWDEBUGF(4, "FindPolygons[%d]: found %d Outer, %d Inners\n", call, out_index, in_index);
 
+	nindexed = out_index;
+	index = RingIndexBuild(Outer, nindexed);
+	found = (Ring **)malloc(sizeof(Ring *) * (nindexed > 0 ? nindexed : 1));
+
 	/* Put the inner rings into the list of the outer rings */
 	/* of which they are within */
 	for (pi = 0; pi < in_index; pi++)
 	{
-		Point pt, pt2;
-		int i;
+		RingBox pts;
+		int i, nfound;
 		Ring *inner = Inner[pi], *outer = NULL;
+		int second = (inner->n > 1) ? inner->start + 1 : inner->start;
+
+		/* Test the first two vertexes of the hole */
+		pts.xmin = obj->padfX[inner->start];
+		pts.ymin = obj->padfY[inner->start];
+		pts.xmax = obj->padfX[second];
+		pts.ymax = obj->padfY[second];
 
-		pt.x = inner->list[0].x;
-		pt.y = inner->list[0].y;
+		nfound = RingIndexSearch(index, &pts, found);
 
-		pt2.x = inner->list[1].x;
-		pt2.y = inner->list[1].y;
+		/* Orphan holes promoted to outer rings are few, test them all */
+		for (i = nindexed; i < out_index; i++)
+			found[nfound++] = Outer[i];
 
-		for (i = 0; i < out_index; i++)
+		for (i = 0; i < nfound; i++)
 		{
-			int in;
+			const double *X = obj->padfX + found[i]->start;
+			const double *Y = obj->padfY + found[i]->start;
 
-			in = PIP(pt, Outer[i]->list, Outer[i]->n);
-			if ( in || PIP(pt2, Outer[i]->list, Outer[i]->n) )
+			if ( PIP(pts.xmin, pts.ymin, X, Y, found[i]->n) ||
+			     PIP(pts.xmax, pts.ymax, X, Y, found[i]->n) )
 			{
-				outer = Outer[i];
+				outer = found[i];
 				break;
 			}
-			/*fprintf(stderr, "!PIP %s\nOUTE %s\n", dump_ring(inner), dump_ring(Outer[i])); */
 		}
 
 		if (outer)
@@ -573,9 +817,15 @@ FindPolygons(SHPObject *obj, Ring ***Out)
 
 			Outer[out_index] = inner;
 			out_index++;
+
+			/* Make room for it among the candidates of the next holes */
+			found = (Ring **)realloc(found, sizeof(Ring *) * out_index);
 		}
 	}
 
+	RingIndexFree(index);
+	free(found);
+
 	*Out = Outer;
 	free(Inner);
 
@@ -597,7 +847,6 @@ ReleasePolygons(Ring **polys, int npolys)
 		{
 			temp = Poly;
 			Poly = Poly->next;
-			free(temp->list);
 			free(temp);
 		}
 	}
@@ -614,7 +863,7 @@ ReleasePolygons(Ring **polys, int npolys)
  *
  */
 int
-GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
+GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry, size_t *size)
 {
 	Ring **Outer;
 	int polygon_total, ring_total;
@@ -628,7 +877,6 @@ GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 	int dims = 0;
 
 	char *mem;
-	size_t mem_length;
 
 	FLAGS_SET_Z(dims, state->has_z);
 	FLAGS_SET_M(dims, state->has_m);
@@ -670,16 +918,16 @@ GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 			/* Create a POINTARRAY containing the points making up the ring */
 			POINTARRAY *pa = ptarray_construct_empty(state->has_z, state->has_m, polyring->n);
 
-			for (vi = 0; vi < polyring->n; vi++)
+			for (vi = polyring->start; vi < polyring->start + polyring->n; vi++)
 			{
 				/* Build up a point array of all the points in this ring */
-				point4d.x = polyring->list[vi].x;
-				point4d.y = polyring->list[vi].y;
+				point4d.x = obj->padfX[vi];
+				point4d.y = obj->padfY[vi];
 
 				if (state->has_z)
-					point4d.z = polyring->list[vi].z;
+					point4d.z = obj->padfZ[vi];
 				if (state->has_m)
-					point4d.m = polyring->list[vi].m;
+					point4d.m = obj->padfM[vi];
 
 				ptarray_append_point(pa, &point4d, LW_TRUE);
 			}
@@ -706,10 +954,7 @@ GeneratePolygonGeometry(SHPLOADERSTATE *state, SHPObject *obj, char **geometry)
 		lwfree(lwpolygons);
 	}
 
-	if (!state->config->use_wkt)
-		mem = lwgeom_to_hexwkb(lwgeom, WKB_EXTENDED, &mem_length);
-	else
-		mem = lwgeom_to_wkt(lwgeom, WKT_EXTENDED, WKT_PRECISION, &mem_length);
+	mem = GenerateGeometryOutput(state, lwgeom, size);
 
 	if ( !mem )
 	{
@@ -768,6 +1013,7 @@ set_loader_config_defaults(SHPLOADERCONFIG *config)
 	config->sr_id = SRID_UNKNOWN;
 	config->shp_sr_id = SRID_UNKNOWN;
 	config->use_wkt = 0;
+	config->binary = 0;
 	config->tablespace = NULL;
 	config->idxtablespace = NULL;
 	config->usetransaction = 1;
@@ -1435,16 +1681,18 @@ ShpLoaderGetSQLCopyStatement(SHPLOADERSTATE *state, char **strheader)
 		if (state->config->schema)
 		{
 			copystr = malloc(strlen(state->config->schema) + strlen(state->config->table) +
-			                 strlen(state->col_names) + 40);
+			                 strlen(state->col_names) + 52);
 
-			sprintf(copystr, "COPY \"%s\".\"%s\" %s FROM stdin;\n",
-			        state->config->schema, state->config->table, state->col_names);
+			sprintf(copystr, "COPY \"%s\".\"%s\" %s FROM stdin%s;\n",
+			        state->config->schema, state->config->table, state->col_names,
+			        state->config->binary ? " WITH BINARY" : "");
 		}
 		else
 		{
-			copystr = malloc(strlen(state->config->table) + strlen(state->col_names) + 40);
+			copystr = malloc(strlen(state->config->table) + strlen(state->col_names) + 52);
 
-			sprintf(copystr, "COPY \"%s\" %s FROM stdin;\n", state->config->table, state->col_names);
+			sprintf(copystr, "COPY \"%s\" %s FROM stdin%s;\n", state->config->table, state->col_names,
+			        state->config->binary ? " WITH BINARY" : "");
 		}
 
 		*strheader = copystr;
@@ -1468,9 +1716,316 @@ ShpLoaderGetRecordCount(SHPLOADERSTATE *state)
 }
 
 
+/*
+ * Binary COPY encoding. Every value is sent as its length followed by the
+ * binary form of its type, all integers big-endian.
+ */
+
+/* Append a 16 bit integer */
+void
+copy_binary_int16(stringbuffer_t *sb, int value)
+{
+	char buf[2];
+
+	buf[0] = (value >> 8) & 0xFF;
+	buf[1] = value & 0xFF;
+	stringbuffer_append_len(sb, buf, 2);
+}
+
+/* Append a 32 bit integer */
+void
+copy_binary_int32(stringbuffer_t *sb, int value)
+{
+	char buf[4];
+
+	buf[0] = (value >> 24) & 0xFF;
+	buf[1] = (value >> 16) & 0xFF;
+	buf[2] = (value >> 8) & 0xFF;
+	buf[3] = value & 0xFF;
+	stringbuffer_append_len(sb, buf, 4);
+}
+
+/*
+ * Append the numeric of a decimal string such as "-12.50" or "1.5E+10", as
+ * base 10000 digits with the weight of the first one, the sign and the number
+ * of decimals. Returns 0 if the string is not a number.
+ */
+int
+copy_binary_numeric(stringbuffer_t *sb, const char *str)
+{
+	char digits[MAXVALUELEN];
+	short groups[MAXVALUELEN / 4 + 2];
+	int ndigits = 0, point = -1, negative = 0, exponent = 0;
+	int dscale, weight, ngroups, first, last, pos, g, d;
+	const char *ptr = str;
+	char *end;
+
+	while (*ptr == ' ')
+		ptr++;
+	if (*ptr == '-' || *ptr == '+')
+		negative = (*ptr++ == '-');
+
+	for (; isdigit(*ptr) || *ptr == '.'; ptr++)
+	{
+		if (*ptr == '.')
+		{
+			if (point >= 0)
+				return 0;
+			point = ndigits;
+		}
+		else if (ndigits < MAXVALUELEN)
+			digits[ndigits++] = *ptr - '0';
+	}
+	if (ndigits == 0)
+		return 0;
+	if (point < 0)
+		point = ndigits;
+
+	if (*ptr == 'e' || *ptr == 'E')
+	{
+		exponent = strtol(ptr + 1, &end, 10);
+		if (end == ptr + 1 || exponent > 1000 || exponent < -1000)
+			return 0;
+		ptr = end;
+	}
+	while (*ptr == ' ')
+		ptr++;
+	if (*ptr)
+		return 0;
+
+	/* Number of digits before the decimal point, and after it */
+	point += exponent;
+	dscale = ndigits > point ? ndigits - point : 0;
+
+	/*
+	 * Digit d stands for 10^(point - 1 - d), so falls in the base 10000 digit
+	 * of weight floor((point - 1 - d) / 4)
+	 */
+#define GROUP_OF(pos) ((pos) >= 0 ? (pos) / 4 : -((3 - (pos)) / 4))
+	weight = GROUP_OF(point - 1);
+	ngroups = weight - GROUP_OF(point - ndigits) + 1;
+	memset(groups, 0, sizeof(short) * ngroups);
+
+	for (d = 0; d < ndigits; d++)
+	{
+		pos = point - 1 - d;
+		g = weight - GROUP_OF(pos);
+		groups[g] = groups[g] * 10 + digits[d];
+	}
+	/* Shift the last group up to its place if the digits stop mid group */
+	for (pos = point - ndigits; pos - 4 * GROUP_OF(pos) > 0; pos--)
+		groups[ngroups - 1] *= 10;
+#undef GROUP_OF
+
+	/* Leading and trailing zero groups are implied */
+	for (first = 0; first < ngroups && groups[first] == 0; first++);
+	for (last = ngroups - 1; last >= first && groups[last] == 0; last--);
+
+	if (first > last)
+	{
+		/* Zero */
+		weight = 0;
+		negative = 0;
+		ngroups = 0;
+	}
+	else
+	{
+		weight -= first;
+		ngroups = last - first + 1;
+	}
+
+	copy_binary_int32(sb, 8 + 2 * ngroups);
+	copy_binary_int16(sb, ngroups);
+	copy_binary_int16(sb, weight);
+	copy_binary_int16(sb, negative ? 0x4000 : 0x0000);
+	copy_binary_int16(sb, dscale);
+	for (g = first; g < first + ngroups; g++)
+		copy_binary_int16(sb, groups[g]);
+
+	return 1;
+}
+
+/*
+ * Append the date of a DBF date string (YYYYMMDD), as days since 2000-01-01.
+ * Returns 0 if the string is not a date.
+ */
+int
+copy_binary_date(stringbuffer_t *sb, const char *str)
+{
+	static const int mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int y, m, d, julian, century;
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		if (!isdigit(str[i]))
+			return 0;
+	}
+	if (str[8] != '\0')
+		return 0;
+
+	y = (str[0] - '0') * 1000 + (str[1] - '0') * 100 + (str[2] - '0') * 10 + (str[3] - '0');
+	m = (str[4] - '0') * 10 + (str[5] - '0');
+	d = (str[6] - '0') * 10 + (str[7] - '0');
+
+	if (m < 1 || m > 12 || d < 1)
+		return 0;
+	if (d > mdays[m - 1] + (m == 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)))
+		return 0;
+
+	/* Julian day, as computed by date2j() in the backend */
+	if (m > 2)
+	{
+		m += 1;
+		y += 4800;
+	}
+	else
+	{
+		m += 13;
+		y += 4799;
+	}
+	century = y / 100;
+	julian = y * 365 - 32167;
+	julian += y / 4 - century + century / 4;
+	julian += 7834 * m / 256 + d;
+
+	/* Days since 2000-01-01, Julian day 2451545 */
+	copy_binary_int32(sb, 4);
+	copy_binary_int32(sb, julian - 2451545);
+
+	return 1;
+}
+
+/*
+ * Append an attribute value, in the binary form of the PostgreSQL type of its
+ * field. Returns SHPLOADERERR and sets the message if the value does not fit.
+ */
+int
+copy_binary_value(SHPLOADERSTATE *state, stringbuffer_t *sb, int field, const char *val)
+{
+	const char *pgtype = state->pgfieldtypes[field];
+	const char *ptr;
+	char *end;
+	long lval;
+	union
+	{
+		double d;
+		uint64_t i;
+	} dval;
+	int ok = 1;
+
+	if (!strcmp(pgtype, "varchar"))
+	{
+		copy_binary_int32(sb, strlen(val));
+		stringbuffer_append_len(sb, val, strlen(val));
+	}
+	else if (!strcmp(pgtype, "int2") || !strcmp(pgtype, "int4"))
+	{
+		errno = 0;
+		lval = strtol(val, &end, 10);
+		while (*end == ' ')
+			end++;
+
+		if (end == val || *end || errno == ERANGE)
+			ok = 0;
+		else if (pgtype[3] == '2')
+		{
+			ok = (lval >= -32768 && lval <= 32767);
+			copy_binary_int32(sb, 2);
+			copy_binary_int16(sb, lval);
+		}
+		else
+		{
+			ok = (lval >= -2147483647L - 1 && lval <= 2147483647L);
+			copy_binary_int32(sb, 4);
+			copy_binary_int32(sb, lval);
+		}
+	}
+	else if (!strcmp(pgtype, "float8"))
+	{
+		dval.d = strtod(val, &end);
+		while (*end == ' ')
+			end++;
+
+		if (end == val || *end)
+			ok = 0;
+		else
+		{
+			copy_binary_int32(sb, 8);
+			copy_binary_int32(sb, (int)(dval.i >> 32));
+			copy_binary_int32(sb, (int)(dval.i & 0xFFFFFFFF));
+		}
+	}
+	else if (!strcmp(pgtype, "numeric"))
+	{
+		ok = copy_binary_numeric(sb, val);
+	}
+	else if (!strcmp(pgtype, "date"))
+	{
+		ok = copy_binary_date(sb, val);
+	}
+	else if (!strcmp(pgtype, "boolean"))
+	{
+		for (ptr = val; *ptr == ' '; ptr++);
+
+		copy_binary_int32(sb, 1);
+		if (*ptr && strchr("TtYy1", *ptr))
+			stringbuffer_append_len(sb, "\1", 1);
+		else if (*ptr && strchr("FfNn0", *ptr))
+			stringbuffer_append_len(sb, "\0", 1);
+		else
+			ok = 0;
+	}
+	else
+	{
+		ok = 0;
+	}
+
+	if (!ok)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Invalid %s value \"%s\" in field %s"), pgtype, val, state->field_names[field]);
+		return SHPLOADERERR;
+	}
+
+	return SHPLOADEROK;
+}
+
+
 /* Return an allocated string representation of a specified record item */
 int
 ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strrecord)
+{
+	if (state->config->binary)
+	{
+		/* Flag an error as the binary rows are not strings */
+		snprintf(state->message, SHPLOADERMSGLEN, _("Internal error: attempt to generate a row string for data that has been requested in binary COPY format"));
+
+		return SHPLOADERERR;
+	}
+
+	return GenerateRowStatement(state, item, strrecord, NULL);
+}
+
+
+/* Return an allocated binary COPY tuple of *size bytes for a specified record item */
+int
+ShpLoaderGenerateCopyBinaryRow(SHPLOADERSTATE *state, int item, char **record, size_t *size)
+{
+	if (!state->config->binary)
+	{
+		/* Flag an error as something has gone horribly wrong */
+		snprintf(state->message, SHPLOADERMSGLEN, _("Internal error: attempt to generate a binary row for data that hasn't been requested in binary COPY format"));
+
+		return SHPLOADERERR;
+	}
+
+	return GenerateRowStatement(state, item, record, size);
+}
+
+
+/* Generate the SQL, COPY or binary COPY form of a record, of *size bytes if size is not NULL */
+int
+GenerateRowStatement(SHPLOADERSTATE *state, int item, char **strrecord, size_t *size)
 {
 	SHPObject *obj = NULL;
 	stringbuffer_t *sb;
@@ -1478,6 +2033,7 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 	char val[MAXVALUELEN];
 	char *escval;
 	char *geometry=NULL, *ret;
+	size_t geometry_size;
 	char *utf8str;
 	int res, i;
 	int rv;
@@ -1530,6 +2086,10 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		}
 	}
 
+	/* A binary COPY tuple starts with its number of fields */
+	if (state->config->binary)
+		copy_binary_int16(sb, DBFGetFieldCount(state->hDBFHandle) + state->config->readshape);
+
 
 	/* Read all of the attributes from the DBF file for this item */
 	for (i = 0; i < DBFGetFieldCount(state->hDBFHandle); i++)
@@ -1537,7 +2097,9 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		/* Special case for NULL attributes */
 		if (DBFIsAttributeNULL(state->hDBFHandle, item, i))
 		{
-			if (state->config->dump_format)
+			if (state->config->binary)
+				copy_binary_int32(sb, -1);
+			else if (state->config->dump_format)
 				stringbuffer_aprintf(sb, "\\N");
 			else
 				stringbuffer_aprintf(sb, "NULL");
@@ -1615,7 +2177,19 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 			}
 
 			/* Escape attribute correctly according to dump format */
-			if (state->config->dump_format)
+			if (state->config->binary)
+			{
+				if (copy_binary_value(state, sb, i, val) != SHPLOADEROK)
+				{
+					SHPDestroyObject(obj);
+					stringbuffer_destroy(sbwarn);
+					stringbuffer_destroy(sb);
+
+					return SHPLOADERERR;
+				}
+				escval = val;
+			}
+			else if (state->config->dump_format)
 			{
 				escval = escape_copy_string(val);
 				stringbuffer_aprintf(sb, "%s", escval);
@@ -1632,7 +2206,8 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		}
 
 		/* Only put in delimeter if not last field or a shape will follow */
-		if (state->config->readshape == 1 || i < DBFGetFieldCount(state->hDBFHandle) - 1)
+		if (!state->config->binary &&
+		        (state->config->readshape == 1 || i < DBFGetFieldCount(state->hDBFHandle) - 1))
 		{
 			if (state->config->dump_format)
 				stringbuffer_aprintf(sb, "\t");
@@ -1650,7 +2225,9 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 		/* Handle the case of a NULL shape */
 		if (obj->nVertices == 0)
 		{
-			if (state->config->dump_format)
+			if (state->config->binary)
+				copy_binary_int32(sb, -1);
+			else if (state->config->dump_format)
 				stringbuffer_aprintf(sb, "\\N");
 			else
 				stringbuffer_aprintf(sb, "NULL");
@@ -1663,27 +2240,27 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 			case SHPT_POLYGON:
 			case SHPT_POLYGONM:
 			case SHPT_POLYGONZ:
-				res = GeneratePolygonGeometry(state, obj, &geometry);
+				res = GeneratePolygonGeometry(state, obj, &geometry, &geometry_size);
 				break;
 
 			case SHPT_POINT:
 			case SHPT_POINTM:
 			case SHPT_POINTZ:
-				res = GeneratePointGeometry(state, obj, &geometry, 0);
+				res = GeneratePointGeometry(state, obj, &geometry, &geometry_size, 0);
 				break;
 
 			case SHPT_MULTIPOINT:
 			case SHPT_MULTIPOINTM:
 			case SHPT_MULTIPOINTZ:
 				/* Force it to multi unless using -S */
-				res = GeneratePointGeometry(state, obj, &geometry,
+				res = GeneratePointGeometry(state, obj, &geometry, &geometry_size,
 					state->config->simple_geometries ? 0 : 1);
 				break;
 
 			case SHPT_ARC:
 			case SHPT_ARCM:
 			case SHPT_ARCZ:
-				res = GenerateLineStringGeometry(state, obj, &geometry);
+				res = GenerateLineStringGeometry(state, obj, &geometry, &geometry_size);
 				break;
 
 			default:
@@ -1715,7 +2292,13 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 				stringbuffer_aprintf(sb, "'");
 			}
 
-			stringbuffer_aprintf(sb, "%s", geometry);
+			if (state->config->binary)
+			{
+				copy_binary_int32(sb, geometry_size);
+				stringbuffer_append_len(sb, geometry, geometry_size);
+			}
+			else
+				stringbuffer_aprintf(sb, "%s", geometry);
 
 			if (!state->config->dump_format)
 			{
@@ -1747,8 +2330,10 @@ ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strreco
 
 
 	/* Copy the string buffer into a new string, destroying the string buffer */
-	ret = (char *)malloc(strlen((char *)stringbuffer_getstring(sb)) + 1);
-	strcpy(ret, (char *)stringbuffer_getstring(sb));
+	ret = (char *)malloc(stringbuffer_getlength(sb) + 1);
+	memcpy(ret, stringbuffer_getstring(sb), stringbuffer_getlength(sb) + 1);
+	if (size)
+		*size = stringbuffer_getlength(sb);
 	stringbuffer_destroy(sb);
 
 	*strrecord = ret;
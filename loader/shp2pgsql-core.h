@@ -72,6 +72,15 @@
 #define GEOMETRY_DEFAULT "geom"
 #define GEOGRAPHY_DEFAULT "geog"
 
+/*
+ * Binary COPY stream header (signature, flags and header extension length)
+ * and trailer (a field count of -1)
+ */
+#define COPY_BINARY_HEADER "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0"
+#define COPY_BINARY_HEADER_LEN 19
+#define COPY_BINARY_TRAILER "\377\377"
+#define COPY_BINARY_TRAILER_LEN 2
+
 /*
  * Default character encoding
  */
@@ -100,6 +109,9 @@ typedef struct shp_loader_config
 	/* 0 = SQL inserts, 1 = dump */
 	int dump_format;
 
+	/* 0 = text dump, 1 = binary dump (raw EWKB and binary attributes, for libpq COPY) */
+	int binary;
+
 	/* 0 = MULTIPOLYGON/MULTILINESTRING, 1 = force to POLYGON/LINESTRING */
 	int simple_geometries;
 	
@@ -229,5 +241,6 @@ int ShpLoaderGetSQLHeader(SHPLOADERSTATE *state, char **strheader);
 int ShpLoaderGetSQLCopyStatement(SHPLOADERSTATE *state, char **strheader);
 int ShpLoaderGetRecordCount(SHPLOADERSTATE *state);
 int ShpLoaderGenerateSQLRowStatement(SHPLOADERSTATE *state, int item, char **strrecord);
+int ShpLoaderGenerateCopyBinaryRow(SHPLOADERSTATE *state, int item, char **record, size_t *size);
 int ShpLoaderGetSQLFooter(SHPLOADERSTATE *state, char **strfooter);
 void ShpLoaderDestroy(SHPLOADERSTATE *state);
@@ -0,0 +1,493 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/*
+ * Direct database loading for shp2pgsql.
+ *
+ * Rather than printing SQL for psql to run, the rows are streamed to the
+ * server with COPY. The records are cut into chunks of LOADER_CHUNK_SIZE,
+ * which a pool of workers hand out to each other: each worker reads its
+ * chunk through its own shapefile handles, converts the geometries and
+ * sends the result over its own connection, so reading, converting and
+ * writing to the server all happen in parallel. The workers keep their
+ * transactions open until all of them are done, then they are all
+ * committed, or all rolled back.
+ */
+
+#include "../postgis_config.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "libpq-fe.h"
+
+#include "shp2pgsql-core.h"
+#include "shp2pgsql-load.h"
+#include "../liblwgeom/liblwgeom.h" /* for SRID_UNKNOWN */
+
+
+/* State shared between the workers of a load */
+typedef struct
+{
+	/* First record of the next chunk to hand out */
+	int next;
+	/* Number of records to load */
+	int nrecords;
+	/* Set when a worker fails, so the others stop and roll back */
+	int failed;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+}
+LOADSHARED;
+
+/* One worker of a load */
+typedef struct
+{
+	/* Copy of the loader state, with its own shapefile handles */
+	SHPLOADERSTATE state;
+	/* Connection the worker copies its rows through */
+	PGconn *conn;
+	LOADSHARED *shared;
+	/* SHPLOADEROK, or SHPLOADERERR with the reason in state.message */
+	int ret;
+}
+LOADWORKER;
+
+
+/* Run a string of SQL statements, returning 0 and setting the message on failure */
+static int
+load_exec(SHPLOADERSTATE *state, PGconn *conn, const char *sql)
+{
+	PGresult *res;
+	ExecStatusType status;
+
+	res = PQexec(conn, sql);
+	status = PQresultStatus(res);
+	PQclear(res);
+
+	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Failed to run SQL: %s"), PQerrorMessage(conn));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* Hand out the next chunk of records, returning 0 when there are none left */
+static int
+load_next_chunk(LOADSHARED *shared, int *first, int *last)
+{
+	int ret = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&shared->lock);
+#endif
+
+	if (!shared->failed && shared->next < shared->nrecords)
+	{
+		*first = shared->next;
+		*last = shared->next + LOADER_CHUNK_SIZE;
+		if (*last > shared->nrecords)
+			*last = shared->nrecords;
+
+		shared->next = *last;
+		ret = 1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&shared->lock);
+#endif
+
+	return ret;
+}
+
+
+/* Tell the other workers to stop */
+static void
+load_set_failed(LOADSHARED *shared)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&shared->lock);
+#endif
+
+	shared->failed = 1;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&shared->lock);
+#endif
+}
+
+
+/*
+ * Body of a worker: open a COPY on the worker connection, then convert and
+ * send chunks of records until there are none left or another worker fails.
+ */
+static void *
+load_worker(void *arg)
+{
+	LOADWORKER *worker = (LOADWORKER *)arg;
+	SHPLOADERSTATE *state = &worker->state;
+	stringbuffer_t *sb;
+	PGresult *res;
+	char *copy, *record;
+	size_t size;
+	int first, last, i, ret;
+	int failed = 0;
+
+	worker->ret = SHPLOADEROK;
+
+	/* Every connection needs the session settings of the header */
+	if (state->config->encoding && !load_exec(state, worker->conn, "SET CLIENT_ENCODING TO UTF8"))
+	{
+		worker->ret = SHPLOADERERR;
+		load_set_failed(worker->shared);
+		return NULL;
+	}
+
+	ShpLoaderGetSQLCopyStatement(state, &copy);
+	res = PQexec(worker->conn, copy);
+	free(copy);
+
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Failed to start COPY: %s"), PQerrorMessage(worker->conn));
+		PQclear(res);
+
+		worker->ret = SHPLOADERERR;
+		load_set_failed(worker->shared);
+		return NULL;
+	}
+	PQclear(res);
+
+	sb = stringbuffer_create();
+
+	/* A binary COPY stream starts with its own header */
+	if (state->config->binary && PQputCopyData(worker->conn, COPY_BINARY_HEADER, COPY_BINARY_HEADER_LEN) < 0)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Failed to start COPY: %s"), PQerrorMessage(worker->conn));
+		failed = 1;
+	}
+
+	while (!failed && load_next_chunk(worker->shared, &first, &last))
+	{
+		stringbuffer_clear(sb);
+
+		for (i = first; i < last; i++)
+		{
+			if (state->config->binary)
+				ret = ShpLoaderGenerateCopyBinaryRow(state, i, &record, &size);
+			else
+				ret = ShpLoaderGenerateSQLRowStatement(state, i, &record);
+
+			switch (ret)
+			{
+			case SHPLOADERWARN:
+				/* Display the warning, but continue */
+				fprintf(stderr, "%s\n", state->message);
+
+				/* Fall through */
+
+			case SHPLOADEROK:
+				if (state->config->binary)
+				{
+					stringbuffer_append_len(sb, record, size);
+				}
+				else
+				{
+					stringbuffer_append(sb, record);
+					stringbuffer_append(sb, "\n");
+				}
+				free(record);
+				break;
+
+			case SHPLOADERERR:
+				/* Keep the message and stop */
+				failed = 1;
+				break;
+
+			case SHPLOADERRECDELETED:
+			case SHPLOADERRECISNULL:
+				/* Skipped records */
+				break;
+			}
+
+			if (failed)
+				break;
+		}
+
+		if (!failed && PQputCopyData(worker->conn, stringbuffer_getstring(sb), stringbuffer_getlength(sb)) < 0)
+		{
+			snprintf(state->message, SHPLOADERMSGLEN, _("Failed to send records %d to %d: %s"), first, last - 1, PQerrorMessage(worker->conn));
+			failed = 1;
+		}
+	}
+
+	stringbuffer_destroy(sb);
+
+	if (!failed && state->config->binary && PQputCopyData(worker->conn, COPY_BINARY_TRAILER, COPY_BINARY_TRAILER_LEN) < 0)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Failed to end COPY: %s"), PQerrorMessage(worker->conn));
+		failed = 1;
+	}
+
+	if (failed)
+		load_set_failed(worker->shared);
+
+	PQputCopyEnd(worker->conn, failed ? "Load aborted" : NULL);
+
+	/* Collect the result of the COPY */
+	while ((res = PQgetResult(worker->conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK && !failed)
+		{
+			snprintf(state->message, SHPLOADERMSGLEN, _("COPY failed with the following error: %s"), PQerrorMessage(worker->conn));
+			failed = 1;
+			load_set_failed(worker->shared);
+		}
+		PQclear(res);
+	}
+
+	if (failed)
+		worker->ret = SHPLOADERERR;
+
+	return NULL;
+}
+
+
+int
+ShpLoaderLoadDatabase(SHPLOADERSTATE *state, const char *conninfo, int jobs)
+{
+	SHPLOADERCONFIG *config = state->config;
+	LOADSHARED shared;
+	LOADWORKER *workers;
+	PGconn *conn;
+	char *header, *footer;
+	int ret = SHPLOADEROK;
+	int i, nworkers = 0;
+#ifdef HAVE_PTHREAD
+	pthread_t *threads;
+#endif
+
+	if (config->shp_sr_id != SRID_UNKNOWN && config->shp_sr_id != config->sr_id)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Loading into the database cannot reproject, as COPY cannot call ST_Transform"));
+		return SHPLOADERERR;
+	}
+
+#ifndef HAVE_PTHREAD
+	jobs = 1;
+#endif
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > LOADER_MAX_JOBS)
+		jobs = LOADER_MAX_JOBS;
+
+	/* No point in connections without records to send */
+	if (config->opt == 'p' || ShpLoaderGetRecordCount(state) == 0)
+		jobs = 1;
+
+	/* The rows always go through COPY */
+	config->dump_format = 1;
+
+	/*
+	 * The table only becomes visible to the other connections once
+	 * committed, and their rows to the footer, so with several jobs the
+	 * header and the footer run on their own, and the rows are committed
+	 * in between, in the transactions of the workers.
+	 */
+	if (jobs > 1)
+		config->usetransaction = 0;
+
+	conn = PQconnectdb(conninfo);
+	if (PQstatus(conn) != CONNECTION_OK)
+	{
+		snprintf(state->message, SHPLOADERMSGLEN, _("Unable to connect to the database: %s"), PQerrorMessage(conn));
+		PQfinish(conn);
+		return SHPLOADERERR;
+	}
+
+	/* Create the table */
+	ret = ShpLoaderGetSQLHeader(state, &header);
+	if (ret == SHPLOADERWARN)
+		fprintf(stderr, "%s\n", state->message);
+	else if (ret != SHPLOADEROK)
+	{
+		PQfinish(conn);
+		return SHPLOADERERR;
+	}
+
+	i = load_exec(state, conn, header);
+	free(header);
+	if (!i)
+	{
+		PQfinish(conn);
+		return SHPLOADERERR;
+	}
+	ret = SHPLOADEROK;
+
+	if (config->opt != 'p')
+	{
+		shared.next = 0;
+		shared.nrecords = ShpLoaderGetRecordCount(state);
+		shared.failed = 0;
+
+		workers = calloc(jobs, sizeof(LOADWORKER));
+
+		/*
+		 * Set up the workers before starting any of them, so a connection
+		 * failure stops the load before a row is sent. A single worker
+		 * shares the connection, and the transaction, of the header.
+		 */
+		for (nworkers = 0; nworkers < jobs; nworkers++)
+		{
+			LOADWORKER *worker = &workers[nworkers];
+
+			worker->state = *state;
+			worker->shared = &shared;
+			worker->ret = SHPLOADEROK;
+
+			if (jobs == 1)
+			{
+				worker->conn = conn;
+				continue;
+			}
+
+			worker->state.hSHPHandle = NULL;
+			if (config->readshape)
+				worker->state.hSHPHandle = SHPOpen(config->shp_file, "rb");
+			worker->state.hDBFHandle = DBFOpen(config->shp_file, "rb");
+
+			if ((config->readshape && !worker->state.hSHPHandle) || !worker->state.hDBFHandle)
+			{
+				snprintf(state->message, SHPLOADERMSGLEN, _("%s: unable to reopen the shapefile"), config->shp_file);
+				ret = SHPLOADERERR;
+			}
+			else
+			{
+				worker->conn = PQconnectdb(conninfo);
+				if (PQstatus(worker->conn) != CONNECTION_OK)
+				{
+					snprintf(state->message, SHPLOADERMSGLEN, _("Unable to connect to the database: %s"), PQerrorMessage(worker->conn));
+					ret = SHPLOADERERR;
+				}
+				else if (!load_exec(state, worker->conn, "BEGIN"))
+				{
+					ret = SHPLOADERERR;
+				}
+			}
+
+			if (ret != SHPLOADEROK)
+			{
+				/* Count the worker in, so it gets cleaned up */
+				nworkers++;
+				break;
+			}
+		}
+
+		if (ret == SHPLOADEROK)
+		{
+#ifdef HAVE_PTHREAD
+			pthread_mutex_init(&shared.lock, NULL);
+
+			threads = malloc(sizeof(pthread_t) * jobs);
+			for (i = 0; i < jobs; i++)
+			{
+				if (pthread_create(&threads[i], NULL, load_worker, &workers[i]) != 0)
+				{
+					/* Finish with the threads we have */
+					break;
+				}
+			}
+
+			if (i == 0)
+			{
+				/* Not even one thread: do the work here */
+				load_worker(&workers[0]);
+				i = 1;
+			}
+			else
+			{
+				while (i-- > 0)
+					pthread_join(threads[i], NULL);
+			}
+			free(threads);
+
+			pthread_mutex_destroy(&shared.lock);
+#else
+			load_worker(&workers[0]);
+#endif
+
+			/* Report the first failure */
+			for (i = 0; i < jobs; i++)
+			{
+				if (workers[i].ret != SHPLOADEROK)
+				{
+					strcpy(state->message, workers[i].state.message);
+					ret = SHPLOADERERR;
+					break;
+				}
+			}
+
+			/*
+			 * Commit the rows of the workers only once all of them have
+			 * succeeded, and roll them all back otherwise. A COMMIT that
+			 * fails (the connection dropping in between) rolls back the
+			 * ones that follow, but not those already committed.
+			 */
+			if (jobs > 1)
+			{
+				for (i = 0; i < jobs; i++)
+				{
+					if (ret == SHPLOADEROK)
+					{
+						if (!load_exec(state, workers[i].conn, "COMMIT"))
+							ret = SHPLOADERERR;
+					}
+					else
+					{
+						PQclear(PQexec(workers[i].conn, "ROLLBACK"));
+					}
+				}
+			}
+		}
+
+		/* Close the worker handles and connections */
+		for (i = 0; i < nworkers; i++)
+		{
+			if (workers[i].conn == conn)
+				continue;
+
+			if (workers[i].state.hSHPHandle)
+				SHPClose(workers[i].state.hSHPHandle);
+			if (workers[i].state.hDBFHandle)
+				DBFClose(workers[i].state.hDBFHandle);
+			if (workers[i].conn)
+				PQfinish(workers[i].conn);
+		}
+		free(workers);
+	}
+
+	/* Create the index and commit */
+	if (ret == SHPLOADEROK)
+	{
+		ShpLoaderGetSQLFooter(state, &footer);
+		if (!load_exec(state, conn, footer))
+			ret = SHPLOADERERR;
+		free(footer);
+	}
+
+	PQfinish(conn);
+
+	return ret;
+}
@@ -0,0 +1,25 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/* Requires shp2pgsql-core.h */
+
+/* Number of records a worker converts and sends to the server in one go */
+#define LOADER_CHUNK_SIZE 1000
+
+/* Upper limit on the number of parallel connections */
+#define LOADER_MAX_JOBS 64
+
+/*
+ * Load the shapefile of an opened loader state straight into the database
+ * described by the libpq connection string, streaming the rows through
+ * COPY over jobs parallel connections. Returns SHPLOADEROK, or SHPLOADERERR
+ * with the reason in state->message.
+ */
+int ShpLoaderLoadDatabase(SHPLOADERSTATE *state, const char *conninfo, int jobs);
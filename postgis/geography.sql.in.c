@@ -240,9 +240,10 @@ CREATE OR REPLACE FUNCTION geography_gist_selectivity (internal, oid, internal,
 	LANGUAGE 'c';
 
 -- Availability: 1.5.0
+-- Changed: 2.1.0 to call the join estimator, not the restriction one
 CREATE OR REPLACE FUNCTION geography_gist_join_selectivity(internal, oid, internal, smallint)
 	RETURNS float8
-	AS 'MODULE_PATHNAME', 'geography_gist_selectivity'
+	AS 'MODULE_PATHNAME', 'geography_gist_join_selectivity'
 	LANGUAGE 'c';
 
 -- Availability: 1.5.0
@@ -259,6 +260,49 @@ CREATE OPERATOR && (
 	JOIN = geography_gist_join_selectivity
 );
 
+-- Availability: 2.1.0
+-- Fraction of the rows of the column the planner expects to overlap the geography
+CREATE OR REPLACE FUNCTION _postgis_selectivity(tbl regclass, att_name text, geom geography)
+	RETURNS float8
+	AS 'MODULE_PATHNAME', '_postgis_gserialized_sel'
+	LANGUAGE 'c' STRICT;
+
+-- Availability: 2.1.0
+-- Estimated and actual number of rows of the column overlapping the geography
+CREATE OR REPLACE FUNCTION _postgis_estimate_check(tbl regclass, att_name text, geom geography, OUT estimated float8, OUT actual int8)
+AS $$
+DECLARE
+	ntuples float4;
+BEGIN
+	SELECT reltuples INTO ntuples FROM pg_class WHERE oid = tbl;
+	estimated := _postgis_selectivity(tbl, att_name, geom) * ntuples;
+	EXECUTE 'SELECT count(*) FROM ' || tbl::text || ' WHERE ' || quote_ident(att_name) || ' && $1'
+		INTO actual USING geom;
+END;
+$$
+LANGUAGE 'plpgsql' VOLATILE STRICT;
+
+
+#if POSTGIS_PGSQL_VERSION >= 95
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION geography_gist_distance(internal, geography, int4)
+	RETURNS float8
+	AS 'MODULE_PATHNAME' ,'gserialized_gist_geog_distance'
+	LANGUAGE 'c';
+
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION geography_distance_knn(geography, geography)
+	RETURNS float8
+	AS 'MODULE_PATHNAME','geography_distance_knn'
+	LANGUAGE 'c' IMMUTABLE STRICT
+	COST 100;
+
+-- Availability: 2.1.0
+CREATE OPERATOR <-> (
+	LEFTARG = geography, RIGHTARG = geography, PROCEDURE = geography_distance_knn,
+	COMMUTATOR = '<->'
+);
+#endif
 
 -- Availability: 1.5.0
 CREATE OPERATOR CLASS gist_geography_ops
@@ -268,6 +312,10 @@ CREATE OPERATOR CLASS gist_geography_ops
 --	OPERATOR        6        ~=	,
 --	OPERATOR        7        ~	,
 --	OPERATOR        8        @	,
+#if POSTGIS_PGSQL_VERSION >= 95
+	OPERATOR        13       <-> FOR ORDER BY pg_catalog.float_ops,
+	FUNCTION        8        geography_gist_distance (internal, geography, int4),
+#endif
 	FUNCTION        1        geography_gist_consistent (internal, geography, int4),
 	FUNCTION        2        geography_gist_union (bytea, internal),
 	FUNCTION        3        geography_gist_compress (internal),
@@ -627,9 +675,10 @@ CREATE OR REPLACE FUNCTION ST_CoveredBy(text, text)
 	LANGUAGE 'sql' IMMUTABLE ;
 
 -- Availability: 1.5.0
+-- Changed: 2.1.0 to use _ST_DWithin, which can stop at the first contact
 CREATE OR REPLACE FUNCTION ST_Intersects(geography, geography)
 	RETURNS boolean
-	AS 'SELECT $1 && $2 AND _ST_Distance($1, $2, 0.0, false) < 0.00001'
+	AS 'SELECT $1 && $2 AND _ST_DWithin($1, $2, 0.00001, false)'
 	LANGUAGE 'sql' IMMUTABLE ;
 
 -- Availability: 1.5.0 - this is just a hack to prevent unknown from causing ambiguous name because of geography
@@ -25,8 +25,10 @@
 #include "lwgeom_pg.h"       /* For debugging macros. */
 #include "geography.h"	     /* For utility functions. */
 #include "lwgeom_transform.h" /* For SRID functions */
+#include "geography_measurement_trees.h" /* For cached distance calculations */
 
 Datum geography_distance(PG_FUNCTION_ARGS);
+Datum geography_distance_knn(PG_FUNCTION_ARGS);
 Datum geography_dwithin(PG_FUNCTION_ARGS);
 Datum geography_area(PG_FUNCTION_ARGS);
 Datum geography_length(PG_FUNCTION_ARGS);
@@ -39,31 +41,17 @@ Datum geography_project(PG_FUNCTION_ARGS);
 Datum geography_azimuth(PG_FUNCTION_ARGS);
 
 /*
-** geography_distance(GSERIALIZED *g1, GSERIALIZED *g2, double tolerance, boolean use_spheroid)
-** returns double distance in meters
+** Distance in meters between two geographies, on the spheroid of the
+** first one or on its mean sphere. Returns LW_FAILURE when the
+** distance is undefined (empty arguments).
 */
-PG_FUNCTION_INFO_V1(geography_distance);
-Datum geography_distance(PG_FUNCTION_ARGS)
+static int
+geography_distance_internal(FunctionCallInfo fcinfo, GSERIALIZED *g1, GSERIALIZED *g2, bool use_spheroid, double *distance)
 {
 	LWGEOM *lwgeom1 = NULL;
 	LWGEOM *lwgeom2 = NULL;
-	GSERIALIZED *g1 = NULL;
-	GSERIALIZED *g2 = NULL;
-	double distance;
-	double tolerance;
-	bool use_spheroid;
 	SPHEROID s;
 
-	/* Get our geometry objects loaded into memory. */
-	g1 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	g2 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-
-	/* Read our tolerance value. */
-	tolerance = PG_GETARG_FLOAT8(2);
-
-	/* Read our calculation type. */
-	use_spheroid = PG_GETARG_BOOL(3);
-
 	/* Initialize spheroid */
 	spheroid_init_from_srid(fcinfo, gserialized_get_srid(g1), &s);
 	
@@ -71,30 +59,85 @@ Datum geography_distance(PG_FUNCTION_ARGS)
 	if ( ! use_spheroid )
 		s.a = s.b = s.radius;
 
+	/* Repeated argument? Use the cached index instead of the brute force path */
+	if ( geography_distance_cache(fcinfo, g1, g2, &s, distance) == LW_SUCCESS )
+		return LW_SUCCESS;
+
 	lwgeom1 = lwgeom_from_gserialized(g1);
 	lwgeom2 = lwgeom_from_gserialized(g2);
 
-	/* Return NULL on empty arguments. */
+	/* No distance to empty arguments. */
 	if ( lwgeom_is_empty(lwgeom1) || lwgeom_is_empty(lwgeom2) )
 	{
-		PG_FREE_IF_COPY(g1, 0);
-		PG_FREE_IF_COPY(g2, 1);
-		PG_RETURN_NULL();
+		lwgeom_free(lwgeom1);
+		lwgeom_free(lwgeom2);
+		return LW_FAILURE;
 	}
 
-	distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &s, FP_TOLERANCE);
+	*distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &s, FP_TOLERANCE);
 
 	/* Clean up */
 	lwgeom_free(lwgeom1);
 	lwgeom_free(lwgeom2);
+
+	/* Something went wrong, negative return... should already be eloged */
+	if ( *distance < 0.0 )
+		return LW_FAILURE;
+
+	return LW_SUCCESS;
+}
+
+/*
+** geography_distance(GSERIALIZED *g1, GSERIALIZED *g2, double tolerance, boolean use_spheroid)
+** returns double distance in meters
+*/
+PG_FUNCTION_INFO_V1(geography_distance);
+Datum geography_distance(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *g1 = NULL;
+	GSERIALIZED *g2 = NULL;
+	double distance;
+	bool use_spheroid;
+	int result;
+
+	/* Get our geometry objects loaded into memory. */
+	g1 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	g2 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+
+	/* Read our calculation type. The tolerance is not used. */
+	use_spheroid = PG_GETARG_BOOL(3);
+
+	result = geography_distance_internal(fcinfo, g1, g2, use_spheroid, &distance);
+
 	PG_FREE_IF_COPY(g1, 0);
 	PG_FREE_IF_COPY(g2, 1);
 
-	/* Something went wrong, negative return... should already be eloged, return NULL */
-	if ( distance < 0.0 )
-	{
+	if ( result == LW_FAILURE )
+		PG_RETURN_NULL();
+
+	PG_RETURN_FLOAT8(distance);
+}
+
+/*
+** geography_distance_knn(GSERIALIZED *g1, GSERIALIZED *g2)
+** returns double distance in meters on the spheroid, for the <->
+** operator the index scan rechecks its candidates with
+*/
+PG_FUNCTION_INFO_V1(geography_distance_knn);
+Datum geography_distance_knn(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *g1 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	GSERIALIZED *g2 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+	double distance;
+	int result;
+
+	result = geography_distance_internal(fcinfo, g1, g2, true, &distance);
+
+	PG_FREE_IF_COPY(g1, 0);
+	PG_FREE_IF_COPY(g2, 1);
+
+	if ( result == LW_FAILURE )
 		PG_RETURN_NULL();
-	}
 
 	PG_RETURN_FLOAT8(distance);
 }
@@ -113,6 +156,7 @@ Datum geography_dwithin(PG_FUNCTION_ARGS)
 	double tolerance;
 	double distance;
 	bool use_spheroid;
+	int dwithin = LW_FALSE;
 	SPHEROID s;
 
 	/* Get our geometry objects loaded into memory. */
@@ -132,6 +176,14 @@ Datum geography_dwithin(PG_FUNCTION_ARGS)
 	if ( ! use_spheroid )
 		s.a = s.b = s.radius;
 
+	/* Repeated argument? Use the cached index instead of the brute force path */
+	if ( geography_dwithin_cache(fcinfo, g1, g2, &s, tolerance, &dwithin) == LW_SUCCESS )
+	{
+		PG_FREE_IF_COPY(g1, 0);
+		PG_FREE_IF_COPY(g2, 1);
+		PG_RETURN_BOOL(dwithin);
+	}
+
 	lwgeom1 = lwgeom_from_gserialized(g1);
 	lwgeom2 = lwgeom_from_gserialized(g2);
 
@@ -452,6 +504,14 @@ Datum geography_covers(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
+	/* Repeated polygon? Use the cached index instead of the brute force path */
+	if ( geography_covers_cache(fcinfo, g1, g2, &result) == LW_SUCCESS )
+	{
+		PG_FREE_IF_COPY(g1, 0);
+		PG_FREE_IF_COPY(g2, 1);
+		PG_RETURN_BOOL(result);
+	}
+
 	/* Construct our working geometries */
 	lwgeom1 = lwgeom_from_gserialized(g1);
 	lwgeom2 = lwgeom_from_gserialized(g2);
@@ -0,0 +1,371 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include <assert.h>
+
+#include "../postgis_config.h"
+#include "liblwgeom_internal.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_cache.h"
+#include "geography_measurement_trees.h"
+
+/***********************************************************************
+**
+**  Spherical index trees cached across calls of the geography
+**  distance and covers functions.
+**
+**  When one argument of ST_Distance / ST_DWithin stays the same from
+**  row to row (a join against a single large polygon, for example) we
+**  build a CIRC_NODE tree over its edges once, and answer each call
+**  by walking that tree against a (cheap) tree of the other argument,
+**  instead of comparing every pair of edges. ST_Covers does the same
+**  for its polygon argument, so that a point-in-polygon test only
+**  visits the ring edges near the stab line.
+**
+**  Everything is palloc'ed in the function memory context, so there
+**  are no external objects to clean up when the context goes away.
+**/
+
+/*
+** Free the index and the geometry it references, leaving the keys.
+*/
+static void
+CircTreeGeomCacheClear(CircTreeGeomCache* cache)
+{
+	if ( cache->index )
+		circ_tree_free(cache->index);
+	if ( cache->lwgeom )
+		lwgeom_free(cache->lwgeom);
+	cache->index = 0;
+	cache->lwgeom = 0;
+	cache->argnum = 0;
+}
+
+/*
+** Build the index over the cached copy of the argument. An argument
+** that can't be indexed (empty, unsupported type) leaves argnum set
+** and index NULL, so we don't try to build it again on every call.
+*/
+static void
+CircTreeGeomCacheBuild(FunctionCallInfoData *fcinfo, CircTreeGeomCache* cache, int argnum)
+{
+	MemoryContext old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	cache->lwgeom = lwgeom_from_gserialized(argnum == 1 ? cache->geom1 : cache->geom2);
+	cache->index = lwgeom_calculate_circ_tree(cache->lwgeom);
+	cache->argnum = argnum;
+
+	MemoryContextSwitchTo(old_context);
+
+	POSTGIS_DEBUGF(3, "CircTreeGeomCacheBuild: indexed argument %d (%p)", argnum, cache->index);
+}
+
+/*
+** GetCircTreeGeomCache
+**
+** Pull the current index from the cache or build one if there is
+** not one available. Only build the index if we are seeing a key for
+** the second time. That way rapidly cycling keys don't cause too much
+** indexing.
+*/
+CircTreeGeomCache*
+GetCircTreeGeomCache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2)
+{
+	MemoryContext old_context;
+	GeomCache* supercache = GetGeomCache(fcinfo);
+	CircTreeGeomCache* cache = supercache->circtree;
+	int copy_keys = 1;
+	size_t g1_size = 0;
+	size_t g2_size = 0;
+
+	assert ( ! cache || cache->type == 3 );
+
+	if ( g1 )
+		g1_size = VARSIZE(g1);
+
+	if ( g2 )
+		g2_size = VARSIZE(g2);
+
+	if ( cache == NULL )
+	{
+		/*
+		** Cache requested, but the cache isn't set up yet.
+		** Set it up, but don't build the index yet.
+		*/
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		cache = palloc(sizeof(CircTreeGeomCache));
+		MemoryContextSwitchTo(old_context);
+
+		cache->type = 3;
+		cache->geom1 = 0;
+		cache->geom2 = 0;
+		cache->geom1_size = 0;
+		cache->geom2_size = 0;
+		cache->argnum = 0;
+		cache->lwgeom = 0;
+		cache->index = 0;
+
+		POSTGIS_DEBUGF(3, "GetCircTreeGeomCache: creating cache: %p", cache);
+
+		supercache->circtree = cache;
+	}
+	else if ( g1 &&
+	          cache->argnum != 2 &&
+	          cache->geom1_size == g1_size &&
+	          memcmp(cache->geom1, g1, g1_size) == 0 )
+	{
+		/* Cache hit on arg1, build the index if this is the second sighting */
+		if ( ! cache->argnum )
+			CircTreeGeomCacheBuild(fcinfo, cache, 1);
+		else
+			POSTGIS_DEBUG(3, "GetCircTreeGeomCache: cache hit, argument 1");
+
+		/* We don't need new keys until we have a cache miss */
+		copy_keys = 0;
+	}
+	else if ( g2 &&
+	          cache->argnum != 1 &&
+	          cache->geom2_size == g2_size &&
+	          memcmp(cache->geom2, g2, g2_size) == 0 )
+	{
+		/* Cache hit on arg2, build the index if this is the second sighting */
+		if ( ! cache->argnum )
+			CircTreeGeomCacheBuild(fcinfo, cache, 2);
+		else
+			POSTGIS_DEBUG(3, "GetCircTreeGeomCache: cache hit, argument 2");
+
+		/* We don't need new keys until we have a cache miss */
+		copy_keys = 0;
+	}
+	else if ( cache->argnum )
+	{
+		/*
+		** No cache hits, so this must be a miss.
+		** Drop the index, empty the cache.
+		*/
+		POSTGIS_DEBUGF(3, "GetCircTreeGeomCache: cache miss, argument %d", cache->argnum);
+		CircTreeGeomCacheClear(cache);
+	}
+
+	if ( copy_keys && g1 )
+	{
+		/*
+		** If this is a new key (cache miss) we flip into the function
+		** manager memory context and make a copy. We can't just store a pointer
+		** because this copy will be pfree'd at the end of this function
+		** call.
+		*/
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		if ( cache->geom1 )
+			pfree(cache->geom1);
+		cache->geom1 = palloc(g1_size);
+		MemoryContextSwitchTo(old_context);
+		memcpy(cache->geom1, g1, g1_size);
+		cache->geom1_size = g1_size;
+	}
+	if ( copy_keys && g2 )
+	{
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		if ( cache->geom2 )
+			pfree(cache->geom2);
+		cache->geom2 = palloc(g2_size);
+		MemoryContextSwitchTo(old_context);
+		memcpy(cache->geom2, g2, g2_size);
+		cache->geom2_size = g2_size;
+	}
+
+	return cache;
+}
+
+/*
+** Return LW_TRUE if the geometry or any member of it is empty. The
+** trees leave empty members out, while the slow path has no distance
+** to them and returns NULL.
+*/
+static int
+lwgeom_has_empty_member(const LWGEOM* lwgeom)
+{
+	const LWCOLLECTION* col;
+	int i;
+
+	if ( lwgeom_is_empty(lwgeom) )
+		return LW_TRUE;
+
+	if ( ! lwtype_is_collection(lwgeom->type) )
+		return LW_FALSE;
+
+	col = (LWCOLLECTION*)lwgeom;
+	for ( i = 0; i < col->ngeoms; i++ )
+	{
+		if ( lwgeom_has_empty_member(col->geoms[i]) )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+/*
+** Distance from the cached index to the other argument, with an early
+** exit as soon as the distance drops under the tolerance.
+*/
+static int
+geography_tree_distance(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double tolerance, double *distance)
+{
+	CircTreeGeomCache* tree_cache;
+	const GSERIALIZED* g_other;
+	LWGEOM* lwgeom;
+	CIRC_NODE* circtree;
+	int type1 = gserialized_get_type(g1);
+	int type2 = gserialized_get_type(g2);
+
+	/* Two points? Get outa here... */
+	if ( type1 == POINTTYPE && type2 == POINTTYPE )
+		return LW_FAILURE;
+
+	/* Fetch/build our cache, if appropriate, etc... */
+	tree_cache = GetCircTreeGeomCache(fcinfo, g1, g2);
+
+	/* Nothing indexed (yet), let the caller do it the slow way */
+	if ( ! tree_cache || ! tree_cache->argnum || ! tree_cache->index )
+		return LW_FAILURE;
+
+	/* Empty members, the slow path knows what to say */
+	if ( lwgeom_has_empty_member(tree_cache->lwgeom) )
+		return LW_FAILURE;
+
+	g_other = (tree_cache->argnum == 1) ? g2 : g1;
+	lwgeom = lwgeom_from_gserialized(g_other);
+	circtree = lwgeom_has_empty_member(lwgeom) ? NULL : lwgeom_calculate_circ_tree(lwgeom);
+
+	/* Empty members or unsupported, the slow path knows what to say */
+	if ( ! circtree )
+	{
+		lwgeom_free(lwgeom);
+		return LW_FAILURE;
+	}
+
+	*distance = circ_tree_distance_tree(tree_cache->index, circtree, s, tolerance);
+
+	circ_tree_free(circtree);
+	lwgeom_free(lwgeom);
+	return LW_SUCCESS;
+}
+
+int
+geography_distance_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double *distance)
+{
+	return geography_tree_distance(fcinfo, g1, g2, s, 0.0, distance);
+}
+
+int
+geography_dwithin_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double tolerance, int *dwithin)
+{
+	double distance;
+
+	if ( geography_tree_distance(fcinfo, g1, g2, s, tolerance, &distance) == LW_FAILURE )
+		return LW_FAILURE;
+
+	*dwithin = (distance <= tolerance ? LW_TRUE : LW_FALSE);
+	return LW_SUCCESS;
+}
+
+/*
+** Return LW_TRUE if every member of the (multi)point or collection
+** of points is a non-empty point, the only input for which the
+** indexed test below matches lwgeom_covers_lwgeom_sphere.
+*/
+static int
+lwgeom_is_points_only(const LWGEOM* lwgeom)
+{
+	int i;
+
+	if ( lwgeom->type == POINTTYPE )
+		return ! lwgeom_is_empty(lwgeom);
+
+	if ( lwtype_is_collection(lwgeom->type) )
+	{
+		const LWCOLLECTION* col = (LWCOLLECTION*)lwgeom;
+		for ( i = 0; i < col->ngeoms; i++ )
+		{
+			if ( ! lwgeom_is_points_only(col->geoms[i]) )
+				return LW_FALSE;
+		}
+		return LW_TRUE;
+	}
+
+	return LW_FALSE;
+}
+
+/*
+** Every point of the (multi)point or collection of points has to be
+** covered by the indexed polygon.
+*/
+static int
+circ_tree_covers_lwgeom(const CIRC_NODE* tree, const LWGEOM* lwgeom)
+{
+	const LWCOLLECTION* col;
+	int i;
+
+	if ( lwgeom->type == POINTTYPE )
+	{
+		POINT2D pt;
+		getPoint2d_p(((LWPOINT*)lwgeom)->point, 0, &pt);
+		return circ_tree_contains_point(tree, &pt);
+	}
+
+	/* lwgeom_is_points_only() lets only collections of points through */
+	col = (LWCOLLECTION*)lwgeom;
+	for ( i = 0; i < col->ngeoms; i++ )
+	{
+		if ( ! circ_tree_covers_lwgeom(tree, col->geoms[i]) )
+			return LW_FALSE;
+	}
+	return LW_TRUE;
+}
+
+int
+geography_covers_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, int *covers)
+{
+	CircTreeGeomCache* tree_cache;
+	LWGEOM* lwgeom;
+
+	/*
+	** lwgeom_covers_lwgeom_sphere wants a single member of a multipolygon
+	** to cover all the points, while the tree only tells whether each
+	** point is in any of them, so only index plain polygons.
+	*/
+	if ( gserialized_get_type(g1) != POLYGONTYPE )
+		return LW_FAILURE;
+
+	tree_cache = GetCircTreeGeomCache(fcinfo, g1, NULL);
+
+	if ( ! tree_cache || tree_cache->argnum != 1 || ! tree_cache->index )
+		return LW_FAILURE;
+
+	lwgeom = lwgeom_from_gserialized(g2);
+
+	/* EMPTY never intersects with another geometry */
+	if ( lwgeom_is_empty(lwgeom) )
+	{
+		*covers = LW_FALSE;
+	}
+	/* Leave empty members and other oddities to the brute force path */
+	else if ( ! lwgeom_is_points_only(lwgeom) )
+	{
+		lwgeom_free(lwgeom);
+		return LW_FAILURE;
+	}
+	else
+	{
+		*covers = circ_tree_covers_lwgeom(tree_cache->index, lwgeom);
+	}
+
+	lwgeom_free(lwgeom);
+	return LW_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#ifndef GEOGRAPHY_MEASUREMENT_TREES_H_
+#define GEOGRAPHY_MEASUREMENT_TREES_H_ 1
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "liblwgeom.h"
+#include "lwgeodetic_tree.h"
+
+/*
+** Cache structure. Like the PrepGeomCache we keep copies of the
+** GSERIALIZED arguments to memcmp against the next call's arguments,
+** and only build the index when an argument shows up a second time.
+** The LWGEOM is deserialized from the cached copy, and the leaves of
+** the CIRC_NODE tree point into its coordinates, so all three live
+** and die together in the function memory context.
+*/
+typedef struct
+{
+	char                          type;
+	GSERIALIZED                   *geom1;
+	GSERIALIZED                   *geom2;
+	size_t                        geom1_size;
+	size_t                        geom2_size;
+	int32                         argnum;
+	LWGEOM                        *lwgeom;
+	CIRC_NODE                     *index;
+}
+CircTreeGeomCache;
+
+/*
+** Get the current cache, given the input geographies.
+** Function will create cache if none exists, and build the index
+** in cache if necessary, or pull an existing cache if possible.
+*/
+CircTreeGeomCache* GetCircTreeGeomCache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2);
+
+/*
+** Calculate distance and dwithin using the cached index of one of the
+** arguments. Return LW_FAILURE if the arguments are not cached (yet),
+** in which case the caller should fall back to the brute-force path.
+*/
+int geography_distance_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double *distance);
+int geography_dwithin_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double tolerance, int *dwithin);
+
+/*
+** Calculate covers using the cached index of the first argument, when
+** it is a polygon. Return LW_FAILURE if it is not cached (yet).
+*/
+int geography_covers_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, int *covers);
+
+#endif /* GEOGRAPHY_MEASUREMENT_TREES_H_ 1 */
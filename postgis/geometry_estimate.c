@@ -27,6 +27,7 @@
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"       /* For debugging macros. */
 #include "gserialized_gist.h" /* For index common functions */
+#include "gserialized_histogram.h"
 
 
 #include <math.h>
@@ -39,56 +40,6 @@
 #include <errno.h>
 #include <ctype.h>
 
-/**
- * 	Assign a number to the postgis statistics kind
- *
- * 	tgl suggested:
- *
- * 	1-100:	reserved for assignment by the core Postgres project
- * 	100-199: reserved for assignment by PostGIS
- * 	200-9999: reserved for other globally-known stats kinds
- * 	10000-32767: reserved for private site-local use
- *
- */
-#define STATISTIC_KIND_GEOMETRY 100
-
-/*
- * Define this if you want to use standard deviation based
- * histogram extent computation. If you do, you can also
- * tweak the deviation factor used in computation with
- * SDFACTOR.
- */
-#define USE_STANDARD_DEVIATION 1
-#define SDFACTOR 3.25
-
-typedef struct GEOM_STATS_T
-{
-	/* cols * rows = total boxes in grid */
-	float4 cols;
-	float4 rows;
-
-	/* average bounding box area of not-null features */
-	float4 avgFeatureArea;
-
-	/*
-	 * average number of histogram cells
-	 * covered by the sample not-null features
-	 */
-	float4 avgFeatureCells;
-
-	/* BOX of area */
-	float4 xmin,ymin, xmax, ymax;
-
-	/*
-	 * variable length # of floats for histogram
-	 */
-	float4 value[1];
-}
-GEOM_STATS;
-
-static float8 estimate_selectivity(GBOX *box, GEOM_STATS *geomstats);
-
-
 #define SHOW_DIGS_DOUBLE 15
 #define MAX_DIGS_DOUBLE (SHOW_DIGS_DOUBLE + 6 + 1 + 3 +1)
 
@@ -132,32 +83,6 @@ Datum geometry_gist_joinsel(PG_FUNCTION_ARGS)
 
 #else /* REALLY_DO_JOINSEL */
 
-static int
-calculate_column_intersection(GBOX *search_box, GEOM_STATS *geomstats1, GEOM_STATS *geomstats2)
-{
-	/**
-	* Calculate the intersection of two columns from their geomstats extents - return true
-	* if a valid intersection was found, false if there is no overlap
-	*/
-
-	float8 i_xmin = Max(geomstats1->xmin, geomstats2->xmin);
-	float8 i_ymin = Max(geomstats1->ymin, geomstats2->ymin);
-	float8 i_xmax = Min(geomstats1->xmax, geomstats2->xmax);
-	float8 i_ymax = Min(geomstats1->ymax, geomstats2->ymax);
-
-	/* If the rectangles don't intersect, return false */
-	if (i_xmin > i_xmax || i_ymin > i_ymax)
-		return FALSE;
-
-	/* Otherwise return the rectangle in search_box */
-	search_box->xmin = i_xmin;
-	search_box->ymin = i_ymin;
-	search_box->xmax = i_xmax;
-	search_box->ymax = i_ymax;
-
-	return TRUE;
-}
-
 /**
 * JOIN selectivity in the GiST && operator
 * for all PG versions
@@ -175,27 +100,16 @@ Datum geometry_gist_joinsel_2d(PG_FUNCTION_ARGS)
 	Var *var1, *var2;
 	Oid relid1, relid2;
 
-	HeapTuple stats1_tuple, stats2_tuple, class_tuple;
-	GEOM_STATS *geomstats1, *geomstats2;
-	/*
-	* These are to avoid casting the corresponding
-	* "type-punned" pointers, which would break
-	* "strict-aliasing rules".
-	*/
-	GEOM_STATS **gs1ptr=&geomstats1, **gs2ptr=&geomstats2;
-	int geomstats1_nvalues = 0, geomstats2_nvalues = 0;
-	float8 selectivity1 = 0.0, selectivity2 = 0.0;
-	float4 num1_tuples = 0.0, num2_tuples = 0.0;
-	float4 total_tuples = 0.0, rows_returned = 0.0;
-	GBOX search_box;
+	BOX_HISTOGRAM *hist1, *hist2;
+	float8 selectivity;
 
 
 	/**
-	* Join selectivity algorithm. To calculation the selectivity we
-	* calculate the intersection of the two column sample extents,
-	* sum the results, and then multiply by two since for each
-	* geometry in col 1 that intersects a geometry in col 2, the same
-	* will also be true.
+	* Join selectivity algorithm. The histograms of the two columns
+	* give, for every pair of buckets, the chance that a box of one
+	* overlaps a box of the other. Summed over all the pairs, this
+	* is the fraction of the rows of the cross product that pass
+	* the && operator, which is what the planner wants.
 	*/
 
 
@@ -230,384 +144,38 @@ Datum geometry_gist_joinsel_2d(PG_FUNCTION_ARGS)
 
 	POSTGIS_DEBUGF(3, "Working with relations oids: %d %d", relid1, relid2);
 
-	/* Read the stats tuple from the first column */
-	stats1_tuple = SearchSysCache(STATRELATT, ObjectIdGetDatum(relid1), Int16GetDatum(var1->varattno), 0, 0);
-	if ( ! stats1_tuple )
-	{
-		POSTGIS_DEBUG(3, " No statistics, returning default geometry join selectivity");
-
-		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_JOINSEL);
-	}
-
-
-
-	if ( ! get_attstatsslot(stats1_tuple, 0, 0, STATISTIC_KIND_GEOMETRY, InvalidOid, NULL, NULL,
-#if POSTGIS_PGSQL_VERSION > 84
-	                        NULL,
-#endif
-	                        (float4 **)gs1ptr, &geomstats1_nvalues) )
+	/* Read the histograms of both columns */
+	hist1 = box_histogram_fetch(relid1, var1->varattno, STATISTIC_KIND_GEOMETRY);
+	if ( ! hist1 )
 	{
 		POSTGIS_DEBUG(3, " STATISTIC_KIND_GEOMETRY stats not found - returning default geometry join selectivity");
 
-		ReleaseSysCache(stats1_tuple);
-		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_JOINSEL);
-	}
-
-
-	/* Read the stats tuple from the second column */
-	stats2_tuple = SearchSysCache(STATRELATT, ObjectIdGetDatum(relid2), Int16GetDatum(var2->varattno), 0, 0);
-	if ( ! stats2_tuple )
-	{
-		POSTGIS_DEBUG(3, " No statistics, returning default geometry join selectivity");
-
-		free_attstatsslot(0, NULL, 0, (float *)geomstats1,
-		                  geomstats1_nvalues);
-		ReleaseSysCache(stats1_tuple);
 		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_JOINSEL);
 	}
 
-
-	if ( ! get_attstatsslot(stats2_tuple, 0, 0, STATISTIC_KIND_GEOMETRY, InvalidOid, NULL, NULL,
-#if POSTGIS_PGSQL_VERSION > 84
-	                        NULL,
-#endif
-	                        (float4 **)gs2ptr, &geomstats2_nvalues) )
+	hist2 = box_histogram_fetch(relid2, var2->varattno, STATISTIC_KIND_GEOMETRY);
+	if ( ! hist2 )
 	{
 		POSTGIS_DEBUG(3, " STATISTIC_KIND_GEOMETRY stats not found - returning default geometry join selectivity");
 
-		free_attstatsslot(0, NULL, 0, (float *)geomstats1,
-		                  geomstats1_nvalues);
-		ReleaseSysCache(stats2_tuple);
-		ReleaseSysCache(stats1_tuple);
+		pfree(hist1);
 		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_JOINSEL);
 	}
 
+	POSTGIS_DEBUGF(3, " -- hist1 extent: %.15g %.15g, %.15g %.15g", hist1->min[0], hist1->min[1], hist1->max[0], hist1->max[1]);
+	POSTGIS_DEBUGF(3, " -- hist2 extent: %.15g %.15g, %.15g %.15g", hist2->min[0], hist2->min[1], hist2->max[0], hist2->max[1]);
 
-	/**
-	* Setup the search box - this is the intersection of the two column
-	* extents.
-	*/
-	calculate_column_intersection(&search_box, geomstats1, geomstats2);
-
-	POSTGIS_DEBUGF(3, " -- geomstats1 box: %.15g %.15g, %.15g %.15g",geomstats1->xmin,geomstats1->ymin,geomstats1->xmax,geomstats1->ymax);
-	POSTGIS_DEBUGF(3, " -- geomstats2 box: %.15g %.15g, %.15g %.15g",geomstats2->xmin,geomstats2->ymin,geomstats2->xmax,geomstats2->ymax);
-	POSTGIS_DEBUGF(3, " -- calculated intersection box is : %.15g %.15g, %.15g %.15g",search_box.xmin,search_box.ymin,search_box.xmax,search_box.ymax);
-
-
-	/* Do the selectivity */
-	selectivity1 = estimate_selectivity(&search_box, geomstats1);
-	selectivity2 = estimate_selectivity(&search_box, geomstats2);
-
-	POSTGIS_DEBUGF(3, "selectivity1: %.15g   selectivity2: %.15g", selectivity1, selectivity2);
-
-	/* Free the statistic tuples */
-	free_attstatsslot(0, NULL, 0, (float *)geomstats1, geomstats1_nvalues);
-	ReleaseSysCache(stats1_tuple);
-
-	free_attstatsslot(0, NULL, 0, (float *)geomstats2, geomstats2_nvalues);
-	ReleaseSysCache(stats2_tuple);
-
-	/*
-	* OK, so before we calculate the join selectivity we also need to
-	* know the number of tuples in each of the columns since
-	* estimate_selectivity returns the number of estimated tuples
-	* divided by the total number of tuples - hence we need to
-	* multiply out the returned selectivity by the total number of rows.
-	*/
-	class_tuple = SearchSysCache(RELOID, ObjectIdGetDatum(relid1),
-	                             0, 0, 0);
-
-	if (HeapTupleIsValid(class_tuple))
-	{
-		Form_pg_class reltup = (Form_pg_class) GETSTRUCT(class_tuple);
-		num1_tuples = reltup->reltuples;
-	}
-
-	ReleaseSysCache(class_tuple);
-
-
-	class_tuple = SearchSysCache(RELOID, ObjectIdGetDatum(relid2),
-	                             0, 0, 0);
-
-	if (HeapTupleIsValid(class_tuple))
-	{
-		Form_pg_class reltup = (Form_pg_class) GETSTRUCT(class_tuple);
-		num2_tuples = reltup->reltuples;
-	}
-
-	ReleaseSysCache(class_tuple);
-
-
-	/*
-	* Finally calculate the estimate of the number of rows returned
-	*
-	*    = 2 * (nrows from col1 + nrows from col2) /
-	*	total nrows in col1 x total nrows in col2
-	*
-	* The factor of 2 accounts for the fact that for each tuple in
-	* col 1 matching col 2,
-	* there will be another match in col 2 matching col 1
-	*/
-
-	total_tuples = num1_tuples * num2_tuples;
-	rows_returned = 2 * ((num1_tuples * selectivity1) +
-	                     (num2_tuples * selectivity2));
-
-	POSTGIS_DEBUGF(3, "Rows from rel1: %g", num1_tuples * selectivity1);
-	POSTGIS_DEBUGF(3, "Rows from rel2: %g", num2_tuples * selectivity2);
-	POSTGIS_DEBUGF(3, "Estimated rows returned: %g", rows_returned);
-
-	/*
-	* One (or both) tuple count is zero...
-	* We return default selectivity estimate.
-	* We could probably attempt at an estimate
-	* w/out looking at tables tuple count, with
-	* a function of selectivity1, selectivity2.
-	*/
-	if ( ! total_tuples )
-	{
-		POSTGIS_DEBUG(3, "Total tuples == 0, returning default join selectivity");
+	selectivity = box_histogram_join_selectivity(hist1, hist2);
 
-		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_JOINSEL);
-	}
+	POSTGIS_DEBUGF(3, " returning computed value: %.15g", selectivity);
 
-	if ( rows_returned > total_tuples )
-		PG_RETURN_FLOAT8(1.0);
-
-	PG_RETURN_FLOAT8(rows_returned / total_tuples);
+	pfree(hist1);
+	pfree(hist2);
+	PG_RETURN_FLOAT8(selectivity);
 }
 
 #endif /* REALLY_DO_JOINSEL */
 
-/**************************** FROM POSTGIS ****************/
-
-
-/**
- * This function returns an estimate of the selectivity
- * of a search_box looking at data in the GEOM_STATS
- * structure.
- * */
-/**
-* TODO: handle box dimension collapses (probably should be handled
-* by the statistic generator, avoiding GEOM_STATS with collapsed
-* dimensions)
-*/
-static float8
-estimate_selectivity(GBOX *box, GEOM_STATS *geomstats)
-{
-	int x, y;
-	int x_idx_min, x_idx_max, y_idx_min, y_idx_max;
-	double intersect_x, intersect_y, AOI;
-	double cell_area, box_area;
-	double geow, geoh; /* width and height of histogram */
-	int histocols, historows; /* histogram grid size */
-	double value;
-	float overlapping_cells;
-	float avg_feat_cells;
-	double gain;
-	float8 selectivity;
-
-
-	/*
-	 * Search box completely miss histogram extent
-	 */
-	if ( box->xmax < geomstats->xmin ||
-	        box->xmin > geomstats->xmax ||
-	        box->ymax < geomstats->ymin ||
-	        box->ymin > geomstats->ymax )
-	{
-		POSTGIS_DEBUG(3, " search_box does not overlaps histogram, returning 0");
-
-		return 0.0;
-	}
-
-	/*
-	 * Search box completely contains histogram extent
-	 */
-	if ( box->xmax >= geomstats->xmax &&
-	        box->xmin <= geomstats->xmin &&
-	        box->ymax >= geomstats->ymax &&
-	        box->ymin <= geomstats->ymin )
-	{
-		POSTGIS_DEBUG(3, " search_box contains histogram, returning 1");
-
-		return 1.0;
-	}
-
-	geow = geomstats->xmax-geomstats->xmin;
-	geoh = geomstats->ymax-geomstats->ymin;
-
-	histocols = geomstats->cols;
-	historows = geomstats->rows;
-
-	POSTGIS_DEBUGF(3, " histogram has %d cols, %d rows", histocols, historows);
-	POSTGIS_DEBUGF(3, " histogram geosize is %fx%f", geow, geoh);
-
-	cell_area = (geow*geoh) / (histocols*historows);
-	box_area = (box->xmax-box->xmin)*(box->ymax-box->ymin);
-	value = 0;
-
-	/* Find first overlapping column */
-	x_idx_min = (box->xmin-geomstats->xmin) / geow * histocols;
-	if (x_idx_min < 0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the left of histogram grid", -x_idx_min);
-
-		/* should increment the value somehow */
-		x_idx_min = 0;
-	}
-	if (x_idx_min >= histocols)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the right of histogram grid", x_idx_min-histocols+1);
-
-		/* should increment the value somehow */
-		x_idx_min = histocols-1;
-	}
-
-	/* Find first overlapping row */
-	y_idx_min = (box->ymin-geomstats->ymin) / geoh * historows;
-	if (y_idx_min <0)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the bottom of histogram grid", -y_idx_min);
-
-		/* should increment the value somehow */
-		y_idx_min = 0;
-	}
-	if (y_idx_min >= historows)
-	{
-		POSTGIS_DEBUGF(3, " search_box overlaps %d columns on the top of histogram grid", y_idx_min-historows+1);
-
-		/* should increment the value somehow */
-		y_idx_min = historows-1;
-	}
-
-	/* Find last overlapping column */
-	x_idx_max = (box->xmax-geomstats->xmin) / geow * histocols;
-	if (x_idx_max <0)
-	{
-		/* should increment the value somehow */
-		x_idx_max = 0;
-	}
-	if (x_idx_max >= histocols )
-	{
-		/* should increment the value somehow */
-		x_idx_max = histocols-1;
-	}
-
-	/* Find last overlapping row */
-	y_idx_max = (box->ymax-geomstats->ymin) / geoh * historows;
-	if (y_idx_max <0)
-	{
-		/* should increment the value somehow */
-		y_idx_max = 0;
-	}
-	if (y_idx_max >= historows)
-	{
-		/* should increment the value somehow */
-		y_idx_max = historows-1;
-	}
-
-	/*
-	 * the {x,y}_idx_{min,max}
-	 * define the grid squares that the box intersects
-	 */
-	for (y=y_idx_min; y<=y_idx_max; y++)
-	{
-		for (x=x_idx_min; x<=x_idx_max; x++)
-		{
-			double val;
-			double gain;
-
-			val = geomstats->value[x+y*histocols];
-
-			/*
-			 * Of the cell value we get
-			 * only the overlap fraction.
-			 */
-
-			intersect_x = Min(box->xmax, geomstats->xmin + (x+1) * geow / histocols) - Max(box->xmin, geomstats->xmin + x * geow / histocols );
-			intersect_y = Min(box->ymax, geomstats->ymin + (y+1) * geoh / historows) - Max(box->ymin, geomstats->ymin+ y * geoh / historows) ;
-
-			AOI = intersect_x*intersect_y;
-			gain = AOI/cell_area;
-
-			POSTGIS_DEBUGF(4, " [%d,%d] cell val %.15f",
-			               x, y, val);
-			POSTGIS_DEBUGF(4, " [%d,%d] AOI %.15f",
-			               x, y, AOI);
-			POSTGIS_DEBUGF(4, " [%d,%d] gain %.15f",
-			               x, y, gain);
-
-			val *= gain;
-
-			POSTGIS_DEBUGF(4, " [%d,%d] adding %.15f to value",
-			               x, y, val);
-
-			value += val;
-		}
-	}
-
-
-	/*
-	 * If the search_box is a point, it will
-	 * overlap a single cell and thus get
-	 * it's value, which is the fraction of
-	 * samples (we can presume of row set also)
-	 * which bumped to that cell.
-	 *
-	 * If the table features are points, each
-	 * of them will overlap a single histogram cell.
-	 * Our search_box value would then be correctly
-	 * computed as the sum of the bumped cells values.
-	 *
-	 * If both our search_box AND the sample features
-	 * overlap more then a single histogram cell we
-	 * need to consider the fact that our sum computation
-	 * will have many duplicated included. E.g. each
-	 * single sample feature would have contributed to
-	 * raise the search_box value by as many times as
-	 * many cells in the histogram are commonly overlapped
-	 * by both search_box and feature. We should then
-	 * divide our value by the number of cells in the virtual
-	 * 'intersection' between average feature cell occupation
-	 * and occupation of the search_box. This is as
-	 * fuzzy as you understand it :)
-	 *
-	 * Consistency check: whenever the number of cells is
-	 * one of whichever part (search_box_occupation,
-	 * avg_feature_occupation) the 'intersection' must be 1.
-	 * If sounds that our 'intersaction' is actually the
-	 * minimun number between search_box_occupation and
-	 * avg_feat_occupation.
-	 *
-	 */
-	overlapping_cells = (x_idx_max-x_idx_min+1) *
-	                    (y_idx_max-y_idx_min+1);
-	avg_feat_cells = geomstats->avgFeatureCells;
-
-	POSTGIS_DEBUGF(3, " search_box overlaps %f cells", overlapping_cells);
-	POSTGIS_DEBUGF(3, " avg feat overlaps %f cells", avg_feat_cells);
-
-	if ( ! overlapping_cells )
-	{
-		POSTGIS_DEBUG(3, " no overlapping cells, returning 0.0");
-
-		return 0.0;
-	}
-
-	gain = 1/Min(overlapping_cells, avg_feat_cells);
-	selectivity = value*gain;
-
-	POSTGIS_DEBUGF(3, " SUM(ov_histo_cells)=%f", value);
-	POSTGIS_DEBUGF(3, " gain=%f", gain);
-	POSTGIS_DEBUGF(3, " selectivity=%f", selectivity);
-
-	/* prevent rounding overflows */
-	if (selectivity > 1.0) selectivity = 1.0;
-	else if (selectivity < 0) selectivity = 0.0;
-
-	return selectivity;
-}
 
 /**
  * This function should return an estimation of the number of
@@ -617,7 +185,7 @@ estimate_selectivity(GBOX *box, GEOM_STATS *geomstats)
  * It can make use (if available) of the statistics collected
  * by the geometry analyzer function.
  *
- * Note that the good work is done by estimate_selectivity() above.
+ * Note that the good work is done by box_histogram_selectivity().
  * This function just tries to find the search_box, loads the statistics
  * and invoke the work-horse.
  *
@@ -633,15 +201,7 @@ Datum geometry_gist_sel_2d(PG_FUNCTION_ARGS)
 	List *args = (List *) PG_GETARG_POINTER(2);
 	/* int varRelid = PG_GETARG_INT32(3); */
 	Oid relid;
-	HeapTuple stats_tuple;
-	GEOM_STATS *geomstats;
-	/*
-	 * This is to avoid casting the corresponding
-	 * "type-punned" pointer, which would break
-	 * "strict-aliasing rules".
-	 */
-	GEOM_STATS **gsptr=&geomstats;
-	int geomstats_nvalues=0;
+	BOX_HISTOGRAM *hist;
 	Node *other;
 	Var *self;
 	GBOX search_box;
@@ -705,53 +265,32 @@ Datum geometry_gist_sel_2d(PG_FUNCTION_ARGS)
 	POSTGIS_DEBUGF(4, " requested search box is : %.15g %.15g, %.15g %.15g",search_box.xmin,search_box.ymin,search_box.xmax,search_box.ymax);
 
 	/*
-	 * Get pg_statistic row
+	 * Get the histogram of the column
 	 */
 
 	relid = getrelid(self->varno, root->parse->rtable);
 
-	stats_tuple = SearchSysCache(STATRELATT, ObjectIdGetDatum(relid), Int16GetDatum(self->varattno), 0, 0);
-	if ( ! stats_tuple )
-	{
-		POSTGIS_DEBUG(3, " No statistics, returning default estimate");
-
-		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_SEL);
-	}
-
-
-	if ( ! get_attstatsslot(stats_tuple, 0, 0, STATISTIC_KIND_GEOMETRY, InvalidOid, NULL, NULL,
-#if POSTGIS_PGSQL_VERSION >= 85
-	                        NULL,
-#endif
-	                        (float4 **)gsptr, &geomstats_nvalues) )
+	hist = box_histogram_fetch(relid, self->varattno, STATISTIC_KIND_GEOMETRY);
+	if ( ! hist )
 	{
 		POSTGIS_DEBUG(3, " STATISTIC_KIND_GEOMETRY stats not found - returning default geometry selectivity");
 
-		ReleaseSysCache(stats_tuple);
 		PG_RETURN_FLOAT8(DEFAULT_GEOMETRY_SEL);
 	}
 
-	POSTGIS_DEBUGF(4, " %d read from stats", geomstats_nvalues);
-
-	POSTGIS_DEBUGF(4, " histo: xmin,ymin: %f,%f",
-	               geomstats->xmin, geomstats->ymin);
-	POSTGIS_DEBUGF(4, " histo: xmax,ymax: %f,%f",
-	               geomstats->xmax, geomstats->ymax);
-	POSTGIS_DEBUGF(4, " histo: cols: %f", geomstats->rows);
-	POSTGIS_DEBUGF(4, " histo: rows: %f", geomstats->cols);
-	POSTGIS_DEBUGF(4, " histo: avgFeatureArea: %f", geomstats->avgFeatureArea);
-	POSTGIS_DEBUGF(4, " histo: avgFeatureCells: %f", geomstats->avgFeatureCells);
+	POSTGIS_DEBUGF(4, " histo: xmin,ymin: %f,%f", hist->min[0], hist->min[1]);
+	POSTGIS_DEBUGF(4, " histo: xmax,ymax: %f,%f", hist->max[0], hist->max[1]);
+	POSTGIS_DEBUGF(4, " histo: buckets: %f", hist->nbuckets);
 
 	/*
 	 * Do the estimation
 	 */
-	selectivity = estimate_selectivity(&search_box, geomstats);
+	selectivity = box_histogram_selectivity(hist, &search_box);
 
 
 	POSTGIS_DEBUGF(3, " returning computed value: %f", selectivity);
 
-	free_attstatsslot(0, NULL, 0, (float *)geomstats, geomstats_nvalues);
-	ReleaseSysCache(stats_tuple);
+	pfree(hist);
 	PG_RETURN_FLOAT8(selectivity);
 
 }
@@ -780,29 +319,12 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 {
 	MemoryContext old_context;
 	int i;
-	int geom_stats_size;
 	GBOX **sampleboxes;
-	GEOM_STATS *geomstats;
+	BOX_HISTOGRAM *hist;
 	bool isnull;
-	int null_cnt=0, notnull_cnt=0, examinedsamples=0;
-	GBOX *sample_extent=NULL;
+	int null_cnt=0, notnull_cnt=0;
 	double total_width=0;
-	double total_boxes_area=0;
-	int total_boxes_cells=0;
-	double cell_area;
-	double cell_width;
-	double cell_height;
-#if USE_STANDARD_DEVIATION
-	/* for standard deviation */
-	double avgLOWx, avgLOWy, avgHIGx, avgHIGy;
-	double sumLOWx=0, sumLOWy=0, sumHIGx=0, sumHIGy=0;
-	double sdLOWx=0, sdLOWy=0, sdHIGx=0, sdHIGy=0;
-	GBOX *newhistobox=NULL;
-#endif
-	double geow, geoh; /* width and height of histogram */
-	int histocells;
-	int cols, rows; /* histogram grid size */
-	GBOX histobox;
+	int nbuckets;
 
 	/*
 	 * This is where geometry_analyze
@@ -811,16 +333,17 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	/* void *mystats = stats->extra_data; */
 
 	/*
-	 * We'll build an histogram having from 40 to 400 boxesPerSide
-	 * Total number of cells is determined by attribute stat
-	 * target. It can go from  1600 to 160000 (stat target: 10,1000)
+	 * We'll build an histogram of 4 buckets per unit of stat
+	 * target (400 for the default target of 100), up to
+	 * HISTOGRAM_MAX_BUCKETS (reached at a target of 1000), of
+	 * about the same number of sample boxes each.
 	 */
-	histocells = 160*stats->attr->attstattarget;
+	nbuckets = Min(4*stats->attr->attstattarget, HISTOGRAM_MAX_BUCKETS);
 
 
 	POSTGIS_DEBUG(2, "compute_geometry_stats called");
 	POSTGIS_DEBUGF(3, " samplerows: %d", samplerows);
-	POSTGIS_DEBUGF(3, " histogram cells: %d", histocells);
+	POSTGIS_DEBUGF(3, " histogram buckets: %d", nbuckets);
 
 	/*
 	 * We might need less space, but don't think
@@ -829,12 +352,10 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	sampleboxes = palloc(sizeof(GBOX *)*samplerows);
 
 	/*
-	 * First scan:
-	 *  o find extent of the sample rows
+	 * Scan the sample:
+	 *  o collect the boxes of the sample rows
 	 *  o count null-infinite/not-null values
 	 *  o compute total_width
-	 *  o compute total features's box area (for avgFeatureArea)
-	 *  o sum features box coordinates (for standard deviation)
 	 */
 	for (i=0; i<samplerows; i++)
 	{
@@ -878,45 +399,12 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 
 		/*
 		 * Cache bounding box
-		 * TODO: reduce BOX2DFLOAT4 copies
 		 */
 		sampleboxes[notnull_cnt] = palloc(sizeof(GBOX));
 		memcpy(sampleboxes[notnull_cnt], &box, sizeof(GBOX));
 
-		/*
-		 * Add to sample extent union
-		 */
-		if ( ! sample_extent )
-		{
-			sample_extent = palloc(sizeof(GBOX));
-			memcpy(sample_extent, &box, sizeof(GBOX));
-		}
-		else
-		{
-			sample_extent->xmax = Max(sample_extent->xmax,
-			                                  box.xmax);
-			sample_extent->ymax = Max(sample_extent->ymax,
-			                                  box.ymax);
-			sample_extent->xmin = Min(sample_extent->xmin,
-			                                  box.xmin);
-			sample_extent->ymin = Min(sample_extent->ymin,
-			                                  box.ymin);
-		}
-
 		/** TODO: ask if we need geom or bvol size for stawidth */
 		total_width += geom->size;
-		total_boxes_area += (box.xmax-box.xmin)*(box.ymax-box.ymin);
-
-#if USE_STANDARD_DEVIATION
-		/*
-		 * Add bvol coordinates to sum for standard deviation
-		 * computation.
-		 */
-		sumLOWx += box.xmin;
-		sumLOWy += box.ymin;
-		sumHIGx += box.xmax;
-		sumHIGy += box.ymax;
-#endif
 
 		notnull_cnt++;
 
@@ -932,318 +420,28 @@ compute_geometry_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 		return;
 	}
 
-#if USE_STANDARD_DEVIATION
-
-	POSTGIS_DEBUGF(3, " sample_extent: xmin,ymin: %f,%f",
-	               sample_extent->xmin, sample_extent->ymin);
-	POSTGIS_DEBUGF(3, " sample_extent: xmax,ymax: %f,%f",
-	               sample_extent->xmax, sample_extent->ymax);
-
-	/*
-	 * Second scan:
-	 *  o compute standard deviation
-	 */
-	avgLOWx = sumLOWx/notnull_cnt;
-	avgLOWy = sumLOWy/notnull_cnt;
-	avgHIGx = sumHIGx/notnull_cnt;
-	avgHIGy = sumHIGy/notnull_cnt;
-	for (i=0; i<notnull_cnt; i++)
-	{
-		GBOX *box;
-		box = (GBOX *)sampleboxes[i];
-
-		sdLOWx += (box->xmin - avgLOWx) * (box->xmin - avgLOWx);
-		sdLOWy += (box->ymin - avgLOWy) * (box->ymin - avgLOWy);
-		sdHIGx += (box->xmax - avgHIGx) * (box->xmax - avgHIGx);
-		sdHIGy += (box->ymax - avgHIGy) * (box->ymax - avgHIGy);
-	}
-	sdLOWx = sqrt(sdLOWx/notnull_cnt);
-	sdLOWy = sqrt(sdLOWy/notnull_cnt);
-	sdHIGx = sqrt(sdHIGx/notnull_cnt);
-	sdHIGy = sqrt(sdHIGy/notnull_cnt);
-
-	POSTGIS_DEBUG(3, " standard deviations:");
-	POSTGIS_DEBUGF(3, "  LOWx - avg:%f sd:%f", avgLOWx, sdLOWx);
-	POSTGIS_DEBUGF(3, "  LOWy - avg:%f sd:%f", avgLOWy, sdLOWy);
-	POSTGIS_DEBUGF(3, "  HIGx - avg:%f sd:%f", avgHIGx, sdHIGx);
-	POSTGIS_DEBUGF(3, "  HIGy - avg:%f sd:%f", avgHIGy, sdHIGy);
-
-	histobox.xmin = Max((avgLOWx - SDFACTOR * sdLOWx),
-	                       sample_extent->xmin);
-	histobox.ymin = Max((avgLOWy - SDFACTOR * sdLOWy),
-	                       sample_extent->ymin);
-	histobox.xmax = Min((avgHIGx + SDFACTOR * sdHIGx),
-	                       sample_extent->xmax);
-	histobox.ymax = Min((avgHIGy + SDFACTOR * sdHIGy),
-	                       sample_extent->ymax);
-
-	POSTGIS_DEBUGF(3, " sd_extent: xmin,ymin: %f,%f",
-	               histobox.xmin, histobox.ymin);
-	POSTGIS_DEBUGF(3, " sd_extent: xmax,ymax: %f,%f",
-	               histobox.xmin, histobox.ymax);
-
-	/*
-	 * Third scan:
-	 *   o skip hard deviants
-	 *   o compute new histogram box
-	 */
-	for (i=0; i<notnull_cnt; i++)
-	{
-		GBOX *box;
-		box = (GBOX *)sampleboxes[i];
-
-		if ( box->xmin > histobox.xmax ||
-		        box->xmax < histobox.xmin ||
-		        box->ymin > histobox.ymax ||
-		        box->ymax < histobox.ymin )
-		{
-			POSTGIS_DEBUGF(4, " feat %d is an hard deviant, skipped", i);
-
-			sampleboxes[i] = NULL;
-			continue;
-		}
-		if ( ! newhistobox )
-		{
-			newhistobox = palloc(sizeof(GBOX));
-			memcpy(newhistobox, box, sizeof(GBOX));
-		}
-		else
-		{
-			if ( box->xmin < newhistobox->xmin )
-				newhistobox->xmin = box->xmin;
-			if ( box->ymin < newhistobox->ymin )
-				newhistobox->ymin = box->ymin;
-			if ( box->xmax > newhistobox->xmax )
-				newhistobox->xmax = box->xmax;
-			if ( box->ymax > newhistobox->ymax )
-				newhistobox->ymax = box->ymax;
-		}
-	}
-
-	/*
-	 * Set histogram extent as the intersection between
-	 * standard deviation based histogram extent
-	 * and computed sample extent after removal of
-	 * hard deviants (there might be no hard deviants).
-	 */
-	if ( histobox.xmin < newhistobox->xmin )
-		histobox.xmin = newhistobox->xmin;
-	if ( histobox.ymin < newhistobox->ymin )
-		histobox.ymin = newhistobox->ymin;
-	if ( histobox.xmax > newhistobox->xmax )
-		histobox.xmax = newhistobox->xmax;
-	if ( histobox.ymax > newhistobox->ymax )
-		histobox.ymax = newhistobox->ymax;
-
-
-#else /* ! USE_STANDARD_DEVIATION */
-
-	/*
-	* Set histogram extent box
-	*/
-	histobox.xmin = sample_extent->xmin;
-	histobox.ymin = sample_extent->ymin;
-	histobox.xmax = sample_extent->xmax;
-	histobox.ymax = sample_extent->ymax;
-#endif /* USE_STANDARD_DEVIATION */
-
-
-	POSTGIS_DEBUGF(3, " histogram_extent: xmin,ymin: %f,%f",
-	               histobox.xmin, histobox.ymin);
-	POSTGIS_DEBUGF(3, " histogram_extent: xmax,ymax: %f,%f",
-	               histobox.xmax, histobox.ymax);
-
-
-	geow = histobox.xmax - histobox.xmin;
-	geoh = histobox.ymax - histobox.ymin;
-
-	/*
-	 * Compute histogram cols and rows based on aspect ratio
-	 * of histogram extent
-	 */
-	if ( ! geow && ! geoh )
-	{
-		cols = 1;
-		rows = 1;
-		histocells = 1;
-	}
-	else if ( ! geow )
-	{
-		cols = 1;
-		rows = histocells;
-	}
-	else if ( ! geoh )
-	{
-		cols = histocells;
-		rows = 1;
-	}
-	else
-	{
-		if ( geow<geoh)
-		{
-			cols = ceil(sqrt((double)histocells*(geow/geoh)));
-			rows = ceil((double)histocells/cols);
-		}
-		else
-		{
-			rows = ceil(sqrt((double)histocells*(geoh/geow)));
-			cols = ceil((double)histocells/rows);
-		}
-		histocells = cols*rows;
-	}
-
-	POSTGIS_DEBUGF(3, " computed histogram grid size (CxR): %dx%d (%d cells)", cols, rows, histocells);
-
-
 	/*
-	 * Create the histogram (GEOM_STATS)
+	 * Build the histogram in the analyze context,
+	 * so that it survives until written out.
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
-	geom_stats_size=sizeof(GEOM_STATS)+(histocells-1)*sizeof(float4);
-	geomstats = palloc(geom_stats_size);
+	hist = box_histogram_build(sampleboxes, notnull_cnt, samplerows, 2, nbuckets);
 	MemoryContextSwitchTo(old_context);
 
-	geomstats->avgFeatureArea = total_boxes_area/notnull_cnt;
-	geomstats->xmin = histobox.xmin;
-	geomstats->ymin = histobox.ymin;
-	geomstats->xmax = histobox.xmax;
-	geomstats->ymax = histobox.ymax;
-	geomstats->cols = cols;
-	geomstats->rows = rows;
-
-	/* Initialize all values to 0 */
-	for (i=0; i<histocells; i++) geomstats->value[i] = 0;
-
-	cell_width = geow/cols;
-	cell_height = geoh/rows;
-	cell_area = cell_width*cell_height;
-
-	POSTGIS_DEBUGF(4, "cell_width: %f", cell_width);
-	POSTGIS_DEBUGF(4, "cell_height: %f", cell_height);
-
-
-	/*
-	 * Fourth scan:
-	 *  o fill histogram values with the number of
-	 *    features' bbox overlaps: a feature's bvol
-	 *    can fully overlap (1) or partially overlap
-	 *    (fraction of 1) an histogram cell.
-	 *
-	 *  o compute total cells occupation
-	 *
-	 */
 	for (i=0; i<notnull_cnt; i++)
-	{
-		GBOX *box;
-		int x_idx_min, x_idx_max, x;
-		int y_idx_min, y_idx_max, y;
-		int numcells=0;
-
-		box = (GBOX *)sampleboxes[i];
-		if ( ! box ) continue; /* hard deviant.. */
-
-		/* give backend a chance of interrupting us */
-		vacuum_delay_point();
-
-		POSTGIS_DEBUGF(4, " feat %d box is %f %f, %f %f",
-		               i, box->xmax, box->ymax,
-		               box->xmin, box->ymin);
-
-		/* Find first overlapping column */
-		x_idx_min = (box->xmin-geomstats->xmin) / geow * cols;
-		if (x_idx_min <0) x_idx_min = 0;
-		if (x_idx_min >= cols) x_idx_min = cols-1;
-
-		/* Find first overlapping row */
-		y_idx_min = (box->ymin-geomstats->ymin) / geoh * rows;
-		if (y_idx_min <0) y_idx_min = 0;
-		if (y_idx_min >= rows) y_idx_min = rows-1;
-
-		/* Find last overlapping column */
-		x_idx_max = (box->xmax-geomstats->xmin) / geow * cols;
-		if (x_idx_max <0) x_idx_max = 0;
-		if (x_idx_max >= cols ) x_idx_max = cols-1;
-
-		/* Find last overlapping row */
-		y_idx_max = (box->ymax-geomstats->ymin) / geoh * rows;
-		if (y_idx_max <0) y_idx_max = 0;
-		if (y_idx_max >= rows) y_idx_max = rows-1;
-
-		POSTGIS_DEBUGF(4, " feat %d overlaps columns %d-%d, rows %d-%d",
-		               i, x_idx_min, x_idx_max, y_idx_min, y_idx_max);
-
-		/*
-		 * the {x,y}_idx_{min,max}
-		 * define the grid squares that the box intersects
-		 */
-		for (y=y_idx_min; y<=y_idx_max; y++)
-		{
-			for (x=x_idx_min; x<=x_idx_max; x++)
-			{
-				geomstats->value[x+y*cols] += 1;
-				numcells++;
-			}
-		}
-
-		/*
-		 * before adding to the total cells
-		 * we could decide if we really
-		 * want this feature to count
-		 */
-		total_boxes_cells += numcells;
-
-		examinedsamples++;
-	}
-
-	POSTGIS_DEBUGF(3, " examined_samples: %d/%d", examinedsamples, samplerows);
-
-	if ( ! examinedsamples )
-	{
-		elog(NOTICE, " no examined values, invalid stats");
-		stats->stats_valid = false;
-
-		POSTGIS_DEBUG(3, " no stats have been gathered");
-
-		return;
-	}
-
-	/** TODO: what about null features (TODO) */
-	geomstats->avgFeatureCells = (float4)total_boxes_cells/examinedsamples;
-
-	POSTGIS_DEBUGF(3, " histo: total_boxes_cells: %d", total_boxes_cells);
-	POSTGIS_DEBUGF(3, " histo: avgFeatureArea: %f", geomstats->avgFeatureArea);
-	POSTGIS_DEBUGF(3, " histo: avgFeatureCells: %f", geomstats->avgFeatureCells);
-
-
-	/*
-	 * Normalize histogram
-	 *
-	 * We divide each histogram cell value
-	 * by the number of samples examined.
-	 *
-	 */
-	for (i=0; i<histocells; i++)
-		geomstats->value[i] /= examinedsamples;
-
-	{
-		int x, y;
-		for (x=0; x<cols; x++)
-		{
-			for (y=0; y<rows; y++)
-			{
-				POSTGIS_DEBUGF(4, " histo[%d,%d] = %.15f", x, y, geomstats->value[x+y*cols]);
-			}
-		}
-	}
+		pfree(sampleboxes[i]);
+	pfree(sampleboxes);
 
+	POSTGIS_DEBUGF(3, " histo: extent: %f,%f %f,%f", hist->min[0], hist->min[1], hist->max[0], hist->max[1]);
+	POSTGIS_DEBUGF(3, " histo: buckets: %d", (int)hist->nbuckets);
 
 	/*
 	 * Write the statistics data
 	 */
 	stats->stakind[0] = STATISTIC_KIND_GEOMETRY;
 	stats->staop[0] = InvalidOid;
-	stats->stanumbers[0] = (float4 *)geomstats;
-	stats->numnumbers[0] = geom_stats_size/sizeof(float4);
+	stats->stanumbers[0] = (float4 *)hist;
+	stats->numnumbers[0] = box_histogram_nvalues(hist);
 
 	stats->stanullfrac = (float4)null_cnt/samplerows;
 	stats->stawidth = total_width/notnull_cnt;
@@ -1327,7 +525,6 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	char *tbl = NULL;
 	char *col = NULL;
 	char *query;
-	ArrayType *array = NULL;
 	int SPIcode;
 	SPITupleTable *tuptable;
 	TupleDesc tupdesc ;
@@ -1335,7 +532,9 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	bool isnull;
 	GBOX *box;
 	size_t querysize;
-	GEOM_STATS geomstats;
+	BOX_HISTOGRAM *hist;
+	Oid relid;
+	AttrNumber attnum;
 	float reltuples;
 	Datum binval;
 
@@ -1429,15 +628,13 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	}
 
 
-	/* Return the stats data */
+	/* Find the column, the histogram is read from the stats cache */
 	if ( txnsp )
 	{
 	  sprintf(query, 
-	    "SELECT s.stanumbers1[5:8], c.reltuples FROM pg_class c"
+	    "SELECT c.oid, a.attnum, c.reltuples FROM pg_class c"
 	    " LEFT OUTER JOIN pg_namespace n ON (n.oid = c.relnamespace)"
 	    " LEFT OUTER JOIN pg_attribute a ON (a.attrelid = c.oid )"
-	    " LEFT OUTER JOIN pg_statistic s ON (s.starelid = c.oid AND "
-	                                        "s.staattnum = a.attnum )"
 	    " WHERE c.relname = '%s' AND a.attname = '%s' "
 	    " AND n.nspname = '%s';",
 	    tbl, col, nsp);
@@ -1445,11 +642,9 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	else
 	{
 	  sprintf(query, 
-	    "SELECT s.stanumbers1[5:8], c.reltuples FROM pg_class c"
+	    "SELECT c.oid, a.attnum, c.reltuples FROM pg_class c"
 	    " LEFT OUTER JOIN pg_namespace n ON (n.oid = c.relnamespace)"
 	    " LEFT OUTER JOIN pg_attribute a ON (a.attrelid = c.oid )"
-	    " LEFT OUTER JOIN pg_statistic s ON (s.starelid = c.oid AND "
-	                                        "s.staattnum = a.attnum )"
 	    " WHERE c.relname = '%s' AND a.attname = '%s' "
 	    " AND n.nspname = current_schema();",
 	    tbl, col);
@@ -1481,7 +676,7 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	tuple = tuptable->vals[0];
 
 	/* Check if the table has zero rows first */
-	binval = SPI_getbinval(tuple, tupdesc, 2, &isnull);
+	binval = SPI_getbinval(tuple, tupdesc, 3, &isnull);
 	if (isnull)
 	{
 
@@ -1507,8 +702,11 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
-	binval = SPI_getbinval(tuple, tupdesc, 1, &isnull);
-	if (isnull)
+	relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	attnum = DatumGetInt16(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+
+	hist = box_histogram_fetch(relid, attnum, STATISTIC_KIND_GEOMETRY);
+	if ( ! hist )
 	{
 
 		POSTGIS_DEBUG(3, " stats are NULL");
@@ -1518,14 +716,6 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 		SPI_finish();
 		PG_RETURN_NULL();
 	}
-	array = DatumGetArrayTypeP(binval);
-	if ( ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)) != 4 )
-	{
-		elog(ERROR, " corrupted histogram");
-		PG_RETURN_NULL();
-	}
-
-	POSTGIS_DEBUGF(3, " stats array has %d elems", ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)));
 
 	/*
 	 * Construct GBOX.
@@ -1537,12 +727,11 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	FLAGS_SET_Z(box->flags, 0);
 	FLAGS_SET_M(box->flags, 0);
 
-	/* Construct the box */
-	memcpy(&(geomstats.xmin), ARR_DATA_PTR(array), sizeof(float)*4);
-	box->xmin = geomstats.xmin;
-	box->xmax = geomstats.xmax;
-	box->ymin = geomstats.ymin;
-	box->ymax = geomstats.ymax;
+	/* Construct the box from the extent of the histogram */
+	box->xmin = hist->min[0];
+	box->xmax = hist->max[0];
+	box->ymin = hist->min[1];
+	box->ymax = hist->max[1];
 
 	POSTGIS_DEBUGF(3, " histogram extent = %g %g, %g %g", box->xmin,
 	               box->ymin, box->xmax, box->ymax);
@@ -369,6 +369,7 @@ static double box2df_distance_leaf_centroid(const BOX2DF *a, const BOX2DF *b)
     return sqrt((a_x - b_x) * (a_x - b_x) + (a_y - b_y) * (a_y - b_y));
 }
 
+#if POSTGIS_PGSQL_VERSION < 95
 /**
 * Calculate the The node_box_edge->query_centroid distance 
 * between the boxes.
@@ -442,6 +443,7 @@ static double box2df_distance_node_centroid(const BOX2DF *node, const BOX2DF *qu
     
     return sqrt(d);
 }
+#endif
 
 /* Quick distance function */
 static inline double pt_distance(double ax, double ay, double bx, double by)
@@ -980,6 +982,9 @@ Datum gserialized_gist_distance_2d(PG_FUNCTION_ARGS)
 	BOX2DF *entry_box;
 	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
 	double distance;
+#if POSTGIS_PGSQL_VERSION >= 95
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+#endif
 
 	POSTGIS_DEBUG(4, "[GIST] 'distance' function called");
 
@@ -1007,6 +1012,19 @@ Datum gserialized_gist_distance_2d(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(distance);
 	}
 
+#if POSTGIS_PGSQL_VERSION >= 95
+	/*
+	** The <-> operator is the real distance between the geometries.
+	** The distance between the (float, rounded outwards) boxes is never
+	** more than that, for the nodes and the leaves alike, so the scan
+	** can hand out leaves in box distance order, and the executor
+	** reorders them on the exact distance of the heap tuples before
+	** they are returned.
+	*/
+	distance = (double)box2df_distance(entry_box, &query_box);
+	if ( GIST_LEAF(entry) )
+		*recheck = true;
+#else
 	/* Treat leaf node tests different from internal nodes */
 	if (GIST_LEAF(entry))
 	{
@@ -1018,6 +1036,7 @@ Datum gserialized_gist_distance_2d(PG_FUNCTION_ARGS)
 	    /* Calculate distance for internal nodes */
 		distance = (double)box2df_distance_node_centroid(entry_box, &query_box);
 	}
+#endif
 
 	PG_RETURN_FLOAT8(distance);
 }
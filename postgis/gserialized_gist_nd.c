@@ -30,9 +30,15 @@
 #include "../postgis_config.h"
 
 #include "liblwgeom.h"         /* For standard geometry types. */
+#include "liblwgeom_internal.h"  /* For MAXFLOAT */
 #include "lwgeom_pg.h"       /* For debugging macros. */
 #include "gserialized_gist.h"	     /* For utility functions. */
 #include "geography.h"
+#if POSTGIS_PGSQL_VERSION >= 95
+#include "lwgeom_transform.h"  /* For spheroid_init_from_srid */
+#endif
+
+#include <math.h>
 
 /*
 ** When is a node split not so good? If more than 90% of the entries
@@ -64,6 +70,9 @@ Datum gserialized_gist_penalty(PG_FUNCTION_ARGS);
 Datum gserialized_gist_picksplit(PG_FUNCTION_ARGS);
 Datum gserialized_gist_union(PG_FUNCTION_ARGS);
 Datum gserialized_gist_same(PG_FUNCTION_ARGS);
+#if POSTGIS_PGSQL_VERSION >= 95
+Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS);
+#endif
 
 /*
 ** ND Operator prototypes
@@ -418,6 +427,39 @@ static bool gidx_equals(GIDX *a, GIDX *b)
 	return TRUE;
 }
 
+#if POSTGIS_PGSQL_VERSION >= 95
+/*
+** Euclidean distance between the closest points of two GIDX boxes,
+** zero when they overlap. Dimensions present in only one box compare
+** against zero, as in gidx_overlaps().
+*/
+static double gidx_distance(GIDX *a, GIDX *b)
+{
+	int i, ndims_b;
+	double d, sum = 0.0;
+
+	/* Ensure 'a' has the most dimensions. */
+	gidx_dimensionality_check(&a, &b);
+
+	ndims_b = GIDX_NDIMS(b);
+
+	for ( i = 0; i < GIDX_NDIMS(a); i++ )
+	{
+		double bmin = i < ndims_b ? GIDX_GET_MIN(b,i) : 0.0;
+		double bmax = i < ndims_b ? GIDX_GET_MAX(b,i) : 0.0;
+
+		if ( GIDX_GET_MIN(a,i) > bmax )
+			d = GIDX_GET_MIN(a,i) - bmax;
+		else if ( bmin > GIDX_GET_MAX(a,i) )
+			d = bmin - GIDX_GET_MAX(a,i);
+		else
+			continue;
+		sum += d * d;
+	}
+	return sqrt(sum);
+}
+#endif
+
 /**
 * Support function. Based on two datums return true if
 * they satisfy the predicate and false otherwise.
@@ -750,6 +792,76 @@ Datum gserialized_gist_consistent(PG_FUNCTION_ARGS)
 }
 
 
+#if POSTGIS_PGSQL_VERSION >= 95
+/*
+** GiST support function. Lower bound of the spheroid distance between
+** the query and the geographies under an entry, for the <-> operator.
+**
+** Geography keys are boxes of unit vectors along the surface normals
+** (geocentric, on the unit sphere), so the gap between two boxes is a
+** lower bound of the chord between any two of their points, and
+** 2*asin(chord/2) bounds the angle between the normals. Along any path
+** on the spheroid the normal turns at most 1/R radians per metre,
+** where R = b*b/a is the smallest radius of curvature (the meridian
+** at the equator), so the angle times R bounds the distance. The bound
+** is loose by up to the flattening, and leaves are rechecked against
+** the exact distance.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_geog_distance);
+Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	Datum query_datum = PG_GETARG_DATUM(1);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	char query_box_mem[GIDX_MAX_SIZE];
+	GIDX *query_box = (GIDX*)query_box_mem;
+	GIDX *entry_box;
+	GSERIALIZED *query_head;
+	SPHEROID s;
+	double chord;
+
+	POSTGIS_DEBUG(4, "[GIST] 'distance' function called");
+
+	/* We are using '13' as the gist distance strategy number, as in 2D */
+	if ( strategy != 13 )
+	{
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+		PG_RETURN_FLOAT8(MAXFLOAT);
+	}
+
+	/* Null box should never make this far. */
+	if ( gserialized_datum_get_gidx_p(query_datum, query_box) == LW_FAILURE )
+	{
+		POSTGIS_DEBUG(4, "[GIST] null query_gbox_index!");
+		PG_RETURN_FLOAT8(MAXFLOAT);
+	}
+
+	entry_box = (GIDX*)DatumGetPointer(entry->key);
+
+	/* Empty geographies sort last, the recheck returns NULL for them */
+	if ( gidx_is_unknown(entry_box) )
+	{
+		*recheck = GIST_LEAF(entry);
+		PG_RETURN_FLOAT8(MAXFLOAT);
+	}
+
+	/* The spheroid of the query, which the <-> operator measures on */
+	query_head = (GSERIALIZED*)PG_DETOAST_DATUM_SLICE(query_datum, 0, 8);
+	if ( spheroid_init_from_srid(fcinfo, gserialized_get_srid(query_head), &s) == LW_FAILURE )
+		spheroid_init(&s, WGS84_MAJOR_AXIS, WGS84_MINOR_AXIS);
+
+	chord = gidx_distance(entry_box, query_box);
+	if ( chord > 2.0 )
+		chord = 2.0;
+
+	if ( GIST_LEAF(entry) )
+		*recheck = true;
+
+	PG_RETURN_FLOAT8(2.0 * asin(chord / 2.0) * s.b * s.b / s.a);
+}
+#endif
+
 /*
 ** GiST support function. Calculate the "penalty" cost of adding this entry into an existing entry.
 ** Calculate the change in volume of the old entry once the new entry is added.
@@ -0,0 +1,595 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"       /* For debugging macros. */
+#include "gserialized_gist.h" /* For gserialized_datum_get_gbox_p */
+#include "gserialized_histogram.h"
+
+#include <math.h>
+
+/***********************************************************************
+**
+**  Equi-depth histograms of the boxes of a geometry or geography
+**  column, built by ANALYZE and read by the selectivity functions of
+**  the && operators.
+**
+**  Each sample box is a point of 2*ndims dimensions: its centre and
+**  its half-size along each axis. A box overlaps a query box when,
+**  along every axis, its centre is within its half-size of the query
+**  box. The estimators assume the centres of the boxes of a bucket
+**  are spread evenly over the range of the bucket, and that the boxes
+**  all have the mean half-size of the bucket.
+**/
+
+typedef struct
+{
+	double v[2 * HISTOGRAM_MAX_DIMS]; /* centre, then half-size, along each axis */
+}
+HISTOGRAM_SAMPLE;
+
+typedef struct
+{
+	int ndims;
+	int nsamples;
+	int nrows;        /* sampled rows, null and empty ones included */
+	int bucket_size;  /* stop splitting under twice this many samples */
+	double scale[HISTOGRAM_MAX_DIMS]; /* extent of the sample, per axis */
+	BOX_HISTOGRAM *hist;
+}
+HISTOGRAM_BUILD;
+
+/*
+** Weight of the spread of the sizes against the spread of the centres,
+** when choosing where to split. A bucket mixing boxes of different
+** sizes is estimated with their mean size, which undercounts the
+** overlaps of the large ones (they grow with the product of the sizes
+** along every axis), so sizes get split apart well before positions.
+** Tuned on samples mixing many small boxes with a few large ones.
+*/
+#define HISTOGRAM_SIZE_WEIGHT 8.0
+
+/* The ordinate the samples are being sorted on (qsort has no argument for it) */
+static int histogram_sort_key = 0;
+
+static int
+histogram_sample_cmp(const void *a, const void *b)
+{
+	double va = ((const HISTOGRAM_SAMPLE*)a)->v[histogram_sort_key];
+	double vb = ((const HISTOGRAM_SAMPLE*)b)->v[histogram_sort_key];
+
+	if ( va < vb )
+		return -1;
+	return va > vb ? 1 : 0;
+}
+
+static double
+gbox_get_min(const GBOX *box, int d)
+{
+	return d == 0 ? box->xmin : (d == 1 ? box->ymin : box->zmin);
+}
+
+static double
+gbox_get_max(const GBOX *box, int d)
+{
+	return d == 0 ? box->xmax : (d == 1 ? box->ymax : box->zmax);
+}
+
+/*
+** Split the samples at the median of their most spread out ordinate
+** until there are few enough of them, and append them as a bucket.
+*/
+static void
+histogram_split(HISTOGRAM_BUILD *build, HISTOGRAM_SAMPLE *samples, int n)
+{
+	int ndims = build->ndims;
+	double lo[2 * HISTOGRAM_MAX_DIMS], hi[2 * HISTOGRAM_MAX_DIMS];
+	double sum[HISTOGRAM_MAX_DIMS];
+	double spread = 0.0;
+	int key = -1;
+	int i, d;
+	float4 *bucket;
+
+	for ( d = 0; d < 2 * ndims; d++ )
+	{
+		lo[d] = hi[d] = samples[0].v[d];
+		for ( i = 1; i < n; i++ )
+		{
+			if ( samples[i].v[d] < lo[d] ) lo[d] = samples[i].v[d];
+			if ( samples[i].v[d] > hi[d] ) hi[d] = samples[i].v[d];
+		}
+	}
+
+	/*
+	** Compare the spreads of centres and sizes to the extent of the
+	** column, so that buckets get split along the long side first,
+	** and big features get split from small ones once the difference
+	** matters at the scale of the column.
+	*/
+	if ( n >= 2 * build->bucket_size )
+	{
+		for ( d = 0; d < 2 * ndims; d++ )
+		{
+			double s;
+			if ( build->scale[d % ndims] <= 0.0 )
+				continue;
+			s = (hi[d] - lo[d]) / build->scale[d % ndims];
+			if ( d >= ndims )
+				s *= HISTOGRAM_SIZE_WEIGHT;
+			if ( s > spread )
+			{
+				spread = s;
+				key = d;
+			}
+		}
+	}
+
+	if ( key >= 0 )
+	{
+		histogram_sort_key = key;
+		qsort(samples, n, sizeof(HISTOGRAM_SAMPLE), histogram_sample_cmp);
+		histogram_split(build, samples, n / 2);
+		histogram_split(build, samples + n / 2, n - n / 2);
+		return;
+	}
+
+	/* Small enough, or all the same: one bucket */
+	for ( d = 0; d < ndims; d++ )
+		sum[d] = 0.0;
+	for ( i = 0; i < n; i++ )
+		for ( d = 0; d < ndims; d++ )
+			sum[d] += samples[i].v[ndims + d];
+
+	bucket = build->hist->value + (int)build->hist->nbuckets * HISTOGRAM_BUCKET_SIZE(ndims);
+	for ( d = 0; d < ndims; d++ )
+	{
+		bucket[3 * d] = lo[d];
+		bucket[3 * d + 1] = hi[d];
+		bucket[3 * d + 2] = sum[d] / n;
+	}
+	bucket[3 * ndims] = (double)n / build->nrows;
+	build->hist->nbuckets += 1;
+}
+
+/**
+* Build the histogram of the sample boxes, of about nbuckets buckets
+* (fewer when the sample is small). The boxes must be finite. The
+* fractions of the buckets are relative to the nrows sampled rows, so
+* that the rows without a box are never selected.
+*/
+BOX_HISTOGRAM *
+box_histogram_build(GBOX **boxes, int nboxes, int nrows, int ndims, int nbuckets)
+{
+	HISTOGRAM_BUILD build;
+	HISTOGRAM_SAMPLE *samples;
+	BOX_HISTOGRAM *hist;
+	int maxbuckets;
+	int i, d;
+
+	if ( nboxes < 1 || ndims < 1 || ndims > HISTOGRAM_MAX_DIMS )
+		return NULL;
+
+	if ( nbuckets < 1 )
+		nbuckets = 1;
+	else if ( nbuckets > HISTOGRAM_MAX_BUCKETS )
+		nbuckets = HISTOGRAM_MAX_BUCKETS;
+
+	build.ndims = ndims;
+	build.nsamples = nboxes;
+	build.nrows = Max(nrows, nboxes);
+	/*
+	 * Round up: the leaves hold from bucket_size to twice as many
+	 * samples, so rounding down could give up to twice nbuckets
+	 */
+	build.bucket_size = Max(1, (nboxes + nbuckets - 1) / nbuckets);
+
+	/* Every bucket holds at least bucket_size samples */
+	maxbuckets = Min(nboxes / build.bucket_size + 1, HISTOGRAM_MAX_BUCKETS);
+	hist = palloc0(BOX_HISTOGRAM_NVALUES(ndims, maxbuckets) * sizeof(float4));
+	hist->ndims = ndims;
+	hist->nbuckets = 0;
+	hist->nsamples = nboxes;
+	build.hist = hist;
+
+	samples = palloc(nboxes * sizeof(HISTOGRAM_SAMPLE));
+	for ( d = 0; d < ndims; d++ )
+	{
+		double min = gbox_get_min(boxes[0], d);
+		double max = gbox_get_max(boxes[0], d);
+
+		for ( i = 0; i < nboxes; i++ )
+		{
+			double bmin = gbox_get_min(boxes[i], d);
+			double bmax = gbox_get_max(boxes[i], d);
+
+			samples[i].v[d] = (bmin + bmax) / 2.0;
+			samples[i].v[ndims + d] = (bmax - bmin) / 2.0;
+			if ( bmin < min ) min = bmin;
+			if ( bmax > max ) max = bmax;
+		}
+		hist->min[d] = min;
+		hist->max[d] = max;
+		build.scale[d] = max - min;
+	}
+
+	histogram_split(&build, samples, nboxes);
+	pfree(samples);
+
+	POSTGIS_DEBUGF(3, " histogram of %d boxes in %d buckets", nboxes, (int)hist->nbuckets);
+
+	return hist;
+}
+
+int
+box_histogram_nvalues(const BOX_HISTOGRAM *hist)
+{
+	return BOX_HISTOGRAM_NVALUES((int)hist->ndims, (int)hist->nbuckets);
+}
+
+/**
+* Read the histogram of a column from pg_statistic. Returns a copy in
+* the current context, or NULL if the column has no statistics of the
+* kind, or if they do not look like a histogram.
+*/
+BOX_HISTOGRAM *
+box_histogram_fetch(Oid relid, AttrNumber attnum, int kind)
+{
+	HeapTuple stats_tuple;
+	BOX_HISTOGRAM *stored = NULL;
+	/*
+	 * This is to avoid casting the corresponding
+	 * "type-punned" pointer, which would break
+	 * "strict-aliasing rules".
+	 */
+	BOX_HISTOGRAM **storedptr = &stored;
+	BOX_HISTOGRAM *hist = NULL;
+	int nvalues = 0;
+
+	stats_tuple = SearchSysCache(STATRELATT, ObjectIdGetDatum(relid), Int16GetDatum(attnum), 0, 0);
+	if ( ! stats_tuple )
+	{
+		POSTGIS_DEBUG(3, " No statistics");
+		return NULL;
+	}
+
+	if ( ! get_attstatsslot(stats_tuple, 0, 0, kind, InvalidOid, NULL, NULL,
+#if POSTGIS_PGSQL_VERSION >= 85
+	                        NULL,
+#endif
+	                        (float4 **)storedptr, &nvalues) )
+	{
+		POSTGIS_DEBUGF(3, " statistics of kind %d not found", kind);
+		ReleaseSysCache(stats_tuple);
+		return NULL;
+	}
+
+	if ( nvalues >= (int)BOX_HISTOGRAM_NVALUES(0, 0) &&
+	     stored->ndims >= 1 && stored->ndims <= HISTOGRAM_MAX_DIMS &&
+	     stored->nbuckets >= 1 && stored->nbuckets <= HISTOGRAM_MAX_BUCKETS &&
+	     nvalues == box_histogram_nvalues(stored) )
+	{
+		hist = palloc(nvalues * sizeof(float4));
+		memcpy(hist, stored, nvalues * sizeof(float4));
+	}
+	else
+	{
+		elog(DEBUG1, "corrupted box histogram (%d values)", nvalues);
+	}
+
+	free_attstatsslot(0, NULL, 0, (float4 *)stored, nvalues);
+	ReleaseSysCache(stats_tuple);
+	return hist;
+}
+
+/*
+** Fraction of the interval [a1, a2] inside [lo, hi]. An interval
+** collapsed to a point is all in or all out.
+*/
+static double
+interval_fraction(double a1, double a2, double lo, double hi)
+{
+	if ( a2 <= a1 )
+		return (a1 >= lo && a1 <= hi) ? 1.0 : 0.0;
+
+	if ( lo < a1 ) lo = a1;
+	if ( hi > a2 ) hi = a2;
+	if ( hi <= lo )
+		return 0.0;
+	return (hi - lo) / (a2 - a1);
+}
+
+/*
+** Integral of min(max(u, b1), b2) from 0 to u.
+*/
+static double
+clamp_integral(double u, double b1, double b2)
+{
+	if ( u <= b1 )
+		return b1 * u;
+	if ( u <= b2 )
+		return b1 * b1 + (u * u - b1 * b1) / 2.0;
+	return b1 * b1 + (b2 * b2 - b1 * b1) / 2.0 + b2 * (u - b2);
+}
+
+/*
+** Area of the part of [a1, a2] x [b1, b2] where x - y <= t.
+*/
+static double
+band_area(double a1, double a2, double b1, double b2, double t)
+{
+	return (a2 - a1) * b2 - (clamp_integral(a2 - t, b1, b2) - clamp_integral(a1 - t, b1, b2));
+}
+
+/*
+** Probability that two points, taken evenly from [a1, a2] and from
+** [b1, b2], are no further than w apart.
+*/
+static double
+interval_proximity(double a1, double a2, double b1, double b2, double w)
+{
+	double origin, p;
+
+	if ( a1 - b2 > w || b1 - a2 > w )
+		return 0.0;
+
+	if ( a2 <= a1 && b2 <= b1 )
+		return fabs(a1 - b1) <= w ? 1.0 : 0.0;
+	if ( a2 <= a1 )
+		return interval_fraction(b1, b2, a1 - w, a1 + w);
+	if ( b2 <= b1 )
+		return interval_fraction(a1, a2, b1 - w, b1 + w);
+
+	/* Work close to zero, the areas are differences of large numbers */
+	origin = Min(a1, b1);
+	a1 -= origin;
+	a2 -= origin;
+	b1 -= origin;
+	b2 -= origin;
+
+	p = (band_area(a1, a2, b1, b2, w) - band_area(a1, a2, b1, b2, -w)) / ((a2 - a1) * (b2 - b1));
+
+	/* Rounding */
+	if ( p < 0.0 ) return 0.0;
+	if ( p > 1.0 ) return 1.0;
+	return p;
+}
+
+/**
+* Fraction of the boxes of the column that overlap the box.
+*/
+double
+box_histogram_selectivity(const BOX_HISTOGRAM *hist, const GBOX *box)
+{
+	int ndims = hist->ndims;
+	int bucket_size = HISTOGRAM_BUCKET_SIZE(ndims);
+	double selectivity = 0.0;
+	int i, d;
+
+	/* Search box completely misses the column */
+	for ( d = 0; d < ndims; d++ )
+	{
+		if ( gbox_get_max(box, d) < hist->min[d] || gbox_get_min(box, d) > hist->max[d] )
+		{
+			POSTGIS_DEBUG(3, " search box does not overlap histogram, returning 0");
+			return 0.0;
+		}
+	}
+
+	for ( i = 0; i < hist->nbuckets; i++ )
+	{
+		const float4 *bucket = hist->value + i * bucket_size;
+		double p = bucket[3 * ndims];
+
+		for ( d = 0; d < ndims && p > 0.0; d++ )
+		{
+			/* Centres that far from the box have their box overlap it */
+			p *= interval_fraction(bucket[3 * d], bucket[3 * d + 1],
+			                       gbox_get_min(box, d) - bucket[3 * d + 2],
+			                       gbox_get_max(box, d) + bucket[3 * d + 2]);
+		}
+		selectivity += p;
+	}
+
+	POSTGIS_DEBUGF(3, " selectivity=%g", selectivity);
+
+	/* prevent rounding overflows */
+	if ( selectivity > 1.0 ) selectivity = 1.0;
+	else if ( selectivity < 0.0 ) selectivity = 0.0;
+
+	return selectivity;
+}
+
+/**
+* Fraction of the pairs of boxes from the two columns that overlap:
+* sum over the pairs of buckets of the chances that a box of each
+* overlap, along all the axes.
+*/
+double
+box_histogram_join_selectivity(const BOX_HISTOGRAM *hist1, const BOX_HISTOGRAM *hist2)
+{
+	int ndims = Min(hist1->ndims, hist2->ndims);
+	int size1 = HISTOGRAM_BUCKET_SIZE((int)hist1->ndims);
+	int size2 = HISTOGRAM_BUCKET_SIZE((int)hist2->ndims);
+	double selectivity = 0.0;
+	int i, j, d;
+
+	/* Columns that don't overlap don't join */
+	for ( d = 0; d < ndims; d++ )
+	{
+		if ( hist1->max[d] < hist2->min[d] || hist2->max[d] < hist1->min[d] )
+		{
+			POSTGIS_DEBUG(3, " histograms do not overlap, returning 0");
+			return 0.0;
+		}
+	}
+
+	for ( i = 0; i < hist1->nbuckets; i++ )
+	{
+		const float4 *b1 = hist1->value + i * size1;
+
+		for ( j = 0; j < hist2->nbuckets; j++ )
+		{
+			const float4 *b2 = hist2->value + j * size2;
+			double p = b1[3 * (int)hist1->ndims] * b2[3 * (int)hist2->ndims];
+
+			for ( d = 0; d < ndims && p > 0.0; d++ )
+			{
+				p *= interval_proximity(b1[3 * d], b1[3 * d + 1],
+				                        b2[3 * d], b2[3 * d + 1],
+				                        b1[3 * d + 2] + b2[3 * d + 2]);
+			}
+			selectivity += p;
+		}
+	}
+
+	POSTGIS_DEBUGF(3, " join selectivity=%g", selectivity);
+
+	if ( selectivity > 1.0 ) selectivity = 1.0;
+	else if ( selectivity < 0.0 ) selectivity = 0.0;
+
+	return selectivity;
+}
+
+/**
+* One line for the header, then one per bucket: the range of the
+* centres and the mean half-size along each axis, and the fraction.
+*/
+char *
+box_histogram_to_string(const BOX_HISTOGRAM *hist)
+{
+	StringInfoData str;
+	int ndims = hist->ndims;
+	int i, d;
+
+	initStringInfo(&str);
+	appendStringInfo(&str, "ndims=%d nbuckets=%d nsamples=%d extent=(",
+	                 ndims, (int)hist->nbuckets, (int)hist->nsamples);
+	for ( d = 0; d < ndims; d++ )
+		appendStringInfo(&str, "%s%.15g", d ? " " : "", hist->min[d]);
+	appendStringInfoString(&str, ", ");
+	for ( d = 0; d < ndims; d++ )
+		appendStringInfo(&str, "%s%.15g", d ? " " : "", hist->max[d]);
+	appendStringInfoString(&str, ")");
+
+	for ( i = 0; i < hist->nbuckets; i++ )
+	{
+		const float4 *bucket = hist->value + i * HISTOGRAM_BUCKET_SIZE(ndims);
+
+		appendStringInfoChar(&str, '\n');
+		for ( d = 0; d < ndims; d++ )
+			appendStringInfo(&str, "[%.15g %.15g]+-%.15g ", bucket[3 * d], bucket[3 * d + 1], bucket[3 * d + 2]);
+		appendStringInfo(&str, "%.6g", bucket[3 * ndims]);
+	}
+
+	return str.data;
+}
+
+/***********************************************************************
+**
+**  Debugging functions, callable from SQL, to look at the histogram
+**  of a column and at the estimates the planner gets from it. They
+**  work on geometry and geography columns alike.
+**/
+
+Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS);
+Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS);
+Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS);
+
+/*
+** Histogram of a column named by its table and name, of whichever
+** kind it has. Errors out when there is no histogram, so that a
+** missing ANALYZE does not pass for an estimate.
+*/
+static BOX_HISTOGRAM *
+box_histogram_fetch_column(Oid relid, text *att_text)
+{
+	char *att_name = text2cstring(att_text);
+	AttrNumber attnum;
+	BOX_HISTOGRAM *hist;
+
+	attnum = get_attnum(relid, att_name);
+	if ( attnum == InvalidAttrNumber )
+		elog(ERROR, "attribute \"%s\" does not exist", att_name);
+
+	hist = box_histogram_fetch(relid, attnum, STATISTIC_KIND_GEOMETRY);
+	if ( ! hist )
+		hist = box_histogram_fetch(relid, attnum, STATISTIC_KIND_GEOGRAPHY);
+	if ( ! hist )
+		elog(ERROR, "stats for \"%s.%s\" do not exist", get_rel_name(relid), att_name);
+
+	return hist;
+}
+
+/**
+* Selectivity of the && operator between a column and a constant, as
+* the planner would estimate it.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_sel);
+Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS)
+{
+	Oid relid = PG_GETARG_OID(0);
+	text *att_text = PG_GETARG_TEXT_P(1);
+	Datum gs = PG_GETARG_DATUM(2);
+	BOX_HISTOGRAM *hist;
+	GBOX gbox;
+	float8 selectivity;
+
+	/* Geography boxes come out geocentric, like the histogram */
+	if ( gserialized_datum_get_gbox_p(gs, &gbox) == LW_FAILURE )
+		PG_RETURN_FLOAT8(0.0);
+
+	hist = box_histogram_fetch_column(relid, att_text);
+	if ( ((int)hist->ndims == 3) != (FLAGS_GET_GEODETIC(gbox.flags) != 0) )
+		elog(ERROR, "the column and the search box are not of the same type");
+
+	selectivity = box_histogram_selectivity(hist, &gbox);
+	pfree(hist);
+	PG_RETURN_FLOAT8(selectivity);
+}
+
+/**
+* Selectivity of the && operator between two columns, as the planner
+* would estimate it for an inner join.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_joinsel);
+Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS)
+{
+	BOX_HISTOGRAM *hist1 = box_histogram_fetch_column(PG_GETARG_OID(0), PG_GETARG_TEXT_P(1));
+	BOX_HISTOGRAM *hist2 = box_histogram_fetch_column(PG_GETARG_OID(2), PG_GETARG_TEXT_P(3));
+	float8 selectivity;
+
+	if ( hist1->ndims != hist2->ndims )
+		elog(ERROR, "cannot join a geometry column with a geography column");
+
+	selectivity = box_histogram_join_selectivity(hist1, hist2);
+	pfree(hist1);
+	pfree(hist2);
+	PG_RETURN_FLOAT8(selectivity);
+}
+
+/**
+* Text dump of the histogram of a column.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_stats);
+Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS)
+{
+	BOX_HISTOGRAM *hist = box_histogram_fetch_column(PG_GETARG_OID(0), PG_GETARG_TEXT_P(1));
+	char *str = box_histogram_to_string(hist);
+
+	pfree(hist);
+	PG_RETURN_TEXT_P(cstring2text(str));
+}
@@ -0,0 +1,94 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.refractions.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#ifndef _GSERIALIZED_HISTOGRAM_H
+#define _GSERIALIZED_HISTOGRAM_H
+
+#include "postgres.h"
+#include "access/attnum.h"
+
+#include "liblwgeom.h"
+
+/**
+ * 	Assign a number to the postgis statistics kind
+ *
+ * 	tgl suggested:
+ *
+ * 	1-100:	reserved for assignment by the core Postgres project
+ * 	100-199: reserved for assignment by PostGIS
+ * 	200-9999: reserved for other globally-known stats kinds
+ * 	10000-32767: reserved for private site-local use
+ *
+ * 	Kinds 100 (geometry) and 101 (geography) were the uniform grids
+ * 	of PostGIS 2.0. They are ignored, until the next ANALYZE replaces
+ * 	them with histograms.
+ */
+#define STATISTIC_KIND_GEOMETRY 102
+#define STATISTIC_KIND_GEOGRAPHY 103
+
+/** Geometry histograms are 2-D, geography ones 3-D (geocentric) */
+#define HISTOGRAM_MAX_DIMS 3
+
+/**
+* Most buckets a histogram gets, whatever the statistics target. The
+* join estimate compares each bucket of one column with each bucket of
+* the other, so it costs the square of this.
+*/
+#define HISTOGRAM_MAX_BUCKETS 4000
+
+/** Number of floats of a bucket of a histogram of ndims dimensions */
+#define HISTOGRAM_BUCKET_SIZE(ndims) (3 * (ndims) + 1)
+
+/**
+* Equi-depth histogram of the boxes of a column, stored as an array
+* of float4 in pg_statistic.
+*
+* Each box is seen as its centre plus its half-size along each axis.
+* The sample is split at the median along the most spread out of
+* these, over and over, until each bucket holds about the same number
+* of boxes. Dense areas end up with many small buckets and empty ones
+* with none, and large features are kept apart from the small ones
+* around them.
+*
+* Each bucket stores, for each axis, the range of the centres of its
+* boxes and their mean half-size, followed by the fraction of the
+* sampled rows it holds.
+*/
+typedef struct
+{
+	float4 ndims;     /* dimensions of the boxes */
+	float4 nbuckets;  /* number of buckets in value[] */
+	float4 nsamples;  /* non-null sample boxes the histogram was built from */
+	float4 min[HISTOGRAM_MAX_DIMS]; /* extent of the sample boxes */
+	float4 max[HISTOGRAM_MAX_DIMS];
+	float4 value[1];  /* nbuckets buckets of HISTOGRAM_BUCKET_SIZE(ndims) floats */
+}
+BOX_HISTOGRAM;
+
+/* Size in floats of a histogram, as stored in pg_statistic */
+#define BOX_HISTOGRAM_NVALUES(ndims, nbuckets) \
+	(offsetof(BOX_HISTOGRAM, value) / sizeof(float4) + (nbuckets) * HISTOGRAM_BUCKET_SIZE(ndims))
+
+/* Histogram of nbuckets buckets (or fewer) of the boxes of nrows sampled rows, allocated in the current context */
+BOX_HISTOGRAM *box_histogram_build(GBOX **boxes, int nboxes, int nrows, int ndims, int nbuckets);
+/* Number of floats to store for the histogram */
+int box_histogram_nvalues(const BOX_HISTOGRAM *hist);
+/* Copy of the histogram of a column, NULL if it has none of that kind */
+BOX_HISTOGRAM *box_histogram_fetch(Oid relid, AttrNumber attnum, int kind);
+
+/* Fraction of the boxes of the histogram that overlap the box */
+double box_histogram_selectivity(const BOX_HISTOGRAM *hist, const GBOX *box);
+/* Fraction of the pairs of boxes of the two histograms that overlap */
+double box_histogram_join_selectivity(const BOX_HISTOGRAM *hist1, const BOX_HISTOGRAM *hist2);
+
+/* Human readable dump of the histogram, for debugging */
+char *box_histogram_to_string(const BOX_HISTOGRAM *hist);
+
+#endif /* !defined _GSERIALIZED_HISTOGRAM_H */
@@ -26,18 +26,19 @@
 Datum PGISDirectFunctionCall1(PGFunction func, Datum arg1);
 Datum pgis_geometry_accum_transfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_accum_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_transfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_union_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_collect_transfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_collect_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_polygonize_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_makeline_transfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_abs_in(PG_FUNCTION_ARGS);
 Datum pgis_abs_out(PG_FUNCTION_ARGS);
 
 /* External prototypes */
 Datum pgis_union_geometry_array(PG_FUNCTION_ARGS);
-Datum LWGEOM_collect_garray(PG_FUNCTION_ARGS);
 Datum polygonize_garray(PG_FUNCTION_ARGS);
-Datum LWGEOM_makeline_garray(PG_FUNCTION_ARGS);
 
 
 /** @file
@@ -85,6 +86,31 @@ pgis_abs_out(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(NULL);
 }
 
+/**
+** The memory context the aggregate state lives in, from either a plain
+** or a window aggregate.
+*/
+static MemoryContext
+pgis_aggcontext(FunctionCallInfo fcinfo)
+{
+	if (fcinfo->context && IsA(fcinfo->context, AggState))
+		return ((AggState *) fcinfo->context)->aggcontext;
+#if POSTGIS_PGSQL_VERSION == 84
+
+	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
+		return ((WindowAggState *) fcinfo->context)->wincontext;
+#endif
+#if POSTGIS_PGSQL_VERSION > 84
+
+	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
+		return ((WindowAggState *) fcinfo->context)->aggcontext;
+#endif
+
+	/* cannot be called directly because of dummy-type argument */
+	elog(ERROR, "array_agg_transfn called in non-aggregate context");
+	return NULL;  /* keep compiler quiet */
+}
+
 /**
 ** The transfer function hooks into the PostgreSQL accumArrayResult()
 ** function (present since 8.0) to build an array in a side memory
@@ -105,25 +131,7 @@ pgis_geometry_accum_transfn(PG_FUNCTION_ARGS)
 		        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 		         errmsg("could not determine input data type")));
 
-	if (fcinfo->context && IsA(fcinfo->context, AggState))
-		aggcontext = ((AggState *) fcinfo->context)->aggcontext;
-#if POSTGIS_PGSQL_VERSION == 84
-
-	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
-		aggcontext = ((WindowAggState *) fcinfo->context)->wincontext;
-#endif
-#if POSTGIS_PGSQL_VERSION > 84
-
-	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
-		aggcontext = ((WindowAggState *) fcinfo->context)->aggcontext;
-#endif
-
-	else
-	{
-		/* cannot be called directly because of dummy-type argument */
-		elog(ERROR, "array_agg_transfn called in non-aggregate context");
-		aggcontext = NULL;  /* keep compiler quiet */
-	}
+	aggcontext = pgis_aggcontext(fcinfo);
 
 	if ( PG_ARGISNULL(0) )
 	{
@@ -204,53 +212,420 @@ pgis_geometry_accum_finalfn(PG_FUNCTION_ARGS)
 }
 
 /**
-* The "accum" final function passes the geometry[] to a union
-* conversion before returning the result.
+** Rather than accumulating the whole input before handing it to GEOS,
+** the ST_Union aggregate unions its input a batch at a time as it
+** arrives, so that memory use stays bounded for large dissolves.
+**
+** Inputs are buffered (copied into the aggregate context) until
+** UNION_BUFFER_SIZE of them or UNION_BUFFER_BYTES of them are waiting.
+** The buffer is then unioned in one go (GEOS cascades the union of the
+** batch over its own STR tree) and the result is pushed onto a binary
+** counter of partial results: partials[i] stands for 2^i batches, and
+** pushing a partial onto a filled level unions the two and carries the
+** result up to the next level, like an addition carries a bit. At most
+** one partial per level is alive, so there are O(log n) of them, and
+** each input geometry goes through O(log n) unions of comparable size.
+**
+** The final function unions what is left in the buffer with the
+** partials, without touching the state, as window aggregates may call
+** it more than once. When nothing was flushed this is exactly the
+** single union the array based aggregate used to do.
+*/
+#define UNION_BUFFER_SIZE 1024
+#define UNION_BUFFER_BYTES (8 * 1024 * 1024)
+#define UNION_MAX_LEVELS 32
+
+typedef struct
+{
+	Oid elemtype;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	int nbuffer;
+	size_t buffer_bytes;
+	GSERIALIZED *buffer[UNION_BUFFER_SIZE];
+	GSERIALIZED *partials[UNION_MAX_LEVELS];
+}
+pgis_union_state;
+
+/**
+** Same container as pgis_abs, a single pointer passed around in the
+** pgis_abs type, pointing to the union state instead.
+*/
+typedef struct
+{
+	pgis_union_state *u;
+}
+pgis_abs_union;
+
+/**
+** Union of a set of geometries, through pgis_union_geometry_array so
+** that SRID checks, empties and GEOS versions are handled the same way
+** as in ST_Union(geometry[]). The result is copied into the given
+** memory context, NULL if the union is NULL.
+*/
+static GSERIALIZED *
+pgis_union_geometries(pgis_union_state *state, GSERIALIZED **geoms, int ngeoms, MemoryContext mctx)
+{
+	MemoryContext old_context;
+	ArrayType *array = NULL;
+	Datum *elems;
+	Datum result;
+	GSERIALIZED *gser = NULL;
+	int i;
+
+	if ( ngeoms == 1 )
+	{
+		result = PointerGetDatum(geoms[0]);
+	}
+	else
+	{
+		elems = palloc(sizeof(Datum) * ngeoms);
+		for ( i = 0; i < ngeoms; i++ )
+			elems[i] = PointerGetDatum(geoms[i]);
+
+		array = construct_array(elems, ngeoms, state->elemtype,
+		                        state->typlen, state->typbyval, state->typalign);
+		pfree(elems);
+
+		result = PGISDirectFunctionCall1( pgis_union_geometry_array, PointerGetDatum(array) );
+	}
+
+	if ( result )
+	{
+		old_context = MemoryContextSwitchTo(mctx);
+		gser = (GSERIALIZED *) PG_DETOAST_DATUM_COPY(result);
+		MemoryContextSwitchTo(old_context);
+	}
+
+	/* Drop the intermediates now, rather than with the per-tuple context */
+	if ( array )
+	{
+		if ( result )
+			pfree(DatumGetPointer(result));
+		pfree(array);
+	}
+
+	return gser;
+}
+
+/**
+** Add a partial union to the binary counter, carrying it up while the
+** levels are taken.
+*/
+static void
+pgis_union_state_push(pgis_union_state *state, GSERIALIZED *partial, MemoryContext aggcontext)
+{
+	GSERIALIZED *pair[2];
+	int level = 0;
+
+	/* Nothing to carry, and the partials we hold must survive */
+	if ( ! partial )
+		return;
+
+	while ( state->partials[level] )
+	{
+		pair[0] = state->partials[level];
+		pair[1] = partial;
+		partial = pgis_union_geometries(state, pair, 2, aggcontext);
+		pfree(pair[0]);
+		pfree(pair[1]);
+		state->partials[level] = NULL;
+
+		/* A failed union leaves nothing to carry up */
+		if ( ! partial )
+			return;
+
+		/* Not going to happen with 2^31 batches, but stay in bounds */
+		if ( level < UNION_MAX_LEVELS - 1 )
+			level++;
+	}
+
+	state->partials[level] = partial;
+}
+
+/**
+** Union the buffered inputs into a partial result, and empty the buffer.
+*/
+static void
+pgis_union_state_flush(pgis_union_state *state, MemoryContext aggcontext)
+{
+	GSERIALIZED *partial;
+	int i;
+
+	POSTGIS_DEBUGF(3, "pgis_union_state_flush: %d geometries, %d bytes", state->nbuffer, (int)state->buffer_bytes);
+
+	if ( state->nbuffer == 0 )
+		return;
+
+	partial = pgis_union_geometries(state, state->buffer, state->nbuffer, aggcontext);
+
+	for ( i = 0; i < state->nbuffer; i++ )
+		pfree(state->buffer[i]);
+	state->nbuffer = 0;
+	state->buffer_bytes = 0;
+
+	pgis_union_state_push(state, partial, aggcontext);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_transfn);
+Datum
+pgis_geometry_union_transfn(PG_FUNCTION_ARGS)
+{
+	Oid arg1_typeid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+	MemoryContext aggcontext, old_context;
+	pgis_union_state *state;
+	pgis_abs_union *p;
+	GSERIALIZED *gser;
+
+	if (arg1_typeid == InvalidOid)
+		ereport(ERROR,
+		        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		         errmsg("could not determine input data type")));
+
+	aggcontext = pgis_aggcontext(fcinfo);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		old_context = MemoryContextSwitchTo(aggcontext);
+		state = palloc0(sizeof(pgis_union_state));
+		MemoryContextSwitchTo(old_context);
+
+		state->elemtype = arg1_typeid;
+		get_typlenbyvalalign(arg1_typeid, &state->typlen, &state->typbyval, &state->typalign);
+
+		p = (pgis_abs_union*) palloc(sizeof(pgis_abs_union));
+		p->u = state;
+	}
+	else
+	{
+		p = (pgis_abs_union*) PG_GETARG_POINTER(0);
+		state = p->u;
+	}
+
+	/* NULLs don't take part in the union */
+	if ( PG_ARGISNULL(1) )
+		PG_RETURN_POINTER(p);
+
+	old_context = MemoryContextSwitchTo(aggcontext);
+	gser = (GSERIALIZED *) PG_DETOAST_DATUM_COPY(PG_GETARG_DATUM(1));
+	MemoryContextSwitchTo(old_context);
+
+	state->buffer[state->nbuffer++] = gser;
+	state->buffer_bytes += VARSIZE(gser);
+
+	if ( state->nbuffer == UNION_BUFFER_SIZE || state->buffer_bytes >= UNION_BUFFER_BYTES )
+		pgis_union_state_flush(state, aggcontext);
+
+	PG_RETURN_POINTER(p);
+}
+
+/**
+* The "union" final function unions the buffered geometries with the
+* partial results before returning the result.
 */
 PG_FUNCTION_INFO_V1(pgis_geometry_union_finalfn);
 Datum
 pgis_geometry_union_finalfn(PG_FUNCTION_ARGS)
 {
-	pgis_abs *p;
-	Datum result = 0;
-	Datum geometry_array = 0;
+	pgis_abs_union *p;
+	pgis_union_state *state;
+	GSERIALIZED **geoms;
+	GSERIALIZED *result;
+	int ngeoms, i;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();   /* returns null iff no input values */
 
-	p = (pgis_abs*) PG_GETARG_POINTER(0);
+	p = (pgis_abs_union*) PG_GETARG_POINTER(0);
+	state = p->u;
+
+	geoms = palloc(sizeof(GSERIALIZED*) * (state->nbuffer + UNION_MAX_LEVELS));
+	ngeoms = 0;
+	for ( i = 0; i < state->nbuffer; i++ )
+		geoms[ngeoms++] = state->buffer[i];
+	for ( i = 0; i < UNION_MAX_LEVELS; i++ )
+	{
+		if ( state->partials[i] )
+			geoms[ngeoms++] = state->partials[i];
+	}
+
+	/* Only NULL inputs */
+	if ( ngeoms == 0 )
+		PG_RETURN_NULL();
+
+	result = pgis_union_geometries(state, geoms, ngeoms, CurrentMemoryContext);
+	pfree(geoms);
 
-	geometry_array = pgis_accum_finalfn(p, CurrentMemoryContext, fcinfo);
-	result = PGISDirectFunctionCall1( pgis_union_geometry_array, geometry_array );
 	if (!result)
 		PG_RETURN_NULL();
 
-	PG_RETURN_DATUM(result);
+	PG_RETURN_POINTER(result);
+}
+
+/**
+** ST_Collect and ST_MakeLine don't need the geometry[] in between:
+** their transfer functions build the output as the rows come in, in
+** the aggregate memory context. The final functions only wrap what
+** was built, and leave the state alone for window aggregates.
+*/
+
+/**
+** The "collect" state: the deserialized inputs, each one referencing
+** the copy of its serialized form also kept in the state, and the
+** collection type and box that fit them so far.
+*/
+typedef struct
+{
+	int srid;
+	uint8_t outtype;
+	int ngeoms;
+	int maxgeoms;
+	LWGEOM **geoms;
+	GBOX *box;
+}
+pgis_collect_state;
+
+typedef struct
+{
+	pgis_collect_state *c;
+}
+pgis_abs_collect;
+
+PG_FUNCTION_INFO_V1(pgis_geometry_collect_transfn);
+Datum
+pgis_geometry_collect_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old_context;
+	pgis_collect_state *state;
+	pgis_abs_collect *p;
+	GSERIALIZED *geom;
+	LWGEOM *lwgeom;
+	uint8_t intype;
+
+	aggcontext = pgis_aggcontext(fcinfo);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		old_context = MemoryContextSwitchTo(aggcontext);
+		state = palloc0(sizeof(pgis_collect_state));
+		MemoryContextSwitchTo(old_context);
+
+		p = (pgis_abs_collect*) palloc(sizeof(pgis_abs_collect));
+		p->c = state;
+	}
+	else
+	{
+		p = (pgis_abs_collect*) PG_GETARG_POINTER(0);
+		state = p->c;
+	}
+
+	/* Don't do anything for NULL values */
+	if ( PG_ARGISNULL(1) )
+		PG_RETURN_POINTER(p);
+
+	old_context = MemoryContextSwitchTo(aggcontext);
+
+	geom = (GSERIALIZED *) PG_DETOAST_DATUM_COPY(PG_GETARG_DATUM(1));
+	intype = gserialized_get_type(geom);
+	lwgeom = lwgeom_from_gserialized(geom);
+
+	if ( ! state->ngeoms )
+	{
+		/* Get first geometry SRID */
+		state->srid = lwgeom->srid;
+
+		/* COMPUTE_BBOX WHEN_SIMPLE */
+		if ( lwgeom->bbox )
+			state->box = gbox_copy(lwgeom->bbox);
+
+		state->maxgeoms = 64;
+		state->geoms = palloc(sizeof(LWGEOM*) * state->maxgeoms);
+	}
+	else
+	{
+		/* Check SRID homogeneity */
+		if ( lwgeom->srid != state->srid )
+			elog(ERROR, "Operation on mixed SRID geometries");
+
+		/* COMPUTE_BBOX WHEN_SIMPLE, a box is dropped for good */
+		if ( state->box )
+		{
+			if ( lwgeom->bbox )
+			{
+				state->box->xmin = Min(state->box->xmin, lwgeom->bbox->xmin);
+				state->box->ymin = Min(state->box->ymin, lwgeom->bbox->ymin);
+				state->box->xmax = Max(state->box->xmax, lwgeom->bbox->xmax);
+				state->box->ymax = Max(state->box->ymax, lwgeom->bbox->ymax);
+			}
+			else
+			{
+				pfree(state->box);
+				state->box = NULL;
+			}
+		}
+
+		if ( state->ngeoms == state->maxgeoms )
+		{
+			state->maxgeoms *= 2;
+			state->geoms = repalloc(state->geoms, sizeof(LWGEOM*) * state->maxgeoms);
+		}
+	}
+
+	lwgeom_drop_srid(lwgeom);
+	lwgeom_drop_bbox(lwgeom);
+	state->geoms[state->ngeoms++] = lwgeom;
+
+	MemoryContextSwitchTo(old_context);
+
+	/* Output type not initialized */
+	if ( ! state->outtype )
+	{
+		/* Input is single, make multi */
+		if ( ! lwtype_is_collection(intype) )
+			state->outtype = lwtype_get_collectiontype(intype);
+		/* Input is multi, make collection */
+		else
+			state->outtype = COLLECTIONTYPE;
+	}
+
+	/* Input type not compatible with output */
+	/* make output type a collection */
+	else if ( state->outtype != COLLECTIONTYPE && intype != state->outtype-3 )
+	{
+		state->outtype = COLLECTIONTYPE;
+	}
+
+	PG_RETURN_POINTER(p);
 }
 
 /**
-* The "collect" final function passes the geometry[] to a geometrycollection
-* conversion before returning the result.
+* The "collect" final function wraps the collected geometries into a
+* geometrycollection before returning the result.
 */
 PG_FUNCTION_INFO_V1(pgis_geometry_collect_finalfn);
 Datum
 pgis_geometry_collect_finalfn(PG_FUNCTION_ARGS)
 {
-	pgis_abs *p;
-	Datum result = 0;
-	Datum geometry_array = 0;
+	pgis_collect_state *state;
+	LWGEOM *outlwg;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();   /* returns null iff no input values */
 
-	p = (pgis_abs*) PG_GETARG_POINTER(0);
+	state = ((pgis_abs_collect*) PG_GETARG_POINTER(0))->c;
 
-	geometry_array = pgis_accum_finalfn(p, CurrentMemoryContext, fcinfo);
-	result = PGISDirectFunctionCall1( LWGEOM_collect_garray, geometry_array );
-	if (!result)
+	/* If we have been passed a complete set of NULLs then return NULL */
+	if ( ! state->ngeoms )
 		PG_RETURN_NULL();
 
-	PG_RETURN_DATUM(result);
+	/* The collection only borrows the geometries of the state */
+	outlwg = (LWGEOM *)lwcollection_construct(
+	             state->outtype, state->srid,
+	             state->box ? gbox_copy(state->box) : NULL,
+	             state->ngeoms, state->geoms);
+
+	PG_RETURN_POINTER(geometry_serialize(outlwg));
 }
 
 /**
@@ -277,28 +652,157 @@ pgis_geometry_polygonize_finalfn(PG_FUNCTION_ARGS)
 }
 
 /**
-* The "makeline" final function passes the geometry[] to a line builder
-* before returning the result.
+** The "makeline" state: the vertices of the line so far, copied
+** straight from the serialized points and lines. The point array
+** takes on the Z and M of the inputs as they show up, like the
+** array based lwline_from_lwgeom_array did.
+*/
+typedef struct
+{
+	int srid;
+	POINTARRAY *pa;
+}
+pgis_makeline_state;
+
+typedef struct
+{
+	pgis_makeline_state *m;
+}
+pgis_abs_makeline;
+
+PG_FUNCTION_INFO_V1(pgis_geometry_makeline_transfn);
+Datum
+pgis_geometry_makeline_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old_context;
+	pgis_makeline_state *state;
+	pgis_abs_makeline *p;
+	GSERIALIZED *geom;
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa, *newpa;
+	POINT4D pt;
+	int type, hasz, hasm, i;
+
+	aggcontext = pgis_aggcontext(fcinfo);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		old_context = MemoryContextSwitchTo(aggcontext);
+		state = palloc0(sizeof(pgis_makeline_state));
+		MemoryContextSwitchTo(old_context);
+
+		p = (pgis_abs_makeline*) palloc(sizeof(pgis_abs_makeline));
+		p->m = state;
+	}
+	else
+	{
+		p = (pgis_abs_makeline*) PG_GETARG_POINTER(0);
+		state = p->m;
+	}
+
+	/* Don't do anything for NULL values */
+	if ( PG_ARGISNULL(1) )
+		PG_RETURN_POINTER(p);
+
+	geom = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+	type = gserialized_get_type(geom);
+
+	/* Elements that are NOT points or lines are discarded */
+	if ( type != POINTTYPE && type != LINETYPE )
+	{
+		PG_FREE_IF_COPY(geom, 1);
+		PG_RETURN_POINTER(p);
+	}
+
+	hasz = gserialized_has_z(geom);
+	hasm = gserialized_has_m(geom);
+
+	old_context = MemoryContextSwitchTo(aggcontext);
+
+	if ( ! state->pa )
+	{
+		state->srid = gserialized_get_srid(geom);
+		state->pa = ptarray_construct_empty(hasz, hasm, 64);
+	}
+	else
+	{
+		/* Check SRID homogeneity */
+		if ( gserialized_get_srid(geom) != state->srid )
+			elog(ERROR, "Operation on mixed SRID geometries");
+
+		/* A new dimension, widen the points we have */
+		if ( (hasz && ! FLAGS_GET_Z(state->pa->flags)) || (hasm && ! FLAGS_GET_M(state->pa->flags)) )
+		{
+			newpa = ptarray_construct_empty(hasz || FLAGS_GET_Z(state->pa->flags),
+			                                hasm || FLAGS_GET_M(state->pa->flags),
+			                                state->pa->maxpoints);
+			for ( i = 0; i < state->pa->npoints; i++ )
+			{
+				getPoint4d_p(state->pa, i, &pt);
+				ptarray_append_point(newpa, &pt, LW_TRUE);
+			}
+			ptarray_free(state->pa);
+			state->pa = newpa;
+		}
+	}
+
+	gserialized_iterator_init(&it, geom);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		if ( type == POINTTYPE )
+		{
+			for ( i = 0; i < pa->npoints; i++ )
+			{
+				getPoint4d_p(pa, i, &pt);
+				ptarray_append_point(state->pa, &pt, LW_TRUE);
+			}
+		}
+		else
+		{
+			ptarray_append_ptarray(state->pa, pa, -1);
+		}
+	}
+
+	MemoryContextSwitchTo(old_context);
+
+	PG_FREE_IF_COPY(geom, 1);
+	PG_RETURN_POINTER(p);
+}
+
+/**
+* The "makeline" final function wraps the points into a line before
+* returning the result.
 */
 PG_FUNCTION_INFO_V1(pgis_geometry_makeline_finalfn);
 Datum
 pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS)
 {
-	pgis_abs *p;
-	Datum result = 0;
-	Datum geometry_array = 0;
+	pgis_makeline_state *state;
+	LWLINE *outline;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();   /* returns null iff no input values */
 
-	p = (pgis_abs*) PG_GETARG_POINTER(0);
+	state = ((pgis_abs_makeline*) PG_GETARG_POINTER(0))->m;
 
-	geometry_array = pgis_accum_finalfn(p, CurrentMemoryContext, fcinfo);
-	result = PGISDirectFunctionCall1( LWGEOM_makeline_garray, geometry_array );
-	if (!result)
+	if ( ! state->pa )
+	{
+		/* TODO: should we return LINESTRING EMPTY here ? */
+		elog(NOTICE, "No points or linestrings in input array");
 		PG_RETURN_NULL();
+	}
 
-	PG_RETURN_DATUM(result);
+	POSTGIS_DEBUGF(3, "pgis_geometry_makeline_finalfn: %d points", state->pa->npoints);
+
+	/* The line only borrows the points of the state */
+	if ( state->pa->npoints > 0 )
+		outline = lwline_construct(state->srid, NULL, state->pa);
+	else
+		outline = lwline_construct_empty(state->srid,
+		                                 FLAGS_GET_Z(state->pa->flags),
+		                                 FLAGS_GET_M(state->pa->flags));
+
+	PG_RETURN_POINTER(geometry_serialize(lwline_as_lwgeom(outline)));
 }
 
 /**
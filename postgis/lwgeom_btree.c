@@ -22,6 +22,9 @@
 #include "utils/geo_decls.h"
 
 #include "../postgis_config.h"
+#if POSTGIS_PGSQL_VERSION >= 92
+#include "utils/sortsupport.h"
+#endif
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
 
@@ -37,39 +40,94 @@ Datum lwgeom_eq(PG_FUNCTION_ARGS);
 Datum lwgeom_ge(PG_FUNCTION_ARGS);
 Datum lwgeom_gt(PG_FUNCTION_ARGS);
 Datum lwgeom_cmp(PG_FUNCTION_ARGS);
+#if POSTGIS_PGSQL_VERSION >= 92
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS);
+#endif
 
 
 #define BTREE_SRID_MISMATCH_SEVERITY ERROR
 
+/*
+** Serialized header, SRID and flags, and the largest box that can
+** follow them (four dimensions of floats).
+*/
+#define BTREE_HEADER_SIZE (4 + 8 * sizeof(float))
+
+/**
+* Read the box and SRID the comparisons work on. When the geometry is
+* out of line and carries its box, only the head of the datum is
+* fetched, so comparing large geometries doesn't cost their size.
+* Empty geometries have no box, and sort as a zero box.
+*/
+static int
+lwgeom_btree_box(Datum datum, GBOX *box)
+{
+	GSERIALIZED *g;
+	int srid;
+
+	if ( VARATT_IS_EXTERNAL(DatumGetPointer(datum)) )
+	{
+		g = (GSERIALIZED *) PG_DETOAST_DATUM_SLICE(datum, 0, BTREE_HEADER_SIZE);
+		if ( FLAGS_GET_BBOX(g->flags) && gserialized_get_gbox_p(g, box) == LW_SUCCESS )
+		{
+			srid = gserialized_get_srid(g);
+			pfree(g);
+			return srid;
+		}
+		pfree(g);
+	}
+
+	g = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
+	srid = gserialized_get_srid(g);
+	if ( gserialized_get_gbox_p(g, box) == LW_FAILURE )
+		memset(box, 0, sizeof(GBOX));
+	if ( (Pointer) g != DatumGetPointer(datum) )
+		pfree(g);
+
+	return srid;
+}
+
+/**
+* The btree order: xmin, ymin, xmax then ymax of the boxes, each one
+* compared with the FPeq tolerance.
+*/
+static int
+lwgeom_btree_cmp(const GBOX *box1, const GBOX *box2)
+{
+	if  ( ! FPeq(box1->xmin , box2->xmin) )
+		return box1->xmin < box2->xmin ? -1 : 1;
+
+	if  ( ! FPeq(box1->ymin , box2->ymin) )
+		return box1->ymin < box2->ymin ? -1 : 1;
+
+	if  ( ! FPeq(box1->xmax , box2->xmax) )
+		return box1->xmax < box2->xmax ? -1 : 1;
+
+	if  ( ! FPeq(box1->ymax , box2->ymax) )
+		return box1->ymax < box2->ymax ? -1 : 1;
+
+	return 0;
+}
+
 PG_FUNCTION_INFO_V1(lwgeom_lt);
 Datum lwgeom_lt(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 
 	POSTGIS_DEBUG(2, "lwgeom_lt called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
 	POSTGIS_DEBUG(3, "lwgeom_lt passed getSRID test");
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
-
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
-
-	POSTGIS_DEBUG(3, "lwgeom_lt getbox2d_p passed");
-
 	if  ( ! FPeq(box1.xmin , box2.xmin) )
 	{
 		if  (box1.xmin < box2.xmin)
@@ -100,28 +158,20 @@ Datum lwgeom_lt(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_le);
 Datum lwgeom_le(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 
 	POSTGIS_DEBUG(2, "lwgeom_le called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
-
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
-
 	if  ( ! FPeq(box1.xmin , box2.xmin) )
 	{
 		if  (box1.xmin < box2.xmin)
@@ -164,28 +214,21 @@ Datum lwgeom_le(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_eq);
 Datum lwgeom_eq(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 	bool result;
 
 	POSTGIS_DEBUG(2, "lwgeom_eq called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
-
 	if  ( ! (FPeq(box1.xmin, box2.xmin) && FPeq(box1.ymin, box2.ymin) &&
 	         FPeq(box1.xmax, box2.xmax) && FPeq(box1.ymax, box2.ymax)) )
 	{
@@ -202,28 +245,20 @@ Datum lwgeom_eq(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_ge);
 Datum lwgeom_ge(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 
 	POSTGIS_DEBUG(2, "lwgeom_ge called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
-
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
-
 	if  ( ! FPeq(box1.xmin , box2.xmin) )
 	{
 		if  (box1.xmin > box2.xmin)
@@ -266,28 +301,20 @@ Datum lwgeom_ge(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_gt);
 Datum lwgeom_gt(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 
 	POSTGIS_DEBUG(2, "lwgeom_gt called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
-
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
-
 	if  ( ! FPeq(box1.xmin , box2.xmin) )
 	{
 		if  (box1.xmin > box2.xmin)
@@ -326,64 +353,132 @@ Datum lwgeom_gt(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(lwgeom_cmp);
 Datum lwgeom_cmp(PG_FUNCTION_ARGS)
 {
-	GSERIALIZED *geom1 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	GSERIALIZED *geom2 = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	GBOX box1;
 	GBOX box2;
+	int srid1 = lwgeom_btree_box(PG_GETARG_DATUM(0), &box1);
+	int srid2 = lwgeom_btree_box(PG_GETARG_DATUM(1), &box2);
 
 	POSTGIS_DEBUG(2, "lwgeom_cmp called");
 
-	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
+	if (srid1 != srid2)
 	{
 		elog(BTREE_SRID_MISMATCH_SEVERITY,
 		     "Operation on two GEOMETRIES with different SRIDs\n");
-		PG_FREE_IF_COPY(geom1, 0);
-		PG_FREE_IF_COPY(geom2, 1);
 		PG_RETURN_NULL();
 	}
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	PG_RETURN_INT32(lwgeom_btree_cmp(&box1, &box2));
+}
 
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
+#if POSTGIS_PGSQL_VERSION >= 92
+
+/*
+** Sort support for the btree opclass: CREATE INDEX, ORDER BY, GROUP BY
+** and DISTINCT call the comparator directly instead of going through
+** the fmgr for lwgeom_cmp.
+**
+** Where the server can abbreviate sort keys (PostgreSQL 9.5 on), the
+** box of each geometry is read once into an abbreviated key, its xmin,
+** and most comparisons are settled on those keys without going back to
+** the geometries. The abbreviated comparison is the first step of
+** lwgeom_btree_cmp, so falling back to the full comparator on ties
+** gives the very same order. The key can't be anything smarter (say a
+** space filling curve code) without changing the order of the existing
+** indexes.
+*/
+
+static int
+lwgeom_sort_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	GBOX box1, box2;
+	int srid1 = lwgeom_btree_box(x, &box1);
+	int srid2 = lwgeom_btree_box(y, &box2);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
-	}
+	if (srid1 != srid2)
+		elog(BTREE_SRID_MISMATCH_SEVERITY,
+		     "Operation on two GEOMETRIES with different SRIDs\n");
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+	return lwgeom_btree_cmp(&box1, &box2);
+}
+
+#if POSTGIS_PGSQL_VERSION >= 95 && USE_FLOAT8_BYVAL
+
+typedef struct
+{
+	bool gotsrid;
+	int srid;
+}
+BtreeSortState;
+
+static Datum
+lwgeom_sort_abbrev_convert(Datum original, SortSupport ssup)
+{
+	BtreeSortState *state = (BtreeSortState *) ssup->ssup_extra;
+	GBOX box;
+	int srid = lwgeom_btree_box(original, &box);
+
+	/*
+	** The abbreviated comparisons never see the SRIDs, so check them
+	** here, every input goes through once.
+	*/
+	if ( ! state->gotsrid )
 	{
-		if  (box1.ymin < box2.ymin)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		state->srid = srid;
+		state->gotsrid = true;
 	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+	else if ( srid != state->srid )
 	{
-		if  (box1.xmax < box2.xmax)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		elog(BTREE_SRID_MISMATCH_SEVERITY,
+		     "Operation on two GEOMETRIES with different SRIDs\n");
 	}
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
+	return Float8GetDatum(box.xmin);
+}
+
+static int
+lwgeom_sort_abbrev_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	double xmin1 = DatumGetFloat8(x);
+	double xmin2 = DatumGetFloat8(y);
+
+	/* Within tolerance, up to the full comparator */
+	if ( FPeq(xmin1, xmin2) )
+		return 0;
+
+	return xmin1 < xmin2 ? -1 : 1;
+}
+
+static bool
+lwgeom_sort_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	/* Reading the key is no more than reading the box once, keep it */
+	return false;
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 95 */
+
+PG_FUNCTION_INFO_V1(lwgeom_sortsupport);
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	POSTGIS_DEBUG(2, "lwgeom_sortsupport called");
+
+	ssup->comparator = lwgeom_sort_cmp;
+
+#if POSTGIS_PGSQL_VERSION >= 95 && USE_FLOAT8_BYVAL
+	if ( ssup->abbreviate )
 	{
-		if  (box1.ymax < box2.ymax)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		ssup->ssup_extra = MemoryContextAllocZero(ssup->ssup_cxt, sizeof(BtreeSortState));
+		ssup->comparator = lwgeom_sort_abbrev_cmp;
+		ssup->abbrev_converter = lwgeom_sort_abbrev_convert;
+		ssup->abbrev_abort = lwgeom_sort_abbrev_abort;
+		ssup->abbrev_full_comparator = lwgeom_sort_cmp;
 	}
+#endif
 
-	PG_RETURN_INT32(0);
+	PG_RETURN_VOID();
 }
 
+#endif /* POSTGIS_PGSQL_VERSION >= 92 */
+
@@ -19,15 +19,16 @@
 GeomCache* GetGeomCache(FunctionCallInfoData *fcinfo)
 {
 	MemoryContext old_context;
-	GeomCache* cache = fcinfo->flinfo->fn_extra;
+	GenericCacheCollection* generic_cache = GetGenericCacheCollection(fcinfo);
+	GeomCache* cache = generic_cache->entry[GEOM_CACHE_ENTRY];
 	if ( ! cache ) {
 		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
 		cache = palloc(sizeof(GeomCache));
 		MemoryContextSwitchTo(old_context);
 		cache->prep = 0;
 		cache->rtree = 0;
-		fcinfo->flinfo->fn_extra = cache;
+		cache->circtree = 0;
+		generic_cache->entry[GEOM_CACHE_ENTRY] = cache;
 	}
 	return cache;
 }
-
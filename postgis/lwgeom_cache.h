@@ -19,10 +19,12 @@
 #include "lwgeom_pg.h"
 #include "lwgeom_rtree.h"
 #include "lwgeom_geos_prepared.h"
+#include "geography_measurement_trees.h"
 
 typedef struct {
 	PrepGeomCache* prep;
 	RTREE_POLY_CACHE* rtree;
+	CircTreeGeomCache* circtree;
 } GeomCache;
 
 GeomCache* GetGeomCache(FunctionCallInfoData *fcinfo);
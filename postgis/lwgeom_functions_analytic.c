@@ -36,7 +36,6 @@ Datum ST_LineCrossingDirection(PG_FUNCTION_ARGS);
 double determineSide(POINT2D *seg1, POINT2D *seg2, POINT2D *point);
 int isOnSegment(POINT2D *seg1, POINT2D *seg2, POINT2D *point);
 int point_in_ring(POINTARRAY *pts, POINT2D *point);
-int point_in_ring_rtree(RTREE_NODE *root, POINT2D *point);
 
 
 PG_FUNCTION_INFO_V1(LWGEOM_simplify2d);
@@ -901,262 +900,195 @@ int isOnSegment(POINT2D *seg1, POINT2D *seg2, POINT2D *point)
  * return 1 iff point is inside ring pts
  * return 0 iff point is on ring pts
  */
-int point_in_ring_rtree(RTREE_NODE *root, POINT2D *point)
+int point_in_ring(POINTARRAY *pts, POINT2D *point)
 {
-	int wn = 0;
-	int i;
-	double side;
-	POINT2D seg1;
-	POINT2D seg2;
-	LWMLINE *lines;
-
 	POSTGIS_DEBUG(2, "point_in_ring called.");
 
-	lines = findLineSegments(root, point->y);
-	if (!lines)
-		return -1;
-
-	for (i=0; i<lines->ngeoms; i++)
-	{
-		getPoint2d_p(lines->geoms[i]->points, 0, &seg1);
-		getPoint2d_p(lines->geoms[i]->points, 1, &seg2);
-
-
-		side = determineSide(&seg1, &seg2, point);
-
-		POSTGIS_DEBUGF(3, "segment: (%.8f, %.8f),(%.8f, %.8f)", seg1.x, seg1.y, seg2.x, seg2.y);
-		POSTGIS_DEBUGF(3, "side result: %.8f", side);
-		POSTGIS_DEBUGF(3, "counterclockwise wrap %d, clockwise wrap %d", FP_CONTAINS_BOTTOM(seg1.y,point->y,seg2.y), FP_CONTAINS_BOTTOM(seg2.y,point->y,seg1.y));
-
-		/* zero length segments are ignored. */
-		if (((seg2.x-seg1.x)*(seg2.x-seg1.x)+(seg2.y-seg1.y)*(seg2.y-seg1.y)) < 1e-12*1e-12)
-		{
-			POSTGIS_DEBUG(3, "segment is zero length... ignoring.");
-
-			continue;
-		}
-
-		/* a point on the boundary of a ring is not contained. */
-		/* WAS: if (fabs(side) < 1e-12), see #852 */
-		if (side == 0.0)
-		{
-			if (isOnSegment(&seg1, &seg2, point) == 1)
-			{
-				POSTGIS_DEBUGF(3, "point on ring boundary between points %d, %d", i, i+1);
-
-				return 0;
-			}
-		}
-
-		/*
-		 * If the point is to the left of the line, and it's rising,
-		 * then the line is to the right of the point and
-		 * circling counter-clockwise, so incremement.
-		 */
-		if (FP_CONTAINS_BOTTOM(seg1.y,point->y,seg2.y) && side>0)
-		{
-			POSTGIS_DEBUG(3, "incrementing winding number.");
-
-			++wn;
-		}
-		/*
-		 * If the point is to the right of the line, and it's falling,
-		 * then the line is to the right of the point and circling
-		 * clockwise, so decrement.
-		 */
-		else if (FP_CONTAINS_BOTTOM(seg2.y,point->y,seg1.y) && side<0)
-		{
-			POSTGIS_DEBUG(3, "decrementing winding number.");
+	/* Winding number, with the edges taken a few at a time where the CPU allows */
+	return ptarray_contains_point_2d(pts, point);
+}
 
-			--wn;
-		}
-	}
+/*
+ * return -1 if point outside polygon
+ * return 0 if point on boundary
+ * return 1 if point inside polygon
+ *
+ * The index holds all the rings of all the polygons, see rtree_contains_point
+ */
+int point_in_multipolygon_rtree(RTREE *root, const POINT2D *pt)
+{
+	POSTGIS_DEBUGF(2, "point_in_multipolygon_rtree called for %p (%g %g).", root, pt->x, pt->y);
 
-	POSTGIS_DEBUGF(3, "winding number %d", wn);
+	/* assume bbox short-circuit has already been attempted */
 
-	if (wn == 0)
-		return -1;
-	return 1;
+	return rtree_contains_point(root, pt);
 }
 
-
 /*
- * return -1 iff point is outside ring pts
- * return 1 iff point is inside ring pts
- * return 0 iff point is on ring pts
+ * return -1 iff point outside (multi)polygon
+ * return 0 iff point on boundary
+ * return 1 iff point inside (multi)polygon
+ *
+ * Same answers as point_in_multipolygon, reading the rings straight
+ * off the serialized (multi)polygon.
  */
-int point_in_ring(POINTARRAY *pts, POINT2D *point)
+int point_in_multipolygon_gserialized(const GSERIALIZED *g, const POINT2D *pt)
 {
-	int wn = 0;
-	int i;
-	double side;
-	POINT2D seg1;
-	POINT2D seg2;
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *ring;
+	POINT2D p = *pt;
+	int result = -1;
+	int skip = LW_FALSE;
+	int in_ring;
 
-	POSTGIS_DEBUG(2, "point_in_ring called.");
+	POSTGIS_DEBUG(2, "point_in_multipolygon_gserialized called.");
 
+	/* assume bbox short-circuit has already been attempted */
 
-	for (i=0; i<pts->npoints-1; i++)
+	gserialized_iterator_init(&it, g);
+	while ( (ring = gserialized_iterator_next(&it)) )
 	{
-		getPoint2d_p(pts, i, &seg1);
-		getPoint2d_p(pts, i+1, &seg2);
-
-
-		side = determineSide(&seg1, &seg2, point);
-
-		POSTGIS_DEBUGF(3, "segment: (%.8f, %.8f),(%.8f, %.8f)", seg1.x, seg1.y, seg2.x, seg2.y);
-		POSTGIS_DEBUGF(3, "side result: %.8f", side);
-		POSTGIS_DEBUGF(3, "counterclockwise wrap %d, clockwise wrap %d", FP_CONTAINS_BOTTOM(seg1.y,point->y,seg2.y), FP_CONTAINS_BOTTOM(seg2.y,point->y,seg1.y));
-
-		/* zero length segments are ignored. */
-		if (((seg2.x-seg1.x)*(seg2.x-seg1.x)+(seg2.y-seg1.y)*(seg2.y-seg1.y)) < 1e-12*1e-12)
+		if ( it.ring == 0 )
 		{
-			POSTGIS_DEBUG(3, "segment is zero length... ignoring.");
-
-			continue;
+			/* Inside the previous polygon and none of its holes */
+			if ( result == 1 )
+				return 1;
+			skip = LW_FALSE;
 		}
+		if ( skip )
+			continue;
 
-		/* a point on the boundary of a ring is not contained. */
-		/* WAS: if (fabs(side) < 1e-12), see #852 */
-		if (side == 0.0)
+		in_ring = point_in_ring(ring, &p);
+		if ( in_ring == 0 ) /* on the edge of the shell or a hole */
 		{
-			if (isOnSegment(&seg1, &seg2, point) == 1)
-			{
-				POSTGIS_DEBUGF(3, "point on ring boundary between points %d, %d", i, i+1);
-
-				return 0;
-			}
+			POSTGIS_DEBUGF(3, "point_in_polygon: on edge of ring %d.", it.ring);
+			return 0;
 		}
-
-		/*
-		 * If the point is to the left of the line, and it's rising,
-		 * then the line is to the right of the point and
-		 * circling counter-clockwise, so incremement.
-		 */
-		if (FP_CONTAINS_BOTTOM(seg1.y,point->y,seg2.y) && side>0)
+		if ( it.ring == 0 )
 		{
-			POSTGIS_DEBUG(3, "incrementing winding number.");
-
-			++wn;
+			if ( in_ring == -1 ) /* outside the exterior ring */
+				skip = LW_TRUE;
+			else
+				result = 1;
 		}
-		/*
-		 * If the point is to the right of the line, and it's falling,
-		 * then the line is to the right of the point and circling
-		 * clockwise, so decrement.
-		 */
-		else if (FP_CONTAINS_BOTTOM(seg2.y,point->y,seg1.y) && side<0)
+		else if ( in_ring == 1 ) /* inside a hole => outside the polygon */
 		{
-			POSTGIS_DEBUG(3, "decrementing winding number.");
-
-			--wn;
+			POSTGIS_DEBUGF(3, "point_in_polygon: within hole %d.", it.ring);
+			result = -1;
+			skip = LW_TRUE;
 		}
 	}
-
-	POSTGIS_DEBUGF(3, "winding number %d", wn);
-
-	if (wn == 0)
-		return -1;
-	return 1;
+	return result;
 }
 
 /*
- * return 0 iff point outside polygon or on boundary
- * return 1 iff point inside polygon
+ * Same as point_in_multipolygon_gserialized for a set of points, in a
+ * single pass over the rings: each ring is tested against all the
+ * points still undecided at once. Fills results with -1 (outside),
+ * 0 (on the boundary) or 1 (inside) for each point.
  */
-int point_in_polygon_rtree(RTREE_NODE **root, int ringCount, LWPOINT *point)
+#define PIM_UNDECIDED 0
+#define PIM_INSIDE    1 /* inside the current shell, and none of its holes so far */
+#define PIM_SKIP      2 /* outside the current polygon */
+#define PIM_DONE      3
+
+void points_in_multipolygon_gserialized(const GSERIALIZED *g, const POINT2D *pts, int npoints, int *results)
 {
-	int i;
-	POINT2D pt;
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *ring;
+	POINT2D *active_pts;
+	int *active, *in_ring;
+	char *state;
+	int nactive, ndone = 0;
+	int i, j;
 
-	POSTGIS_DEBUGF(2, "point_in_polygon called for %p %d %p.", root, ringCount, point);
+	POSTGIS_DEBUGF(2, "points_in_multipolygon_gserialized called with %d points.", npoints);
 
-	getPoint2d_p(point->point, 0, &pt);
 	/* assume bbox short-circuit has already been attempted */
 
-	if (point_in_ring_rtree(root[0], &pt) != 1)
-	{
-		POSTGIS_DEBUG(3, "point_in_polygon_rtree: outside exterior ring.");
+	if ( npoints < 1 )
+		return;
 
-		return 0;
+	active_pts = palloc(sizeof(POINT2D) * npoints);
+	active = palloc(sizeof(int) * npoints);
+	in_ring = palloc(sizeof(int) * npoints);
+	state = palloc(npoints);
+	for ( i = 0; i < npoints; i++ )
+	{
+		results[i] = -1;
+		state[i] = PIM_UNDECIDED;
 	}
 
-	for (i=1; i<ringCount; i++)
+	gserialized_iterator_init(&it, g);
+	while ( ndone < npoints && (ring = gserialized_iterator_next(&it)) )
 	{
-		if (point_in_ring_rtree(root[i], &pt) != -1)
+		/* A new polygon, settle the points inside the previous one */
+		if ( it.ring == 0 )
 		{
-			POSTGIS_DEBUGF(3, "point_in_polygon_rtree: within hole %d.", i);
-
-			return 0;
+			for ( i = 0; i < npoints; i++ )
+			{
+				if ( state[i] == PIM_INSIDE )
+				{
+					results[i] = 1;
+					state[i] = PIM_DONE;
+					ndone++;
+				}
+				else if ( state[i] == PIM_SKIP )
+				{
+					state[i] = PIM_UNDECIDED;
+				}
+			}
+			if ( ndone == npoints )
+				break;
 		}
-	}
-	return 1;
-}
-
-/*
- * return -1 if point outside polygon
- * return 0 if point on boundary
- * return 1 if point inside polygon
- *
- * Expected **root order is each exterior ring followed by its holes, eg. EIIEIIEI
- */
-int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, LWPOINT *point)
-{
-	int i, p, r, in_ring;
-	POINT2D pt;
-	int result = -1;
-
-	POSTGIS_DEBUGF(2, "point_in_multipolygon_rtree called for %p %d %p.", root, polyCount, point);
 
-	getPoint2d_p(point->point, 0, &pt);
-	/* assume bbox short-circuit has already been attempted */
+		/* Gather the points this ring can still say something about */
+		nactive = 0;
+		for ( i = 0; i < npoints; i++ )
+		{
+			if ( state[i] == PIM_DONE || state[i] == PIM_SKIP )
+				continue;
+			active[nactive] = i;
+			active_pts[nactive] = pts[i];
+			nactive++;
+		}
+		if ( nactive == 0 )
+			continue;
 
-        i = 0; /* the current index into the root array */
+		ptarray_contains_points_2d(ring, active_pts, nactive, in_ring);
 
-	/* is the point inside any of the sub-polygons? */
-	for ( p = 0; p < polyCount; p++ )
-	{
-		in_ring = point_in_ring_rtree(root[i], &pt);
-		POSTGIS_DEBUGF(4, "point_in_multipolygon_rtree: exterior ring (%d), point_in_ring returned %d", p, in_ring);
-		if ( in_ring == -1 ) /* outside the exterior ring */
+		for ( j = 0; j < nactive; j++ )
 		{
-			POSTGIS_DEBUG(3, "point_in_multipolygon_rtree: outside exterior ring.");
+			i = active[j];
+			if ( in_ring[j] == 0 ) /* on the edge of the shell or a hole */
+			{
+				results[i] = 0;
+				state[i] = PIM_DONE;
+				ndone++;
+			}
+			else if ( it.ring == 0 )
+			{
+				/* outside the exterior ring, or inside so far */
+				state[i] = (in_ring[j] == -1) ? PIM_SKIP : PIM_INSIDE;
+			}
+			else if ( in_ring[j] == 1 ) /* inside a hole => outside the polygon */
+			{
+				state[i] = PIM_SKIP;
+			}
 		}
-         	else if ( in_ring == 0 ) /* on the boundary */
-		{
-			POSTGIS_DEBUGF(3, "point_in_multipolygon_rtree: on edge of exterior ring %d", p);
-                        return 0;
-		} else {
-                	result = in_ring;
-
-	                for(r=1; r<ringCounts[p]; r++)
-     	                {
-                        	in_ring = point_in_ring_rtree(root[i+r], &pt);
-		        	POSTGIS_DEBUGF(4, "point_in_multipolygon_rtree: interior ring (%d), point_in_ring returned %d", r, in_ring);
-                        	if (in_ring == 1) /* inside a hole => outside the polygon */
-                        	{
-                                	POSTGIS_DEBUGF(3, "point_in_multipolygon_rtree: within hole %d of exterior ring %d", r, p);
-                                	result = -1;
-                                	break;
-                        	}
-                        	if (in_ring == 0) /* on the edge of a hole */
-                        	{
-			        	POSTGIS_DEBUGF(3, "point_in_multipolygon_rtree: on edge of hole %d of exterior ring %d", r, p);
-                                	return 0;
-		        	}
-                	}
-                	/* if we have a positive result, we can short-circuit and return it */
-                	if ( result != -1)
-                	{
-                        	return result;
-                	}
-                }
-                /* increment the index by the total number of rings in the sub-poly */
-                /* we do this here in case we short-cutted out of the poly before looking at all the rings */ 
-                i += ringCounts[p];
 	}
 
-	return result; /* -1 = outside, 0 = boundary, 1 = inside */
+	/* Inside the last polygon and none of its holes */
+	for ( i = 0; i < npoints; i++ )
+	{
+		if ( state[i] == PIM_INSIDE )
+			results[i] = 1;
+	}
 
+	pfree(active_pts);
+	pfree(active);
+	pfree(in_ring);
+	pfree(state);
 }
 
 /*
@@ -16,8 +16,11 @@
 ** Public prototypes for analytic functions.
 */
 
-int point_in_polygon_rtree(RTREE_NODE **root, int ringCount, LWPOINT *point);
-int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, LWPOINT *point);
+double determineSide(POINT2D *seg1, POINT2D *seg2, POINT2D *point);
+int isOnSegment(POINT2D *seg1, POINT2D *seg2, POINT2D *point);
+int point_in_multipolygon_rtree(RTREE *root, const POINT2D *pt);
+int point_in_multipolygon_gserialized(const GSERIALIZED *g, const POINT2D *pt);
+void points_in_multipolygon_gserialized(const GSERIALIZED *g, const POINT2D *pts, int npoints, int *results);
 int point_in_polygon(LWPOLY *polygon, LWPOINT *point);
 int point_in_multipolygon(LWMPOLY *mpolygon, LWPOINT *pont);
 
@@ -19,6 +19,7 @@
 #include "liblwgeom_internal.h"
 #include "libtgeom.h"
 #include "lwgeom_pg.h"
+#include "lwgeom_rtree.h"
 
 #include <math.h>
 #include <float.h>
@@ -91,6 +92,7 @@ Datum LWGEOM_affine(PG_FUNCTION_ARGS);
 Datum LWGEOM_longitude_shift(PG_FUNCTION_ARGS);
 Datum optimistic_overlap(PG_FUNCTION_ARGS);
 Datum ST_GeoHash(PG_FUNCTION_ARGS);
+Datum ST_HilbertKey(PG_FUNCTION_ARGS);
 Datum ST_MakeEnvelope(PG_FUNCTION_ARGS);
 Datum ST_CollectionExtract(PG_FUNCTION_ARGS);
 Datum ST_CollectionHomogenize(PG_FUNCTION_ARGS);
@@ -211,11 +213,9 @@ PG_FUNCTION_INFO_V1(LWGEOM_npoints);
 Datum LWGEOM_npoints(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom = (GSERIALIZED *)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	LWGEOM *lwgeom = lwgeom_from_gserialized(geom);
 	int npoints = 0;
 
-	npoints = lwgeom_count_vertices(lwgeom);
-	lwgeom_free(lwgeom);
+	npoints = gserialized_count_vertices(geom);
 
 	PG_FREE_IF_COPY(geom, 0);
 	PG_RETURN_INT32(npoints);
@@ -620,19 +620,26 @@ Datum LWGEOM_mindistance2d(PG_FUNCTION_ARGS)
 	double mindist;
 	GSERIALIZED *geom1 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
 	GSERIALIZED *geom2 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
-	LWGEOM *lwgeom1 = lwgeom_from_gserialized(geom1);
-	LWGEOM *lwgeom2 = lwgeom_from_gserialized(geom2);
+	LWGEOM *lwgeom1;
+	LWGEOM *lwgeom2;
 
-	if (lwgeom1->srid != lwgeom2->srid)
+	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
 	{
 		elog(ERROR,"Operation on two GEOMETRIES with different SRIDs\n");
 		PG_RETURN_NULL();
 	}
 
-	mindist = lwgeom_mindistance2d(lwgeom1, lwgeom2);
-
-	lwgeom_free(lwgeom1);
-	lwgeom_free(lwgeom2);
+	/* Repeated geometry? Walk its cached index instead of every pair of segments */
+	if ( rtree_distance_cache(fcinfo, geom1, geom2, 0.0, &mindist) == LW_FAILURE &&
+	     /* A point against points, lines or polygons is read in place */
+	     gserialized_distance2d_point(geom1, geom2, 0.0, &mindist) == LW_FAILURE )
+	{
+		lwgeom1 = lwgeom_from_gserialized(geom1);
+		lwgeom2 = lwgeom_from_gserialized(geom2);
+		mindist = lwgeom_mindistance2d(lwgeom1, lwgeom2);
+		lwgeom_free(lwgeom1);
+		lwgeom_free(lwgeom2);
+	}
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -656,8 +663,8 @@ Datum LWGEOM_dwithin(PG_FUNCTION_ARGS)
 	GSERIALIZED *geom1 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
 	GSERIALIZED *geom2 = (GSERIALIZED*)PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
 	double tolerance = PG_GETARG_FLOAT8(2);	
-	LWGEOM *lwgeom1 = lwgeom_from_gserialized(geom1);
-	LWGEOM *lwgeom2 = lwgeom_from_gserialized(geom2);
+	LWGEOM *lwgeom1;
+	LWGEOM *lwgeom2;
 
 	if ( tolerance < 0 )
 	{
@@ -665,13 +672,21 @@ Datum LWGEOM_dwithin(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
-	if (lwgeom1->srid != lwgeom2->srid)
+	if (gserialized_get_srid(geom1) != gserialized_get_srid(geom2))
 	{
 		elog(ERROR,"Operation on two GEOMETRIES with different SRIDs\n");
 		PG_RETURN_NULL();
 	}
 
-	mindist = lwgeom_mindistance2d_tolerance(lwgeom1,lwgeom2,tolerance);
+	if ( rtree_distance_cache(fcinfo, geom1, geom2, tolerance, &mindist) == LW_FAILURE &&
+	     gserialized_distance2d_point(geom1, geom2, tolerance, &mindist) == LW_FAILURE )
+	{
+		lwgeom1 = lwgeom_from_gserialized(geom1);
+		lwgeom2 = lwgeom_from_gserialized(geom2);
+		mindist = lwgeom_mindistance2d_tolerance(lwgeom1,lwgeom2,tolerance);
+		lwgeom_free(lwgeom1);
+		lwgeom_free(lwgeom2);
+	}
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -1785,10 +1800,8 @@ PG_FUNCTION_INFO_V1(LWGEOM_isempty);
 Datum LWGEOM_isempty(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom = (GSERIALIZED *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	LWGEOM *lwgeom = lwgeom_from_gserialized(geom);
-	bool empty = lwgeom_is_empty(lwgeom);
+	bool empty = gserialized_is_empty(geom);
 
-	lwgeom_free(lwgeom);
 	PG_FREE_IF_COPY(geom, 0);
 	PG_RETURN_BOOL(empty);
 }
@@ -2534,6 +2547,31 @@ Datum ST_GeoHash(PG_FUNCTION_ARGS)
 
 }
 
+/**
+* ST_HilbertKey(geometry, box2d) returns the position of the centre of
+* the geometry box along a Hilbert curve laid over the extent, for
+* spatially local orderings of any SRID. NULL for empty geometries.
+*/
+PG_FUNCTION_INFO_V1(ST_HilbertKey);
+Datum ST_HilbertKey(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = (GSERIALIZED *)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
+	GBOX *extent = (GBOX *)PG_GETARG_POINTER(1);
+	GBOX box;
+	int64 key;
+
+	if ( gserialized_get_gbox_p(geom, &box) == LW_FAILURE )
+	{
+		PG_FREE_IF_COPY(geom, 0);
+		PG_RETURN_NULL();
+	}
+
+	key = (int64)gbox_hilbert_key(&box, extent);
+
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_INT64(key);
+}
+
 PG_FUNCTION_INFO_V1(ST_CollectionExtract);
 Datum ST_CollectionExtract(PG_FUNCTION_ARGS)
 {
@@ -87,27 +87,6 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS);
 ** Prototypes end
 */
 
-static RTREE_POLY_CACHE *
-GetRtreeCache(FunctionCallInfoData *fcinfo, LWGEOM *lwgeom, GSERIALIZED *poly)
-{
-	MemoryContext old_context;
-	GeomCache* supercache = GetGeomCache(fcinfo);
-	RTREE_POLY_CACHE *poly_cache = supercache->rtree;
-
-	/*
-	 * Switch the context to the function-scope context,
-	 * retrieve the appropriate cache object, cache it for
-	 * future use, then switch back to the local context.
-	 */
-	old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-	poly_cache = retrieveCache(lwgeom, poly, poly_cache);
-	supercache->rtree = poly_cache;
-	MemoryContextSwitchTo(old_context);
-
-	return poly_cache;
-}
-
-
 PG_FUNCTION_INFO_V1(postgis_geos_version);
 Datum postgis_geos_version(PG_FUNCTION_ARGS)
 {
@@ -1977,6 +1956,70 @@ Datum overlaps(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Locates the point(s) of gpoint against the (multi)polygon gpoly,
+ * straight off the serializations, through the cached index of the
+ * polygon if there is one. Counts the points inside and outside of the
+ * polygon, the others are on its boundary. Returns the number of
+ * points, empty points don't count.
+ */
+static int
+points_in_polygon_short_circuit(const RTREE_POLY_CACHE *poly_cache, const GSERIALIZED *gpoly, const GSERIALIZED *gpoint, int *ninside, int *noutside)
+{
+	GSERIALIZED_ITERATOR it;
+	POINTARRAY *pa;
+	POINT2D pt;
+	int result;
+	POINT2D *pts = &pt;
+	int *results = &result;
+	int npoints = gserialized_count_vertices(gpoint);
+	int i = 0;
+
+	*ninside = *noutside = 0;
+	if ( npoints == 0 )
+		return 0;
+
+	if ( npoints > 1 )
+	{
+		pts = palloc(sizeof(POINT2D) * npoints);
+		results = palloc(sizeof(int) * npoints);
+	}
+
+	gserialized_iterator_init(&it, gpoint);
+	while ( (pa = gserialized_iterator_next(&it)) )
+	{
+		if ( pa->npoints > 0 )
+			getPoint2d_p(pa, 0, &(pts[i++]));
+	}
+
+	POSTGIS_DEBUGF(3, "Precall point_in_multipolygon_rtree %p, %d points", poly_cache ? poly_cache->index : NULL, npoints);
+
+	if ( poly_cache && poly_cache->index )
+	{
+		for ( i = 0; i < npoints; i++ )
+			results[i] = point_in_multipolygon_rtree(poly_cache->index, &(pts[i]));
+	}
+	else
+	{
+		points_in_multipolygon_gserialized(gpoly, pts, npoints, results);
+	}
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		if ( results[i] == 1 )
+			(*ninside)++;
+		else if ( results[i] == -1 )
+			(*noutside)++;
+	}
+
+	if ( npoints > 1 )
+	{
+		pfree(pts);
+		pfree(results);
+	}
+	return npoints;
+}
+
 PG_FUNCTION_INFO_V1(contains);
 Datum contains(PG_FUNCTION_ARGS)
 {
@@ -1985,8 +2028,7 @@ Datum contains(PG_FUNCTION_ARGS)
 	GEOSGeometry *g1, *g2;
 	GBOX box1, box2;
 	int type1, type2;
-	LWGEOM *lwgeom;
-	LWPOINT *point;
+	int npoints, ninside, noutside;
 	RTREE_POLY_CACHE *poly_cache;
 	bool result;
 #ifdef PREPARED_GEOM
@@ -2026,39 +2068,18 @@ Datum contains(PG_FUNCTION_ARGS)
 	*/
 	type1 = gserialized_get_type(geom1);
 	type2 = gserialized_get_type(geom2);
-	if ((type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE) && type2 == POINTTYPE)
+	if ((type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE) &&
+	    (type2 == POINTTYPE || type2 == MULTIPOINTTYPE))
 	{
 		POSTGIS_DEBUG(3, "Point in Polygon test requested...short-circuiting.");
-		lwgeom = lwgeom_from_gserialized(geom1);
-		point = lwgeom_as_lwpoint(lwgeom_from_gserialized(geom2));
-
-		POSTGIS_DEBUGF(3, "Precall point_in_multipolygon_rtree %p, %p", lwgeom, point);
 
-		poly_cache = GetRtreeCache(fcinfo, lwgeom, geom1);
+		poly_cache = GetRtreeCache(fcinfo, geom1, NULL);
+		npoints = points_in_polygon_short_circuit(poly_cache, geom1, geom2, &ninside, &noutside);
 
-		if ( poly_cache->ringIndices )
-		{
-			result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
-		}
-		else if ( type1 == POLYGONTYPE )
-		{
-			result = point_in_polygon((LWPOLY*)lwgeom, point);
-		}
-		else if ( type1 == MULTIPOLYGONTYPE )
-		{
-			result = point_in_multipolygon((LWMPOLY*)lwgeom, point);
-		}
-		else
-		{
-			/* Gulp! Should not be here... */
-			elog(ERROR,"Type isn't poly or multipoly!");
-			PG_RETURN_NULL();
-		}
-		lwgeom_free(lwgeom);
-		lwpoint_free(point);
 		PG_FREE_IF_COPY(geom1, 0);
 		PG_FREE_IF_COPY(geom2, 1);
-		if ( result == 1 ) /* completely inside */
+		/* nothing outside, and something inside (not all on the boundary) */
+		if ( npoints > 0 && noutside == 0 && ninside > 0 )
 		{
 			PG_RETURN_BOOL(TRUE);
 		}
@@ -2222,8 +2243,7 @@ Datum covers(PG_FUNCTION_ARGS)
 	bool result;
 	GBOX box1, box2;
 	int type1, type2;
-	LWGEOM *lwgeom;
-	LWPOINT *point;
+	int npoints, ninside, noutside;
 	RTREE_POLY_CACHE *poly_cache;
 #ifdef PREPARED_GEOM
 	PrepGeomCache *prep_cache;
@@ -2259,41 +2279,17 @@ Datum covers(PG_FUNCTION_ARGS)
 	 */
 	type1 = gserialized_get_type(geom1);
 	type2 = gserialized_get_type(geom2);
-	if ((type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE) && type2 == POINTTYPE)
+	if ((type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE) &&
+	    (type2 == POINTTYPE || type2 == MULTIPOINTTYPE))
 	{
 		POSTGIS_DEBUG(3, "Point in Polygon test requested...short-circuiting.");
 
-		lwgeom = lwgeom_from_gserialized(geom1);
-		point = lwgeom_as_lwpoint(lwgeom_from_gserialized(geom2));
+		poly_cache = GetRtreeCache(fcinfo, geom1, NULL);
+		npoints = points_in_polygon_short_circuit(poly_cache, geom1, geom2, &ninside, &noutside);
 
-		POSTGIS_DEBUGF(3, "Precall point_in_multipolygon_rtree %p, %p", lwgeom, point);
-
-		poly_cache = GetRtreeCache(fcinfo, lwgeom, geom1);
-
-		if ( poly_cache->ringIndices )
-		{
-			result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
-		}
-		else if ( type1 == POLYGONTYPE )
-		{
-			result = point_in_polygon((LWPOLY*)lwgeom, point);
-		}
-		else if ( type1 == MULTIPOLYGONTYPE )
-		{
-			result = point_in_multipolygon((LWMPOLY*)lwgeom, point);
-		}
-		else
-		{
-			/* Gulp! Should not be here... */
-			elog(ERROR,"Type isn't poly or multipoly!");
-			PG_RETURN_NULL();
-		}
-
-		lwgeom_free(lwgeom);
-		lwpoint_free(point);
 		PG_FREE_IF_COPY(geom1, 0);
 		PG_FREE_IF_COPY(geom2, 1);
-		if ( result != -1 ) /* not outside */
+		if ( npoints > 0 && noutside == 0 ) /* nothing outside */
 		{
 			PG_RETURN_BOOL(TRUE);
 		}
@@ -2380,9 +2376,8 @@ Datum coveredby(PG_FUNCTION_ARGS)
 	GEOSGeometry *g1, *g2;
 	bool result;
 	GBOX box1, box2;
-	LWGEOM *lwgeom;
-	LWPOINT *point;
 	int type1, type2;
+	int npoints, ninside, noutside;
 	RTREE_POLY_CACHE *poly_cache;
 	char *patt = "**F**F***";
 
@@ -2418,39 +2413,17 @@ Datum coveredby(PG_FUNCTION_ARGS)
 	 */
 	type1 = gserialized_get_type(geom1);
 	type2 = gserialized_get_type(geom2);
-	if ((type2 == POLYGONTYPE || type2 == MULTIPOLYGONTYPE) && type1 == POINTTYPE)
+	if ((type2 == POLYGONTYPE || type2 == MULTIPOLYGONTYPE) &&
+	    (type1 == POINTTYPE || type1 == MULTIPOINTTYPE))
 	{
 		POSTGIS_DEBUG(3, "Point in Polygon test requested...short-circuiting.");
 
-		point = lwgeom_as_lwpoint(lwgeom_from_gserialized(geom1));
-		lwgeom = lwgeom_from_gserialized(geom2);
+		poly_cache = GetRtreeCache(fcinfo, NULL, geom2);
+		npoints = points_in_polygon_short_circuit(poly_cache, geom2, geom1, &ninside, &noutside);
 
-		poly_cache = GetRtreeCache(fcinfo, lwgeom, geom2);
-
-		if ( poly_cache->ringIndices )
-		{
-			result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
-		}
-		else if ( type2 == POLYGONTYPE )
-		{
-			result = point_in_polygon((LWPOLY*)lwgeom, point);
-		}
-		else if ( type2 == MULTIPOLYGONTYPE )
-		{
-			result = point_in_multipolygon((LWMPOLY*)lwgeom, point);
-		}
-		else
-		{
-			/* Gulp! Should not be here... */
-			elog(ERROR,"Type isn't poly or multipoly!");
-			PG_RETURN_NULL();
-		}
-
-		lwgeom_free(lwgeom);
-		lwpoint_free(point);
 		PG_FREE_IF_COPY(geom1, 0);
 		PG_FREE_IF_COPY(geom2, 1);
-		if ( result != -1 ) /* not outside */
+		if ( npoints > 0 && noutside == 0 ) /* nothing outside */
 		{
 			PG_RETURN_BOOL(TRUE);
 		}
@@ -2571,12 +2544,12 @@ Datum intersects(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom1;
 	GSERIALIZED *geom2;
+	GSERIALIZED *serialized_point;
 	GSERIALIZED *serialized_poly;
 	bool result;
 	GBOX box1, box2;
-	int type1, type2, polytype;
-	LWPOINT *point;
-	LWGEOM *lwgeom;
+	int type1, type2;
+	int npoints, ninside, noutside;
 	RTREE_POLY_CACHE *poly_cache;
 #ifdef PREPARED_GEOM
 	PrepGeomCache *prep_cache;
@@ -2612,52 +2585,28 @@ Datum intersects(PG_FUNCTION_ARGS)
 	 */
 	type1 = gserialized_get_type(geom1);
 	type2 = gserialized_get_type(geom2);
-	if ( (type1 == POINTTYPE && (type2 == POLYGONTYPE || type2 == MULTIPOLYGONTYPE)) ||
-	        (type2 == POINTTYPE && (type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE)))
+	if ( ((type1 == POINTTYPE || type1 == MULTIPOINTTYPE) && (type2 == POLYGONTYPE || type2 == MULTIPOLYGONTYPE)) ||
+	        ((type2 == POINTTYPE || type2 == MULTIPOINTTYPE) && (type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE)))
 	{
 		POSTGIS_DEBUG(3, "Point in Polygon test requested...short-circuiting.");
 
-		if ( type1 == POINTTYPE )
+		if ( type1 == POINTTYPE || type1 == MULTIPOINTTYPE )
 		{
-			point = lwgeom_as_lwpoint(lwgeom_from_gserialized(geom1));
-			lwgeom = lwgeom_from_gserialized(geom2);
+			serialized_point = geom1;
 			serialized_poly = geom2;
-			polytype = type2;
 		}
 		else
 		{
-			point = lwgeom_as_lwpoint(lwgeom_from_gserialized(geom2));
-			lwgeom = lwgeom_from_gserialized(geom1);
+			serialized_point = geom2;
 			serialized_poly = geom1;
-			polytype = type1;
 		}
 
-		poly_cache = GetRtreeCache(fcinfo, lwgeom, serialized_poly);
-
-		if ( poly_cache->ringIndices )
-		{
-			result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
-		}
-		else if ( polytype == POLYGONTYPE )
-		{
-			result = point_in_polygon((LWPOLY*)lwgeom, point);
-		}
-		else if ( polytype == MULTIPOLYGONTYPE )
-		{
-			result = point_in_multipolygon((LWMPOLY*)lwgeom, point);
-		}
-		else
-		{
-			/* Gulp! Should not be here... */
-			elog(ERROR,"Type isn't poly or multipoly!");
-			PG_RETURN_NULL();
-		}
+		poly_cache = GetRtreeCache(fcinfo, serialized_poly, NULL);
+		npoints = points_in_polygon_short_circuit(poly_cache, serialized_poly, serialized_point, &ninside, &noutside);
 
-		lwgeom_free(lwgeom);
-		lwpoint_free(point);
 		PG_FREE_IF_COPY(geom1, 0);
 		PG_FREE_IF_COPY(geom2, 1);
-		if ( result != -1 ) /* not outside */
+		if ( npoints > noutside ) /* not all outside */
 		{
 			PG_RETURN_BOOL(TRUE);
 		}
@@ -14,6 +14,9 @@
 
 #include <assert.h>
 
+#include "postgres.h"
+#include "funcapi.h"
+
 #include "../postgis_config.h"
 #include "lwgeom_geos_prepared.h"
 #include "lwgeom_cache.h"
@@ -31,12 +34,12 @@
 **
 **  Working parts:
 **
-**  PrepGeomCache, the actual struct that holds the keys we compare
-**  to determine if our cache is stale, and references to the GEOS
-**  objects used in computations.
+**  PrepGeomCache, the actual struct that holds a small LRU list of
+**  PrepGeomCacheEntry, each with the key we compare to find it and
+**  references to the GEOS objects used in computations.
 **
 **  PrepGeomHash, a global hash table that uses a MemoryContext as
-**  key and returns a structure holding references to the GEOS
+**  key and returns the PrepGeomCache holding references to the GEOS
 **  objects used in computations.
 **
 **  PreparedCacheContextMethods, a set of callback functions that
@@ -60,7 +63,9 @@
 ** so we need to map that over to actual references to GEOS objects to
 ** delete.
 **
-** This hash table stores a key/value pair of MemoryContext/Geom* objects.
+** This hash table stores a key/value pair of MemoryContext/PrepGeomCache*.
+** The PrepGeomCache lives in the parent of the MemoryContext, so it is
+** still around when the MemoryContext is deleted.
 */
 static HTAB* PrepGeomHash = NULL;
 
@@ -69,11 +74,28 @@ static HTAB* PrepGeomHash = NULL;
 typedef struct
 {
 	MemoryContext context;
-	const GEOSPreparedGeometry* prepared_geom;
-	const GEOSGeometry* geom;
+	PrepGeomCache* cache;
 }
 PrepGeomHashEntry;
 
+/* Value of the postgis.prepared_cache_size setting */
+int prepared_cache_size = PREPARED_CACHE_SIZE_DEFAULT;
+
+/*
+** Backend totals for all the call sites, reported by
+** postgis_prepared_cache_stats().
+*/
+static struct
+{
+	int64 hits;       /* a key was found in the cache */
+	int64 misses;     /* no key was found, new keys were copied */
+	int64 prepares;   /* a key was seen twice, and got prepared */
+	int64 evictions;  /* an entry was dropped to make room */
+}
+PrepGeomCacheStats = { 0, 0, 0, 0 };
+
+Datum postgis_prepared_cache_stats(PG_FUNCTION_ARGS);
+
 /* Memory context hash table function prototypes */
 uint32 mcxt_ptr_hasha(const void *key, Size keysize);
 static void CreatePrepGeomHash(void);
@@ -121,6 +143,8 @@ static void
 PreparedCacheDelete(MemoryContext context)
 {
 	PrepGeomHashEntry* pghe;
+	PrepGeomCache* cache;
+	int i;
 
 	/* Lookup the hash entry pointer in the global hash table so we can free it */
 	pghe = GetPrepGeomHashEntry(context);
@@ -128,13 +152,19 @@ PreparedCacheDelete(MemoryContext context)
 	if (!pghe)
 		elog(ERROR, "PreparedCacheDelete: Trying to delete non-existant hash entry object with MemoryContext key (%p)", (void *)context);
 
-	POSTGIS_DEBUGF(3, "deleting geom object (%p) and prepared geom object (%p) with MemoryContext key (%p)", pghe->geom, pghe->prepared_geom, context);
+	cache = pghe->cache;
+
+	POSTGIS_DEBUGF(3, "deleting %d geom objects of cache (%p) with MemoryContext key (%p)", cache->num_entries, cache, context);
 
 	/* Free them */
-	if ( pghe->prepared_geom )
-		GEOSPreparedGeom_destroy( pghe->prepared_geom );
-	if ( pghe->geom )
-		GEOSGeom_destroy( (GEOSGeometry *)pghe->geom );
+	for ( i = 0; i < cache->num_entries; i++ )
+	{
+		if ( cache->entries[i].prepared_geom )
+			GEOSPreparedGeom_destroy( cache->entries[i].prepared_geom );
+		if ( cache->entries[i].geom )
+			GEOSGeom_destroy( (GEOSGeometry *)cache->entries[i].geom );
+	}
+	cache->num_entries = 0;
 
 	/* Remove the hash entry as it is no longer needed */
 	DeletePrepGeomHashEntry(context);
@@ -222,8 +252,7 @@ AddPrepGeomHashEntry(PrepGeomHashEntry pghe)
 	{
 		/* Insert the entry into the new hash element */
 		he->context = pghe.context;
-		he->geom = pghe.geom;
-		he->prepared_geom = pghe.prepared_geom;
+		he->cache = pghe.cache;
 	}
 	else
 	{
@@ -259,13 +288,118 @@ DeletePrepGeomHashEntry(MemoryContext mcxt)
 	/* Delete the projection object from the hash */
 	he = (PrepGeomHashEntry *) hash_search(PrepGeomHash, key, HASH_REMOVE, NULL);
 
-	he->prepared_geom = NULL;
-	he->geom = NULL;
-
 	if (!he)
 		elog(ERROR, "DeletePrepGeomHashEntry: There was an error removing the geometry object from this MemoryContext (%p)", (void *)mcxt);
 }
 
+/*
+** Find a key in the cache, and move it to the front of the list.
+** Returns NULL if the key is not there.
+** The front entry is tried first by size and contents, as the same
+** key comes back call after call in most joins. Only when that fails
+** the key gets hashed, into *hash, to skip the memcmp of the others.
+*/
+static PrepGeomCacheEntry*
+PrepGeomCacheLookup(PrepGeomCache* cache, GSERIALIZED *pg_geom, size_t pg_geom_size, uint32 *hash)
+{
+	PrepGeomCacheEntry entry;
+	int i;
+
+	if ( cache->num_entries > 0 &&
+	     cache->entries[0].pg_geom_size == pg_geom_size &&
+	     memcmp(cache->entries[0].pg_geom, pg_geom, pg_geom_size) == 0 )
+	{
+		return cache->entries;
+	}
+
+	*hash = DatumGetUInt32(hash_any((unsigned char *)pg_geom, pg_geom_size));
+
+	for ( i = 1; i < cache->num_entries; i++ )
+	{
+		if ( cache->entries[i].hash == *hash &&
+		     cache->entries[i].pg_geom_size == pg_geom_size &&
+		     memcmp(cache->entries[i].pg_geom, pg_geom, pg_geom_size) == 0 )
+		{
+			if ( i > 0 )
+			{
+				entry = cache->entries[i];
+				memmove(cache->entries + 1, cache->entries, i * sizeof(PrepGeomCacheEntry));
+				cache->entries[0] = entry;
+			}
+			return cache->entries;
+		}
+	}
+	return NULL;
+}
+
+/*
+** Add a new, unprepared, key at the front of the list, dropping
+** the least recently used entry if the cache is full.
+*/
+static void
+PrepGeomCacheInsert(FunctionCallInfoData *fcinfo, PrepGeomCache* cache, GSERIALIZED *pg_geom, size_t pg_geom_size, uint32 hash)
+{
+	MemoryContext old_context;
+	PrepGeomCacheEntry* entry;
+
+	if ( cache->num_entries == cache->max_entries )
+	{
+		entry = cache->entries + cache->num_entries - 1;
+
+		POSTGIS_DEBUGF(3, "PrepGeomCacheInsert: evicting entry %d", cache->num_entries - 1);
+
+		if ( entry->prepared_geom )
+			GEOSPreparedGeom_destroy( entry->prepared_geom );
+		if ( entry->geom )
+			GEOSGeom_destroy( (GEOSGeometry *)entry->geom );
+		pfree(entry->pg_geom);
+		cache->num_entries--;
+		PrepGeomCacheStats.evictions++;
+	}
+
+	memmove(cache->entries + 1, cache->entries, cache->num_entries * sizeof(PrepGeomCacheEntry));
+	cache->num_entries++;
+
+	/*
+	** We flip into the function manager memory context to make a copy
+	** of the key. We can't just store a pointer because this copy will
+	** be pfree'd at the end of this function call.
+	*/
+	entry = cache->entries;
+	old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	entry->pg_geom = palloc(pg_geom_size);
+	MemoryContextSwitchTo(old_context);
+	memcpy(entry->pg_geom, pg_geom, pg_geom_size);
+	entry->pg_geom_size = pg_geom_size;
+	entry->hash = hash;
+	entry->prepared_geom = 0;
+	entry->geom = 0;
+	entry->failed = 0;
+}
+
+/*
+** Prepare the geometry of an entry, on the second sighting of its key.
+** A failure is remembered, so that the key goes on being served by
+** the unprepared path instead of being prepared again on every call.
+*/
+static void
+PrepGeomCachePrepare(PrepGeomCacheEntry* entry)
+{
+	entry->geom = POSTGIS2GEOS( entry->pg_geom );
+	if ( entry->geom )
+		entry->prepared_geom = GEOSPrepare( entry->geom );
+	PrepGeomCacheStats.prepares++;
+
+	if ( ! entry->prepared_geom )
+	{
+		POSTGIS_DEBUG(3, "PrepGeomCachePrepare: preparing failed, won't retry");
+		if ( entry->geom )
+			GEOSGeom_destroy( (GEOSGeometry *)entry->geom );
+		entry->geom = 0;
+		entry->failed = 1;
+	}
+}
+
 /*
 ** GetPrepGeomCache
 **
@@ -273,6 +407,10 @@ DeletePrepGeomHashEntry(MemoryContext mcxt)
 ** one if there is not one available. Only prepare geometry
 ** if we are seeing a key for the second time. That way rapidly
 ** cycling keys don't cause too much preparing.
+**
+** The cache remembers the last postgis.prepared_cache_size keys,
+** so a join whose outer side cycles through a handful of geometries
+** keeps all of them prepared.
 */
 PrepGeomCache*
 GetPrepGeomCache(FunctionCallInfoData *fcinfo, GSERIALIZED *pg_geom1, GSERIALIZED *pg_geom2)
@@ -280,9 +418,11 @@ GetPrepGeomCache(FunctionCallInfoData *fcinfo, GSERIALIZED *pg_geom1, GSERIALIZE
 	MemoryContext old_context;
 	GeomCache* supercache = GetGeomCache(fcinfo);
 	PrepGeomCache* cache = supercache->prep;
-	int copy_keys = 1;
+	PrepGeomCacheEntry* entry = NULL;
 	size_t pg_geom1_size = 0;
 	size_t pg_geom2_size = 0;
+	uint32 hash1 = 0;
+	uint32 hash2 = 0;
 
 	assert ( ! cache || cache->type == 2 );
 
@@ -307,16 +447,15 @@ GetPrepGeomCache(FunctionCallInfoData *fcinfo, GSERIALIZED *pg_geom1, GSERIALIZE
 
 		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
 		cache = palloc(sizeof(PrepGeomCache));
+		cache->max_entries = prepared_cache_size;
+		cache->entries = palloc(sizeof(PrepGeomCacheEntry) * cache->max_entries);
 		MemoryContextSwitchTo(old_context);
 
 		cache->type = 2;
 		cache->prepared_geom = 0;
 		cache->geom = 0;
 		cache->argnum = 0;
-		cache->pg_geom1 = 0;
-		cache->pg_geom2 = 0;
-		cache->pg_geom1_size = 0;
-		cache->pg_geom2_size = 0;
+		cache->num_entries = 0;
 		cache->context = MemoryContextCreate(T_AllocSetContext, 8192,
 		                                     &PreparedCacheContextMethods,
 		                                     fcinfo->flinfo->fn_mcxt,
@@ -325,132 +464,97 @@ GetPrepGeomCache(FunctionCallInfoData *fcinfo, GSERIALIZED *pg_geom1, GSERIALIZE
 		POSTGIS_DEBUGF(3, "GetPrepGeomCache: creating cache: %p", cache);
 
 		pghe.context = cache->context;
-		pghe.geom = 0;
-		pghe.prepared_geom = 0;
+		pghe.cache = cache;
 		AddPrepGeomHashEntry( pghe );
 
 		supercache->prep = cache;
 
 		POSTGIS_DEBUGF(3, "GetPrepGeomCache: adding context to hash: %p", cache);
 	}
-	else if ( pg_geom1 &&
-	          cache->argnum != 2 &&
-	          cache->pg_geom1_size == pg_geom1_size &&
-	          memcmp(cache->pg_geom1, pg_geom1, pg_geom1_size) == 0)
-	{
-		if ( !cache->prepared_geom )
-		{
-			/*
-			** Cache hit, but we haven't prepared our geometry yet.
-			** Prepare it.
-			*/
-			PrepGeomHashEntry* pghe;
 
-			cache->geom = POSTGIS2GEOS( pg_geom1 );
-			cache->prepared_geom = GEOSPrepare( cache->geom );
-			cache->argnum = 1;
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: preparing obj in argument 1");
+	cache->argnum = 0;
+	cache->prepared_geom = 0;
+	cache->geom = 0;
 
-			pghe = GetPrepGeomHashEntry(cache->context);
-			pghe->geom = cache->geom;
-			pghe->prepared_geom = cache->prepared_geom;
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: storing references to prepared obj in argument 1");
-		}
-		else
-		{
-			/*
-			** Cache hit, and we're good to go. Do nothing.
-			*/
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: cache hit, argument 1");
-		}
-		/* We don't need new keys until we have a cache miss */
-		copy_keys = 0;
+	if ( pg_geom1 && (entry = PrepGeomCacheLookup(cache, pg_geom1, pg_geom1_size, &hash1)) )
+	{
+		cache->argnum = 1;
+	}
+	else if ( pg_geom2 && (entry = PrepGeomCacheLookup(cache, pg_geom2, pg_geom2_size, &hash2)) )
+	{
+		cache->argnum = 2;
 	}
-	else if ( pg_geom2 &&
-	          cache->argnum != 1 &&
-	          cache->pg_geom2_size == pg_geom2_size &&
-	          memcmp(cache->pg_geom2, pg_geom2, pg_geom2_size) == 0)
+
+	if ( entry )
 	{
-		if ( !cache->prepared_geom )
+		PrepGeomCacheStats.hits++;
+
+		if ( ! entry->prepared_geom && ! entry->failed )
 		{
 			/*
-			** Cache hit on arg2, but we haven't prepared our geometry yet.
+			** Cache hit, but we haven't prepared our geometry yet.
 			** Prepare it.
 			*/
-			PrepGeomHashEntry* pghe;
-
-			cache->geom = POSTGIS2GEOS( pg_geom2 );
-			cache->prepared_geom = GEOSPrepare( cache->geom );
-			cache->argnum = 2;
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: preparing obj in argument 2");
-
-			pghe = GetPrepGeomHashEntry(cache->context);
-			pghe->geom = cache->geom;
-			pghe->prepared_geom = cache->prepared_geom;
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: storing references to prepared obj in argument 2");
+			POSTGIS_DEBUGF(3, "GetPrepGeomCache: preparing obj in argument %d", cache->argnum);
+			PrepGeomCachePrepare(entry);
 		}
 		else
 		{
-			/*
-			** Cache hit, and we're good to go. Do nothing.
-			*/
-			POSTGIS_DEBUG(3, "GetPrepGeomCache: cache hit, argument 2");
+			POSTGIS_DEBUGF(3, "GetPrepGeomCache: cache hit, argument %d", cache->argnum);
 		}
-		/* We don't need new keys until we have a cache miss */
-		copy_keys = 0;
+
+		cache->prepared_geom = entry->prepared_geom;
+		cache->geom = entry->geom;
+		if ( ! cache->prepared_geom )
+			cache->argnum = 0;
 	}
-	else if ( cache->prepared_geom )
+	else
 	{
 		/*
-		** No cache hits, so this must be a miss.
-		** Destroy the GEOS objects, empty the cache.
+		** No cache hits, so this must be a miss. Remember the new
+		** keys, we only prepare them if they come back. Both keys
+		** were looked up, so both hashes are set by now.
 		*/
-		PrepGeomHashEntry* pghe;
+		POSTGIS_DEBUG(3, "GetPrepGeomCache: cache miss, copying keys into cache");
+		PrepGeomCacheStats.misses++;
 
-		pghe = GetPrepGeomHashEntry(cache->context);
-		pghe->geom = 0;
-		pghe->prepared_geom = 0;
+		if ( pg_geom2 )
+			PrepGeomCacheInsert(fcinfo, cache, pg_geom2, pg_geom2_size, hash2);
+		if ( pg_geom1 )
+			PrepGeomCacheInsert(fcinfo, cache, pg_geom1, pg_geom1_size, hash1);
+	}
 
-		POSTGIS_DEBUGF(3, "GetPrepGeomCache: cache miss, argument %d", cache->argnum);
-		GEOSPreparedGeom_destroy( cache->prepared_geom );
-		GEOSGeom_destroy( (GEOSGeometry *)cache->geom );
+	return cache;
 
-		cache->prepared_geom = 0;
-		cache->geom = 0;
-		cache->argnum = 0;
+}
 
-	}
+/*
+** postgis_prepared_cache_stats()
+**
+** Returns the hits, misses, prepares and evictions of the prepared
+** geometry caches of this backend.
+*/
+PG_FUNCTION_INFO_V1(postgis_prepared_cache_stats);
+Datum postgis_prepared_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	HeapTuple tuple;
+	Datum values[4];
+	bool nulls[4];
 
-	if ( copy_keys && pg_geom1 )
-	{
-		/*
-		** If this is a new key (cache miss) we flip into the function
-		** manager memory context and make a copy. We can't just store a pointer
-		** because this copy will be pfree'd at the end of this function
-		** call.
-		*/
-		POSTGIS_DEBUG(3, "GetPrepGeomCache: copying pg_geom1 into cache");
-		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-		if ( cache->pg_geom1 )
-			pfree(cache->pg_geom1);
-		cache->pg_geom1 = palloc(pg_geom1_size);
-		MemoryContextSwitchTo(old_context);
-		memcpy(cache->pg_geom1, pg_geom1, pg_geom1_size);
-		cache->pg_geom1_size = pg_geom1_size;
-	}
-	if ( copy_keys && pg_geom2 )
+	if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
 	{
-		POSTGIS_DEBUG(3, "GetPrepGeomCache: copying pg_geom2 into cache");
-		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-		if ( cache->pg_geom2 )
-			pfree(cache->pg_geom2);
-		cache->pg_geom2 = palloc(pg_geom2_size);
-		MemoryContextSwitchTo(old_context);
-		memcpy(cache->pg_geom2, pg_geom2, pg_geom2_size);
-		cache->pg_geom2_size = pg_geom2_size;
+		elog(ERROR, "postgis_prepared_cache_stats: return type must be a row type");
+		PG_RETURN_NULL();
 	}
+	tupdesc = BlessTupleDesc(tupdesc);
 
-	return cache;
+	values[0] = Int64GetDatum(PrepGeomCacheStats.hits);
+	values[1] = Int64GetDatum(PrepGeomCacheStats.misses);
+	values[2] = Int64GetDatum(PrepGeomCacheStats.prepares);
+	values[3] = Int64GetDatum(PrepGeomCacheStats.evictions);
+	memset(nulls, 0, sizeof(nulls));
 
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
 }
-
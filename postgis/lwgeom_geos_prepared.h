@@ -25,25 +25,56 @@
 #include "lwgeom_geos.h"
 
 /*
-** Cache structure. We use GSERIALIZED as keys so no transformations
+** Default and maximum number of geometries kept by each call site,
+** see the postgis.prepared_cache_size setting.
+*/
+#define PREPARED_CACHE_SIZE_DEFAULT 8
+#define PREPARED_CACHE_SIZE_MAX 1024
+
+/*
+** Value of the postgis.prepared_cache_size setting. A cache keeps the
+** size it was created with, changes only apply to new call sites.
+*/
+extern int prepared_cache_size;
+
+/*
+** Cache entry. We use GSERIALIZED as keys so no transformations
 ** are needed before we memcmp them with other keys. We store the
-** size to avoid having to calculate the size every time.
-** The argnum gives the number of function arguments we are caching.
-** Intersects requires that both arguments be checked for cacheability,
-** while Contains only requires that the containing argument be checked.
+** size and a hash of the key to skip most of the memcmp calls.
 ** Both the Geometry and the PreparedGeometry have to be cached,
 ** because the PreparedGeometry contains a reference to the geometry.
+** They stay NULL until the key is seen a second time.
+*/
+typedef struct
+{
+	GSERIALIZED                   *pg_geom;
+	size_t                        pg_geom_size;
+	uint32                        hash;
+	const GEOSPreparedGeometry    *prepared_geom;
+	const GEOSGeometry            *geom;
+	int                           failed;  /* preparing it failed, don't retry */
+}
+PrepGeomCacheEntry;
+
+/*
+** Cache structure. The entries are kept most recently used first,
+** and the least recently used one is dropped to make room for a new
+** key once there are max_entries of them.
+** The argnum gives the argument that matched the prepared geometry
+** of the current call, and prepared_geom and geom refer to it, or
+** are NULL if there is nothing prepared for the current arguments.
+** Intersects requires that both arguments be checked for cacheability,
+** while Contains only requires that the containing argument be checked.
 */
 typedef struct
 {
 	char                          type;
-	GSERIALIZED                     *pg_geom1;
-	GSERIALIZED                     *pg_geom2;
-	size_t                        pg_geom1_size;
-	size_t                        pg_geom2_size;
 	int32                         argnum;
 	const GEOSPreparedGeometry    *prepared_geom;
-	const GEOSGeometry                  *geom;
+	const GEOSGeometry            *geom;
+	int                           num_entries;
+	int                           max_entries;
+	PrepGeomCacheEntry            *entries;
 	MemoryContext                 context;
 }
 PrepGeomCache;
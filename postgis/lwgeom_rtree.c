@@ -10,514 +10,634 @@
  **********************************************************************/
 
 #include <assert.h>
+#include <math.h>
 
 #include "../postgis_config.h"
 #include "lwgeom_pg.h"
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"         /* For FP comparators. */
+#include "measures.h"                   /* For lw_dist2d_seg_seg. */
+#include "lwgeom_cache.h"
 #include "lwgeom_rtree.h"
-
-
-Datum LWGEOM_polygon_index(PG_FUNCTION_ARGS);
+#include "lwgeom_functions_analytic.h"  /* For determineSide and isOnSegment. */
 
 
 /**
- * Creates an rtree given a pointer to the point array.
- * Must copy the point array.
+ * Counts the vertices, leaves and components needed to index the
+ * geometry. Returns LW_FAILURE for types the tree can't handle.
  */
-RTREE_NODE *createTree(POINTARRAY *pointArray)
+static int
+rtree_count(const LWGEOM *lwgeom, int *npoints, int *nleaves, int *ncomponents)
 {
-	RTREE_NODE *root;
-	RTREE_NODE** nodes = lwalloc(sizeof(RTREE_NODE*) * pointArray->npoints);
-	int i, nodeCount;
-	int childNodes, parentNodes;
-
-	POSTGIS_DEBUGF(2, "createTree called with pointarray %p", pointArray);
+	const POINTARRAY *pa;
+	int i;
 
-	nodeCount = pointArray->npoints - 1;
-
-	POSTGIS_DEBUGF(3, "Total leaf nodes: %d", nodeCount);
-
-	/*
-	 * Create a leaf node for every line segment.
-	 */
-	for (i = 0; i < nodeCount; i++)
+	switch (lwgeom->type)
 	{
-		nodes[i] = createLeafNode(pointArray, i);
-	}
-
-	/*
-	 * Next we group nodes by pairs.  If there's an odd number of nodes,
-	 * we bring the last node up a level as is.	 Continue until we have
-	 * a single top node.
-	 */
-	childNodes = nodeCount;
-	parentNodes = nodeCount / 2;
-	while (parentNodes > 0)
+	case POINTTYPE:
+	case LINETYPE:
+		pa = (lwgeom->type == POINTTYPE) ? ((LWPOINT*)lwgeom)->point : ((LWLINE*)lwgeom)->points;
+		if ( ! pa || pa->npoints == 0 )
+			return LW_SUCCESS;
+		*npoints += pa->npoints;
+		*nleaves += (pa->npoints > 1) ? pa->npoints - 1 : 1;
+		*ncomponents += 1;
+		return LW_SUCCESS;
+
+	case POLYGONTYPE:
 	{
-		POSTGIS_DEBUGF(3, "Merging %d children into %d parents.", childNodes, parentNodes);
-
-		i = 0;
-		while (i < parentNodes)
+		const LWPOLY *poly = (LWPOLY*)lwgeom;
+		if ( poly->nrings == 0 || poly->rings[0]->npoints == 0 )
+			return LW_SUCCESS;
+		for ( i = 0; i < poly->nrings; i++ )
 		{
-			nodes[i] = createInteriorNode(nodes[i*2], nodes[i*2+1]);
-			i++;
+			pa = poly->rings[i];
+			if ( pa->npoints == 0 )
+				continue;
+			*npoints += pa->npoints;
+			*nleaves += (pa->npoints > 1) ? pa->npoints - 1 : 1;
 		}
-		/*
-		 * Check for an odd numbered final node.
-		 */
-		if (parentNodes * 2 < childNodes)
-		{
-			POSTGIS_DEBUGF(3, "Shuffling child %d to parent %d", childNodes - 1, i);
+		*ncomponents += 1;
+		return LW_SUCCESS;
+	}
 
-			nodes[i] = nodes[childNodes - 1];
-			parentNodes++;
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	{
+		const LWCOLLECTION *col = (LWCOLLECTION*)lwgeom;
+		for ( i = 0; i < col->ngeoms; i++ )
+		{
+			if ( rtree_count(col->geoms[i], npoints, nleaves, ncomponents) == LW_FAILURE )
+				return LW_FAILURE;
 		}
-		childNodes = parentNodes;
-		parentNodes = parentNodes / 2;
+		return LW_SUCCESS;
 	}
 
-	root = nodes[0];
-	lwfree(nodes);
-	POSTGIS_DEBUGF(3, "createTree returning %p", root);
-
-	return root;
+	default:
+		return LW_FAILURE;
+	}
 }
 
 /**
- * Creates an interior node given the children.
+ * Copies the point array into the packed vertex array of the tree,
+ * and creates a leaf for each of its segments, or a single leaf for
+ * a lone point.
  */
-RTREE_NODE *createInteriorNode(RTREE_NODE *left, RTREE_NODE *right)
+static void
+rtree_add_ptarray(RTREE *tree, const POINTARRAY *pa)
 {
-	RTREE_NODE *parent;
-
-	POSTGIS_DEBUGF(2, "createInteriorNode called for children %p, %p", left, right);
+	int i, start = tree->npoints;
+	RTREE_NODE *leaf;
+	POINT2D *p1, *p2;
 
-	parent = lwalloc(sizeof(RTREE_NODE));
-	parent->leftNode = left;
-	parent->rightNode = right;
-	parent->interval = mergeIntervals(left->interval, right->interval);
-	parent->segment = NULL;
+	if ( pa->npoints == 0 )
+		return;
 
-	POSTGIS_DEBUGF(3, "createInteriorNode returning %p", parent);
+	for ( i = 0; i < pa->npoints; i++ )
+		getPoint2d_p(pa, i, &(tree->points[tree->npoints++]));
 
-	return parent;
+	for ( i = 0; i < FP_MAX(pa->npoints - 1, 1); i++ )
+	{
+		leaf = &(tree->nodes[tree->nleaves++]);
+		leaf->first = start + i;
+		leaf->count = (pa->npoints > 1) ? 1 : 0;
+		p1 = &(tree->points[leaf->first]);
+		p2 = &(tree->points[leaf->first + leaf->count]);
+		leaf->xmin = FP_MIN(p1->x, p2->x);
+		leaf->xmax = FP_MAX(p1->x, p2->x);
+		leaf->ymin = FP_MIN(p1->y, p2->y);
+		leaf->ymax = FP_MAX(p1->y, p2->y);
+	}
 }
 
 /**
- * Creates a leaf node given the pointer to the start point of the segment.
+ * Fills the vertices, leaves and components of the tree, in
+ * geometry order. rtree_count has already checked the types.
  */
-RTREE_NODE *createLeafNode(POINTARRAY *pa, int startPoint)
+static void
+rtree_add_lwgeom(RTREE *tree, const LWGEOM *lwgeom)
 {
-	RTREE_NODE *parent;
-	LWLINE *line;
-	double value1;
-	double value2;
-	POINT4D tmp;
-	POINTARRAY *npa;
+	const POINTARRAY *pa;
+	int i;
 
-	POSTGIS_DEBUGF(2, "createLeafNode called for point %d of %p", startPoint, pa);
+	switch (lwgeom->type)
+	{
+	case POINTTYPE:
+	case LINETYPE:
+		pa = (lwgeom->type == POINTTYPE) ? ((LWPOINT*)lwgeom)->point : ((LWLINE*)lwgeom)->points;
+		if ( ! pa || pa->npoints == 0 )
+			return;
+		tree->components[tree->ncomponents++] = tree->npoints;
+		rtree_add_ptarray(tree, pa);
+		return;
 
-	if (pa->npoints < startPoint + 2)
+	case POLYGONTYPE:
 	{
-		lwerror("createLeafNode: npoints = %d, startPoint = %d", pa->npoints, startPoint);
+		const LWPOLY *poly = (LWPOLY*)lwgeom;
+		if ( poly->nrings == 0 || poly->rings[0]->npoints == 0 )
+			return;
+		tree->components[tree->ncomponents++] = tree->npoints;
+		for ( i = 0; i < poly->nrings; i++ )
+			rtree_add_ptarray(tree, poly->rings[i]);
+		return;
 	}
 
-	/*
-	 * The given point array will be part of a geometry that will be freed
-	 * independently of the index.	Since we may want to cache the index,
-	 * we must create independent arrays.
-	 */
-	npa = ptarray_construct_empty(0,0,2);
-
-	getPoint4d_p(pa, startPoint, &tmp);
-	value1 = tmp.y;
-	ptarray_append_point(npa,&tmp,LW_TRUE);
-	
-	getPoint4d_p(pa, startPoint+1, &tmp);
-	value2 = tmp.y;
-	ptarray_append_point(npa,&tmp,LW_TRUE);
-
-	line = lwline_construct(SRID_UNKNOWN, NULL, npa);
-	
-	parent = lwalloc(sizeof(RTREE_NODE));
-	parent->interval = createInterval(value1, value2);
-	parent->segment = line;
-	parent->leftNode = NULL;
-	parent->rightNode = NULL;
-
-	POSTGIS_DEBUGF(3, "createLeafNode returning %p", parent);
-
-	return parent;
+	default:
+	{
+		const LWCOLLECTION *col = (LWCOLLECTION*)lwgeom;
+		for ( i = 0; i < col->ngeoms; i++ )
+			rtree_add_lwgeom(tree, col->geoms[i]);
+		return;
+	}
+	}
 }
 
-/**
- * Creates an interval with the total extents of the two given intervals.
- */
-INTERVAL *mergeIntervals(INTERVAL *inter1, INTERVAL *inter2)
+static int
+rtree_node_cmp_x(const void *a, const void *b)
 {
-	INTERVAL *interval;
-
-	POSTGIS_DEBUGF(2, "mergeIntervals called with %p, %p", inter1, inter2);
-
-	interval = lwalloc(sizeof(INTERVAL));
-	interval->max = FP_MAX(inter1->max, inter2->max);
-	interval->min = FP_MIN(inter1->min, inter2->min);
-
-	POSTGIS_DEBUGF(3, "interval min = %8.3f, max = %8.3f", interval->min, interval->max);
+	const RTREE_NODE *n1 = (const RTREE_NODE*)a;
+	const RTREE_NODE *n2 = (const RTREE_NODE*)b;
+	double c1 = n1->xmin + n1->xmax;
+	double c2 = n2->xmin + n2->xmax;
+	return (c1 < c2) ? -1 : ((c1 > c2) ? 1 : 0);
+}
 
-	return interval;
+static int
+rtree_node_cmp_y(const void *a, const void *b)
+{
+	const RTREE_NODE *n1 = (const RTREE_NODE*)a;
+	const RTREE_NODE *n2 = (const RTREE_NODE*)b;
+	double c1 = n1->ymin + n1->ymax;
+	double c2 = n2->ymin + n2->ymax;
+	return (c1 < c2) ? -1 : ((c1 > c2) ? 1 : 0);
 }
 
 /**
- * Creates an interval given the min and max values, in arbitrary order.
+ * Creates an rtree given a geometry. The vertices are copied, so
+ * the geometry can be freed independently of the index.
+ * Returns NULL for empty geometries and unsupported types.
  */
-INTERVAL *createInterval(double value1, double value2)
+RTREE *rtree_new(const LWGEOM *lwgeom)
 {
-	INTERVAL *interval;
+	RTREE *tree;
+	int npoints = 0, nleaves = 0, ncomponents = 0;
+	int nnodes, n, start, next, i, j;
 
-	POSTGIS_DEBUGF(2, "createInterval called with %8.3f, %8.3f", value1, value2);
+	POSTGIS_DEBUGF(2, "rtree_new called with geometry %p", lwgeom);
 
-	interval = lwalloc(sizeof(INTERVAL));
-	interval->max = FP_MAX(value1, value2);
-	interval->min = FP_MIN(value1, value2);
+	if ( rtree_count(lwgeom, &npoints, &nleaves, &ncomponents) == LW_FAILURE || nleaves == 0 )
+		return NULL;
 
-	POSTGIS_DEBUGF(3, "interval min = %8.3f, max = %8.3f", interval->min, interval->max);
+	/* Every level has 1/RTREE_NODE_SIZE the nodes of the level below */
+	nnodes = n = nleaves;
+	while ( n > 1 )
+	{
+		n = (n + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+		nnodes += n;
+	}
 
-	return interval;
-}
+	tree = lwalloc(sizeof(RTREE));
+	tree->type = lwgeom->type;
+	tree->nodes = lwalloc(sizeof(RTREE_NODE) * nnodes);
+	tree->points = lwalloc(sizeof(POINT2D) * npoints);
+	tree->components = lwalloc(sizeof(int) * ncomponents);
+	tree->nnodes = nnodes;
+	tree->nleaves = tree->npoints = tree->ncomponents = 0;
 
-/**
- * Recursively frees the child nodes, the interval and the line before
- * freeing the root node.
- */
-void freeTree(RTREE_NODE *root)
-{
-	POSTGIS_DEBUGF(2, "freeTree called for %p", root);
-
-	if (root->leftNode)
-		freeTree(root->leftNode);
-	if (root->rightNode)
-		freeTree(root->rightNode);
-	lwfree(root->interval);
-	if (root->segment)
+	rtree_add_lwgeom(tree, lwgeom);
+
+	POSTGIS_DEBUGF(3, "rtree_new: %d points, %d leaves, %d nodes", npoints, nleaves, nnodes);
+
+	/*
+	 * Sort-Tile-Recursive packing: sort the level by x, cut it into
+	 * vertical slices of about sqrt(parents) parents each, sort each
+	 * slice by y, and group runs of RTREE_NODE_SIZE nodes under a
+	 * parent. Repeat on the parents until there is a single root.
+	 */
+	start = 0;
+	next = n = nleaves;
+	while ( n > 1 )
 	{
-		lwline_free(root->segment);
+		int nparents = (n + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+		int slice = RTREE_NODE_SIZE * (int)ceil(sqrt((double)nparents));
+		RTREE_NODE *level = tree->nodes + start;
+
+		qsort(level, n, sizeof(RTREE_NODE), rtree_node_cmp_x);
+		for ( i = 0; i < n; i += slice )
+			qsort(level + i, FP_MIN(slice, n - i), sizeof(RTREE_NODE), rtree_node_cmp_y);
+
+		for ( i = 0; i < n; i += RTREE_NODE_SIZE )
+		{
+			RTREE_NODE *parent = tree->nodes + next++;
+			parent->first = start + i;
+			parent->count = FP_MIN(RTREE_NODE_SIZE, n - i);
+			parent->xmin = level[i].xmin;
+			parent->xmax = level[i].xmax;
+			parent->ymin = level[i].ymin;
+			parent->ymax = level[i].ymax;
+			for ( j = i + 1; j < i + parent->count; j++ )
+			{
+				parent->xmin = FP_MIN(parent->xmin, level[j].xmin);
+				parent->xmax = FP_MAX(parent->xmax, level[j].xmax);
+				parent->ymin = FP_MIN(parent->ymin, level[j].ymin);
+				parent->ymax = FP_MAX(parent->ymax, level[j].ymax);
+			}
+		}
+		start += n;
+		n = nparents;
 	}
-	lwfree(root);
-}
+	assert(next == nnodes);
+
+	POSTGIS_DEBUGF(3, "rtree_new returning %p", tree);
 
+	return tree;
+}
 
 /**
- * Free the cache object and all the sub-objects properly.
+ * Frees the tree.
  */
-void clearCache(RTREE_POLY_CACHE *cache)
+void rtree_free(RTREE *tree)
 {
-	int g, r, i;
-	POSTGIS_DEBUGF(2, "clearCache called for %p", cache);
-        i = 0;
-        for (g = 0; g < cache->polyCount; g++)
-        {
-	        for (r = 0; r < cache->ringCounts[g]; r++)
-	        {
-		        freeTree(cache->ringIndices[i]);
-                        i++;
-                }
-	}
-	lwfree(cache->ringIndices);
-        lwfree(cache->ringCounts);
-	lwfree(cache->poly);
-	cache->poly = 0;
-	cache->ringIndices = 0;
-	cache->ringCounts = 0;
-	cache->polyCount = 0;
-}
+	POSTGIS_DEBUGF(2, "rtree_free called for %p", tree);
 
+	lwfree(tree->nodes);
+	lwfree(tree->points);
+	lwfree(tree->components);
+	lwfree(tree);
+}
 
 /**
- * Retrieves a collection of line segments given the root and crossing value.
- * The collection is a multilinestring consisting of two point lines
- * representing the segments of the ring that may be crossed by the
- * horizontal projection line at the given y value.
+ * Counts the segments crossed by the horizontal ray running right
+ * from the point, using the same rules as point_in_ring.
+ * Returns LW_TRUE as soon as the point is found on a segment.
  */
-LWMLINE *findLineSegments(RTREE_NODE *root, double value)
+static int
+rtree_contains_point_recursive(const RTREE *tree, int n, const POINT2D *pt, int *crossings)
 {
-	LWMLINE *tmp, *result;
-	LWGEOM **lwgeoms;
-
-	POSTGIS_DEBUGF(2, "findLineSegments called for tree %p and value %8.3f", root, value);
+	const RTREE_NODE *node = &(tree->nodes[n]);
+	POINT2D *seg1, *seg2;
+	double side;
+	int i;
 
-	result = NULL;
+	/* Nothing in here can touch the point, or cross the ray */
+	if ( FP_LT(pt->y, node->ymin) || FP_GT(pt->y, node->ymax) || FP_LT(node->xmax, pt->x) )
+		return LW_FALSE;
 
-	if (!isContained(root->interval, value))
+	if ( n >= tree->nleaves )
 	{
-		POSTGIS_DEBUGF(3, "findLineSegments %p: not contained.", root);
-
-		return NULL;
+		for ( i = node->first; i < node->first + node->count; i++ )
+		{
+			if ( rtree_contains_point_recursive(tree, i, pt, crossings) )
+				return LW_TRUE;
+		}
+		return LW_FALSE;
 	}
 
-	/* If there is a segment defined for this node, include it. */
-	if (root->segment)
-	{
-		POSTGIS_DEBUGF(3, "findLineSegments %p: adding segment %p %d.", root, root->segment, root->segment->type);
+	/* Lone points don't bound anything */
+	if ( node->count == 0 )
+		return LW_FALSE;
 
-		lwgeoms = lwalloc(sizeof(LWGEOM *));
-		lwgeoms[0] = (LWGEOM *)root->segment;
+	seg1 = &(tree->points[node->first]);
+	seg2 = &(tree->points[node->first + 1]);
 
-		POSTGIS_DEBUGF(3, "Found geom %p, type %d, dim %d", root->segment, root->segment->type, FLAGS_GET_Z(root->segment->flags));
+	/* zero length segments are ignored. */
+	if (((seg2->x-seg1->x)*(seg2->x-seg1->x)+(seg2->y-seg1->y)*(seg2->y-seg1->y)) < 1e-12*1e-12)
+		return LW_FALSE;
 
-		result = (LWMLINE *)lwcollection_construct(MULTILINETYPE, SRID_UNKNOWN, NULL, 1, lwgeoms);
-	}
+	side = determineSide(seg1, seg2, (POINT2D*)pt);
 
-	/* If there is a left child node, recursively include its results. */
-	if (root->leftNode)
+	/* a point on the boundary of a ring is not contained. */
+	if ( side == 0.0 && isOnSegment(seg1, seg2, (POINT2D*)pt) == 1 )
 	{
-		POSTGIS_DEBUGF(3, "findLineSegments %p: recursing left.", root);
-
-		tmp = findLineSegments(root->leftNode, value);
-		if (tmp)
-		{
-			POSTGIS_DEBUGF(3, "Found geom %p, type %d, dim %d", tmp, tmp->type, FLAGS_GET_Z(tmp->flags));
-
-			if (result)
-				result = mergeMultiLines(result, tmp);
-			else
-				result = tmp;
-		}
+		POSTGIS_DEBUGF(3, "point on ring boundary between points %d, %d", node->first, node->first + 1);
+		return LW_TRUE;
 	}
 
-	/* Same for any right child. */
-	if (root->rightNode)
+	/* Rising with the point on the left, or falling with the point on the right */
+	if ( (FP_CONTAINS_BOTTOM(seg1->y, pt->y, seg2->y) && side > 0) ||
+	     (FP_CONTAINS_BOTTOM(seg2->y, pt->y, seg1->y) && side < 0) )
 	{
-		POSTGIS_DEBUGF(3, "findLineSegments %p: recursing right.", root);
+		(*crossings)++;
+	}
+	return LW_FALSE;
+}
 
-		tmp = findLineSegments(root->rightNode, value);
-		if (tmp)
-		{
-			POSTGIS_DEBUGF(3, "Found geom %p, type %d, dim %d", tmp, tmp->type, FLAGS_GET_Z(tmp->flags));
+/**
+ * Point in (multi)polygon test against the index.
+ *
+ * All the rings of all the polygons are in one tree, so we count the
+ * ring crossings of a ray instead of winding numbers per ring: an odd
+ * count means the point is inside a shell and not inside one of its
+ * holes. This is the same answer as point_in_multipolygon for valid
+ * polygons.
+ *
+ * return -1 iff point outside polygon
+ * return 0 iff point on boundary
+ * return 1 iff point inside polygon
+ */
+int rtree_contains_point(const RTREE *tree, const POINT2D *pt)
+{
+	int crossings = 0;
 
-			if (result)
-				result = mergeMultiLines(result, tmp);
-			else
-				result = tmp;
-		}
-	}
+	if ( tree->type != POLYGONTYPE && tree->type != MULTIPOLYGONTYPE )
+		return -1;
+
+	if ( rtree_contains_point_recursive(tree, tree->nnodes - 1, pt, &crossings) )
+		return 0;
 
-	return result;
+	POSTGIS_DEBUGF(3, "rtree_contains_point: %d crossings", crossings);
+
+	return (crossings % 2) ? 1 : -1;
 }
 
-/** Merges two multilinestrings into a single multilinestring. */
-LWMLINE *mergeMultiLines(LWMLINE *line1, LWMLINE *line2)
+/**
+ * Squared distance between the boxes of two nodes, a lower bound of
+ * the distance between anything underneath them.
+ */
+static double
+rtree_node_distance2(const RTREE_NODE *n1, const RTREE_NODE *n2)
 {
-	LWGEOM **geoms;
-	LWCOLLECTION *col;
-	int i, j, ngeoms;
+	double dx = 0.0, dy = 0.0;
 
-	POSTGIS_DEBUGF(2, "mergeMultiLines called on %p, %d, %d; %p, %d, %d", line1, line1->ngeoms, line1->type, line2, line2->ngeoms, line2->type);
+	if ( n1->xmax < n2->xmin )
+		dx = n2->xmin - n1->xmax;
+	else if ( n2->xmax < n1->xmin )
+		dx = n1->xmin - n2->xmax;
 
-	ngeoms = line1->ngeoms + line2->ngeoms;
-	geoms = lwalloc(sizeof(LWGEOM *) * ngeoms);
+	if ( n1->ymax < n2->ymin )
+		dy = n2->ymin - n1->ymax;
+	else if ( n2->ymax < n1->ymin )
+		dy = n1->ymin - n2->ymax;
+
+	return dx * dx + dy * dy;
+}
+
+typedef struct
+{
+	int n1;
+	int n2;
+	double d2;
+}
+RTREE_NODE_PAIR;
 
-	j = 0;
-	for (i = 0; i < line1->ngeoms; i++, j++)
+/**
+ * Branch and bound walk of two trees. The larger interior node is
+ * split, and its children visited closest first, so that most of the
+ * pairs can be pruned against the best distance found so far.
+ */
+static void
+rtree_distance_recursive(const RTREE *t1, int n1, const RTREE *t2, int n2, DISTPTS *dl, double threshold)
+{
+	const RTREE_NODE *node1 = &(t1->nodes[n1]);
+	const RTREE_NODE *node2 = &(t2->nodes[n2]);
+	int leaf1 = (n1 < t1->nleaves);
+	int leaf2 = (n2 < t2->nleaves);
+	RTREE_NODE_PAIR pairs[RTREE_NODE_SIZE], tmp;
+	int split1, npairs, i, j;
+
+	if ( leaf1 && leaf2 )
 	{
-		geoms[j] = lwgeom_clone((LWGEOM *)line1->geoms[i]);
+		lw_dist2d_seg_seg(&(t1->points[node1->first]), &(t1->points[node1->first + node1->count]),
+		                  &(t2->points[node2->first]), &(t2->points[node2->first + node2->count]), dl);
+		return;
 	}
-	for (i = 0; i < line2->ngeoms; i++, j++)
+
+	split1 = ( ! leaf1 ) &&
+	         ( leaf2 || (node1->xmax - node1->xmin) + (node1->ymax - node1->ymin) >=
+	                    (node2->xmax - node2->xmin) + (node2->ymax - node2->ymin) );
+
+	npairs = split1 ? node1->count : node2->count;
+	for ( i = 0; i < npairs; i++ )
 	{
-		geoms[j] = lwgeom_clone((LWGEOM *)line2->geoms[i]);
+		tmp.n1 = split1 ? node1->first + i : n1;
+		tmp.n2 = split1 ? n2 : node2->first + i;
+		tmp.d2 = rtree_node_distance2(&(t1->nodes[tmp.n1]), &(t2->nodes[tmp.n2]));
+
+		/* Insertion sort, there are never more than RTREE_NODE_SIZE */
+		for ( j = i; j > 0 && pairs[j-1].d2 > tmp.d2; j-- )
+			pairs[j] = pairs[j-1];
+		pairs[j] = tmp;
 	}
-	col = lwcollection_construct(MULTILINETYPE, SRID_UNKNOWN, NULL, ngeoms, geoms);
-
-	POSTGIS_DEBUGF(3, "mergeMultiLines returning %p, %d, %d", col, col->ngeoms, col->type);
 
-	return (LWMLINE *)col;
+	for ( i = 0; i < npairs; i++ )
+	{
+		/* Close enough, or everything left is farther than what we have */
+		if ( dl->distance <= threshold || pairs[i].d2 > dl->distance * dl->distance )
+			return;
+		rtree_distance_recursive(t1, pairs[i].n1, t2, pairs[i].n2, dl, threshold);
+	}
 }
 
 /**
- * Returns 1 if min < value <= max, 0 otherwise. */
-uint32 isContained(INTERVAL *interval, double value)
-{
-	return FP_CONTAINS_INCL(interval->min, value, interval->max) ? 1 : 0;
-}
-
-PG_FUNCTION_INFO_V1(LWGEOM_polygon_index);
-Datum LWGEOM_polygon_index(PG_FUNCTION_ARGS)
+ * Is any component of the second tree in a polygon of the first one?
+ * If the geometries intersect without any boundaries crossing, one
+ * of them holds all of a component of the other.
+ */
+static int
+rtree_contains_any_component(const RTREE *tree1, const RTREE *tree2)
 {
-	GSERIALIZED *igeom, *result;
-	LWPOLY *poly;
-	LWMLINE *mline;
-	RTREE_NODE *root;
-	double yval;
-#if POSTGIS_DEBUG_LEVEL >= 3
-	int i = 0;
-#endif
-
-	POSTGIS_DEBUG(2, "polygon_index called.");
-
-	result = NULL;
-	igeom = (GSERIALIZED *)PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	yval = PG_GETARG_FLOAT8(1);
-	if ( gserialized_get_type(igeom) != POLYGONTYPE )
-	{
-		PG_FREE_IF_COPY(igeom, 0);
-		PG_RETURN_NULL();
-	}
-	poly = lwgeom_as_lwpoly(lwgeom_from_gserialized(igeom));
-	root = createTree(poly->rings[0]);
+	int i;
 
-	mline = findLineSegments(root, yval);
+	if ( tree1->type != POLYGONTYPE && tree1->type != MULTIPOLYGONTYPE )
+		return LW_FALSE;
 
-#if POSTGIS_DEBUG_LEVEL >= 3
-	POSTGIS_DEBUGF(3, "mline returned %p %d", mline, mline->type);
-	for (i = 0; i < mline->ngeoms; i++)
+	for ( i = 0; i < tree2->ncomponents; i++ )
 	{
-		POSTGIS_DEBUGF(3, "geom[%d] %p %d", i, mline->geoms[i], mline->geoms[i]->type);
+		if ( rtree_contains_point(tree1, &(tree2->points[tree2->components[i]])) != -1 )
+			return LW_TRUE;
 	}
-#endif
+	return LW_FALSE;
+}
+
+/**
+ * Minimum 2d distance between two indexed geometries. Returns as
+ * soon as a distance under the threshold is found, so for dwithin
+ * the answer is only exact when it is over the threshold.
+ */
+double rtree_distance_tree(const RTREE *tree1, const RTREE *tree2, double threshold)
+{
+	DISTPTS dl;
 
-	if (mline)
-		result = geometry_serialize((LWGEOM *)mline);
+	POSTGIS_DEBUGF(2, "rtree_distance_tree called for %p, %p", tree1, tree2);
 
-	POSTGIS_DEBUGF(3, "returning result %p", result);
+	if ( rtree_contains_any_component(tree1, tree2) || rtree_contains_any_component(tree2, tree1) )
+		return 0.0;
 
-	lwfree(root);
+	dl.mode = DIST_MIN;
+	dl.distance = MAXFLOAT;
+	dl.twisted = 1;
+	dl.tolerance = 0.0;
 
-	lwpoly_free(poly);
-	lwmline_free(mline);
-	PG_FREE_IF_COPY(igeom, 0);
-	PG_RETURN_POINTER(result);
+	rtree_distance_recursive(tree1, tree1->nnodes - 1, tree2, tree2->nnodes - 1, &dl, threshold);
 
+	return dl.distance;
 }
 
-RTREE_POLY_CACHE * createCache()
+
+/**
+ * Free the index, leaving the keys.
+ */
+static void
+RtreeCacheClear(RTREE_POLY_CACHE *cache)
 {
-	RTREE_POLY_CACHE *result;
-	result = lwalloc(sizeof(RTREE_POLY_CACHE));
-	result->polyCount = 0;
-	result->ringCounts = 0;
-	result->ringIndices = 0;
-	result->poly = 0;
-	result->type = 1;
-	return result;
+	if ( cache->index )
+		rtree_free(cache->index);
+	cache->index = 0;
+	cache->argnum = 0;
 }
 
-void populateCache(RTREE_POLY_CACHE *currentCache, LWGEOM *lwgeom, GSERIALIZED *serializedPoly)
+/**
+ * Build the index over the cached copy of the argument. An argument
+ * that can't be indexed leaves argnum set and index NULL, so we don't
+ * try to build it again on every call.
+ */
+static void
+RtreeCacheBuild(FunctionCallInfoData *fcinfo, RTREE_POLY_CACHE *cache, int argnum)
 {
-	int i, p, r, length;
-	LWMPOLY *mpoly;
-	LWPOLY *poly;
-	int nrings;
+	MemoryContext old_context;
+	LWGEOM *lwgeom = lwgeom_from_gserialized(argnum == 1 ? cache->geom1 : cache->geom2);
 
-	POSTGIS_DEBUGF(2, "populateCache called with cache %p geom %p", currentCache, lwgeom);
+	old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	cache->index = rtree_new(lwgeom);
+	cache->argnum = argnum;
+	MemoryContextSwitchTo(old_context);
 
-	if (lwgeom->type == MULTIPOLYGONTYPE)
-	{
-		POSTGIS_DEBUG(2, "populateCache MULTIPOLYGON");
-		mpoly = (LWMPOLY *)lwgeom;
-		nrings = 0;
-		/*
-		** Count the total number of rings.
-		*/
-		currentCache->polyCount = mpoly->ngeoms;
-		currentCache->ringCounts = lwalloc(sizeof(int) * mpoly->ngeoms);
-		for ( i = 0; i < mpoly->ngeoms; i++ )
-		{
-                        currentCache->ringCounts[i] = mpoly->geoms[i]->nrings;
-			nrings += mpoly->geoms[i]->nrings;
-		}
-		currentCache->ringIndices = lwalloc(sizeof(RTREE_NODE *) * nrings);
-		/*
-		** Load the array in geometry order, each outer ring followed by the inner rings
-                ** associated with that outer ring
-		*/
-                i = 0;
-		for ( p = 0; p < mpoly->ngeoms; p++ )
-		{
-			for ( r = 0; r < mpoly->geoms[p]->nrings; r++ )
-			{
-				currentCache->ringIndices[i] = createTree(mpoly->geoms[p]->rings[r]);
-				i++;
-			}
-		}
-	}
-	else if ( lwgeom->type == POLYGONTYPE )
-	{
-		POSTGIS_DEBUG(2, "populateCache POLYGON");
-		poly = (LWPOLY *)lwgeom;
-		currentCache->polyCount = 1;
-		currentCache->ringCounts = lwalloc(sizeof(int));
-		currentCache->ringCounts[0] = poly->nrings;
-		/*
-		** Just load the rings on in order
-		*/
-		currentCache->ringIndices = lwalloc(sizeof(RTREE_NODE *) * poly->nrings);
-		for ( i = 0; i < poly->nrings; i++ )
-		{
-			currentCache->ringIndices[i] = createTree(poly->rings[i]);
-		}
-	}
-	else
-	{
-		/* Uh oh, shouldn't be here. */
-		return;
-	}
+	lwgeom_free(lwgeom);
 
-	/*
-	** Copy the serialized form of the polygon into the cache so
-	** we can test for equality against subsequent polygons.
-	*/
-	length = VARSIZE(serializedPoly);
-	currentCache->poly = lwalloc(length);
-	memcpy(currentCache->poly, serializedPoly, length);
-	POSTGIS_DEBUGF(3, "populateCache returning %p", currentCache);
+	POSTGIS_DEBUGF(3, "RtreeCacheBuild: indexed argument %d (%p)", argnum, cache->index);
 }
 
 /**
- * Creates a new cachable index if needed, or returns the current cache if
- * it is applicable to the current polygon.
- * The memory context must be changed to function scope before calling this
- * method.	The method will allocate memory for the cache it creates,
- * as well as freeing the memory of any cache that is no longer applicable.
+ * Pull the current index from the cache or build one if there is
+ * not one available. Only build the index if we are seeing a key for
+ * the second time. That way rapidly cycling keys don't cause too much
+ * indexing.
  */
-RTREE_POLY_CACHE *retrieveCache(LWGEOM *lwgeom, GSERIALIZED *serializedPoly, RTREE_POLY_CACHE *currentCache)
+RTREE_POLY_CACHE *
+GetRtreeCache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2)
 {
-	int length;
+	MemoryContext old_context;
+	GeomCache* supercache = GetGeomCache(fcinfo);
+	RTREE_POLY_CACHE *cache = supercache->rtree;
+	int copy_keys = 1;
+	size_t g1_size = 0;
+	size_t g2_size = 0;
 
-	POSTGIS_DEBUGF(2, "retrieveCache called with %p %p %p", lwgeom, serializedPoly, currentCache);
+	assert ( ! cache || cache->type == 1 );
 
-	assert ( ! currentCache || currentCache->type == 1 );
+	if ( g1 )
+		g1_size = VARSIZE(g1);
 
-	if (!currentCache)
+	if ( g2 )
+		g2_size = VARSIZE(g2);
+
+	if ( cache == NULL )
 	{
-		POSTGIS_DEBUG(3, "No existing cache, create one.");
-		return createCache();
+		/*
+		** Cache requested, but the cache isn't set up yet.
+		** Set it up, but don't build the index yet.
+		*/
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		cache = palloc(sizeof(RTREE_POLY_CACHE));
+		MemoryContextSwitchTo(old_context);
+
+		cache->type = 1;
+		cache->geom1 = 0;
+		cache->geom2 = 0;
+		cache->geom1_size = 0;
+		cache->geom2_size = 0;
+		cache->argnum = 0;
+		cache->index = 0;
+
+		POSTGIS_DEBUGF(3, "GetRtreeCache: creating cache: %p", cache);
+
+		supercache->rtree = cache;
 	}
-	if (!(currentCache->poly))
+	else if ( g1 &&
+	          cache->argnum != 2 &&
+	          cache->geom1_size == g1_size &&
+	          memcmp(cache->geom1, g1, g1_size) == 0 )
 	{
-		POSTGIS_DEBUG(3, "Cache contains no polygon, populating it.");
-		populateCache(currentCache, lwgeom, serializedPoly);
-		return currentCache;
+		if ( ! cache->argnum )
+			RtreeCacheBuild(fcinfo, cache, 1);
+		else
+			POSTGIS_DEBUG(3, "GetRtreeCache: cache hit, argument 1");
+
+		copy_keys = 0;
 	}
+	else if ( g2 &&
+	          cache->argnum != 1 &&
+	          cache->geom2_size == g2_size &&
+	          memcmp(cache->geom2, g2, g2_size) == 0 )
+	{
+		if ( ! cache->argnum )
+			RtreeCacheBuild(fcinfo, cache, 2);
+		else
+			POSTGIS_DEBUG(3, "GetRtreeCache: cache hit, argument 2");
 
-	length = VARSIZE(serializedPoly);
+		copy_keys = 0;
+	}
+	else if ( cache->argnum )
+	{
+		POSTGIS_DEBUGF(3, "GetRtreeCache: cache miss, argument %d", cache->argnum);
+		RtreeCacheClear(cache);
+	}
 
-	if (VARSIZE(currentCache->poly) != length)
+	/*
+	** On a miss, copy the new keys into the function memory context,
+	** the arguments themselves are freed at the end of the call.
+	*/
+	if ( copy_keys && g1 )
 	{
-		POSTGIS_DEBUG(3, "Polygon size mismatch, creating new cache.");
-		clearCache(currentCache);
-		return currentCache;
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		if ( cache->geom1 )
+			pfree(cache->geom1);
+		cache->geom1 = palloc(g1_size);
+		MemoryContextSwitchTo(old_context);
+		memcpy(cache->geom1, g1, g1_size);
+		cache->geom1_size = g1_size;
 	}
-	if ( memcmp(serializedPoly, currentCache->poly, length) )
+	if ( copy_keys && g2 )
 	{
-		POSTGIS_DEBUG(3, "Polygon mismatch, creating new cache.");
-		clearCache(currentCache);
-		return currentCache;
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		if ( cache->geom2 )
+			pfree(cache->geom2);
+		cache->geom2 = palloc(g2_size);
+		MemoryContextSwitchTo(old_context);
+		memcpy(cache->geom2, g2, g2_size);
+		cache->geom2_size = g2_size;
 	}
 
-	POSTGIS_DEBUGF(3, "Polygon match, retaining current cache, %p.",
-	                  currentCache);
-
-	return currentCache;
+	return cache;
 }
 
+int
+rtree_distance_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, double threshold, double *distance)
+{
+	RTREE_POLY_CACHE *cache;
+	RTREE *other;
+	LWGEOM *lwgeom;
+
+	/* Two points? Get outa here... */
+	if ( gserialized_get_type(g1) == POINTTYPE && gserialized_get_type(g2) == POINTTYPE )
+		return LW_FAILURE;
+
+	cache = GetRtreeCache(fcinfo, g1, g2);
+
+	/* Nothing indexed (yet), let the caller do it the slow way */
+	if ( ! cache || ! cache->argnum || ! cache->index )
+		return LW_FAILURE;
+
+	/* The tree copies the vertices, we don't need to keep the geometry */
+	lwgeom = lwgeom_from_gserialized(cache->argnum == 1 ? g2 : g1);
+	other = rtree_new(lwgeom);
+	lwgeom_free(lwgeom);
+	if ( ! other )
+		return LW_FAILURE;
+
+	*distance = rtree_distance_tree(cache->index, other, threshold);
+
+	rtree_free(other);
+	return LW_SUCCESS;
+}
@@ -1,72 +1,87 @@
 #ifndef _LWGEOM_RTREE_H
 #define _LWGEOM_RTREE_H
 
+#include "postgres.h"
+#include "fmgr.h"
+
 #include "liblwgeom.h"
 
+/**
+* Maximum number of children under an interior node of the tree.
+*/
+#define RTREE_NODE_SIZE 8
+
+/**
+* Node of a packed 2-D R-Tree, built with the Sort-Tile-Recursive
+* algorithm of Leutenegger, Edgington and Lopez ("STR: A Simple and
+* Efficient Algorithm for R-Tree Packing", 1997).
+*
+* All the nodes of a tree live in a single array: the leaves first,
+* then each level of parents, with the root last. The children of an
+* interior node are contiguous, so a node only needs to know where
+* its first child is and how many there are.
+*/
 typedef struct
 {
-	double min;
-	double max;
+	double xmin, ymin, xmax, ymax;
+	int first; /* leaves: start of the segment in the point array, interior: first child */
+	int count; /* leaves: 0 for a point, 1 for a segment, interior: number of children */
 }
-INTERVAL;
-
-/* Returns 1 if min < value <= max, 0 otherwise */
-uint32 isContained(INTERVAL *interval, double value);
-/* Creates an interval given the min and max values, in whatever order. */
-INTERVAL *createInterval(double value1, double value2);
-/* Creates an interval with the total extents of the two given intervals. */
-INTERVAL *mergeIntervals(INTERVAL *inter1, INTERVAL *inter2);
+RTREE_NODE;
 
-/*
- * The following struct and methods are used for a 1D RTree implementation,
- * described at:
- *  http://lin-ear-th-inking.blogspot.com/2007/06/packed-1-dimensional-r-tree.html
- */
-typedef struct rtree_node
+/**
+* Index over all the segments (and isolated points) of a geometry.
+* The vertices are copied into one packed array, so the tree does
+* not reference the geometry it was built from, and can be cached
+* after that geometry is freed.
+*/
+typedef struct
 {
-	INTERVAL *interval;
-	struct rtree_node *leftNode;
-	struct rtree_node *rightNode;
-	LWLINE *segment;
+	int type;           /* type of the indexed geometry */
+	int nleaves;        /* nodes[0..nleaves-1] are leaves */
+	int nnodes;         /* nodes[nnodes-1] is the root */
+	RTREE_NODE *nodes;
+	int npoints;
+	POINT2D *points;
+	int ncomponents;
+	int *components;    /* first vertex of every point, line and polygon */
 }
-RTREE_NODE;
+RTREE;
 
-/* Creates an interior node given the children. */
-RTREE_NODE *createInteriorNode(RTREE_NODE *left, RTREE_NODE *right);
-/* Creates a leaf node given the pointer to the start point of the segment. */
-RTREE_NODE *createLeafNode(POINTARRAY *pa, int startPoint);
-/*
- * Creates an rtree given a pointer to the point array.
- * Must copy the point array.
- */
-RTREE_NODE *createTree(POINTARRAY *pointArray);
+/* Build an index of the geometry, NULL for empty or unsupported geometries */
+RTREE *rtree_new(const LWGEOM *lwgeom);
 /* Frees the tree. */
-void freeTree(RTREE_NODE *root);
-/* Retrieves a collection of line segments given the root and crossing value. */
-LWMLINE *findLineSegments(RTREE_NODE *root, double value);
-/* Merges two multilinestrings into a single multilinestring. */
-LWMLINE *mergeMultiLines(LWMLINE *line1, LWMLINE *line2);
+void rtree_free(RTREE *tree);
+/* -1 if the point is outside the indexed (multi)polygon, 0 on the boundary, 1 inside */
+int rtree_contains_point(const RTREE *tree, const POINT2D *pt);
+/* Minimum distance between two indexed geometries, stops early under the threshold */
+double rtree_distance_tree(const RTREE *tree1, const RTREE *tree2, double threshold);
 
 typedef struct
 {
 	char type;
-	RTREE_NODE **ringIndices;
-	int* ringCounts;
-	int polyCount;
-	GSERIALIZED *poly;
+	GSERIALIZED *geom1;
+	GSERIALIZED *geom2;
+	size_t geom1_size;
+	size_t geom2_size;
+	int32 argnum;
+	RTREE *index;
 }
 RTREE_POLY_CACHE;
 
 /*
- * Creates a new cachable index if needed, or returns the current cache if
- * it is applicable to the current polygon.
+ * Returns the current cache, building the index of an argument the
+ * second time it is seen. Pass NULL for an argument that should not
+ * be indexed.
  */
-RTREE_POLY_CACHE *retrieveCache(LWGEOM *lwgeom, GSERIALIZED *serializedPoly, RTREE_POLY_CACHE *currentCache);
-RTREE_POLY_CACHE *createCache(void);
-/* Frees the cache. */
-void populateCache(RTREE_POLY_CACHE *cache, LWGEOM *lwgeom, GSERIALIZED *serializedPoly);
-void clearCache(RTREE_POLY_CACHE *cache);
-
+RTREE_POLY_CACHE *GetRtreeCache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2);
 
+/*
+ * Distance between the indexed argument of the cache and the other
+ * argument. Returns LW_FAILURE if there is no index (yet), or if the
+ * other argument can't be indexed, for the caller to fall back on
+ * the brute force path.
+ */
+int rtree_distance_cache(FunctionCallInfoData *fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, double threshold, double *distance);
 
-#endif /* !defined _LIBLWGEOM_H */
+#endif /* !defined _LWGEOM_RTREE_H */
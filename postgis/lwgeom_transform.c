@@ -12,6 +12,9 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "funcapi.h"
+#include "commands/trigger.h"
+#include "utils/inval.h"
 
 #include "../postgis_config.h"
 #include "liblwgeom.h"
@@ -21,6 +24,8 @@
 Datum transform(PG_FUNCTION_ARGS);
 Datum transform_geom(PG_FUNCTION_ARGS);
 Datum postgis_proj_version(PG_FUNCTION_ARGS);
+Datum postgis_proj_cache_stats(PG_FUNCTION_ARGS);
+Datum postgis_proj_cache_invalidate(PG_FUNCTION_ARGS);
 
 
 
@@ -207,3 +212,59 @@ Datum postgis_proj_version(PG_FUNCTION_ARGS)
 	text *result = cstring2text(ver);
 	PG_RETURN_POINTER(result);
 }
+
+/*
+** postgis_proj_cache_stats()
+**
+** Returns the hits, misses, evictions and invalidations of the
+** projection cache of this backend, and its current size.
+*/
+PG_FUNCTION_INFO_V1(postgis_proj_cache_stats);
+Datum postgis_proj_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	HeapTuple tuple;
+	PROJ4CacheStats stats;
+	Datum values[5];
+	bool nulls[5];
+
+	if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
+	{
+		elog(ERROR, "postgis_proj_cache_stats: return type must be a row type");
+		PG_RETURN_NULL();
+	}
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	GetPROJ4CacheStats(&stats);
+	values[0] = Int64GetDatum(stats.hits);
+	values[1] = Int64GetDatum(stats.misses);
+	values[2] = Int64GetDatum(stats.evictions);
+	values[3] = Int64GetDatum(stats.invalidations);
+	values[4] = Int32GetDatum(stats.entries);
+	memset(nulls, 0, sizeof(nulls));
+
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
+/*
+** postgis_proj_cache_invalidate()
+**
+** Statement trigger on spatial_ref_sys. The relcache invalidation
+** reaches every backend when the transaction commits, and makes them
+** flush their projection cache. Our own cache is flushed right away,
+** for the rest of the transaction to see the new definitions.
+*/
+PG_FUNCTION_INFO_V1(postgis_proj_cache_invalidate);
+Datum postgis_proj_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if ( ! CALLED_AS_TRIGGER(fcinfo) )
+		elog(ERROR, "postgis_proj_cache_invalidate: not called by trigger manager");
+
+	CacheInvalidateRelcacheByRelid(RelationGetRelid(trigdata->tg_relation));
+	InvalidatePROJ4Cache();
+
+	return PointerGetDatum(NULL);
+}
@@ -273,6 +273,14 @@ CREATE OR REPLACE FUNCTION geometry_cmp(geom1 geometry, geom2 geometry)
 	AS 'MODULE_PATHNAME', 'lwgeom_cmp'
 	LANGUAGE 'c' IMMUTABLE STRICT;
 
+#if POSTGIS_PGSQL_VERSION >= 92
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION geometry_sortsupport(internal)
+	RETURNS void
+	AS 'MODULE_PATHNAME', 'lwgeom_sortsupport'
+	LANGUAGE 'c' IMMUTABLE STRICT;
+#endif
+
 --
 -- Sorting operators for Btree
 --
@@ -314,6 +322,9 @@ CREATE OPERATOR CLASS btree_geometry_ops
 	OPERATOR	3	= ,
 	OPERATOR	4	>= ,
 	OPERATOR	5	> ,
+#if POSTGIS_PGSQL_VERSION >= 92
+	FUNCTION	2	geometry_sortsupport (internal),
+#endif
 	FUNCTION	1	geometry_cmp (geom1 geometry, geom2 geometry);
 
 
@@ -418,9 +429,14 @@ CREATE OPERATOR ~= (
 );
 
 -- Availability: 2.0.0
+-- Changed: 2.1.0 exact distance with PostgreSQL 9.5+, the index rechecks on it
 CREATE OR REPLACE FUNCTION geometry_distance_centroid(geom1 geometry, geom2 geometry) 
 	RETURNS float8 
+#if POSTGIS_PGSQL_VERSION >= 95
+	AS 'MODULE_PATHNAME' ,'LWGEOM_mindistance2d'
+#else
 	AS 'MODULE_PATHNAME' ,'gserialized_distance_centroid_2d'
+#endif
 	LANGUAGE 'c' IMMUTABLE STRICT;
 
 -- Availability: 2.0.0
@@ -863,6 +879,63 @@ CREATE OR REPLACE FUNCTION ST_estimated_extent(text,text) RETURNS box2d AS
 	'MODULE_PATHNAME', 'geometry_estimated_extent'
 	LANGUAGE 'c' IMMUTABLE STRICT SECURITY DEFINER;
 
+-----------------------------------------------------------------------
+-- Debugging of the selectivity estimates of the && operator
+-----------------------------------------------------------------------
+-- Availability: 2.1.0
+-- Fraction of the rows of the column the planner expects to overlap the geometry
+CREATE OR REPLACE FUNCTION _postgis_selectivity(tbl regclass, att_name text, geom geometry)
+	RETURNS float8
+	AS 'MODULE_PATHNAME', '_postgis_gserialized_sel'
+	LANGUAGE 'c' STRICT;
+
+-- Availability: 2.1.0
+-- Fraction of the cross product of the columns the planner expects to overlap
+CREATE OR REPLACE FUNCTION _postgis_join_selectivity(regclass, text, regclass, text)
+	RETURNS float8
+	AS 'MODULE_PATHNAME', '_postgis_gserialized_joinsel'
+	LANGUAGE 'c' STRICT;
+
+-- Availability: 2.1.0
+-- Histogram of the column, as built by the last ANALYZE
+CREATE OR REPLACE FUNCTION _postgis_stats(tbl regclass, att_name text)
+	RETURNS text
+	AS 'MODULE_PATHNAME', '_postgis_gserialized_stats'
+	LANGUAGE 'c' STRICT;
+
+-- Availability: 2.1.0
+-- Estimated and actual number of rows of the column overlapping the geometry
+CREATE OR REPLACE FUNCTION _postgis_estimate_check(tbl regclass, att_name text, geom geometry, OUT estimated float8, OUT actual int8)
+AS $$
+DECLARE
+	ntuples float4;
+BEGIN
+	SELECT reltuples INTO ntuples FROM pg_class WHERE oid = tbl;
+	estimated := _postgis_selectivity(tbl, att_name, geom) * ntuples;
+	EXECUTE 'SELECT count(*) FROM ' || tbl::text || ' WHERE ' || quote_ident(att_name) || ' && $1'
+		INTO actual USING geom;
+END;
+$$
+LANGUAGE 'plpgsql' VOLATILE STRICT;
+
+-- Availability: 2.1.0
+-- Estimated and actual number of pairs of rows of the columns that overlap
+CREATE OR REPLACE FUNCTION _postgis_join_estimate_check(tbl1 regclass, att_name1 text, tbl2 regclass, att_name2 text, OUT estimated float8, OUT actual int8)
+AS $$
+DECLARE
+	ntuples1 float4;
+	ntuples2 float4;
+BEGIN
+	SELECT reltuples INTO ntuples1 FROM pg_class WHERE oid = tbl1;
+	SELECT reltuples INTO ntuples2 FROM pg_class WHERE oid = tbl2;
+	estimated := _postgis_join_selectivity(tbl1, att_name1, tbl2, att_name2) * ntuples1 * ntuples2;
+	EXECUTE 'SELECT count(*) FROM ' || tbl1::text || ' a, ' || tbl2::text || ' b'
+		|| ' WHERE a.' || quote_ident(att_name1) || ' && b.' || quote_ident(att_name2)
+		INTO actual;
+END;
+$$
+LANGUAGE 'plpgsql' VOLATILE STRICT;
+
 -----------------------------------------------------------------------
 -- FIND_EXTENT( <schema name>, <table name>, <column name> )
 -----------------------------------------------------------------------
@@ -1489,6 +1562,17 @@ CREATE TABLE spatial_ref_sys (
 	 proj4text varchar(2048)
 );
 
+-- Availability: 2.1.0
+-- Flushes the projection caches of all backends when spatial_ref_sys changes
+CREATE OR REPLACE FUNCTION postgis_proj_cache_invalidate()
+	RETURNS trigger
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c' VOLATILE;
+
+CREATE TRIGGER spatial_ref_sys_proj_cache
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON spatial_ref_sys
+	FOR EACH STATEMENT EXECUTE PROCEDURE postgis_proj_cache_invalidate();
+
 
 -----------------------------------------------------------------------
 -- POPULATE_GEOMETRY_COLUMNS()
@@ -2347,6 +2431,18 @@ CREATE OR REPLACE FUNCTION postgis_lib_build_date() RETURNS text
 	AS 'MODULE_PATHNAME'
 	LANGUAGE 'c' IMMUTABLE;
 
+-- Availability: 2.1.0
+-- Hits and misses of the prepared geometry caches of this backend
+CREATE OR REPLACE FUNCTION postgis_prepared_cache_stats(OUT hits int8, OUT misses int8, OUT prepares int8, OUT evictions int8)
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c' VOLATILE;
+
+-- Availability: 2.1.0
+-- Hits and misses of the projection cache of this backend
+CREATE OR REPLACE FUNCTION postgis_proj_cache_stats(OUT hits int8, OUT misses int8, OUT evictions int8, OUT invalidations int8, OUT entries int4)
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c' VOLATILE;
+
 CREATE OR REPLACE FUNCTION postgis_full_version() RETURNS text
 AS $$
 DECLARE
@@ -3058,12 +3154,24 @@ CREATE OR REPLACE FUNCTION pgis_geometry_union_finalfn(pgis_abs)
 	AS 'MODULE_PATHNAME'
 	LANGUAGE 'c';
 
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION pgis_geometry_union_transfn(pgis_abs, geometry)
+	RETURNS pgis_abs
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c';
+
 -- Availability: 1.4.0
 CREATE OR REPLACE FUNCTION pgis_geometry_collect_finalfn(pgis_abs)
 	RETURNS geometry
 	AS 'MODULE_PATHNAME'
 	LANGUAGE 'c';
 
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION pgis_geometry_collect_transfn(pgis_abs, geometry)
+	RETURNS pgis_abs
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c';
+
 -- Availability: 1.4.0
 CREATE OR REPLACE FUNCTION pgis_geometry_polygonize_finalfn(pgis_abs)
 	RETURNS geometry
@@ -3076,6 +3184,12 @@ CREATE OR REPLACE FUNCTION pgis_geometry_makeline_finalfn(pgis_abs)
 	AS 'MODULE_PATHNAME'
 	LANGUAGE 'c';
 
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION pgis_geometry_makeline_transfn(pgis_abs, geometry)
+	RETURNS pgis_abs
+	AS 'MODULE_PATHNAME'
+	LANGUAGE 'c';
+
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_Accum (
 	sfunc = pgis_geometry_accum_transfn,
@@ -3093,7 +3207,7 @@ CREATE OR REPLACE FUNCTION ST_Union (geometry[])
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_Union (
 	basetype = geometry,
-	sfunc = pgis_geometry_accum_transfn,
+	sfunc = pgis_geometry_union_transfn,
 	stype = pgis_abs,
 	finalfunc = pgis_geometry_union_finalfn
 	);
@@ -3101,7 +3215,7 @@ CREATE AGGREGATE ST_Union (
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_Collect (
 	BASETYPE = geometry,
-	SFUNC = pgis_geometry_accum_transfn,
+	SFUNC = pgis_geometry_collect_transfn,
 	STYPE = pgis_abs,
 	FINALFUNC = pgis_geometry_collect_finalfn
 	);
@@ -3117,7 +3231,7 @@ CREATE AGGREGATE ST_Polygonize (
 -- Availability: 1.2.2
 CREATE AGGREGATE ST_MakeLine (
 	BASETYPE = geometry,
-	SFUNC = pgis_geometry_accum_transfn,
+	SFUNC = pgis_geometry_makeline_transfn,
 	STYPE = pgis_abs,
 	FINALFUNC = pgis_geometry_makeline_finalfn
 	);
@@ -3502,6 +3616,77 @@ CREATE OR REPLACE FUNCTION ST_GeoHash(geom geometry, maxchars int4 DEFAULT 0)
 		AS 'MODULE_PATHNAME', 'ST_GeoHash'
 	LANGUAGE 'c' IMMUTABLE STRICT;
 
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION ST_HilbertKey(geom geometry, extent box2d)
+	RETURNS int8
+	AS 'MODULE_PATHNAME', 'ST_HilbertKey'
+	LANGUAGE 'c' IMMUTABLE STRICT;
+
+-----------------------------------------------------------------------
+-- ST_HilbertCluster( <schema name>, <table name>, <column name> )
+-----------------------------------------------------------------------
+-- CLUSTER a table in the order of the Hilbert keys of a geometry
+-- column, over the estimated extent of the column (or the real one if
+-- there are no statistics), through a temporary expression index.
+-- Only the named table is rewritten, not its children. The clustering
+-- index the table had, if any, is restored. Returns the number of rows
+-- of the table.
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION ST_HilbertCluster(schema_name text, table_name text, column_name text)
+	RETURNS int8 AS
+$$
+DECLARE
+	qualified text;
+	idxname text;
+	previdx name;
+	ext box2d;
+	nrows int8;
+BEGIN
+	qualified := quote_ident(schema_name) || '.' || quote_ident(table_name);
+
+	EXECUTE 'LOCK TABLE ' || qualified || ' IN ACCESS EXCLUSIVE MODE';
+
+	BEGIN
+		ext := ST_Estimated_Extent(schema_name, table_name, column_name);
+	EXCEPTION WHEN OTHERS THEN
+		ext := NULL;
+	END;
+	IF ext IS NULL THEN
+		EXECUTE 'SELECT ST_Extent(' || quote_ident(column_name) || ') FROM ONLY ' || qualified INTO ext;
+	END IF;
+
+	-- Empty table, nothing to order
+	IF ext IS NULL THEN
+		RETURN 0;
+	END IF;
+
+	SELECT c.relname INTO previdx
+		FROM pg_index i JOIN pg_class c ON c.oid = i.indexrelid
+		WHERE i.indrelid = qualified::regclass AND i.indisclustered;
+
+	-- Errors roll the index back with the rest of the transaction
+	idxname := 'pgis_hilbert_cluster_' || (qualified::regclass::oid)::text;
+	EXECUTE 'CREATE INDEX ' || quote_ident(idxname) || ' ON ' || qualified ||
+	        ' (ST_HilbertKey(' || quote_ident(column_name) || ', ' || quote_literal(ext::text) || '::box2d))';
+	EXECUTE 'CLUSTER ' || qualified || ' USING ' || quote_ident(idxname);
+	EXECUTE 'DROP INDEX ' || quote_ident(schema_name) || '.' || quote_ident(idxname);
+	IF previdx IS NOT NULL THEN
+		EXECUTE 'ALTER TABLE ' || qualified || ' CLUSTER ON ' || quote_ident(previdx);
+	END IF;
+
+	EXECUTE 'SELECT count(*) FROM ONLY ' || qualified INTO nrows;
+
+	RETURN nrows;
+END;
+$$
+LANGUAGE 'plpgsql' VOLATILE STRICT;
+
+-- Availability: 2.1.0
+CREATE OR REPLACE FUNCTION ST_HilbertCluster(table_name text, column_name text)
+	RETURNS int8 AS
+	$$ SELECT ST_HilbertCluster(current_schema()::text, $1, $2) $$
+	LANGUAGE 'sql' VOLATILE STRICT;
+
 ------------------------------------------------------------------------
 -- OGC defined
 ------------------------------------------------------------------------
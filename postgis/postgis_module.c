@@ -18,6 +18,8 @@
 #include "../postgis_config.h"
 #include "lwgeom_log.h"
 #include "lwgeom_pg.h"
+#include "lwgeom_geos_prepared.h"
+#include "lwgeom_transform.h"
 
 /*
  * This is required for builds against pgsql
@@ -31,6 +33,40 @@ void _PG_init(void);
 void
 _PG_init(void)
 {
+  /* Number of prepared geometries kept by each call site */
+  DefineCustomIntVariable(
+    "postgis.prepared_cache_size", /* name */
+    "Sets the number of prepared geometries cached by each spatial predicate call.", /* short_desc */
+    "Joins that cycle through more outer geometries than this re-prepare them on every row.", /* long_desc */
+    &prepared_cache_size, /* valueAddr */
+    1, PREPARED_CACHE_SIZE_MAX, /* min-max */
+    PREPARED_CACHE_SIZE_DEFAULT, /* bootValue */
+    PGC_USERSET, /* GucContext context */
+    0, /* int flags */
+#if POSTGIS_PGSQL_VERSION >= 91
+    NULL, /* GucIntCheckHook check_hook */
+#endif
+    NULL, /* GucIntAssignHook assign_hook */
+    NULL  /* GucShowHook show_hook */
+   );
+
+  /* Number of projections kept by the backend */
+  DefineCustomIntVariable(
+    "postgis.proj_cache_size", /* name */
+    "Sets the number of PROJ.4 projections cached by each backend.", /* short_desc */
+    "Transforming between more spatial reference systems than this re-reads spatial_ref_sys.", /* long_desc */
+    &proj_cache_size, /* valueAddr */
+    2, PROJ_CACHE_SIZE_MAX, /* min-max */
+    PROJ_CACHE_SIZE_DEFAULT, /* bootValue */
+    PGC_USERSET, /* GucContext context */
+    0, /* int flags */
+#if POSTGIS_PGSQL_VERSION >= 91
+    NULL, /* GucIntCheckHook check_hook */
+#endif
+    NULL, /* GucIntAssignHook assign_hook */
+    NULL  /* GucShowHook show_hook */
+   );
+
 #if 0
   /* Define custom GUC variables. */
   DefineCustomIntVariable(
@@ -29,9 +29,11 @@
  */
 
 #include <math.h>
+#include <errno.h>
 #include <stdio.h>  /* for printf (default message handler) */
 #include <stdarg.h> /* for va_list, va_start etc */
 #include <string.h> /* for memcpy and strlen */
+#include <ctype.h> /* for isdigit and tolower */
 #include <assert.h>
 #include <time.h> /* for time */
 #include "rt_api.h"
@@ -188,6 +190,35 @@ static void quicksort(double *left, double *right) {
 	}
 }
 
+/*
+ * Pseudo-random numbers for sampling pixels, with the state kept by the
+ * caller rather than in rand()'s globals (xorshift, state must not be 0)
+ */
+static uint32_t
+rt_util_sample_rand(uint32_t *state) {
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*state = x;
+	return x;
+}
+
+/* qsort comparison of doubles, ascending */
+static int
+rt_util_dbl_cmp(const void *a, const void *b) {
+	double x = *((const double *) a);
+	double y = *((const double *) b);
+
+	if (x < y)
+		return -1;
+	else if (x > y)
+		return 1;
+	return 0;
+}
+
 /**
  * Convert cstring name to GDAL Resample Algorithm
  *
@@ -2132,6 +2163,163 @@ rt_band_get_pixel(
     }
 }
 
+/**
+ * Get the values of multiple pixels of a row, without copying them.
+ * Unlike rt_band_get_pixel, the values are of the band's pixel type.
+ *
+ * @param band : the band to get values from
+ * @param x : X coordinate of the first pixel (0-based)
+ * @param y : Y coordinate (0-based)
+ * @param len : # of pixels, which must all be in row y
+ *
+ * @return pointer to the values in the band's data, or NULL on error
+ */
+void *
+rt_band_get_pixel_line_data(
+	rt_band band,
+	int x, int y,
+	uint16_t len
+) {
+	uint8_t *data = NULL;
+
+	assert(NULL != band);
+
+	if (
+		x < 0 || x + len > band->width ||
+		y < 0 || y >= band->height
+	) {
+		rterror("rt_band_get_pixel_line_data: Coordinates out of range (%d to %d, %d) vs (%d, %d)", x, x + len, y, band->width, band->height);
+		return NULL;
+	}
+
+	data = rt_band_get_data(band);
+	if (data == NULL) {
+		rterror("rt_band_get_pixel_line_data: Cannot get band data");
+		return NULL;
+	}
+
+	return data + rt_pixtype_size(band->pixtype) * (x + (y * band->width));
+}
+
+/**
+ * Get the values of multiple pixels of a row as doubles, converted in
+ * one pass, and optionally which of them are NODATA.
+ *
+ * @param band : the band to get values from
+ * @param x : X coordinate of the first pixel (0-based)
+ * @param y : Y coordinate (0-based)
+ * @param len : # of pixels, which must all be in row y
+ * @param vals : set to the len values
+ * @param nodata : if not NULL, set to 1 for the values that are the
+ *   band's NODATA value, or that value clamped to the pixel type, and
+ *   to 0 for the others
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+rt_band_get_pixel_line(
+	rt_band band,
+	int x, int y,
+	uint16_t len,
+	double *vals, uint8_t *nodata
+) {
+	void *data = NULL;
+	double clamped = 0;
+	int i;
+
+	assert(NULL != band);
+	assert(NULL != vals);
+
+	data = rt_band_get_pixel_line_data(band, x, y, len);
+	if (data == NULL)
+		return -1;
+
+	/* one loop per pixel type, that the compiler can vectorize */
+	switch (band->pixtype) {
+		case PT_1BB: {
+			uint8_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_1BB(band->nodataval);
+			break;
+		}
+		case PT_2BUI: {
+			uint8_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_2BUI(band->nodataval);
+			break;
+		}
+		case PT_4BUI: {
+			uint8_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_4BUI(band->nodataval);
+			break;
+		}
+		case PT_8BUI: {
+			uint8_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_8BUI(band->nodataval);
+			break;
+		}
+		case PT_8BSI: {
+			int8_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_8BSI(band->nodataval);
+			break;
+		}
+		case PT_16BSI: {
+			int16_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_16BSI(band->nodataval);
+			break;
+		}
+		case PT_16BUI: {
+			uint16_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_16BUI(band->nodataval);
+			break;
+		}
+		case PT_32BSI: {
+			int32_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_32BSI(band->nodataval);
+			break;
+		}
+		case PT_32BUI: {
+			uint32_t *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_32BUI(band->nodataval);
+			break;
+		}
+		case PT_32BF: {
+			float *ptr = data;
+			for (i = 0; i < len; i++) vals[i] = ptr[i];
+			clamped = rt_util_clamp_to_32F(band->nodataval);
+			break;
+		}
+		case PT_64BF:
+			memcpy(vals, data, sizeof(double) * len);
+			clamped = band->nodataval;
+			break;
+		default:
+			rterror("rt_band_get_pixel_line: Unknown pixeltype %d", band->pixtype);
+			return -1;
+	}
+
+	if (nodata == NULL)
+		return 0;
+
+	if (!band->hasnodata) {
+		memset(nodata, 0, sizeof(uint8_t) * len);
+		return 0;
+	}
+
+	/* as rt_band_clamped_value_is_nodata, for values of the pixel type */
+	for (i = 0; i < len; i++)
+		nodata[i] = FLT_EQ(vals[i], band->nodataval) || FLT_EQ(vals[i], clamped);
+
+	return 0;
+}
+
 double
 rt_band_get_nodata(rt_band band) {
 
@@ -2156,7 +2344,7 @@ rt_band_get_min_value(rt_band band) {
 int
 rt_band_check_is_nodata(rt_band band) {
 	int i, j, err;
-	double pxValue;
+	double *vals = NULL;
 
 	assert(NULL != band);
 
@@ -2167,23 +2355,33 @@ rt_band_check_is_nodata(rt_band band) {
 		return FALSE;
 	}
 
-	pxValue = band->nodataval;
+	if (band->width > 0) {
+		vals = rtalloc(sizeof(double) * band->width);
+		if (vals == NULL) {
+			rterror("rt_band_check_is_nodata: Unable to allocate memory for band pixels");
+			return FALSE;
+		}
+	}
 
-	/* Check all pixels */
-	for (i = 0; i < band->width; i++) {
-		for (j = 0; j < band->height; j++) {
-			err = rt_band_get_pixel(band, i, j, &pxValue);
-			if (err != 0) {
-				rterror("rt_band_check_is_nodata: Cannot get band pixel");
-				return FALSE;
-			}
-			else if (FLT_NEQ(pxValue, band->nodataval)) {
+	/* Check all pixels, a row at a time */
+	for (j = 0; j < band->height && band->width > 0; j++) {
+		err = rt_band_get_pixel_line(band, 0, j, band->width, vals, NULL);
+		if (err != 0) {
+			rterror("rt_band_check_is_nodata: Cannot get band pixel");
+			rtdealloc(vals);
+			return FALSE;
+		}
+
+		for (i = 0; i < band->width; i++) {
+			if (FLT_NEQ(vals[i], band->nodataval)) {
 				band->isnodata = FALSE;
+				rtdealloc(vals);
 				return FALSE;
 			}
 		}
 	}
 
+	if (vals != NULL) rtdealloc(vals);
 	band->isnodata = TRUE;
 	return TRUE;
 }
@@ -2363,42 +2561,46 @@ rt_band_corrected_clamped_value(rt_band band, double val, double *newval) {
  * @param exclude_nodata_value: if non-zero, ignore nodata values
  * @param sample: percentage of pixels to sample
  * @param inc_vals: flag to include values in return struct
- * @param cK: number of pixels counted thus far in coverage
- * @param cM: M component of 1-pass stddev for coverage
- * @param cQ: Q component of 1-pass stddev for coverage
  *
  * @return the summary statistics for a band
  */
 rt_bandstats
 rt_band_get_summary_stats(
 	rt_band band,
-	int exclude_nodata_value, double sample, int inc_vals,
-	uint64_t *cK, double *cM, double *cQ
+	int exclude_nodata_value, double sample, int inc_vals
 ) {
 	uint8_t *data = NULL;
 	uint32_t x = 0;
 	uint32_t y = 0;
-	uint32_t z = 0;
 	uint32_t offset = 0;
 	uint32_t diff = 0;
 	int rtn;
 	int hasnodata = FALSE;
 	double nodata = 0;
 	double *values = NULL;
-	double value;
+	double *rowvals = NULL;
+	uint8_t *rownodata = NULL;
 	rt_bandstats stats = NULL;
 
 	uint32_t do_sample = 0;
 	uint32_t sample_size = 0;
 	uint32_t sample_per = 0;
 	uint32_t sample_int = 0;
+	uint32_t seed = 0;
 	uint32_t i = 0;
-	uint32_t j = 0;
 	double sum = 0;
 	uint32_t k = 0;
 	double M = 0;
 	double Q = 0;
 
+	uint32_t n = 0;
+	double rowsum = 0;
+	double rowmin = 0;
+	double rowmax = 0;
+	double rowmean = 0;
+	double rowQ = 0;
+	double delta = 0;
+
 #if POSTGIS_DEBUG_LEVEL > 0
 	clock_t start, stop;
 	double elapsed = 0;
@@ -2496,7 +2698,7 @@ rt_band_get_summary_stats(
 	/* sample all pixels */
 	if (!do_sample) {
 		sample_size = band->width * band->height;
-		sample_per = band->height;
+		sample_per = band->width;
 	}
 	/*
 	 randomly sample a percentage of available pixels
@@ -2505,18 +2707,29 @@ rt_band_get_summary_stats(
 	*/
 	else {
 		sample_size = round((band->width * band->height) * sample);
-		sample_per = round(sample_size / band->width);
+		sample_per = round(sample_size / band->height);
 		if (sample_per < 1)
 			sample_per = 1;
-		sample_int = round(band->height / sample_per);
-		srand(time(NULL));
+		sample_int = round(band->width / sample_per);
+		seed = (uint32_t) time(NULL) | 1;
 	}
 
 	RASTER_DEBUGF(3, "sampling %d of %d available pixels w/ %d per set"
 		, sample_size, (band->width * band->height), sample_per);
 
+	/* pixels are read a row at a time */
+	rowvals = rtalloc(sizeof(double) * band->width);
+	rownodata = rtalloc(sizeof(uint8_t) * band->width);
+	if (rowvals == NULL || rownodata == NULL) {
+		rterror("rt_band_get_summary_stats: Unable to allocate memory for band pixels");
+		if (rowvals != NULL) rtdealloc(rowvals);
+		if (rownodata != NULL) rtdealloc(rownodata);
+		return NULL;
+	}
+
 	if (inc_vals) {
-		values = rtalloc(sizeof(double) * sample_size);
+		/* at least one pixel is sampled per row */
+		values = rtalloc(sizeof(double) * sample_per * band->height);
 		if (NULL == values) {
 			rtwarn("Unable to allocate memory for values");
 			inc_vals = 0;
@@ -2527,6 +2740,9 @@ rt_band_get_summary_stats(
 	stats = (rt_bandstats) rtalloc(sizeof(struct rt_bandstats_t));
 	if (NULL == stats) {
 		rterror("rt_band_get_summary_stats: Unable to allocate memory for stats");
+		if (inc_vals) rtdealloc(values);
+		rtdealloc(rowvals);
+		rtdealloc(rownodata);
 		return NULL;
 	}
 	stats->sample = sample;
@@ -2538,94 +2754,97 @@ rt_band_get_summary_stats(
 	stats->values = NULL;
 	stats->sorted = 0;
 
-	for (x = 0, j = 0, k = 0; x < band->width; x++) {
-		y = -1;
-		diff = 0;
+	for (y = 0, k = 0; y < band->height; y++) {
+		rtn = rt_band_get_pixel_line(band, 0, y, band->width, rowvals, rownodata);
+		if (rtn != 0) {
+			rterror("rt_band_get_summary_stats: Cannot get band pixels");
+			if (inc_vals) rtdealloc(values);
+			rtdealloc(rowvals);
+			rtdealloc(rownodata);
+			rtdealloc(stats);
+			return NULL;
+		}
 
-		for (i = 0, z = 0; i < sample_per; i++) {
-			if (!do_sample)
-				y = i;
+		/* pack the values of the row to count at the start of rowvals */
+		n = 0;
+		if (!do_sample) {
+			if (!exclude_nodata_value)
+				n = band->width;
 			else {
-				offset = (rand() % sample_int) + 1;
-				y += diff + offset;
-				diff = sample_int - offset;
-			}
-			RASTER_DEBUGF(5, "(x, y, z) = (%d, %d, %d)", x, y, z);
-			if (y >= band->height || z > sample_per) break;
-
-			rtn = rt_band_get_pixel(band, x, y, &value);
-#if POSTGIS_DEBUG_LEVEL > 0
-			if (rtn != -1) {
-				RASTER_DEBUGF(5, "(x, y, value) = (%d,%d, %f)", x, y, value);
+				for (x = 0; x < band->width; x++) {
+					rowvals[n] = rowvals[x];
+					n += !rownodata[x];
+				}
 			}
-#endif
-
-			j++;
-			if (
-				rtn != -1 && (
-					!exclude_nodata_value || (
-						exclude_nodata_value &&
-						(hasnodata != FALSE) && (
-							FLT_NEQ(value, nodata) &&
-							(rt_band_clamped_value_is_nodata(band, value) != 1)
-						)
-					)
-				)
-			) {
+		}
+		else {
+			x = -1;
+			diff = 0;
 
-				/* inc_vals set, collect pixel values */
-				if (inc_vals) values[k] = value;
+			for (i = 0; i < sample_per; i++) {
+				offset = (rt_util_sample_rand(&seed) % sample_int) + 1;
+				x += diff + offset;
+				diff = sample_int - offset;
+				RASTER_DEBUGF(5, "(x, y) = (%d, %d)", x, y);
+				if (x >= band->width) break;
 
-				/* average */
-				k++;
-				sum += value;
+				if (!exclude_nodata_value || !rownodata[x])
+					rowvals[n++] = rowvals[x];
+			}
+		}
+		if (n < 1) continue;
 
-				/*
-					one-pass standard deviation
-					http://www.eecs.berkeley.edu/~mhoemmen/cs194/Tutorials/variance.pdf
-				*/
-				if (k == 1) {
-					Q = 0;
-					M = value;
-				}
-				else {
-					Q += (((k  - 1) * pow(value - M, 2)) / k);
-					M += ((value - M ) / k);
-				}
+		/* inc_vals set, collect pixel values */
+		if (inc_vals)
+			memcpy(values + k, rowvals, sizeof(double) * n);
 
-				/* coverage one-pass standard deviation */
-				if (NULL != cK) {
-					(*cK)++;
-					if (*cK == 1) {
-						*cQ = 0;
-						*cM = value;
-					}
-					else {
-						*cQ += (((*cK  - 1) * pow(value - *cM, 2)) / *cK);
-						*cM += ((value - *cM ) / *cK);
-					}
-				}
+		/* sum, min and max of the row */
+		rowsum = 0;
+		rowmin = rowmax = rowvals[0];
+		for (x = 0; x < n; x++) {
+			rowsum += rowvals[x];
+			if (rowvals[x] < rowmin)
+				rowmin = rowvals[x];
+			if (rowvals[x] > rowmax)
+				rowmax = rowvals[x];
+		}
 
-				/* min/max */
-				if (stats->count < 1) {
-					stats->count = 1;
-					stats->min = stats->max = value;
-				}
-				else {
-					if (value < stats->min)
-						stats->min = value;
-					if (value > stats->max)
-						stats->max = value;
-				}
+		/* sum of squares of differences from the mean of the row */
+		rowmean = rowsum / n;
+		rowQ = 0;
+		for (x = 0; x < n; x++)
+			rowQ += (rowvals[x] - rowmean) * (rowvals[x] - rowmean);
 
-			}
+		/*
+			merge the row into the band, as in Chan et al.
+			http://www.eecs.berkeley.edu/~mhoemmen/cs194/Tutorials/variance.pdf
+		*/
+		if (k < 1) {
+			M = rowmean;
+			Q = rowQ;
+			stats->min = rowmin;
+			stats->max = rowmax;
+		}
+		else {
+			delta = rowmean - M;
+			M += delta * n / (k + n);
+			Q += rowQ + delta * delta * ((double) k * n / (k + n));
 
-			z++;
+			if (rowmin < stats->min)
+				stats->min = rowmin;
+			if (rowmax > stats->max)
+				stats->max = rowmax;
 		}
+
+		k += n;
+		sum += rowsum;
 	}
 
 	RASTER_DEBUG(3, "sampling complete");
 
+	rtdealloc(rowvals);
+	rtdealloc(rownodata);
+
 	stats->count = k;
 	if (k > 0) {
 		if (inc_vals) {
@@ -2656,49 +2875,106 @@ rt_band_get_summary_stats(
 		rtdealloc(values);
 
 	/* if count is zero and do_sample is one */
-	if (k < 0 && do_sample)
+	if (k < 1 && do_sample)
 		rtwarn("All sampled pixels of band have the NODATA value");
 
 #if POSTGIS_DEBUG_LEVEL > 0
 	stop = clock();
 	elapsed = ((double) (stop - start)) / CLOCKS_PER_SEC;
-	RASTER_DEBUGF(3, "(time, count, mean, stddev, min, max) = (%0.4f, %d, %f, %f, %f, %f)",
-		elapsed, stats->count, stats->mean, stats->stddev, stats->min, stats->max);
+	RASTER_DEBUGF(3, "(time, count, mean, stddev, min, max) = (%0.4f, %llu, %f, %f, %f, %f)",
+		elapsed, (unsigned long long) stats->count, stats->mean, stats->stddev, stats->min, stats->max);
 #endif
 
 	RASTER_DEBUG(3, "done");
 	return stats;
 }
 
+/* Sum of squares of differences from the mean behind stats->stddev */
+static double
+rt_bandstats_sumsq(rt_bandstats stats) {
+	if (stats->count < 1 || stats->stddev < 0)
+		return 0;
+
+	/* sample deviation */
+	if (stats->sample > 0 && stats->sample < 1)
+		return stats->stddev * stats->stddev * (stats->count - 1);
+	/* standard deviation */
+	else
+		return stats->stddev * stats->stddev * stats->count;
+}
+
 /**
- * Count the distribution of data
- *
- * @param stats: a populated stats struct for processing
- * @param bin_count: the number of bins to group the data by
- * @param bin_width: the width of each bin as an array
- * @param bin_width_count: number of values in bin_width
- * @param right: evaluate bins by (a,b] rather than default [a,b)
- * @param min: user-defined minimum value of the histogram
- *   a value less than the minimum value is not counted in any bins
- *   if min = max, min and max are not used
- * @param max: user-defined maximum value of the histogram
- *   a value greater than the max value is not counted in any bins
- *   if min = max, min and max are not used
- * @param rtn_count: set to the number of bins being returned
+ * Merge the summary statistics of a set of pixels into those of
+ * another, such as those of two tiles of a coverage
  *
- * @return the histogram of the data
+ * @param stats: the summary stats to merge into
+ * @param other: the summary stats to merge, computed with the same
+ *   sample percentage as stats. Its values are not merged.
  */
-rt_histogram
-rt_band_get_histogram(rt_bandstats stats,
+void
+rt_bandstats_merge(rt_bandstats stats, rt_bandstats other) {
+	uint64_t count;
+	double Q;
+	double delta;
+
+	assert(NULL != stats);
+	assert(NULL != other);
+
+	if (other->count < 1)
+		return;
+
+	if (stats->count < 1) {
+		stats->count = other->count;
+		stats->min = other->min;
+		stats->max = other->max;
+		stats->sum = other->sum;
+		stats->mean = other->mean;
+		stats->stddev = other->stddev;
+		return;
+	}
+
+	/* combine the sums of squares as in Chan et al. */
+	count = stats->count + other->count;
+	delta = other->mean - stats->mean;
+	Q = rt_bandstats_sumsq(stats) + rt_bandstats_sumsq(other) +
+		delta * delta * ((double) stats->count * other->count / count);
+
+	stats->count = count;
+	stats->sum += other->sum;
+	stats->mean = stats->sum / count;
+
+	if (other->min < stats->min)
+		stats->min = other->min;
+	if (other->max > stats->max)
+		stats->max = other->max;
+
+	/* sample deviation */
+	if (stats->sample > 0 && stats->sample < 1)
+		stats->stddev = sqrt(Q / (count - 1));
+	/* standard deviation */
+	else
+		stats->stddev = sqrt(Q / count);
+}
+
+/*
+ * Histogram of nvalues values, each counted weights[i] times or once if
+ * weights is NULL, that make a set of count values from vmin to vmax
+ */
+static rt_histogram
+rt_util_get_histogram(
+	const double *values, const uint64_t *weights, uint32_t nvalues,
+	uint64_t count, double vmin, double vmax,
 	int bin_count, double *bin_width, int bin_width_count,
-	int right, double min, double max, uint32_t *rtn_count) {
+	int right, double min, double max, uint32_t *rtn_count
+) {
 	rt_histogram bins = NULL;
 	int init_width = 0;
 	int i;
 	int j;
 	double tmp;
 	double value;
-	int sum = 0;
+	uint64_t weight;
+	uint64_t sum = 0;
 	int user_minmax = 0;
 	double qmin;
 	double qmax;
@@ -2713,13 +2989,6 @@ rt_band_get_histogram(rt_bandstats stats,
 	start = clock();
 #endif
 
-	assert(NULL != stats);
-
-	if (stats->count < 1 || NULL == stats->values) {
-		rterror("rt_util_get_histogram: rt_bandstats object has no value");
-		return NULL;
-	}
-
 	/* bin width must be positive numbers and not zero */
 	if (NULL != bin_width && bin_width_count > 0) {
 		for (i = 0; i < bin_width_count; i++) {
@@ -2732,8 +3001,8 @@ rt_band_get_histogram(rt_bandstats stats,
 
 	/* ignore min and max parameters */
 	if (FLT_EQ(max, min)) {
-		qmin = stats->min;
-		qmax = stats->max;
+		qmin = vmin;
+		qmax = vmax;
 	}
 	else {
 		user_minmax = 1;
@@ -2753,12 +3022,12 @@ rt_band_get_histogram(rt_bandstats stats,
 
 			all computed bins are assumed to have equal width
 		*/
-		/* Square-root choice for stats->count < 30 */
-		if (stats->count < 30)
-			bin_count = ceil(sqrt(stats->count));
-		/* Sturges' formula for stats->count >= 30 */
+		/* Square-root choice for count < 30 */
+		if (count < 30)
+			bin_count = ceil(sqrt(count));
+		/* Sturges' formula for count >= 30 */
 		else
-			bin_count = ceil(log2((double) stats->count) + 1.);
+			bin_count = ceil(log2((double) count) + 1.);
 
 		/* bin_width_count provided and bin_width has value */
 		if (bin_width_count > 0 && NULL != bin_width) {
@@ -2792,7 +3061,7 @@ rt_band_get_histogram(rt_bandstats stats,
 			return NULL;
 		}
 
-		bins->count = stats->count;
+		bins->count = count;
 		bins->percent = -1;
 		bins->min = qmin;
 		bins->max = qmax;
@@ -2871,8 +3140,9 @@ rt_band_get_histogram(rt_bandstats stats,
 	}
 
 	/* process the values */
-	for (i = 0; i < stats->count; i++) {
-		value = stats->values[i];
+	for (i = 0; i < nvalues; i++) {
+		value = values[i];
+		weight = (weights != NULL) ? weights[i] : 1;
 
 		/* default, [a, b) */
 		if (!right) {
@@ -2885,8 +3155,8 @@ rt_band_get_histogram(rt_bandstats stats,
 						)
 					)
 				) {
-					bins[j].count++;
-					sum++;
+					bins[j].count += weight;
+					sum += weight;
 					break;
 				}
 			}
@@ -2902,8 +3172,8 @@ rt_band_get_histogram(rt_bandstats stats,
 						)
 					)
 				) {
-					bins[j].count++;
-					sum++;
+					bins[j].count += weight;
+					sum += weight;
 					break;
 				}
 			}
@@ -2920,8 +3190,9 @@ rt_band_get_histogram(rt_bandstats stats,
 	RASTER_DEBUGF(3, "elapsed time = %0.4f", elapsed);
 
 	for (j = 0; j < bin_count; j++) {
-		RASTER_DEBUGF(5, "(min, max, inc_min, inc_max, count, sum, percent) = (%f, %f, %d, %d, %d, %d, %f)",
-			bins[j].min, bins[j].max, bins[j].inc_min, bins[j].inc_max, bins[j].count, sum, bins[j].percent);
+		RASTER_DEBUGF(5, "(min, max, inc_min, inc_max, count, sum, percent) = (%f, %f, %d, %d, %llu, %llu, %f)",
+			bins[j].min, bins[j].max, bins[j].inc_min, bins[j].inc_max,
+			(unsigned long long) bins[j].count, (unsigned long long) sum, bins[j].percent);
 	}
 #endif
 
@@ -2932,42 +3203,92 @@ rt_band_get_histogram(rt_bandstats stats,
 }
 
 /**
- * Compute the default set of or requested quantiles for a set of data
- * the quantile formula used is same as Excel and R default method
+ * Count the distribution of data
  *
  * @param stats: a populated stats struct for processing
- * @param quantiles: the quantiles to be computed
- * @param quantiles_count: the number of quantiles to be computed
- * @param rtn_count: set to the number of quantiles being returned
+ * @param bin_count: the number of bins to group the data by
+ * @param bin_width: the width of each bin as an array
+ * @param bin_width_count: number of values in bin_width
+ * @param right: evaluate bins by (a,b] rather than default [a,b)
+ * @param min: user-defined minimum value of the histogram
+ *   a value less than the minimum value is not counted in any bins
+ *   if min = max, min and max are not used
+ * @param max: user-defined maximum value of the histogram
+ *   a value greater than the max value is not counted in any bins
+ *   if min = max, min and max are not used
+ * @param rtn_count: set to the number of bins being returned
  *
- * @return the default set of or requested quantiles for a band
+ * @return the histogram of the data
  */
-rt_quantile
-rt_band_get_quantiles(rt_bandstats stats,
-	double *quantiles, int quantiles_count, uint32_t *rtn_count) {
-	rt_quantile rtn;
-	int init_quantiles = 0;
-	int i = 0;
-	double h;
-	int hl;
-
-#if POSTGIS_DEBUG_LEVEL > 0
-	clock_t start, stop;
-	double elapsed = 0;
-#endif
-
-	RASTER_DEBUG(3, "starting");
-#if POSTGIS_DEBUG_LEVEL > 0
-	start = clock();
-#endif
-
+rt_histogram
+rt_band_get_histogram(rt_bandstats stats,
+	int bin_count, double *bin_width, int bin_width_count,
+	int right, double min, double max, uint32_t *rtn_count) {
 	assert(NULL != stats);
 
 	if (stats->count < 1 || NULL == stats->values) {
-		rterror("rt_band_get_quantiles: rt_bandstats object has no value");
+		rterror("rt_util_get_histogram: rt_bandstats object has no value");
 		return NULL;
 	}
 
+	return rt_util_get_histogram(
+		stats->values, NULL, stats->count,
+		stats->count, stats->min, stats->max,
+		bin_count, bin_width, bin_width_count,
+		right, min, max, rtn_count
+	);
+}
+
+/*
+ * Value of 0-based rank rank of nvalues sorted values, each counted
+ * weights[i] times or once if weights is NULL
+ */
+static double
+rt_util_value_at_rank(
+	const double *values, const uint64_t *weights, uint32_t nvalues,
+	uint64_t rank
+) {
+	uint32_t i;
+
+	if (NULL == weights)
+		return values[rank];
+
+	for (i = 0; i < nvalues - 1; i++) {
+		if (rank < weights[i])
+			break;
+		rank -= weights[i];
+	}
+
+	return values[i];
+}
+
+/*
+ * Quantiles of nvalues sorted values, each counted weights[i] times or
+ * once if weights is NULL, that make a set of count values
+ */
+static rt_quantile
+rt_util_get_quantiles(
+	const double *values, const uint64_t *weights, uint32_t nvalues,
+	uint64_t count,
+	double *quantiles, int quantiles_count, uint32_t *rtn_count
+) {
+	rt_quantile rtn;
+	int init_quantiles = 0;
+	int i = 0;
+	double h;
+	uint64_t hl;
+	double low;
+
+#if POSTGIS_DEBUG_LEVEL > 0
+	clock_t start, stop;
+	double elapsed = 0;
+#endif
+
+	RASTER_DEBUG(3, "starting");
+#if POSTGIS_DEBUG_LEVEL > 0
+	start = clock();
+#endif
+
 	/* quantiles not provided */
 	if (NULL == quantiles) {
 		/* quantile count not specified, default to quartiles */
@@ -2977,7 +3298,7 @@ rt_band_get_quantiles(rt_bandstats stats,
 		quantiles = rtalloc(sizeof(double) * quantiles_count);
 		init_quantiles = 1;
 		if (NULL == quantiles) {
-			rterror("rt_band_get_quantiles: Unable to allocate memory for quantile input");
+			rterror("rt_util_get_quantiles: Unable to allocate memory for quantile input");
 			return NULL;
 		}
 
@@ -2990,7 +3311,7 @@ rt_band_get_quantiles(rt_bandstats stats,
 	/* check quantiles */
 	for (i = 0; i < quantiles_count; i++) {
 		if (quantiles[i] < 0. || quantiles[i] > 1.) {
-			rterror("rt_band_get_quantiles: Quantile value not between 0 and 1");
+			rterror("rt_util_get_quantiles: Quantile value not between 0 and 1");
 			if (init_quantiles) rtdealloc(quantiles);
 			return NULL;
 		}
@@ -3000,17 +3321,11 @@ rt_band_get_quantiles(rt_bandstats stats,
 	/* initialize rt_quantile */
 	rtn = rtalloc(sizeof(struct rt_quantile_t) * quantiles_count);
 	if (NULL == rtn) {
-		rterror("rt_band_get_quantiles: Unable to allocate memory for quantile output");
+		rterror("rt_util_get_quantiles: Unable to allocate memory for quantile output");
 		if (init_quantiles) rtdealloc(quantiles);
 		return NULL;
 	}
 
-	/* sort values */
-	if (!stats->sorted) {
-		quicksort(stats->values, stats->values + stats->count - 1);
-		stats->sorted = 1;
-	}
-
 	/*
 		make quantiles
 
@@ -3020,15 +3335,16 @@ rt_band_get_quantiles(rt_bandstats stats,
 	for (i = 0; i < quantiles_count; i++) {
 		rtn[i].quantile = quantiles[i];
 
-		h = ((stats->count - 1.) * quantiles[i]) + 1.;
+		h = ((count - 1.) * quantiles[i]) + 1.;
 		hl = floor(h);
+		low = rt_util_value_at_rank(values, weights, nvalues, hl - 1);
 
 		/* h greater than hl, do full equation */
 		if (h > hl)
-			rtn[i].value = stats->values[hl - 1] + ((h - hl) * (stats->values[hl] - stats->values[hl - 1]));
+			rtn[i].value = low + ((h - hl) * (rt_util_value_at_rank(values, weights, nvalues, hl) - low));
 		/* shortcut as second part of equation is zero */
 		else
-			rtn[i].value = stats->values[hl - 1];
+			rtn[i].value = low;
 	}
 
 #if POSTGIS_DEBUG_LEVEL > 0
@@ -3043,6 +3359,339 @@ rt_band_get_quantiles(rt_bandstats stats,
 	return rtn;
 }
 
+/**
+ * Compute the default set of or requested quantiles for a set of data
+ * the quantile formula used is same as Excel and R default method
+ *
+ * @param stats: a populated stats struct for processing
+ * @param quantiles: the quantiles to be computed
+ * @param quantiles_count: the number of quantiles to be computed
+ * @param rtn_count: set to the number of quantiles being returned
+ *
+ * @return the default set of or requested quantiles for a band
+ */
+rt_quantile
+rt_band_get_quantiles(rt_bandstats stats,
+	double *quantiles, int quantiles_count, uint32_t *rtn_count) {
+	assert(NULL != stats);
+
+	if (stats->count < 1 || NULL == stats->values) {
+		rterror("rt_band_get_quantiles: rt_bandstats object has no value");
+		return NULL;
+	}
+
+	/* sort values */
+	if (!stats->sorted) {
+		quicksort(stats->values, stats->values + stats->count - 1);
+		stats->sorted = 1;
+	}
+
+	return rt_util_get_quantiles(
+		stats->values, NULL, stats->count,
+		stats->count,
+		quantiles, quantiles_count, rtn_count
+	);
+}
+
+/**
+ * Create an empty sketch of the distribution of a set of values
+ *
+ * @param size: # of centroids to keep, RT_SKETCH_SIZE if 0
+ *
+ * @return the sketch or NULL on error
+ */
+rt_sketch
+rt_sketch_new(uint32_t size) {
+	rt_sketch sketch = NULL;
+
+	sketch = (rt_sketch) rtalloc(sizeof(struct rt_sketch_t));
+	if (NULL == sketch) {
+		rterror("rt_sketch_new: Unable to allocate memory for sketch");
+		return NULL;
+	}
+
+	if (size == 0)
+		size = RT_SKETCH_SIZE;
+	/* fewer centroids would hardly describe the distribution */
+	else if (size < 8)
+		size = 8;
+
+	sketch->size = size;
+	sketch->count = 0;
+	sketch->values = NULL;
+	sketch->weights = NULL;
+	sketch->total = 0;
+	sketch->min = sketch->max = 0;
+
+	return sketch;
+}
+
+/**
+ * Free a sketch
+ *
+ * @param sketch: the sketch to free
+ */
+void
+rt_sketch_destroy(rt_sketch sketch) {
+	if (NULL == sketch)
+		return;
+
+	if (NULL != sketch->values)
+		rtdealloc(sketch->values);
+	if (NULL != sketch->weights)
+		rtdealloc(sketch->weights);
+	rtdealloc(sketch);
+}
+
+/*
+ * Merge neighbouring centroids of a sketch until no more than
+ * sketch->size are left. A centroid may take up to total / delta values
+ * in the middle of the distribution and half as many at its ends, so
+ * any two neighbours left hold more than total / (2 * delta) values and
+ * there are at most 4 * delta + 1 of them.
+ */
+static void
+rt_sketch_compress(rt_sketch sketch) {
+	double delta = (sketch->size - 1) / 4.;
+	double before = 0; /* # of values before centroid j */
+	double q;
+	double limit;
+	uint64_t weight;
+	uint32_t i;
+	uint32_t j;
+
+	for (i = 1, j = 0; i < sketch->count; i++) {
+		weight = sketch->weights[j] + sketch->weights[i];
+		q = (before + weight / 2.) / sketch->total;
+		limit = sketch->total / delta * (0.5 + 2 * q * (1 - q));
+
+		if (weight <= limit) {
+			sketch->values[j] += (sketch->values[i] - sketch->values[j]) * sketch->weights[i] / weight;
+			sketch->weights[j] = weight;
+		}
+		else {
+			before += sketch->weights[j];
+			j++;
+			sketch->values[j] = sketch->values[i];
+			sketch->weights[j] = sketch->weights[i];
+		}
+	}
+
+	RASTER_DEBUGF(3, "compressed %d centroids to %d", sketch->count, j + 1);
+	sketch->count = j + 1;
+}
+
+/*
+ * Merge count distinct sorted values, each counted weights[i] times,
+ * into the centroids of a sketch, whose total must already count them
+ */
+static int
+rt_sketch_insert(
+	rt_sketch sketch,
+	const double *values, const uint64_t *weights, uint32_t count
+) {
+	double *newvalues = NULL;
+	uint64_t *newweights = NULL;
+	uint32_t i = 0;
+	uint32_t j = 0;
+	uint32_t k = 0;
+
+	newvalues = rtalloc(sizeof(double) * (sketch->count + count));
+	newweights = rtalloc(sizeof(uint64_t) * (sketch->count + count));
+	if (NULL == newvalues || NULL == newweights) {
+		rterror("rt_sketch_insert: Unable to allocate memory for sketch");
+		if (NULL != newvalues) rtdealloc(newvalues);
+		if (NULL != newweights) rtdealloc(newweights);
+		return 0;
+	}
+
+	while (i < sketch->count || j < count) {
+		if (j >= count || (i < sketch->count && sketch->values[i] < values[j])) {
+			newvalues[k] = sketch->values[i];
+			newweights[k] = sketch->weights[i];
+			i++;
+		}
+		else if (i >= sketch->count || values[j] < sketch->values[i]) {
+			newvalues[k] = values[j];
+			newweights[k] = weights[j];
+			j++;
+		}
+		/* same value */
+		else {
+			newvalues[k] = values[j];
+			newweights[k] = sketch->weights[i] + weights[j];
+			i++;
+			j++;
+		}
+		k++;
+	}
+
+	if (NULL != sketch->values) rtdealloc(sketch->values);
+	if (NULL != sketch->weights) rtdealloc(sketch->weights);
+	sketch->values = newvalues;
+	sketch->weights = newweights;
+	sketch->count = k;
+
+	if (sketch->count > sketch->size)
+		rt_sketch_compress(sketch);
+
+	return 1;
+}
+
+/**
+ * Add values to a sketch
+ *
+ * @param sketch: the sketch to add to
+ * @param values: the values to add, which are overwritten
+ * @param count: # of values
+ *
+ * @return 1 on success, 0 on error
+ */
+int
+rt_sketch_add(rt_sketch sketch, double *values, uint32_t count) {
+	uint64_t *weights = NULL;
+	uint32_t i;
+	uint32_t j;
+	int rtn;
+
+	assert(NULL != sketch);
+
+	if (count < 1)
+		return 1;
+
+	weights = rtalloc(sizeof(uint64_t) * count);
+	if (NULL == weights) {
+		rterror("rt_sketch_add: Unable to allocate memory for sketch");
+		return 0;
+	}
+
+	/* pack each distinct value once at the start of values */
+	qsort(values, count, sizeof(double), rt_util_dbl_cmp);
+	weights[0] = 1;
+	for (i = 1, j = 0; i < count; i++) {
+		if (values[i] == values[j])
+			weights[j]++;
+		else {
+			j++;
+			values[j] = values[i];
+			weights[j] = 1;
+		}
+	}
+
+	if (sketch->total < 1 || values[0] < sketch->min)
+		sketch->min = values[0];
+	if (sketch->total < 1 || values[j] > sketch->max)
+		sketch->max = values[j];
+
+	sketch->total += count;
+	rtn = rt_sketch_insert(sketch, values, weights, j + 1);
+	rtdealloc(weights);
+
+	return rtn;
+}
+
+/**
+ * Merge a sketch into another
+ *
+ * @param sketch: the sketch to merge into
+ * @param other: the sketch to merge
+ *
+ * @return 1 on success, 0 on error
+ */
+int
+rt_sketch_merge(rt_sketch sketch, rt_sketch other) {
+	assert(NULL != sketch);
+	assert(NULL != other);
+
+	if (other->total < 1)
+		return 1;
+
+	if (sketch->total < 1 || other->min < sketch->min)
+		sketch->min = other->min;
+	if (sketch->total < 1 || other->max > sketch->max)
+		sketch->max = other->max;
+
+	sketch->total += other->total;
+	return rt_sketch_insert(sketch, other->values, other->weights, other->count);
+}
+
+/**
+ * Count the distribution of the values of a sketch
+ *
+ * @param sketch: the sketch of the values
+ * @param bin_count: the number of bins to group the data by
+ * @param bin_width: the width of each bin as an array
+ * @param bin_width_count: number of values in bin_width
+ * @param right: evaluate bins by (a,b] rather than default [a,b)
+ * @param min: user-defined minimum value of the histogram
+ * @param max: user-defined maximum value of the histogram
+ *   if min = max, min and max are not used
+ * @param rtn_count: set to the number of bins being returned
+ *
+ * @return the histogram of the values or NULL on error
+ */
+rt_histogram
+rt_sketch_get_histogram(rt_sketch sketch,
+	int bin_count, double *bin_width, int bin_width_count,
+	int right, double min, double max, uint32_t *rtn_count) {
+	assert(NULL != sketch);
+
+	if (sketch->total < 1) {
+		rterror("rt_sketch_get_histogram: Sketch has no value");
+		return NULL;
+	}
+
+	return rt_util_get_histogram(
+		sketch->values, sketch->weights, sketch->count,
+		sketch->total, sketch->min, sketch->max,
+		bin_count, bin_width, bin_width_count,
+		right, min, max, rtn_count
+	);
+}
+
+/**
+ * Compute the default set of or requested quantiles of the values of
+ * a sketch
+ *
+ * @param sketch: the sketch of the values
+ * @param quantiles: the quantiles to be computed
+ * @param quantiles_count: the number of quantiles to be computed
+ * @param rtn_count: set to the number of quantiles being returned
+ *
+ * @return the quantiles of the values or NULL on error
+ */
+rt_quantile
+rt_sketch_get_quantiles(rt_sketch sketch,
+	double *quantiles, int quantiles_count, uint32_t *rtn_count) {
+	rt_quantile rtn = NULL;
+	uint32_t i;
+
+	assert(NULL != sketch);
+
+	if (sketch->total < 1) {
+		rterror("rt_sketch_get_quantiles: Sketch has no value");
+		return NULL;
+	}
+
+	rtn = rt_util_get_quantiles(
+		sketch->values, sketch->weights, sketch->count,
+		sketch->total,
+		quantiles, quantiles_count, rtn_count
+	);
+	if (NULL == rtn)
+		return NULL;
+
+	/* the ends of the distribution are known even once compressed */
+	for (i = 0; i < *rtn_count; i++) {
+		if (rtn[i].quantile <= 0)
+			rtn[i].value = sketch->min;
+		else if (rtn[i].quantile >= 1)
+			rtn[i].value = sketch->max;
+	}
+
+	return rtn;
+}
+
 static struct quantile_llist_element *quantile_llist_search(
 	struct quantile_llist_element *element,
 	double needle
@@ -3307,6 +3956,7 @@ rt_band_get_quantiles_stream(rt_band band,
 	uint32_t sample_size = 0;
 	uint32_t sample_per = 0;
 	uint32_t sample_int = 0;
+	uint32_t seed = 0;
 	int status;
 
 	RASTER_DEBUG(3, "starting");
@@ -3438,7 +4088,7 @@ rt_band_get_quantiles_stream(rt_band band,
 		sample_size = round((band->width * band->height) * sample);
 		sample_per = round(sample_size / band->width);
 		sample_int = round(band->height / sample_per);
-		srand(time(NULL));
+		seed = (uint32_t) time(NULL) | 1;
 	}
 	RASTER_DEBUGF(3, "sampling %d of %d available pixels w/ %d per set"
 		, sample_size, (band->width * band->height), sample_per);
@@ -3451,7 +4101,7 @@ rt_band_get_quantiles_stream(rt_band band,
 			if (do_sample != 1)
 				y = i;
 			else {
-				offset = (rand() % sample_int) + 1;
+				offset = (rt_util_sample_rand(&seed) % sample_int) + 1;
 				y += diff + offset;
 				diff = sample_int - offset;
 			}
@@ -3859,6 +4509,30 @@ rt_band_get_quantiles_stream(rt_band band,
 	return rtn;
 }
 
+/* Sort value counts on the positions where their values were first found */
+static void
+rt_valuecount_sort(rt_valuecount vcnts, uint32_t *firstpos, int count) {
+	struct rt_valuecount_t vcnt;
+	uint32_t pos;
+	int gap;
+	int i;
+	int j;
+
+	/* shell sort, the values being mostly found in order already */
+	for (gap = count / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < count; i++) {
+			vcnt = vcnts[i];
+			pos = firstpos[i];
+			for (j = i; j >= gap && firstpos[j - gap] > pos; j -= gap) {
+				vcnts[j] = vcnts[j - gap];
+				firstpos[j] = firstpos[j - gap];
+			}
+			vcnts[j] = vcnt;
+			firstpos[j] = pos;
+		}
+	}
+}
+
 /**
  * Count the number of times provided value(s) occur in
  * the band
@@ -3896,6 +4570,10 @@ rt_band_get_value_count(rt_band band, int exclude_nodata_value,
 	uint32_t total = 0;
 	int vcnts_count = 0;
 	int new_valuecount = 0;
+	double *rowvals = NULL;
+	uint8_t *rownodata = NULL;
+	uint32_t pos = 0;
+	uint32_t *firstpos = NULL;
 
 #if POSTGIS_DEBUG_LEVEL > 0
 	clock_t start, stop;
@@ -4046,66 +4724,90 @@ rt_band_get_value_count(rt_band band, int exclude_nodata_value,
 		}
 	}
 
-	for (x = 0; x < band->width; x++) {
-		for (y = 0; y < band->height; y++) {
-			rtn = rt_band_get_pixel(band, x, y, &pxlval);
+	/* pixels are read a row at a time */
+	rowvals = rtalloc(sizeof(double) * band->width);
+	rownodata = rtalloc(sizeof(uint8_t) * band->width);
+	if (rowvals == NULL || rownodata == NULL) {
+		rterror("rt_band_get_count_of_values: Unable to allocate memory for band pixels");
+		if (rowvals != NULL) rtdealloc(rowvals);
+		if (rownodata != NULL) rtdealloc(rownodata);
+		if (vcnts != NULL) rtdealloc(vcnts);
+		*rtn_count = 0;
+		return NULL;
+	}
 
-			/* error getting value, continue */
-			if (rtn == -1) continue;
+	for (y = 0; y < band->height; y++) {
+		rtn = rt_band_get_pixel_line(band, 0, y, band->width, rowvals, rownodata);
 
-			if (
-				!exclude_nodata_value || (
-					exclude_nodata_value &&
-					(hasnodata != FALSE) && (
-						FLT_NEQ(pxlval, nodata) &&
-						(rt_band_clamped_value_is_nodata(band, pxlval) != 1)
-					)
-				)
-			) {
-				total++;
-				if (doround) {
-					rpxlval = ROUND(pxlval, scale);
-				}
-				else
-					rpxlval = pxlval;
-				RASTER_DEBUGF(5, "(pxlval, rpxlval) => (%0.6f, %0.6f)", pxlval, rpxlval);
-
-				new_valuecount = 1;
-				/* search for match in existing valuecounts */
-				for (i = 0; i < vcnts_count; i++) {
-					/* match found */
-					if (FLT_EQ(vcnts[i].value, rpxlval)) {
-						vcnts[i].count++;
-						new_valuecount = 0;
-						RASTER_DEBUGF(5, "(value, count) => (%0.6f, %d)", vcnts[i].value, vcnts[i].count);
-						break;
-					}
-				}
+		/* error getting values, continue */
+		if (rtn != 0) continue;
 
-				/*
-					don't add new valuecount either because
-						- no need for new one
-						- user-defined search values
-				*/
-				if (!new_valuecount || search_values_count > 0) continue;
+		for (x = 0; x < band->width; x++) {
+			if (exclude_nodata_value && rownodata[x])
+				continue;
 
-				/* add new valuecount */
-				vcnts = rtrealloc(vcnts, sizeof(struct rt_valuecount_t) * (vcnts_count + 1));
-				if (NULL == vcnts) {
-					rterror("rt_band_get_count_of_values: Unable to allocate memory for value counts");
-					*rtn_count = 0;
-					return NULL;
+			pxlval = rowvals[x];
+			total++;
+			if (doround) {
+				rpxlval = ROUND(pxlval, scale);
+			}
+			else
+				rpxlval = pxlval;
+			RASTER_DEBUGF(5, "(pxlval, rpxlval) => (%0.6f, %0.6f)", pxlval, rpxlval);
+
+			/* position of the pixel, column by column, to keep the values in that order */
+			pos = x * band->height + y;
+
+			new_valuecount = 1;
+			/* search for match in existing valuecounts */
+			for (i = 0; i < vcnts_count; i++) {
+				/* match found */
+				if (FLT_EQ(vcnts[i].value, rpxlval)) {
+					vcnts[i].count++;
+					if (firstpos != NULL && pos < firstpos[i])
+						firstpos[i] = pos;
+					new_valuecount = 0;
+					RASTER_DEBUGF(5, "(value, count) => (%0.6f, %d)", vcnts[i].value, vcnts[i].count);
+					break;
 				}
+			}
 
-				vcnts[vcnts_count].value = rpxlval;
-				vcnts[vcnts_count].count = 1;
-				vcnts[vcnts_count].percent = 0;
-				RASTER_DEBUGF(5, "(value, count) => (%0.6f, %d)", vcnts[vcnts_count].value, vcnts[vcnts_count].count);
-				vcnts_count++;
+			/*
+				don't add new valuecount either because
+					- no need for new one
+					- user-defined search values
+			*/
+			if (!new_valuecount || search_values_count > 0) continue;
+
+			/* add new valuecount */
+			vcnts = rtrealloc(vcnts, sizeof(struct rt_valuecount_t) * (vcnts_count + 1));
+			firstpos = rtrealloc(firstpos, sizeof(uint32_t) * (vcnts_count + 1));
+			if (NULL == vcnts || NULL == firstpos) {
+				rterror("rt_band_get_count_of_values: Unable to allocate memory for value counts");
+				rtdealloc(rowvals);
+				rtdealloc(rownodata);
+				*rtn_count = 0;
+				return NULL;
 			}
+
+			vcnts[vcnts_count].value = rpxlval;
+			vcnts[vcnts_count].count = 1;
+			vcnts[vcnts_count].percent = 0;
+			firstpos[vcnts_count] = pos;
+			RASTER_DEBUGF(5, "(value, count) => (%0.6f, %d)", vcnts[vcnts_count].value, vcnts[vcnts_count].count);
+			vcnts_count++;
 		}
 	}
 
+	rtdealloc(rowvals);
+	rtdealloc(rownodata);
+
+	/* values found in the band are returned in the order of a scan column by column */
+	if (firstpos != NULL) {
+		rt_valuecount_sort(vcnts, firstpos, vcnts_count);
+		rtdealloc(firstpos);
+	}
+
 #if POSTGIS_DEBUG_LEVEL > 0
 	stop = clock();
 	elapsed = ((double) (stop - start)) / CLOCKS_PER_SEC;
@@ -4158,6 +4860,7 @@ rt_band_reclass(rt_band srcband, rt_pixtype pixtype,
 	double nv = 0;
 	int do_nv = 0;
 	rt_reclassexpr expr = NULL;
+	double *rowvals = NULL;
 
 	assert(NULL != srcband);
 	assert(NULL != exprset);
@@ -4313,18 +5016,29 @@ rt_band_reclass(rt_band srcband, rt_pixtype pixtype,
 	}
 	RASTER_DEBUGF(3, "rt_band_reclass: new band @ %p", band);
 
-	for (x = 0; x < width; x++) {
-		for (y = 0; y < height; y++) {
-			rtn = rt_band_get_pixel(srcband, x, y, &ov);
+	/* source pixels are read a row at a time */
+	rowvals = rtalloc(sizeof(double) * width);
+	if (!rowvals) {
+		rterror("rt_band_reclass: Could not allocate memory for band pixels");
+		rt_band_destroy(band);
+		rtdealloc(mem);
+		return 0;
+	}
 
-			/* error getting value, skip */
-			if (rtn == -1) {
-				RASTER_DEBUGF(3, "Cannot get value at %d, %d", x, y);
-				continue;
-			}
+	for (y = 0; y < height; y++) {
+		rtn = rt_band_get_pixel_line(srcband, 0, y, width, rowvals, NULL);
 
-			do {
-				do_nv = 0;
+		/* error getting values, skip */
+		if (rtn != 0) {
+			RASTER_DEBUGF(3, "Cannot get values of row %d", y);
+			continue;
+		}
+
+		for (x = 0; x < width; x++) {
+			ov = rowvals[x];
+
+			do {
+				do_nv = 0;
 
 				/* no data*/
 				if (src_hasnodata && hasnodata && FLT_EQ(ov, src_nodataval)) {
@@ -4450,6 +5164,7 @@ rt_band_reclass(rt_band srcband, rt_pixtype pixtype,
 			);
 			if (rt_band_set_pixel(band, x, y, nv) < 0) {
 				rterror("rt_band_reclass: Could not assign value to new band");
+				rtdealloc(rowvals);
 				rt_band_destroy(band);
 				rtdealloc(mem);
 				return 0;
@@ -4459,9 +5174,1523 @@ rt_band_reclass(rt_band srcband, rt_pixtype pixtype,
 		}
 	}
 
+	rtdealloc(rowvals);
+
 	return band;
 }
 
+/*- rt_mapexpr -------------------------------------------------------*/
+
+/*
+ * Expressions are compiled into a list of instructions in postfix order,
+ * instruction k writing register k. A register holds the values and NULL
+ * flags of RT_MAPEXPR_BLOCK pixels, and every instruction is evaluated
+ * only for the pixels set in its mask register. Masks are how CASE, AND
+ * and OR avoid evaluating (and failing on) pixels PostgreSQL would not
+ * evaluate. Register 0 is the mask of pixels given to rt_mapexpr_eval.
+ */
+
+enum rt_mapexpr_op {
+	MXO_ROOT, MXO_CONST, MXO_VAR,
+	MXO_NEG, MXO_ADD, MXO_SUB, MXO_MUL, MXO_DIV, MXO_MOD, MXO_POW,
+	MXO_ABS, MXO_SQRT, MXO_EXP, MXO_LN, MXO_LOG, MXO_FLOOR, MXO_CEIL,
+	MXO_ROUND, MXO_TOINT, MXO_GREATEST, MXO_LEAST,
+	MXO_LT, MXO_LE, MXO_GT, MXO_GE, MXO_EQ, MXO_NE,
+	MXO_NOT, MXO_AND, MXO_OR,
+	MXO_WHEN, MXO_UNLESS, MXO_NOTFALSE, MXO_NOTTRUE, MXO_SELECT
+};
+
+/* SQL types of the values of registers */
+enum rt_mapexpr_type {
+	MXT_INT4, MXT_FLOAT8, MXT_NUMERIC, MXT_BOOL, MXT_UNKNOWN
+};
+
+enum rt_mapexpr_token {
+	MXK_END, MXK_NUM, MXK_VAR, MXK_IDENT, MXK_OP, MXK_LPAREN, MXK_RPAREN,
+	MXK_COMMA, MXK_CAST
+};
+
+struct rt_mapexpr_tok {
+	int kind;
+	const char *str;
+	int len;
+};
+
+typedef struct {
+	rt_mapexpr mapexpr;
+	struct rt_mapexpr_tok *toks;
+	int pos;
+	int nvars;
+	const char **varnames;
+	const rt_pixtype *vartypes;
+} rt_mapexpr_parser;
+
+/* Returns the error PostgreSQL raises for a float8 result, if any */
+static const char *
+rt_mapexpr_checkfloat(double val, int inf_is_valid, int zero_is_valid) {
+	if (isinf(val) && !inf_is_valid)
+		return "value out of range: overflow";
+	if (val == 0.0 && !zero_is_valid)
+		return "value out of range: underflow";
+	return NULL;
+}
+
+static const char *
+rt_mapexpr_checkint(double val) {
+	if (val < INT32_MIN || val > INT32_MAX)
+		return "integer out of range";
+	return NULL;
+}
+
+/* float8 comparison, where NaN equals itself and sorts above everything */
+static int
+rt_mapexpr_cmp(double a, double b) {
+	if (isnan(a))
+		return isnan(b) ? 0 : 1;
+	if (isnan(b))
+		return -1;
+	return (a > b) ? 1 : ((a < b) ? -1 : 0);
+}
+
+/* Evaluate stmt for the lanes in mask whose arguments are not NULL */
+#define MAPEXPR_STRICT(argnull, stmt) \
+	for (i = 0; i < n; i++) { \
+		if (m[i] == 0 || (argnull)) { \
+			d[i] = 0; \
+			nd[i] = 1; \
+			continue; \
+		} \
+		nd[i] = 0; \
+		stmt; \
+	}
+
+#define MAPEXPR_CHECK(check) \
+	if ((err = (check)) != NULL) return err;
+
+/*
+ * Evaluate an instruction for n lanes into d and nd, with the arguments
+ * in a, b and c. Returns the error message if the evaluation failed,
+ * worded as PostgreSQL would, or NULL.
+ */
+static const char *
+rt_mapexpr_exec(struct rt_mapexpr_instr *ins, int n, const double *m,
+	const double *a, const uint8_t *na,
+	const double *b, const uint8_t *nb,
+	const double *c, const uint8_t *nc,
+	double *d, uint8_t *nd
+) {
+	const char *err = NULL;
+	int isint = (ins->argtype == MXT_INT4);
+	int i;
+
+	switch (ins->op) {
+		case MXO_NEG:
+			if (isint) {
+				MAPEXPR_STRICT(na[i], d[i] = -a[i]; MAPEXPR_CHECK(rt_mapexpr_checkint(d[i])))
+			}
+			else {
+				MAPEXPR_STRICT(na[i], d[i] = -a[i])
+			}
+			break;
+		case MXO_ADD:
+			if (isint) {
+				MAPEXPR_STRICT(na[i] || nb[i], d[i] = a[i] + b[i]; MAPEXPR_CHECK(rt_mapexpr_checkint(d[i])))
+			}
+			else {
+				MAPEXPR_STRICT(na[i] || nb[i],
+					d[i] = a[i] + b[i];
+					MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]) || isinf(b[i]), 1))
+				)
+			}
+			break;
+		case MXO_SUB:
+			if (isint) {
+				MAPEXPR_STRICT(na[i] || nb[i], d[i] = a[i] - b[i]; MAPEXPR_CHECK(rt_mapexpr_checkint(d[i])))
+			}
+			else {
+				MAPEXPR_STRICT(na[i] || nb[i],
+					d[i] = a[i] - b[i];
+					MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]) || isinf(b[i]), 1))
+				)
+			}
+			break;
+		case MXO_MUL:
+			/* products of int4 overflow the int4 range before they lose precision */
+			if (isint) {
+				MAPEXPR_STRICT(na[i] || nb[i], d[i] = a[i] * b[i]; MAPEXPR_CHECK(rt_mapexpr_checkint(d[i])))
+			}
+			else {
+				MAPEXPR_STRICT(na[i] || nb[i],
+					d[i] = a[i] * b[i];
+					MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]) || isinf(b[i]), a[i] == 0 || b[i] == 0))
+				)
+			}
+			break;
+		case MXO_DIV:
+			if (isint) {
+				MAPEXPR_STRICT(na[i] || nb[i],
+					if (b[i] == 0) return "division by zero";
+					if (a[i] == INT32_MIN && b[i] == -1) return "integer out of range";
+					d[i] = (int32_t) a[i] / (int32_t) b[i]
+				)
+			}
+			else {
+				MAPEXPR_STRICT(na[i] || nb[i],
+					if (b[i] == 0) return "division by zero";
+					d[i] = a[i] / b[i];
+					MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]) || isinf(b[i]), a[i] == 0))
+				)
+			}
+			break;
+		case MXO_MOD:
+			MAPEXPR_STRICT(na[i] || nb[i],
+				if (b[i] == 0) return "division by zero";
+				d[i] = (b[i] == -1) ? 0 : (int32_t) a[i] % (int32_t) b[i]
+			)
+			break;
+		case MXO_POW:
+			MAPEXPR_STRICT(na[i] || nb[i],
+				if (a[i] == 0 && b[i] < 0)
+					return "zero raised to a negative power is undefined";
+				if (a[i] < 0 && floor(b[i]) != b[i])
+					return "a negative number raised to a non-integer power yields a complex result";
+				d[i] = pow(a[i], b[i]);
+				MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]) || isinf(b[i]), a[i] == 0))
+			)
+			break;
+		case MXO_ABS:
+			if (isint) {
+				MAPEXPR_STRICT(na[i], d[i] = fabs(a[i]); MAPEXPR_CHECK(rt_mapexpr_checkint(d[i])))
+			}
+			else {
+				MAPEXPR_STRICT(na[i], d[i] = fabs(a[i]))
+			}
+			break;
+		case MXO_SQRT:
+			MAPEXPR_STRICT(na[i],
+				if (a[i] < 0) return "cannot take square root of a negative number";
+				d[i] = sqrt(a[i]);
+				MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]), a[i] == 0))
+			)
+			break;
+		case MXO_EXP:
+			MAPEXPR_STRICT(na[i],
+				d[i] = exp(a[i]);
+				MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]), 0))
+			)
+			break;
+		case MXO_LN:
+		case MXO_LOG:
+			MAPEXPR_STRICT(na[i],
+				if (a[i] == 0) return "cannot take logarithm of zero";
+				if (a[i] < 0) return "cannot take logarithm of a negative number";
+				d[i] = (ins->op == MXO_LN) ? log(a[i]) : log10(a[i]);
+				MAPEXPR_CHECK(rt_mapexpr_checkfloat(d[i], isinf(a[i]), a[i] == 1))
+			)
+			break;
+		case MXO_FLOOR:
+			MAPEXPR_STRICT(na[i], d[i] = floor(a[i]))
+			break;
+		case MXO_CEIL:
+			MAPEXPR_STRICT(na[i], d[i] = ceil(a[i]))
+			break;
+		case MXO_ROUND:
+			MAPEXPR_STRICT(na[i], d[i] = rint(a[i]))
+			break;
+		case MXO_TOINT:
+			MAPEXPR_STRICT(na[i],
+				if (isnan(a[i])) return "integer out of range";
+				MAPEXPR_CHECK(rt_mapexpr_checkint(a[i]));
+				d[i] = rint(a[i])
+			)
+			break;
+		case MXO_LT:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) < 0)
+			break;
+		case MXO_LE:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) <= 0)
+			break;
+		case MXO_GT:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) > 0)
+			break;
+		case MXO_GE:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) >= 0)
+			break;
+		case MXO_EQ:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) == 0)
+			break;
+		case MXO_NE:
+			MAPEXPR_STRICT(na[i] || nb[i], d[i] = rt_mapexpr_cmp(a[i], b[i]) != 0)
+			break;
+		case MXO_NOT:
+			MAPEXPR_STRICT(na[i], d[i] = (a[i] == 0))
+			break;
+		/* NULL only if both are */
+		case MXO_GREATEST:
+			MAPEXPR_STRICT(na[i] && nb[i],
+				if (nb[i] || (!na[i] && rt_mapexpr_cmp(a[i], b[i]) >= 0))
+					d[i] = a[i];
+				else
+					d[i] = b[i]
+			)
+			break;
+		case MXO_LEAST:
+			MAPEXPR_STRICT(na[i] && nb[i],
+				if (nb[i] || (!na[i] && rt_mapexpr_cmp(a[i], b[i]) <= 0))
+					d[i] = a[i];
+				else
+					d[i] = b[i]
+			)
+			break;
+		/* three-valued logic, b is only evaluated where a did not decide */
+		case MXO_AND:
+			MAPEXPR_STRICT(0,
+				if ((!na[i] && a[i] == 0) || (!nb[i] && b[i] == 0))
+					d[i] = 0;
+				else if (na[i] || nb[i])
+					nd[i] = 1;
+				else
+					d[i] = 1
+			)
+			break;
+		case MXO_OR:
+			MAPEXPR_STRICT(0,
+				if ((!na[i] && a[i] != 0) || (!nb[i] && b[i] != 0))
+					d[i] = 1;
+				else if (na[i] || nb[i])
+					nd[i] = 1;
+				else
+					d[i] = 0
+			)
+			break;
+		/* masks of the lanes a CASE branch or a second AND/OR operand covers */
+		case MXO_WHEN:
+			for (i = 0; i < n; i++) {
+				d[i] = m[i] != 0 && !na[i] && a[i] != 0;
+				nd[i] = 0;
+			}
+			break;
+		case MXO_UNLESS:
+			for (i = 0; i < n; i++) {
+				d[i] = m[i] != 0 && (na[i] || a[i] == 0);
+				nd[i] = 0;
+			}
+			break;
+		case MXO_NOTFALSE:
+			for (i = 0; i < n; i++) {
+				d[i] = m[i] != 0 && (na[i] || a[i] != 0);
+				nd[i] = 0;
+			}
+			break;
+		case MXO_NOTTRUE:
+			for (i = 0; i < n; i++) {
+				d[i] = m[i] != 0 && (na[i] || a[i] == 0);
+				nd[i] = 0;
+			}
+			break;
+		/* a is the mask of a CASE branch, b its value and c the rest of the CASE */
+		case MXO_SELECT:
+			MAPEXPR_STRICT(0,
+				if (a[i] != 0) {
+					d[i] = b[i];
+					nd[i] = nb[i];
+				}
+				else {
+					d[i] = c[i];
+					nd[i] = nc[i];
+				}
+			)
+			break;
+		default:
+			break;
+	}
+
+	return NULL;
+}
+
+#undef MAPEXPR_STRICT
+#undef MAPEXPR_CHECK
+
+/* Append an instruction to the program, returning its register or -1 */
+static int
+rt_mapexpr_emit(rt_mapexpr_parser *parser, int op, int type, int argtype,
+	int mask, int a, int b, int c
+) {
+	rt_mapexpr mapexpr = parser->mapexpr;
+	struct rt_mapexpr_instr *ins = NULL;
+	struct rt_mapexpr_instr *args[3] = {NULL};
+	int foldable = 0;
+	int i;
+
+	if (mapexpr->ncode == mapexpr->maxcode) {
+		mapexpr->maxcode *= 2;
+		mapexpr->code = rtrealloc(mapexpr->code, sizeof(struct rt_mapexpr_instr) * mapexpr->maxcode);
+		if (mapexpr->code == NULL) {
+			rterror("rt_mapexpr_compile: Could not allocate memory for instructions");
+			return -1;
+		}
+	}
+
+	ins = &(mapexpr->code[mapexpr->ncode]);
+	memset(ins, 0, sizeof(struct rt_mapexpr_instr));
+	ins->op = op;
+	ins->type = type;
+	ins->argtype = argtype;
+	ins->mask = mask;
+	ins->arg[0] = a;
+	ins->arg[1] = b;
+	ins->arg[2] = c;
+
+	/*
+	 * Fold operations on constants as the planner would, so that an
+	 * expression whose constant part fails is left to PostgreSQL
+	 */
+	if (op >= MXO_NEG && op <= MXO_NOT) {
+		foldable = 1;
+		for (i = 0; i < 3; i++) {
+			if (ins->arg[i] < 0) continue;
+			args[i] = &(mapexpr->code[ins->arg[i]]);
+			if (args[i]->op != MXO_CONST) foldable = 0;
+		}
+	}
+
+	if (foldable) {
+		double one = 1;
+		double value = 0;
+		uint8_t isnull = 0;
+
+		if (rt_mapexpr_exec(ins, 1, &one,
+			&(args[0]->value), &(args[0]->isnull),
+			args[1] ? &(args[1]->value) : NULL, args[1] ? &(args[1]->isnull) : NULL,
+			NULL, NULL, &value, &isnull) != NULL) {
+			RASTER_DEBUG(3, "Constant part of the expression fails");
+			return -1;
+		}
+
+		memset(ins, 0, sizeof(struct rt_mapexpr_instr));
+		ins->op = MXO_CONST;
+		ins->type = type;
+		ins->mask = mask;
+		ins->arg[0] = ins->arg[1] = ins->arg[2] = -1;
+		ins->value = value;
+		ins->isnull = isnull;
+	}
+
+	return mapexpr->ncode++;
+}
+
+static int
+rt_mapexpr_const(rt_mapexpr_parser *parser, int type, int mask, double value, int isnull) {
+	int reg = rt_mapexpr_emit(parser, MXO_CONST, type, type, mask, -1, -1, -1);
+	if (reg < 0) return -1;
+	parser->mapexpr->code[reg].value = value;
+	parser->mapexpr->code[reg].isnull = isnull;
+	return reg;
+}
+
+static int
+rt_mapexpr_type_of(rt_mapexpr_parser *parser, int reg) {
+	return parser->mapexpr->code[reg].type;
+}
+
+static int
+rt_mapexpr_isnum(int type) {
+	return type == MXT_INT4 || type == MXT_FLOAT8 || type == MXT_NUMERIC;
+}
+
+/*
+ * Type both numeric arguments of an operator or function resolve to, as
+ * with PostgreSQL's implicit casts. Operations on numeric are not
+ * handled, but numeric constants are cast to float8 like in SQL.
+ */
+static int
+rt_mapexpr_common_type(int ta, int tb) {
+	if (ta == MXT_UNKNOWN) ta = tb;
+	if (tb == MXT_UNKNOWN) tb = ta;
+	if (!rt_mapexpr_isnum(ta) || !rt_mapexpr_isnum(tb))
+		return -1;
+	if (ta == MXT_FLOAT8 || tb == MXT_FLOAT8)
+		return MXT_FLOAT8;
+	if (ta == MXT_NUMERIC || tb == MXT_NUMERIC)
+		return -1;
+	return MXT_INT4;
+}
+
+static struct rt_mapexpr_tok *
+rt_mapexpr_peek(rt_mapexpr_parser *parser) {
+	return &(parser->toks[parser->pos]);
+}
+
+/* Is the token the operator or keyword str, keywords being case insensitive */
+static int
+rt_mapexpr_tok_is(struct rt_mapexpr_tok *tok, int kind, const char *str) {
+	int i;
+
+	if (tok->kind != kind)
+		return 0;
+	if (str == NULL)
+		return 1;
+	if ((int) strlen(str) != tok->len)
+		return 0;
+
+	for (i = 0; i < tok->len; i++) {
+		if (tolower((unsigned char) tok->str[i]) != str[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+rt_mapexpr_is(rt_mapexpr_parser *parser, int kind, const char *str) {
+	return rt_mapexpr_tok_is(rt_mapexpr_peek(parser), kind, str);
+}
+
+static int
+rt_mapexpr_accept(rt_mapexpr_parser *parser, int kind, const char *str) {
+	if (!rt_mapexpr_is(parser, kind, str))
+		return 0;
+	parser->pos++;
+	return 1;
+}
+
+static int rt_mapexpr_parse_or(rt_mapexpr_parser *parser, int mask);
+static int rt_mapexpr_parse_add(rt_mapexpr_parser *parser, int mask);
+static int rt_mapexpr_parse_unary(rt_mapexpr_parser *parser, int mask);
+
+static int
+rt_mapexpr_parse_case(rt_mapexpr_parser *parser, int mask) {
+	int when[RT_MAPEXPR_MAXWHEN];
+	int then[RT_MAPEXPR_MAXWHEN];
+	int nwhen = 0;
+	int rest = mask;
+	int cond;
+	int type = MXT_UNKNOWN;
+	int t;
+	int reg;
+	int i;
+
+	/* simple CASE is not handled */
+	if (!rt_mapexpr_is(parser, MXK_IDENT, "when"))
+		return -1;
+
+	while (rt_mapexpr_accept(parser, MXK_IDENT, "when")) {
+		if (nwhen == RT_MAPEXPR_MAXWHEN)
+			return -1;
+
+		if ((cond = rt_mapexpr_parse_or(parser, rest)) < 0)
+			return -1;
+		t = rt_mapexpr_type_of(parser, cond);
+		if (t != MXT_BOOL && t != MXT_UNKNOWN)
+			return -1;
+
+		if ((when[nwhen] = rt_mapexpr_emit(parser, MXO_WHEN, MXT_BOOL, MXT_BOOL, rest, cond, -1, -1)) < 0)
+			return -1;
+
+		if (!rt_mapexpr_accept(parser, MXK_IDENT, "then"))
+			return -1;
+		if ((then[nwhen] = rt_mapexpr_parse_or(parser, when[nwhen])) < 0)
+			return -1;
+
+		if ((rest = rt_mapexpr_emit(parser, MXO_UNLESS, MXT_BOOL, MXT_BOOL, rest, cond, -1, -1)) < 0)
+			return -1;
+		nwhen++;
+	}
+
+	if (rt_mapexpr_accept(parser, MXK_IDENT, "else"))
+		reg = rt_mapexpr_parse_or(parser, rest);
+	else
+		reg = rt_mapexpr_const(parser, MXT_UNKNOWN, rest, 0, 1);
+	if (reg < 0 || !rt_mapexpr_accept(parser, MXK_IDENT, "end"))
+		return -1;
+
+	/* resolve the type of the results as PostgreSQL does for CASE */
+	for (i = 0; i <= nwhen; i++) {
+		t = rt_mapexpr_type_of(parser, (i < nwhen) ? then[i] : reg);
+		if (t == MXT_UNKNOWN)
+			continue;
+		if (type == MXT_UNKNOWN || type == t)
+			type = t;
+		else if (rt_mapexpr_isnum(type) && rt_mapexpr_isnum(t)) {
+			if (type == MXT_FLOAT8 || t == MXT_FLOAT8)
+				type = MXT_FLOAT8;
+			else
+				type = MXT_NUMERIC;
+		}
+		else
+			return -1;
+	}
+
+	for (i = nwhen - 1; i >= 0; i--) {
+		if ((reg = rt_mapexpr_emit(parser, MXO_SELECT, type, type, mask, when[i], then[i], reg)) < 0)
+			return -1;
+	}
+
+	return reg;
+}
+
+/* GREATEST and LEAST, which skip NULL arguments */
+static int
+rt_mapexpr_minmax(rt_mapexpr_parser *parser, int op, int mask, int *args, int nargs) {
+	int type;
+	int reg;
+	int i;
+
+	type = rt_mapexpr_type_of(parser, args[0]);
+	for (i = 1; i < nargs; i++)
+		type = rt_mapexpr_common_type(type, rt_mapexpr_type_of(parser, args[i]));
+	if (type != MXT_INT4 && type != MXT_FLOAT8)
+		return -1;
+
+	reg = args[0];
+	for (i = 1; i < nargs && reg >= 0; i++)
+		reg = rt_mapexpr_emit(parser, op, type, type, mask, reg, args[i], -1);
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_func(rt_mapexpr_parser *parser, int mask) {
+	struct {
+		const char *name;
+		int op;
+		int nargs;
+		int intop; /* has an int4 variant */
+	} funcs[] = {
+		{"abs", MXO_ABS, 1, 1},
+		{"ceil", MXO_CEIL, 1, 0},
+		{"ceiling", MXO_CEIL, 1, 0},
+		{"exp", MXO_EXP, 1, 0},
+		{"floor", MXO_FLOOR, 1, 0},
+		{"greatest", MXO_GREATEST, -1, 1},
+		{"least", MXO_LEAST, -1, 1},
+		{"ln", MXO_LN, 1, 0},
+		{"log", MXO_LOG, 1, 0},
+		{"mod", MXO_MOD, 2, 1},
+		{"pi", MXO_CONST, 0, 0},
+		{"pow", MXO_POW, 2, 0},
+		{"power", MXO_POW, 2, 0},
+		{"round", MXO_ROUND, 1, 0},
+		{"sqrt", MXO_SQRT, 1, 0}
+	};
+	int nfuncs = sizeof(funcs) / sizeof(funcs[0]);
+	int args[RT_MAPEXPR_MAXARGS];
+	int nargs = 0;
+	int type;
+	int f;
+	int i;
+
+	for (f = 0; f < nfuncs; f++) {
+		if (rt_mapexpr_is(parser, MXK_IDENT, funcs[f].name))
+			break;
+	}
+	if (f == nfuncs)
+		return -1;
+	parser->pos++;
+
+	if (!rt_mapexpr_accept(parser, MXK_LPAREN, NULL))
+		return -1;
+	if (!rt_mapexpr_is(parser, MXK_RPAREN, NULL)) {
+		do {
+			if (nargs == RT_MAPEXPR_MAXARGS)
+				return -1;
+			if ((args[nargs] = rt_mapexpr_parse_or(parser, mask)) < 0)
+				return -1;
+			nargs++;
+		}
+		while (rt_mapexpr_accept(parser, MXK_COMMA, NULL));
+	}
+	if (!rt_mapexpr_accept(parser, MXK_RPAREN, NULL))
+		return -1;
+	/* variadic functions take at least one argument */
+	if (funcs[f].nargs < 0 ? nargs < 1 : nargs != funcs[f].nargs)
+		return -1;
+
+	if (funcs[f].op == MXO_CONST)
+		return rt_mapexpr_const(parser, MXT_FLOAT8, mask, M_PI, 0);
+	if (funcs[f].op == MXO_GREATEST || funcs[f].op == MXO_LEAST)
+		return rt_mapexpr_minmax(parser, funcs[f].op, mask, args, nargs);
+
+	/* arguments of unknown type would make the choice of function ambiguous */
+	for (i = 0; i < nargs; i++) {
+		if (!rt_mapexpr_isnum(rt_mapexpr_type_of(parser, args[i])))
+			return -1;
+	}
+	type = rt_mapexpr_type_of(parser, args[0]);
+	if (nargs == 2)
+		type = rt_mapexpr_common_type(type, rt_mapexpr_type_of(parser, args[1]));
+	if (type != MXT_INT4 && type != MXT_FLOAT8)
+		return -1;
+
+	/* mod only exists for integers, the others prefer float8 */
+	if (funcs[f].op == MXO_MOD && type != MXT_INT4)
+		return -1;
+	if (!funcs[f].intop)
+		type = MXT_FLOAT8;
+
+	return rt_mapexpr_emit(parser, funcs[f].op, type, type, mask,
+		args[0], nargs == 2 ? args[1] : -1, -1);
+}
+
+static int
+rt_mapexpr_parse_primary(rt_mapexpr_parser *parser, int mask) {
+	struct rt_mapexpr_tok *tok = rt_mapexpr_peek(parser);
+	int reg;
+	int i;
+
+	switch (tok->kind) {
+		case MXK_NUM: {
+			char num[64];
+			int isint = 1;
+			double value;
+
+			if (tok->len >= (int) sizeof(num))
+				return -1;
+			memcpy(num, tok->str, tok->len);
+			num[tok->len] = '\0';
+			parser->pos++;
+
+			for (i = 0; i < tok->len; i++) {
+				if (num[i] < '0' || num[i] > '9')
+					isint = 0;
+			}
+			errno = 0;
+			value = strtod(num, NULL);
+
+			/* out of the float8 range, leave the error (or numeric) to the server */
+			if (errno == ERANGE)
+				return -1;
+
+			/* larger integers are int8 constants */
+			if (isint && value > INT32_MAX)
+				return -1;
+
+			return rt_mapexpr_const(parser, isint ? MXT_INT4 : MXT_NUMERIC, mask, value, 0);
+		}
+		case MXK_VAR:
+			for (i = 0; i < parser->nvars; i++) {
+				if ((int) strlen(parser->varnames[i]) == tok->len && strncmp(parser->varnames[i], tok->str, tok->len) == 0)
+					break;
+			}
+			if (i == parser->nvars)
+				return -1;
+			parser->pos++;
+
+			/* a variable without values is a NULL float8 */
+			if (parser->vartypes[i] == PT_END)
+				return rt_mapexpr_const(parser, MXT_FLOAT8, mask, 0, 1);
+
+			reg = rt_mapexpr_emit(parser, MXO_VAR, (parser->vartypes[i] == PT_32BSI) ? MXT_INT4 : MXT_FLOAT8, MXT_FLOAT8, mask, -1, -1, -1);
+			if (reg < 0) return -1;
+			parser->mapexpr->code[reg].var = i;
+			return reg;
+		case MXK_LPAREN:
+			parser->pos++;
+			reg = rt_mapexpr_parse_or(parser, mask);
+			if (reg < 0 || !rt_mapexpr_accept(parser, MXK_RPAREN, NULL))
+				return -1;
+			return reg;
+		case MXK_IDENT:
+			if (rt_mapexpr_accept(parser, MXK_IDENT, "case"))
+				return rt_mapexpr_parse_case(parser, mask);
+			if (rt_mapexpr_accept(parser, MXK_IDENT, "true"))
+				return rt_mapexpr_const(parser, MXT_BOOL, mask, 1, 0);
+			if (rt_mapexpr_accept(parser, MXK_IDENT, "false"))
+				return rt_mapexpr_const(parser, MXT_BOOL, mask, 0, 0);
+			if (rt_mapexpr_accept(parser, MXK_IDENT, "null"))
+				return rt_mapexpr_const(parser, MXT_UNKNOWN, mask, 0, 1);
+			return rt_mapexpr_parse_func(parser, mask);
+		default:
+			return -1;
+	}
+}
+
+static int
+rt_mapexpr_parse_cast(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_primary(parser, mask);
+	int type;
+	int totype;
+
+	while (reg >= 0 && rt_mapexpr_accept(parser, MXK_CAST, NULL)) {
+		if (
+			rt_mapexpr_accept(parser, MXK_IDENT, "int") ||
+			rt_mapexpr_accept(parser, MXK_IDENT, "integer") ||
+			rt_mapexpr_accept(parser, MXK_IDENT, "int4")
+		) {
+			totype = MXT_INT4;
+		}
+		else if (
+			rt_mapexpr_accept(parser, MXK_IDENT, "float8") || (
+				rt_mapexpr_accept(parser, MXK_IDENT, "double") &&
+				rt_mapexpr_accept(parser, MXK_IDENT, "precision")
+			)
+		) {
+			totype = MXT_FLOAT8;
+		}
+		else
+			return -1;
+
+		type = rt_mapexpr_type_of(parser, reg);
+		if (type == MXT_UNKNOWN || type == totype)
+			parser->mapexpr->code[reg].type = totype;
+		/* numeric to float8 goes through the same strtod() */
+		else if (type == MXT_NUMERIC && totype == MXT_FLOAT8)
+			parser->mapexpr->code[reg].type = totype;
+		else if (type == MXT_INT4 && totype == MXT_FLOAT8)
+			parser->mapexpr->code[reg].type = totype;
+		else if (type == MXT_FLOAT8 && totype == MXT_INT4)
+			reg = rt_mapexpr_emit(parser, MXO_TOINT, MXT_INT4, MXT_FLOAT8, mask, reg, -1, -1);
+		else
+			return -1;
+	}
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_unary(rt_mapexpr_parser *parser, int mask) {
+	int reg;
+	int type;
+
+	if (rt_mapexpr_accept(parser, MXK_OP, "-")) {
+		if ((reg = rt_mapexpr_parse_unary(parser, mask)) < 0)
+			return -1;
+		type = rt_mapexpr_type_of(parser, reg);
+
+		/* negative numeric constants stay numeric */
+		if (type == MXT_NUMERIC && parser->mapexpr->code[reg].op == MXO_CONST) {
+			parser->mapexpr->code[reg].value = -parser->mapexpr->code[reg].value;
+			return reg;
+		}
+		if (type != MXT_INT4 && type != MXT_FLOAT8)
+			return -1;
+		return rt_mapexpr_emit(parser, MXO_NEG, type, type, mask, reg, -1, -1);
+	}
+	else if (rt_mapexpr_accept(parser, MXK_OP, "+")) {
+		if ((reg = rt_mapexpr_parse_unary(parser, mask)) < 0)
+			return -1;
+		if (!rt_mapexpr_isnum(rt_mapexpr_type_of(parser, reg)))
+			return -1;
+		return reg;
+	}
+
+	return rt_mapexpr_parse_cast(parser, mask);
+}
+
+/* Binary arithmetic operator, resolving the types of its arguments */
+static int
+rt_mapexpr_arith(rt_mapexpr_parser *parser, int op, int mask, int a, int b) {
+	int ta = rt_mapexpr_type_of(parser, a);
+	int tb = rt_mapexpr_type_of(parser, b);
+	int type;
+
+	if (ta == MXT_UNKNOWN && tb == MXT_UNKNOWN)
+		return -1;
+	if ((type = rt_mapexpr_common_type(ta, tb)) < 0)
+		return -1;
+
+	/* ^ is only float8 for non-numeric arguments, % only int4 */
+	if (op == MXO_POW)
+		type = MXT_FLOAT8;
+	else if (op == MXO_MOD && type != MXT_INT4)
+		return -1;
+
+	return rt_mapexpr_emit(parser, op, type, type, mask, a, b, -1);
+}
+
+static int
+rt_mapexpr_parse_pow(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_unary(parser, mask);
+	int right;
+
+	while (reg >= 0 && rt_mapexpr_accept(parser, MXK_OP, "^")) {
+		if ((right = rt_mapexpr_parse_unary(parser, mask)) < 0)
+			return -1;
+		reg = rt_mapexpr_arith(parser, MXO_POW, mask, reg, right);
+	}
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_mul(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_pow(parser, mask);
+	int right;
+	int op;
+
+	while (reg >= 0) {
+		if (rt_mapexpr_accept(parser, MXK_OP, "*"))
+			op = MXO_MUL;
+		else if (rt_mapexpr_accept(parser, MXK_OP, "/"))
+			op = MXO_DIV;
+		else if (rt_mapexpr_accept(parser, MXK_OP, "%"))
+			op = MXO_MOD;
+		else
+			break;
+
+		if ((right = rt_mapexpr_parse_pow(parser, mask)) < 0)
+			return -1;
+		reg = rt_mapexpr_arith(parser, op, mask, reg, right);
+	}
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_add(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_mul(parser, mask);
+	int right;
+	int op;
+
+	while (reg >= 0) {
+		if (rt_mapexpr_accept(parser, MXK_OP, "+"))
+			op = MXO_ADD;
+		else if (rt_mapexpr_accept(parser, MXK_OP, "-"))
+			op = MXO_SUB;
+		else
+			break;
+
+		if ((right = rt_mapexpr_parse_mul(parser, mask)) < 0)
+			return -1;
+		reg = rt_mapexpr_arith(parser, op, mask, reg, right);
+	}
+
+	return reg;
+}
+
+/* Comparison operator, int4 only when both arguments are */
+static int
+rt_mapexpr_compare(rt_mapexpr_parser *parser, int op, int mask, int a, int b) {
+	int ta = rt_mapexpr_type_of(parser, a);
+	int tb = rt_mapexpr_type_of(parser, b);
+	int type;
+
+	if (ta == MXT_UNKNOWN && tb == MXT_UNKNOWN)
+		return -1;
+	if ((type = rt_mapexpr_common_type(ta, tb)) < 0)
+		return -1;
+
+	return rt_mapexpr_emit(parser, op, MXT_BOOL, type, mask, a, b, -1);
+}
+
+static int
+rt_mapexpr_parse_cmp(rt_mapexpr_parser *parser, int mask) {
+	const char *ops[] = {"<", "<=", ">", ">=", "=", "<>", "!="};
+	const int opcodes[] = {MXO_LT, MXO_LE, MXO_GT, MXO_GE, MXO_EQ, MXO_NE, MXO_NE};
+	int reg = rt_mapexpr_parse_add(parser, mask);
+	int right;
+	int negate = 0;
+	int i;
+
+	if (reg < 0)
+		return -1;
+
+	/* a BETWEEN b AND c is a >= b AND a <= c, and NOT BETWEEN its opposite */
+	if (
+		rt_mapexpr_is(parser, MXK_IDENT, "not") &&
+		rt_mapexpr_tok_is(&(parser->toks[parser->pos + 1]), MXK_IDENT, "between")
+	) {
+		parser->pos++;
+		negate = 1;
+	}
+	if (rt_mapexpr_accept(parser, MXK_IDENT, "between")) {
+		int lower;
+		int upper;
+		int second;
+
+		if (
+			rt_mapexpr_is(parser, MXK_IDENT, "symmetric") ||
+			rt_mapexpr_is(parser, MXK_IDENT, "asymmetric")
+		) {
+			return -1;
+		}
+
+		if ((right = rt_mapexpr_parse_add(parser, mask)) < 0)
+			return -1;
+		if ((lower = rt_mapexpr_compare(parser, negate ? MXO_LT : MXO_GE, mask, reg, right)) < 0)
+			return -1;
+
+		if (!rt_mapexpr_accept(parser, MXK_IDENT, "and"))
+			return -1;
+		if ((second = rt_mapexpr_emit(parser, negate ? MXO_NOTTRUE : MXO_NOTFALSE, MXT_BOOL, MXT_BOOL, mask, lower, -1, -1)) < 0)
+			return -1;
+		if ((right = rt_mapexpr_parse_add(parser, second)) < 0)
+			return -1;
+		if ((upper = rt_mapexpr_compare(parser, negate ? MXO_GT : MXO_LE, second, reg, right)) < 0)
+			return -1;
+
+		reg = rt_mapexpr_emit(parser, negate ? MXO_OR : MXO_AND, MXT_BOOL, MXT_BOOL, mask, lower, upper, -1);
+	}
+	else if (negate)
+		return -1;
+	else {
+		for (i = 0; i < 7; i++) {
+			if (rt_mapexpr_accept(parser, MXK_OP, ops[i]))
+				break;
+		}
+		if (i == 7)
+			return reg;
+
+		if ((right = rt_mapexpr_parse_add(parser, mask)) < 0)
+			return -1;
+		reg = rt_mapexpr_compare(parser, opcodes[i], mask, reg, right);
+	}
+
+	/*
+	 * Chained comparisons parse differently across PostgreSQL versions,
+	 * leave them to the server
+	 */
+	if (rt_mapexpr_is(parser, MXK_OP, NULL) || rt_mapexpr_is(parser, MXK_IDENT, "between"))
+		return -1;
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_not(rt_mapexpr_parser *parser, int mask) {
+	int reg;
+	int type;
+
+	if (
+		rt_mapexpr_is(parser, MXK_IDENT, "not") &&
+		!rt_mapexpr_tok_is(&(parser->toks[parser->pos + 1]), MXK_IDENT, "between")
+	) {
+		parser->pos++;
+		if ((reg = rt_mapexpr_parse_not(parser, mask)) < 0)
+			return -1;
+		type = rt_mapexpr_type_of(parser, reg);
+		if (type != MXT_BOOL && type != MXT_UNKNOWN)
+			return -1;
+		return rt_mapexpr_emit(parser, MXO_NOT, MXT_BOOL, MXT_BOOL, mask, reg, -1, -1);
+	}
+
+	return rt_mapexpr_parse_cmp(parser, mask);
+}
+
+static int
+rt_mapexpr_parse_and(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_not(parser, mask);
+	int second;
+	int right;
+
+	while (reg >= 0 && rt_mapexpr_accept(parser, MXK_IDENT, "and")) {
+		if ((second = rt_mapexpr_emit(parser, MXO_NOTFALSE, MXT_BOOL, MXT_BOOL, mask, reg, -1, -1)) < 0)
+			return -1;
+		if ((right = rt_mapexpr_parse_not(parser, second)) < 0)
+			return -1;
+		if (
+			(rt_mapexpr_type_of(parser, reg) != MXT_BOOL && rt_mapexpr_type_of(parser, reg) != MXT_UNKNOWN) ||
+			(rt_mapexpr_type_of(parser, right) != MXT_BOOL && rt_mapexpr_type_of(parser, right) != MXT_UNKNOWN)
+		) {
+			return -1;
+		}
+		reg = rt_mapexpr_emit(parser, MXO_AND, MXT_BOOL, MXT_BOOL, mask, reg, right, -1);
+	}
+
+	return reg;
+}
+
+static int
+rt_mapexpr_parse_or(rt_mapexpr_parser *parser, int mask) {
+	int reg = rt_mapexpr_parse_and(parser, mask);
+	int second;
+	int right;
+
+	while (reg >= 0 && rt_mapexpr_accept(parser, MXK_IDENT, "or")) {
+		if ((second = rt_mapexpr_emit(parser, MXO_NOTTRUE, MXT_BOOL, MXT_BOOL, mask, reg, -1, -1)) < 0)
+			return -1;
+		if ((right = rt_mapexpr_parse_and(parser, second)) < 0)
+			return -1;
+		if (
+			(rt_mapexpr_type_of(parser, reg) != MXT_BOOL && rt_mapexpr_type_of(parser, reg) != MXT_UNKNOWN) ||
+			(rt_mapexpr_type_of(parser, right) != MXT_BOOL && rt_mapexpr_type_of(parser, right) != MXT_UNKNOWN)
+		) {
+			return -1;
+		}
+		reg = rt_mapexpr_emit(parser, MXO_OR, MXT_BOOL, MXT_BOOL, mask, reg, right, -1);
+	}
+
+	return reg;
+}
+
+/*
+ * Split the expression into tokens the way PostgreSQL's lexer does.
+ * Returns 0 on anything the evaluator does not handle, such as string
+ * literals, quoted identifiers and comments.
+ */
+static int
+rt_mapexpr_tokenize(const char *expr, struct rt_mapexpr_tok *toks) {
+	const char *opchars = "~!@#^&|`?+-*/%<>=";
+	const char *p = expr;
+	int ntok = 0;
+	int len;
+	int i;
+
+	while (1) {
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f')
+			p++;
+
+		toks[ntok].str = p;
+		len = 1;
+
+		if (*p == '\0') {
+			toks[ntok].kind = MXK_END;
+			toks[ntok].len = 0;
+			return 1;
+		}
+		else if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1]))) {
+			len = 0;
+			while (isdigit((unsigned char) p[len])) len++;
+			if (p[len] == '.') {
+				len++;
+				while (isdigit((unsigned char) p[len])) len++;
+			}
+			if (p[len] == 'e' || p[len] == 'E') {
+				len++;
+				if (p[len] == '+' || p[len] == '-') len++;
+				if (!isdigit((unsigned char) p[len]))
+					return 0;
+				while (isdigit((unsigned char) p[len])) len++;
+			}
+			toks[ntok].kind = MXK_NUM;
+		}
+		else if (*p == '[') {
+			while (p[len] != '\0' && p[len] != ']') len++;
+			if (p[len] != ']')
+				return 0;
+			len++;
+			toks[ntok].kind = MXK_VAR;
+		}
+		else if (isalpha((unsigned char) *p) || *p == '_') {
+			while (isalnum((unsigned char) p[len]) || p[len] == '_' || p[len] == '$') len++;
+			toks[ntok].kind = MXK_IDENT;
+		}
+		else if (*p == '(')
+			toks[ntok].kind = MXK_LPAREN;
+		else if (*p == ')')
+			toks[ntok].kind = MXK_RPAREN;
+		else if (*p == ',')
+			toks[ntok].kind = MXK_COMMA;
+		else if (*p == ':' && p[1] == ':') {
+			len = 2;
+			toks[ntok].kind = MXK_CAST;
+		}
+		else if (strchr(opchars, *p) != NULL) {
+			len = 0;
+			while (p[len] != '\0' && strchr(opchars, p[len]) != NULL) {
+				/* comments start inside operators */
+				if ((p[len] == '-' && p[len + 1] == '-') || (p[len] == '/' && p[len + 1] == '*'))
+					return 0;
+				len++;
+			}
+
+			/* a multi-character operator can only end in + or - if it has one of ~!@#^&|`?% */
+			if (len > 1 && (p[len - 1] == '+' || p[len - 1] == '-')) {
+				for (i = 0; i < len - 1; i++) {
+					if (strchr("~!@#^&|`?%", p[i]) != NULL)
+						break;
+				}
+				if (i == len - 1) {
+					while (len > 1 && (p[len - 1] == '+' || p[len - 1] == '-'))
+						len--;
+				}
+			}
+			toks[ntok].kind = MXK_OP;
+		}
+		else
+			return 0;
+
+		toks[ntok].len = len;
+		p += len;
+		ntok++;
+	}
+}
+
+/**
+ * Compile a map algebra expression, written in SQL, into a program that
+ * evaluates it for many pixels at once. Only arithmetic, comparisons,
+ * boolean operators, CASE, BETWEEN, a few math functions and casts to
+ * int4 and float8 are handled, with the semantics PostgreSQL gives them.
+ *
+ * @param expr : the expression, as given to ST_MapAlgebraExpr
+ * @param nvars : number of variables
+ * @param varnames : names of the variables, like "[rast]"
+ * @param vartypes : type of each variable, PT_32BSI for int4 values,
+ *   PT_64BF for float8 values and PT_END for a float8 variable that is
+ *   always NULL
+ *
+ * @return the compiled expression, or NULL if the expression uses
+ *   anything else, and must be evaluated by PostgreSQL
+ */
+rt_mapexpr
+rt_mapexpr_compile(const char *expr, int nvars, const char **varnames,
+	const rt_pixtype *vartypes
+) {
+	rt_mapexpr_parser parser;
+	rt_mapexpr mapexpr = NULL;
+	struct rt_mapexpr_instr *ins = NULL;
+	int type;
+	int reg;
+	int i;
+	int j;
+
+	assert(NULL != expr);
+
+	mapexpr = rtalloc(sizeof(struct rt_mapexpr_t));
+	if (mapexpr == NULL) {
+		rterror("rt_mapexpr_compile: Could not allocate memory for expression");
+		return NULL;
+	}
+	memset(mapexpr, 0, sizeof(struct rt_mapexpr_t));
+	mapexpr->nvars = nvars;
+
+	mapexpr->maxcode = 16;
+	mapexpr->code = rtalloc(sizeof(struct rt_mapexpr_instr) * mapexpr->maxcode);
+	parser.toks = rtalloc(sizeof(struct rt_mapexpr_tok) * (strlen(expr) + 1));
+	if (mapexpr->code == NULL || parser.toks == NULL) {
+		rterror("rt_mapexpr_compile: Could not allocate memory for expression");
+		if (parser.toks != NULL) rtdealloc(parser.toks);
+		rt_mapexpr_destroy(mapexpr);
+		return NULL;
+	}
+
+	parser.mapexpr = mapexpr;
+	parser.pos = 0;
+	parser.nvars = nvars;
+	parser.varnames = varnames;
+	parser.vartypes = vartypes;
+
+	reg = -1;
+	if (rt_mapexpr_tokenize(expr, parser.toks)) {
+		if (rt_mapexpr_emit(&parser, MXO_ROOT, MXT_BOOL, MXT_BOOL, -1, -1, -1, -1) == 0)
+			reg = rt_mapexpr_parse_or(&parser, 0);
+		if (reg >= 0 && !rt_mapexpr_is(&parser, MXK_END, NULL))
+			reg = -1;
+	}
+	rtdealloc(parser.toks);
+
+	/* the result is cast to float8 */
+	if (reg >= 0) {
+		type = rt_mapexpr_type_of(&parser, reg);
+		if (!rt_mapexpr_isnum(type))
+			reg = -1;
+	}
+	if (reg < 0) {
+		RASTER_DEBUGF(3, "Expression is left to PostgreSQL: %s", expr);
+		rt_mapexpr_destroy(mapexpr);
+		return NULL;
+	}
+
+	/* registers, with the constants set once and for all */
+	mapexpr->values = rtalloc(sizeof(double) * RT_MAPEXPR_BLOCK * mapexpr->ncode);
+	mapexpr->isnull = rtalloc(sizeof(uint8_t) * RT_MAPEXPR_BLOCK * mapexpr->ncode);
+	if (mapexpr->values == NULL || mapexpr->isnull == NULL) {
+		rterror("rt_mapexpr_compile: Could not allocate memory for registers");
+		rt_mapexpr_destroy(mapexpr);
+		return NULL;
+	}
+	memset(mapexpr->isnull, 0, sizeof(uint8_t) * RT_MAPEXPR_BLOCK * mapexpr->ncode);
+
+	for (i = 0; i < mapexpr->ncode; i++) {
+		ins = &(mapexpr->code[i]);
+		if (ins->op != MXO_CONST) continue;
+
+		for (j = 0; j < RT_MAPEXPR_BLOCK; j++) {
+			mapexpr->values[i * RT_MAPEXPR_BLOCK + j] = ins->value;
+			mapexpr->isnull[i * RT_MAPEXPR_BLOCK + j] = ins->isnull;
+		}
+	}
+
+	RASTER_DEBUGF(3, "Expression compiled into %d instructions", mapexpr->ncode);
+
+	return mapexpr;
+}
+
+/**
+ * Evaluate a compiled expression for count pixels.
+ *
+ * @param mapexpr : the compiled expression
+ * @param count : number of pixels
+ * @param vars : for each variable of the expression, the array of its
+ *   count values
+ * @param mask : if not NULL, only pixels whose mask is non-zero are
+ *   evaluated, and the values of the others are undefined
+ * @param values : set to the count values of the expression
+ * @param isnull : set to non-zero where the expression is NULL
+ *
+ * @return 1 on success, 0 if the expression failed for a pixel, like
+ *   PostgreSQL would on division by zero
+ */
+int
+rt_mapexpr_eval(rt_mapexpr mapexpr, int count, double **vars,
+	const uint8_t *mask, double *values, uint8_t *isnull
+) {
+	struct rt_mapexpr_instr *ins = NULL;
+	double *regval[3];
+	uint8_t *regnull[3];
+	double *d;
+	uint8_t *nd;
+	const char *err;
+	int offset;
+	int n;
+	int i;
+	int j;
+	int k;
+
+	assert(NULL != mapexpr);
+
+	for (offset = 0; offset < count; offset += RT_MAPEXPR_BLOCK) {
+		n = count - offset;
+		if (n > RT_MAPEXPR_BLOCK) n = RT_MAPEXPR_BLOCK;
+
+		for (k = 0; k < mapexpr->ncode; k++) {
+			ins = &(mapexpr->code[k]);
+			d = mapexpr->values + k * RT_MAPEXPR_BLOCK;
+			nd = mapexpr->isnull + k * RT_MAPEXPR_BLOCK;
+
+			switch (ins->op) {
+				case MXO_ROOT:
+					for (i = 0; i < n; i++)
+						d[i] = (mask == NULL || mask[offset + i]);
+					break;
+				case MXO_CONST:
+					break;
+				case MXO_VAR:
+					memcpy(d, vars[ins->var] + offset, sizeof(double) * n);
+					break;
+				default:
+					for (j = 0; j < 3; j++) {
+						if (ins->arg[j] < 0) {
+							regval[j] = NULL;
+							regnull[j] = NULL;
+							continue;
+						}
+						regval[j] = mapexpr->values + ins->arg[j] * RT_MAPEXPR_BLOCK;
+						regnull[j] = mapexpr->isnull + ins->arg[j] * RT_MAPEXPR_BLOCK;
+					}
+
+					err = rt_mapexpr_exec(ins, n,
+						mapexpr->values + ins->mask * RT_MAPEXPR_BLOCK,
+						regval[0], regnull[0], regval[1], regnull[1], regval[2], regnull[2],
+						d, nd
+					);
+					if (err != NULL) {
+						rterror("%s", err);
+						return 0;
+					}
+					break;
+			}
+		}
+
+		k = mapexpr->ncode - 1;
+		memcpy(values + offset, mapexpr->values + k * RT_MAPEXPR_BLOCK, sizeof(double) * n);
+		memcpy(isnull + offset, mapexpr->isnull + k * RT_MAPEXPR_BLOCK, sizeof(uint8_t) * n);
+	}
+
+	return 1;
+}
+
+/**
+ * Release memory associated to a compiled expression
+ *
+ * @param mapexpr : the compiled expression
+ */
+void
+rt_mapexpr_destroy(rt_mapexpr mapexpr) {
+	if (mapexpr == NULL) return;
+
+	if (mapexpr->code != NULL) rtdealloc(mapexpr->code);
+	if (mapexpr->values != NULL) rtdealloc(mapexpr->values);
+	if (mapexpr->isnull != NULL) rtdealloc(mapexpr->isnull);
+	rtdealloc(mapexpr);
+}
+
+/**
+ * Burn into a band the result of map algebra on two aligned bands,
+ * as ST_MapAlgebraExpr does for two rasters.  A row of the output band
+ * is computed at a time, from rows of the two bands read as doubles.
+ *
+ * The variables of the expressions are, in order, [rast1.x], [rast1.y],
+ * [rast1.val], [rast1], [rast2.x], [rast2.y], [rast2.val] and [rast2],
+ * where x and y are the 1-based column and row of the pixel in the band.
+ *
+ * @param band : the output band, whose pixels are only set where the
+ *   result is not NULL
+ * @param band1 : the first band, or NULL if it has no pixel
+ * @param band2 : the second band, or NULL if it has no pixel
+ * @param offset : the columns and rows of the output band where band1
+ *   and band2 start, as set by rt_raster_from_two_rasters
+ * @param exprs : the expressions for pixels where both bands have a
+ *   value, only band2 has one and only band1 has one.  The values of
+ *   the band without a pixel are NULL, so those expressions should be
+ *   compiled with its variables as PT_END.  An expression may be NULL,
+ *   for a NULL result.
+ * @param hasnodatanodataval : if non-zero, nodatanodataval is the
+ *   result where neither band has a pixel, otherwise it is NULL
+ * @param nodatanodataval : result where neither band has a pixel
+ *
+ * @return 1 on success, 0 on error
+ */
+int
+rt_band_mapalgebra2(
+	rt_band band,
+	rt_band band1, rt_band band2, double *offset,
+	rt_mapexpr *exprs,
+	int hasnodatanodataval, double nodatanodataval
+) {
+	rt_band bands[2];
+	int width = 0;
+	int height = 0;
+	int off[2][2];
+	int start[2];
+	int end[2];
+	double nodataval[2];
+	int hasnodata[2];
+	double *buf = NULL;
+	double *vars[8];
+	double *vals[2];
+	double *result[3];
+	uint8_t *mask = NULL;
+	uint8_t *has[2];
+	uint8_t *casemask[3];
+	uint8_t *isnull[3];
+	int c;
+	int i;
+	int x;
+	int y;
+
+	assert(NULL != band);
+	assert(NULL != offset);
+	assert(NULL != exprs);
+
+	bands[0] = band1;
+	bands[1] = band2;
+	width = rt_band_get_width(band);
+	height = rt_band_get_height(band);
+	if (width < 1 || height < 1)
+		return 1;
+
+	/* x, y and values of each band, then the results */
+	buf = rtalloc(sizeof(double) * width * 9);
+	mask = rtalloc(sizeof(uint8_t) * width * 8);
+	if (buf == NULL || mask == NULL) {
+		rterror("rt_band_mapalgebra2: Could not allocate memory for rows");
+		if (buf != NULL) rtdealloc(buf);
+		if (mask != NULL) rtdealloc(mask);
+		return 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		vars[i * 4] = buf + width * (i * 3);
+		vars[i * 4 + 1] = buf + width * (i * 3 + 1);
+		vars[i * 4 + 2] = vars[i * 4 + 3] = vals[i] = buf + width * (i * 3 + 2);
+		has[i] = mask + width * i;
+
+		off[i][0] = (int) offset[i * 2];
+		off[i][1] = (int) offset[i * 2 + 1];
+
+		for (x = 0; x < width; x++)
+			vars[i * 4][x] = x - off[i][0] + 1;
+
+		/* columns of the output band covered by the band */
+		start[i] = end[i] = 0;
+		hasnodata[i] = 0;
+		nodataval[i] = 0;
+		if (bands[i] != NULL) {
+			start[i] = off[i][0] > 0 ? off[i][0] : 0;
+			end[i] = off[i][0] + rt_band_get_width(bands[i]);
+			if (end[i] > width) end[i] = width;
+			if (end[i] < start[i]) end[i] = start[i];
+
+			hasnodata[i] = rt_band_get_hasnodata_flag(bands[i]);
+			if (hasnodata[i])
+				nodataval[i] = rt_band_get_nodata(bands[i]);
+		}
+	}
+	for (c = 0; c < 3; c++) {
+		result[c] = buf + width * (6 + c);
+		casemask[c] = mask + width * (2 + c);
+		isnull[c] = mask + width * (5 + c);
+	}
+
+	for (y = 0; y < height; y++) {
+		for (i = 0; i < 2; i++) {
+			int _y = y - off[i][1];
+
+			for (x = 0; x < width; x++)
+				vars[i * 4 + 1][x] = _y + 1;
+			memset(has[i], 0, sizeof(uint8_t) * width);
+
+			if (
+				bands[i] == NULL ||
+				start[i] == end[i] ||
+				_y < 0 || _y >= rt_band_get_height(bands[i])
+			) {
+				continue;
+			}
+
+			if (rt_band_get_pixel_line(bands[i], start[i] - off[i][0], _y, end[i] - start[i], vals[i] + start[i], NULL) != 0) {
+				rterror("rt_band_mapalgebra2: Unable to get pixels of the %s band", i < 1 ? "first" : "second");
+				rtdealloc(buf);
+				rtdealloc(mask);
+				return 0;
+			}
+
+			if (hasnodata[i]) {
+				for (x = start[i]; x < end[i]; x++)
+					has[i][x] = FLT_NEQ(nodataval[i], vals[i][x]);
+			}
+			else
+				memset(has[i] + start[i], 1, sizeof(uint8_t) * (end[i] - start[i]));
+		}
+
+		/* which expression each pixel is computed with */
+		for (x = 0; x < width; x++) {
+			casemask[0][x] = has[0][x] && has[1][x];
+			casemask[1][x] = !has[0][x] && has[1][x];
+			casemask[2][x] = has[0][x] && !has[1][x];
+		}
+
+		for (c = 0; c < 3; c++) {
+			if (exprs[c] == NULL) continue;
+			if (!rt_mapexpr_eval(exprs[c], width, vars, casemask[c], result[c], isnull[c])) {
+				rtdealloc(buf);
+				rtdealloc(mask);
+				return 0;
+			}
+		}
+
+		for (x = 0; x < width; x++) {
+			double pixel = 0;
+
+			for (c = 0; c < 3; c++) {
+				if (casemask[c][x]) break;
+			}
+
+			if (c == 3) {
+				if (!hasnodatanodataval) continue;
+				pixel = nodatanodataval;
+			}
+			else if (exprs[c] == NULL || isnull[c][x])
+				continue;
+			else
+				pixel = result[c][x];
+
+			if (rt_band_set_pixel(band, x, y, pixel) < 0) {
+				rterror("rt_band_mapalgebra2: Unable to set pixel value of output band");
+				rtdealloc(buf);
+				rtdealloc(mask);
+				return 0;
+			}
+		}
+	}
+
+	rtdealloc(buf);
+	rtdealloc(mask);
+
+	return 1;
+}
+
 /*- rt_raster --------------------------------------------------------*/
 
 rt_raster
@@ -138,8 +138,10 @@ typedef struct rt_bandstats_t* rt_bandstats;
 typedef struct rt_histogram_t* rt_histogram;
 typedef struct rt_quantile_t* rt_quantile;
 typedef struct rt_valuecount_t* rt_valuecount;
+typedef struct rt_sketch_t* rt_sketch;
 typedef struct rt_gdaldriver_t* rt_gdaldriver;
 typedef struct rt_reclassexpr_t* rt_reclassexpr;
+typedef struct rt_mapexpr_t* rt_mapexpr;
 
 /* envelope information */
 typedef struct {
@@ -536,6 +538,45 @@ int rt_band_get_pixel(
 	double *result
 );
 
+/**
+ * Get the values of multiple pixels of a row, without copying them.
+ * Unlike rt_band_get_pixel, the values are of the band's pixel type.
+ *
+ * @param band : the band to get values from
+ * @param x : X coordinate of the first pixel (0-based)
+ * @param y : Y coordinate (0-based)
+ * @param len : # of pixels, which must all be in row y
+ *
+ * @return pointer to the values in the band's data, or NULL on error
+ */
+void *rt_band_get_pixel_line_data(
+	rt_band band,
+	int x, int y,
+	uint16_t len
+);
+
+/**
+ * Get the values of multiple pixels of a row as doubles, converted in
+ * one pass, and optionally which of them are NODATA.
+ *
+ * @param band : the band to get values from
+ * @param x : X coordinate of the first pixel (0-based)
+ * @param y : Y coordinate (0-based)
+ * @param len : # of pixels, which must all be in row y
+ * @param vals : set to the len values
+ * @param nodata : if not NULL, set to 1 for the values that are the
+ *   band's NODATA value, or that value clamped to the pixel type, and
+ *   to 0 for the others
+ *
+ * @return 0 on success, -1 on error
+ */
+int rt_band_get_pixel_line(
+	rt_band band,
+	int x, int y,
+	uint16_t len,
+	double *vals, uint8_t *nodata
+);
+
 /**
  * Returns the minimal possible value for the band according to the pixel type.
  * @param band: the band to get info from
@@ -589,14 +630,21 @@ rt_band_corrected_clamped_value(rt_band band, double val, double *newval);
  * @param exclude_nodata_value: if non-zero, ignore nodata values
  * @param sample: percentage of pixels to sample
  * @param inc_vals: flag to include values in return struct
- * @param cK: number of pixels counted thus far in coverage
- * @param cM: M component of 1-pass stddev for coverage
- * @param cQ: Q component of 1-pass stddev for coverage
  *
  * @return the summary statistics for a band
  */
 rt_bandstats rt_band_get_summary_stats(rt_band band, int exclude_nodata_value,
-	double sample, int inc_vals, uint64_t *cK, double *cM, double *cQ);
+	double sample, int inc_vals);
+
+/**
+ * Merge the summary statistics of a set of pixels into those of
+ * another, such as those of two tiles of a coverage
+ *
+ * @param stats: the summary stats to merge into
+ * @param other: the summary stats to merge, computed with the same
+ *   sample percentage as stats. Its values are not merged.
+ */
+void rt_bandstats_merge(rt_bandstats stats, rt_bandstats other);
 	
 /**
  * Count the distribution of data
@@ -634,6 +682,81 @@ rt_histogram rt_band_get_histogram(rt_bandstats stats,
 rt_quantile rt_band_get_quantiles(rt_bandstats stats,
 	double *quantiles, int quantiles_count, uint32_t *rtn_count);
 
+/**
+ * Create an empty sketch of the distribution of a set of values,
+ * from which histograms and quantiles are computed as from the values
+ * themselves as long as it has no more than size distinct values. Past
+ * that, neighbouring values are merged into centroids, smaller toward
+ * the ends of the distribution, so that it keeps about size of them.
+ *
+ * @param size: # of centroids to keep, RT_SKETCH_SIZE if 0
+ *
+ * @return the sketch or NULL on error
+ */
+rt_sketch rt_sketch_new(uint32_t size);
+
+/**
+ * Free a sketch
+ *
+ * @param sketch: the sketch to free
+ */
+void rt_sketch_destroy(rt_sketch sketch);
+
+/**
+ * Add values to a sketch
+ *
+ * @param sketch: the sketch to add to
+ * @param values: the values to add, which are overwritten
+ * @param count: # of values
+ *
+ * @return 1 on success, 0 on error
+ */
+int rt_sketch_add(rt_sketch sketch, double *values, uint32_t count);
+
+/**
+ * Merge a sketch into another, such as those of two tiles of a coverage
+ *
+ * @param sketch: the sketch to merge into
+ * @param other: the sketch to merge
+ *
+ * @return 1 on success, 0 on error
+ */
+int rt_sketch_merge(rt_sketch sketch, rt_sketch other);
+
+/**
+ * Count the distribution of the values of a sketch, as
+ * rt_band_get_histogram does for those of a rt_bandstats
+ *
+ * @param sketch: the sketch of the values
+ * @param bin_count: the number of bins to group the data by
+ * @param bin_width: the width of each bin as an array
+ * @param bin_width_count: number of values in bin_width
+ * @param right: evaluate bins by (a,b] rather than default [a,b)
+ * @param min: user-defined minimum value of the histogram
+ * @param max: user-defined maximum value of the histogram
+ *   if min = max, min and max are not used
+ * @param rtn_count: set to the number of bins being returned
+ *
+ * @return the histogram of the values or NULL on error
+ */
+rt_histogram rt_sketch_get_histogram(rt_sketch sketch,
+	int bin_count, double *bin_width, int bin_width_count,
+	int right, double min, double max, uint32_t *rtn_count);
+
+/**
+ * Compute the default set of or requested quantiles of the values of
+ * a sketch, as rt_band_get_quantiles does for those of a rt_bandstats
+ *
+ * @param sketch: the sketch of the values
+ * @param quantiles: the quantiles to be computed
+ * @param quantiles_count: the number of quantiles to be computed
+ * @param rtn_count: set to the number of quantiles being returned
+ *
+ * @return the quantiles of the values or NULL on error
+ */
+rt_quantile rt_sketch_get_quantiles(rt_sketch sketch,
+	double *quantiles, int quantiles_count, uint32_t *rtn_count);
+
 struct quantile_llist;
 int quantile_llist_destroy(struct quantile_llist **list,
 	uint32_t list_count);
@@ -706,6 +829,82 @@ rt_band rt_band_reclass(rt_band srcband, rt_pixtype pixtype,
 	uint32_t hasnodata, double nodataval,
 	rt_reclassexpr *exprset, int exprcount);
 
+/*- rt_mapexpr -------------------------------------------------------*/
+
+/**
+ * Compile a map algebra expression, written in SQL, into a program that
+ * evaluates it for many pixels at once. Only arithmetic, comparisons,
+ * boolean operators, CASE, BETWEEN, a few math functions and casts to
+ * int4 and float8 are handled, with the semantics PostgreSQL gives them.
+ *
+ * @param expr : the expression, as given to ST_MapAlgebraExpr
+ * @param nvars : number of variables
+ * @param varnames : names of the variables, like "[rast]"
+ * @param vartypes : type of each variable, PT_32BSI for int4 values,
+ *   PT_64BF for float8 values and PT_END for a float8 variable that is
+ *   always NULL
+ *
+ * @return the compiled expression, or NULL if the expression uses
+ *   anything else, and must be evaluated by PostgreSQL
+ */
+rt_mapexpr rt_mapexpr_compile(const char *expr, int nvars,
+	const char **varnames, const rt_pixtype *vartypes);
+
+/**
+ * Evaluate a compiled expression for count pixels.
+ *
+ * @param mapexpr : the compiled expression
+ * @param count : number of pixels
+ * @param vars : for each variable of the expression, the array of its
+ *   count values
+ * @param mask : if not NULL, only pixels whose mask is non-zero are
+ *   evaluated, and the values of the others are undefined
+ * @param values : set to the count values of the expression
+ * @param isnull : set to non-zero where the expression is NULL
+ *
+ * @return 1 on success, 0 if the expression failed for a pixel, like
+ *   PostgreSQL would on division by zero
+ */
+int rt_mapexpr_eval(rt_mapexpr mapexpr, int count, double **vars,
+	const uint8_t *mask, double *values, uint8_t *isnull);
+
+/**
+ * Release memory associated to a compiled expression
+ *
+ * @param mapexpr : the compiled expression
+ */
+void rt_mapexpr_destroy(rt_mapexpr mapexpr);
+
+/**
+ * Burn into a band the result of map algebra on two aligned bands,
+ * as ST_MapAlgebraExpr does for two rasters.
+ *
+ * The variables of the expressions are, in order, [rast1.x], [rast1.y],
+ * [rast1.val], [rast1], [rast2.x], [rast2.y], [rast2.val] and [rast2],
+ * where x and y are the 1-based column and row of the pixel in the band.
+ *
+ * @param band : the output band, whose pixels are only set where the
+ *   result is not NULL
+ * @param band1 : the first band, or NULL if it has no pixel
+ * @param band2 : the second band, or NULL if it has no pixel
+ * @param offset : the columns and rows of the output band where band1
+ *   and band2 start, as set by rt_raster_from_two_rasters
+ * @param exprs : the expressions for pixels where both bands have a
+ *   value, only band2 has one and only band1 has one.  The values of
+ *   the band without a pixel are NULL, so those expressions should be
+ *   compiled with its variables as PT_END.  An expression may be NULL,
+ *   for a NULL result.
+ * @param hasnodatanodataval : if non-zero, nodatanodataval is the
+ *   result where neither band has a pixel, otherwise it is NULL
+ * @param nodatanodataval : result where neither band has a pixel
+ *
+ * @return 1 on success, 0 on error
+ */
+int rt_band_mapalgebra2(rt_band band,
+	rt_band band1, rt_band band2, double *offset,
+	rt_mapexpr *exprs,
+	int hasnodatanodataval, double nodatanodataval);
+
 /*- rt_raster --------------------------------------------------------*/
 
 /**
@@ -1661,7 +1860,7 @@ struct rt_geomval_t {
 /* summary stats of specified band */
 struct rt_bandstats_t {
 	double sample;
-	uint32_t count;
+	uint64_t count; /* may sum those of many bands once merged */
 
 	double min;
 	double max;
@@ -1675,7 +1874,7 @@ struct rt_bandstats_t {
 
 /* histogram bin(s) of specified band */
 struct rt_histogram_t {
-	uint32_t count;
+	uint64_t count;
 	double percent;
 
 	double min;
@@ -1730,6 +1929,21 @@ struct rt_valuecount_t {
 	double percent;
 };
 
+/* default number of centroids a sketch is compressed to */
+#define RT_SKETCH_SIZE 2048
+
+/* mergeable sketch of the distribution of a set of values */
+struct rt_sketch_t {
+	uint32_t size; /* # of centroids the sketch is compressed to */
+	uint32_t count; /* # of centroids */
+	double *values; /* means of the centroids, ascending */
+	uint64_t *weights; /* # of values of each centroid */
+
+	uint64_t total; /* # of values */
+	double min;
+	double max;
+};
+
 /* reclassification expression */
 struct rt_reclassexpr_t {
 	struct rt_reclassrange {
@@ -1742,6 +1956,36 @@ struct rt_reclassexpr_t {
 	} src, dst;
 };
 
+/* number of pixels a compiled expression evaluates at once */
+#define RT_MAPEXPR_BLOCK 256
+
+/* maximum number of WHEN clauses of a compiled CASE */
+#define RT_MAPEXPR_MAXWHEN 64
+
+/* maximum number of arguments of a function of a compiled expression */
+#define RT_MAPEXPR_MAXARGS 16
+
+/* compiled map algebra expression */
+struct rt_mapexpr_t {
+	struct rt_mapexpr_instr {
+		int op;
+		int type; /* type of the result */
+		int argtype; /* type the arguments are operated on as */
+		int mask; /* register of the pixels to evaluate */
+		int arg[3]; /* registers of the arguments, -1 if none */
+		int var; /* index of the variable */
+		double value; /* value of a constant */
+		uint8_t isnull;
+	} *code;
+	int ncode;
+	int maxcode;
+	int nvars;
+
+	/* registers, RT_MAPEXPR_BLOCK values for each instruction */
+	double *values;
+	uint8_t *isnull;
+};
+
 /* gdal driver information */
 struct rt_gdaldriver_t {
 	int idx;
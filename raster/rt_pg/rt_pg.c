@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h> /* for isspace */
+#include <limits.h> /* for INT_MAX in RASTER_valueCount_finalfn */
 
 #include <postgres.h> /* for palloc */
 #include <access/gist.h>
@@ -45,6 +46,7 @@
 #include <executor/spi.h>
 #include <executor/executor.h> /* for GetAttributeByName in RASTER_reclass */
 #include <funcapi.h>
+#include <utils/hsearch.h> /* for HTAB in RASTER_valueCount_transfn */
 
 #include "../../postgis_config.h"
 
@@ -217,18 +219,26 @@ Datum RASTER_band(PG_FUNCTION_ARGS);
 /* Get summary stats */
 Datum RASTER_summaryStats(PG_FUNCTION_ARGS);
 Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS);
+Datum RASTER_summaryStats_transfn(PG_FUNCTION_ARGS);
+Datum RASTER_summaryStats_finalfn(PG_FUNCTION_ARGS);
 
 /* get histogram */
 Datum RASTER_histogram(PG_FUNCTION_ARGS);
 Datum RASTER_histogramCoverage(PG_FUNCTION_ARGS);
+Datum RASTER_histogram_transfn(PG_FUNCTION_ARGS);
+Datum RASTER_histogram_finalfn(PG_FUNCTION_ARGS);
 
 /* get quantiles */
 Datum RASTER_quantile(PG_FUNCTION_ARGS);
 Datum RASTER_quantileCoverage(PG_FUNCTION_ARGS);
+Datum RASTER_quantile_transfn(PG_FUNCTION_ARGS);
+Datum RASTER_quantile_finalfn(PG_FUNCTION_ARGS);
 
 /* get counts of values */
 Datum RASTER_valueCount(PG_FUNCTION_ARGS);
 Datum RASTER_valueCountCoverage(PG_FUNCTION_ARGS);
+Datum RASTER_valueCount_transfn(PG_FUNCTION_ARGS);
+Datum RASTER_valueCount_finalfn(PG_FUNCTION_ARGS);
 
 /* reclassify specified bands of a raster */
 Datum RASTER_reclass(PG_FUNCTION_ARGS);
@@ -2675,6 +2685,9 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
     bool isnull = FALSE;
     int i = 0;
     int j = 0;
+    rt_mapexpr mapexpr = NULL;
+    const char *mapexprkw[] = {"[rast]", "[rast.val]", "[rast.x]", "[rast.y]"};
+    const rt_pixtype mapexprkwtypes[] = {PT_64BF, PT_64BF, PT_32BSI, PT_32BSI};
 
     POSTGIS_RT_DEBUG(2, "RASTER_mapAlgebraExpr: Starting...");
 
@@ -3090,6 +3103,86 @@ Datum RASTER_mapAlgebraExpr(PG_FUNCTION_ARGS)
     POSTGIS_RT_DEBUGF(3, "RASTER_mapAlgebraExpr: Main computing loop (%d x %d)",
             width, height);
 
+    /**
+     * Optimization: If the expression only uses what rt_mapexpr_compile
+     * handles, evaluate it a row of pixels at a time instead of running
+     * the prepared statement for each pixel
+     **/
+    if (skipcomputation == 0)
+        mapexpr = rt_mapexpr_compile(expression, 4, mapexprkw, mapexprkwtypes);
+
+    if (mapexpr != NULL) {
+        double *rowvals = (double *) palloc(sizeof(double) * width * 4);
+        double *rowx = rowvals + width;
+        double *rowy = rowvals + width * 2;
+        double *rownew = rowvals + width * 3;
+        uint8_t *rowmask = (uint8_t *) palloc(sizeof(uint8_t) * width * 2);
+        uint8_t *rownull = rowmask + width;
+        double *rowvars[4];
+
+        POSTGIS_RT_DEBUG(3, "RASTER_mapAlgebraExpr: Expression compiled");
+
+        /* The variables, in the order of mapexprkw */
+        rowvars[0] = rowvals;
+        rowvars[1] = rowvals;
+        rowvars[2] = rowx;
+        rowvars[3] = rowy;
+
+        for (x = 0; x < width; x++)
+            rowx[x] = x + 1;
+
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                ret = rt_band_get_pixel(band, x, y, &r);
+                rowvals[x] = r;
+                rowy[x] = y + 1;
+
+                /* Only compute the withdata value pixels, as above */
+                rowmask[x] = (ret != -1 && FLT_NEQ(r, newnodatavalue));
+            }
+
+            if (!rt_mapexpr_eval(mapexpr, width, rowvars, rowmask, rownew, rownull)) {
+                pfree(rowvals);
+                pfree(rowmask);
+                rt_mapexpr_destroy(mapexpr);
+                pfree(initexpr);
+                rt_raster_destroy(raster);
+                rt_raster_destroy(newrast);
+
+                elog(ERROR, "RASTER_mapAlgebraExpr: Could not evaluate expression."
+                    " Aborting");
+                PG_RETURN_NULL();
+            }
+
+            for (x = 0; x < width; x++) {
+                if (!rowmask[x]) continue;
+                rt_band_set_pixel(newband, x, y,
+                    rownull[x] ? newinitialvalue : rownew[x]);
+            }
+        }
+
+        pfree(rowvals);
+        pfree(rowmask);
+        rt_mapexpr_destroy(mapexpr);
+        pfree(initexpr);
+
+        /* Serialize created raster */
+        pgraster = rt_raster_serialize(newrast);
+        if (NULL == pgraster) {
+            rt_raster_destroy(raster);
+            rt_raster_destroy(newrast);
+
+            PG_RETURN_NULL();
+        }
+
+        SET_VARSIZE(pgraster, pgraster->size);
+
+        rt_raster_destroy(raster);
+        rt_raster_destroy(newrast);
+
+        PG_RETURN_POINTER(pgraster);
+    }
+
     if (initexpr != NULL) {
     	/* Convert [rast.val] to [rast] */
         newexpr = rtpg_strreplace(initexpr, "[rast.val]", "[rast]", NULL);
@@ -3924,7 +4017,7 @@ Datum RASTER_summaryStats(PG_FUNCTION_ARGS)
 	}
 
 	/* we don't need the raw values, hence the zero parameter */
-	stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 0, NULL, NULL, NULL);
+	stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 0);
 	rt_band_destroy(band);
 	rt_raster_destroy(raster);
 	if (NULL == stats) {
@@ -4003,9 +4096,6 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS)
 	rt_raster raster = NULL;
 	rt_band band = NULL;
 	int num_bands = 0;
-	uint64_t cK = 0;
-	double cM = 0;
-	double cQ = 0;
 	rt_bandstats stats = NULL;
 	rt_bandstats rtn = NULL;
 
@@ -4154,7 +4244,7 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS)
 		}
 
 		/* we don't need the raw values, hence the zero parameter */
-		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 0, &cK, &cM, &cQ);
+		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 0);
 
 		rt_band_destroy(band);
 		rt_raster_destroy(raster);
@@ -4185,25 +4275,15 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS)
 				}
 
 				rtn->sample = stats->sample;
-				rtn->count = stats->count;
-				rtn->min = stats->min;
-				rtn->max = stats->max;
-				rtn->sum = stats->sum;
-				rtn->mean = stats->mean;
+				rtn->count = 0;
 				rtn->stddev = -1;
 
 				rtn->values = NULL;
 				rtn->sorted = 0;
 			}
-			else {
-				rtn->count += stats->count;
-				rtn->sum += stats->sum;
 
-				if (stats->min < rtn->min)
-					rtn->min = stats->min;
-				if (stats->max > rtn->max)
-					rtn->max = stats->max;
-			}
+			/* merge the stats of the tile into those of the coverage */
+			rt_bandstats_merge(rtn, stats);
 		}
 
 		pfree(stats);
@@ -4221,15 +4301,6 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
-	/* coverage mean and deviation */
-	rtn->mean = rtn->sum / rtn->count;
-	/* sample deviation */
-	if (rtn->sample > 0 && rtn->sample < 1)
-		rtn->stddev = sqrt(cQ / (rtn->count - 1));
-	/* standard deviation */
-	else
-		rtn->stddev = sqrt(cQ / rtn->count);
-
 	/* Build a tuple descriptor for our result type */
 	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
 		ereport(ERROR, (
@@ -4273,6 +4344,371 @@ Datum RASTER_summaryStatsCoverage(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/*
+ * Memory context in which the state of the aggregate calling a
+ * transition function lives across calls
+ */
+static MemoryContext
+rtpg_aggcontext(FunctionCallInfo fcinfo)
+{
+	if (fcinfo->context && IsA(fcinfo->context, AggState))
+		return ((AggState *) fcinfo->context)->aggcontext;
+#if POSTGIS_PGSQL_VERSION == 84
+
+	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
+		return ((WindowAggState *) fcinfo->context)->wincontext;
+#endif
+#if POSTGIS_PGSQL_VERSION > 84
+
+	else if (fcinfo->context && IsA(fcinfo->context, WindowAggState))
+		return ((WindowAggState *) fcinfo->context)->aggcontext;
+#endif
+
+	/* cannot be called directly because of internal-type argument */
+	elog(ERROR, "rtpg_aggcontext: Function called in non-aggregate context");
+	return NULL;
+}
+
+/*
+ * Get the band of the raster passed to an aggregate transition function
+ * as its arguments 1 (raster) and 2 (1-based band index). Returns NULL
+ * if the raster is NULL.
+ */
+static rt_band
+rtpg_aggband(FunctionCallInfo fcinfo, const char *fname, rt_raster *raster)
+{
+	rt_pgraster *pgraster = NULL;
+	rt_band band = NULL;
+	int32_t bandindex = 1;
+
+	*raster = NULL;
+	if (PG_ARGISNULL(1))
+		return NULL;
+	pgraster = (rt_pgraster *) PG_DETOAST_DATUM(PG_GETARG_DATUM(1));
+
+	*raster = rt_raster_deserialize(pgraster, FALSE);
+	if (NULL == *raster) {
+		elog(ERROR, "%s: Could not deserialize raster", fname);
+		return NULL;
+	}
+
+	/* band index is 1-based */
+	if (!PG_ARGISNULL(2))
+		bandindex = PG_GETARG_INT32(2);
+	if (bandindex < 1 || bandindex > rt_raster_get_num_bands(*raster)) {
+		rt_raster_destroy(*raster);
+		elog(ERROR, "%s: Invalid band index %d (must use 1-based)", fname, bandindex);
+		return NULL;
+	}
+
+	band = rt_raster_get_band(*raster, bandindex - 1);
+	if (NULL == band) {
+		rt_raster_destroy(*raster);
+		elog(ERROR, "%s: Could not find band at index %d", fname, bandindex);
+		return NULL;
+	}
+
+	return band;
+}
+
+/*
+ * Get the sample percentage passed to an aggregate transition function
+ * as its argument argnum, 1 if NULL or 0
+ */
+static double
+rtpg_aggsample(FunctionCallInfo fcinfo, int argnum, const char *fname)
+{
+	double sample = 1;
+
+	if (!PG_ARGISNULL(argnum)) {
+		sample = PG_GETARG_FLOAT8(argnum);
+		if (sample < 0 || sample > 1)
+			elog(ERROR, "%s: Invalid sample percentage (must be between 0 and 1)", fname);
+		else if (FLT_EQ(sample, 0.0))
+			sample = 1;
+	}
+
+	return sample;
+}
+
+/*
+ * Get the non-NULL elements of the double precision array passed to a
+ * function as its argument argnum. Returns NULL if the array is NULL
+ * or has no such element.
+ */
+static double *
+rtpg_getarg_float8array(FunctionCallInfo fcinfo, int argnum, const char *fname, uint32_t *count)
+{
+	ArrayType *array;
+	Oid etype;
+	Datum *e;
+	bool *nulls;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	double *rtn = NULL;
+	int i;
+	int j;
+	int n;
+
+	*count = 0;
+	if (PG_ARGISNULL(argnum))
+		return NULL;
+
+	array = PG_GETARG_ARRAYTYPE_P(argnum);
+	etype = ARR_ELEMTYPE(array);
+	get_typlenbyvalalign(etype, &typlen, &typbyval, &typalign);
+
+	switch (etype) {
+		case FLOAT4OID:
+		case FLOAT8OID:
+			break;
+		default:
+			elog(ERROR, "%s: Invalid data type for array", fname);
+			return NULL;
+	}
+
+	deconstruct_array(array, etype, typlen, typbyval, typalign, &e,
+		&nulls, &n);
+
+	rtn = palloc(sizeof(double) * n);
+	for (i = 0, j = 0; i < n; i++) {
+		if (nulls[i]) continue;
+
+		switch (etype) {
+			case FLOAT4OID:
+				rtn[j] = (double) DatumGetFloat4(e[i]);
+				break;
+			case FLOAT8OID:
+				rtn[j] = (double) DatumGetFloat8(e[i]);
+				break;
+		}
+
+		POSTGIS_RT_DEBUGF(5, "%s: array[%d] = %f", fname, j, rtn[j]);
+		j++;
+	}
+
+	if (j < 1) {
+		pfree(rtn);
+		return NULL;
+	}
+
+	*count = j;
+	return rtn;
+}
+
+/*
+ * Build the array of composites returned by the final function of an
+ * aggregate from count tuples of values_length values and nulls each
+ */
+static ArrayType *
+rtpg_aggtuplearray(FunctionCallInfo fcinfo, Datum *values, bool *nulls,
+	int values_length, int count)
+{
+	Oid elemtype;
+	TupleDesc tupdesc;
+	Datum *tuples;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	int i;
+
+	elemtype = get_element_type(get_func_rettype(fcinfo->flinfo->fn_oid));
+	if (!OidIsValid(elemtype))
+		elog(ERROR, "rtpg_aggtuplearray: Function must return an array");
+
+	tupdesc = BlessTupleDesc(TypeGetTupleDesc(elemtype, NIL));
+
+	tuples = palloc(sizeof(Datum) * (count > 0 ? count : 1));
+	for (i = 0; i < count; i++) {
+		tuples[i] = HeapTupleGetDatum(heap_form_tuple(
+			tupdesc,
+			values + (i * values_length),
+			nulls + (i * values_length)
+		));
+	}
+
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	return construct_array(tuples, count, elemtype, typlen, typbyval, typalign);
+}
+
+/**
+ * Accumulate the summary stats of a band of each raster of an aggregate,
+ * merging them as they come.
+ * Arguments are the state, raster, band index, exclude_nodata_value
+ * and, optionally, sample percentage
+ */
+PG_FUNCTION_INFO_V1(RASTER_summaryStats_transfn);
+Datum RASTER_summaryStats_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	rt_bandstats state = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	bool exclude_nodata_value = TRUE;
+	double sample = 1;
+	rt_bandstats stats = NULL;
+
+	aggcontext = rtpg_aggcontext(fcinfo);
+
+	if (!PG_ARGISNULL(0))
+		state = (rt_bandstats) PG_GETARG_POINTER(0);
+
+	/* exclude_nodata_value flag */
+	if (!PG_ARGISNULL(3))
+		exclude_nodata_value = PG_GETARG_BOOL(3);
+
+	/* sample % */
+	if (PG_NARGS() > 4)
+		sample = rtpg_aggsample(fcinfo, 4, "RASTER_summaryStats_transfn");
+
+	band = rtpg_aggband(fcinfo, "RASTER_summaryStats_transfn", &raster);
+	if (NULL == band) {
+		if (NULL == state) PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	/* we don't need the raw values, hence the zero parameter */
+	stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 0);
+	rt_band_destroy(band);
+	rt_raster_destroy(raster);
+	if (NULL == stats)
+		elog(ERROR, "RASTER_summaryStats_transfn: Unable to compute summary statistics of raster");
+
+	if (NULL == state) {
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		state = palloc(sizeof(struct rt_bandstats_t));
+		MemoryContextSwitchTo(oldcontext);
+
+		memcpy(state, stats, sizeof(struct rt_bandstats_t));
+	}
+	else
+		rt_bandstats_merge(state, stats);
+	pfree(stats);
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+ * Return the summary stats accumulated by RASTER_summaryStats_transfn
+ */
+PG_FUNCTION_INFO_V1(RASTER_summaryStats_finalfn);
+Datum RASTER_summaryStats_finalfn(PG_FUNCTION_ARGS)
+{
+	rt_bandstats stats = NULL;
+
+	TupleDesc tupdesc;
+	int values_length = 6;
+	Datum values[values_length];
+	bool nulls[values_length];
+	HeapTuple tuple;
+	Datum result;
+
+	if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+	stats = (rt_bandstats) PG_GETARG_POINTER(0);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+		ereport(ERROR, (
+			errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg(
+				"function returning record called in context "
+				"that cannot accept type record"
+			)
+		));
+	}
+
+	BlessTupleDesc(tupdesc);
+
+	memset(nulls, FALSE, values_length);
+
+	values[0] = Int64GetDatum(stats->count);
+	if (stats->count > 0) {
+		values[1] = Float8GetDatum(stats->sum);
+		values[2] = Float8GetDatum(stats->mean);
+		values[3] = Float8GetDatum(stats->stddev);
+		values[4] = Float8GetDatum(stats->min);
+		values[5] = Float8GetDatum(stats->max);
+	}
+	else {
+		nulls[1] = TRUE;
+		nulls[2] = TRUE;
+		nulls[3] = TRUE;
+		nulls[4] = TRUE;
+		nulls[5] = TRUE;
+	}
+
+	/* build a tuple */
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+
+	/* make the tuple into a datum */
+	result = HeapTupleGetDatum(tuple);
+
+	PG_RETURN_DATUM(result);
+}
+
+/* state of the histogram and quantile aggregates */
+typedef struct {
+	rt_sketch sketch;
+
+	/* parameters of the histogram, taken from the first row */
+	uint32_t bin_count;
+	double *bin_width;
+	uint32_t bin_width_count;
+	bool right;
+
+	/* quantiles, taken from the first row */
+	double *quantiles;
+	uint32_t quantiles_count;
+} rtpg_sketch_state;
+
+/*
+ * Add the values of a band to the sketch of the state of a histogram
+ * or quantile aggregate, creating the state if NULL
+ */
+static rtpg_sketch_state *
+rtpg_sketch_state_add(FunctionCallInfo fcinfo, rtpg_sketch_state *state,
+	rt_band band, bool exclude_nodata_value, double sample, const char *fname)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	rt_bandstats stats = NULL;
+
+	aggcontext = rtpg_aggcontext(fcinfo);
+
+	stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1);
+	if (NULL == stats)
+		elog(ERROR, "%s: Unable to compute summary statistics of raster", fname);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+
+	if (NULL == state) {
+		state = palloc(sizeof(rtpg_sketch_state));
+		memset(state, 0, sizeof(rtpg_sketch_state));
+
+		state->sketch = rt_sketch_new(0);
+		if (NULL == state->sketch) {
+			MemoryContextSwitchTo(oldcontext);
+			elog(ERROR, "%s: Unable to create sketch", fname);
+			return NULL;
+		}
+	}
+
+	if (stats->count > 0 && !rt_sketch_add(state->sketch, stats->values, stats->count)) {
+		MemoryContextSwitchTo(oldcontext);
+		elog(ERROR, "%s: Unable to add values to sketch", fname);
+		return NULL;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (NULL != stats->values) pfree(stats->values);
+	pfree(stats);
+
+	return state;
+}
+
 /**
  * Returns histogram for a band
  */
@@ -4459,7 +4895,7 @@ Datum RASTER_histogram(PG_FUNCTION_ARGS)
 		}
 
 		/* get stats */
-		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1, NULL, NULL, NULL);
+		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1);
 		rt_band_destroy(band);
 		rt_raster_destroy(raster);
 		if (NULL == stats || NULL == stats->values) {
@@ -4930,7 +5366,7 @@ Datum RASTER_histogramCoverage(PG_FUNCTION_ARGS)
 			}
 
 			/* we need the raw values, hence the non-zero parameter */
-			stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1, NULL, NULL, NULL);
+			stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1);
 
 			rt_band_destroy(band);
 			rt_raster_destroy(raster);
@@ -5090,6 +5526,134 @@ Datum RASTER_histogramCoverage(PG_FUNCTION_ARGS)
 	}
 }
 
+/**
+ * Accumulate the values of a band of each raster of an aggregate into a
+ * sketch from which to compute their histogram.
+ * Arguments are the state, raster, band index, exclude_nodata_value
+ * and either bin count or sample percentage, bin count, bin widths
+ * and right
+ */
+PG_FUNCTION_INFO_V1(RASTER_histogram_transfn);
+Datum RASTER_histogram_transfn(PG_FUNCTION_ARGS)
+{
+	rtpg_sketch_state *state = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	bool exclude_nodata_value = TRUE;
+	double sample = 1;
+	int binarg = 4;
+	bool first = FALSE;
+	MemoryContext oldcontext;
+	uint32_t i;
+
+	if (!PG_ARGISNULL(0))
+		state = (rtpg_sketch_state *) PG_GETARG_POINTER(0);
+
+	/* exclude_nodata_value flag */
+	if (!PG_ARGISNULL(3))
+		exclude_nodata_value = PG_GETARG_BOOL(3);
+
+	/* sample % */
+	if (PG_NARGS() > 5) {
+		sample = rtpg_aggsample(fcinfo, 4, "RASTER_histogram_transfn");
+		binarg = 5;
+	}
+
+	band = rtpg_aggband(fcinfo, "RASTER_histogram_transfn", &raster);
+	if (NULL == band) {
+		if (NULL == state) PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	first = (NULL == state);
+	state = rtpg_sketch_state_add(fcinfo, state, band, exclude_nodata_value, sample, "RASTER_histogram_transfn");
+	rt_band_destroy(band);
+	rt_raster_destroy(raster);
+
+	if (first) {
+		oldcontext = MemoryContextSwitchTo(rtpg_aggcontext(fcinfo));
+
+		/* bin_count */
+		if (!PG_ARGISNULL(binarg) && PG_GETARG_INT32(binarg) > 0)
+			state->bin_count = PG_GETARG_INT32(binarg);
+
+		if (binarg < PG_NARGS() - 1) {
+			/* bin_width */
+			state->bin_width = rtpg_getarg_float8array(fcinfo, binarg + 1, "RASTER_histogram_transfn", &(state->bin_width_count));
+			for (i = 0; i < state->bin_width_count; i++) {
+				if (state->bin_width[i] < 0 || FLT_EQ(state->bin_width[i], 0.0)) {
+					MemoryContextSwitchTo(oldcontext);
+					elog(ERROR, "RASTER_histogram_transfn: Invalid value for width (must be greater than 0)");
+				}
+			}
+
+			/* right */
+			if (!PG_ARGISNULL(binarg + 2))
+				state->right = PG_GETARG_BOOL(binarg + 2);
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+ * Return the histogram of the values accumulated by
+ * RASTER_histogram_transfn as an array
+ */
+PG_FUNCTION_INFO_V1(RASTER_histogram_finalfn);
+Datum RASTER_histogram_finalfn(PG_FUNCTION_ARGS)
+{
+	rtpg_sketch_state *state = NULL;
+	rt_histogram hist = NULL;
+	uint32_t count = 0;
+	int values_length = 4;
+	Datum *values;
+	bool *nulls;
+	ArrayType *result;
+	uint32_t i;
+
+	if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+	state = (rtpg_sketch_state *) PG_GETARG_POINTER(0);
+
+	if (state->sketch->total < 1) {
+		elog(NOTICE, "Unable to compute histogram as the rasters have no values. Returning NULL");
+		PG_RETURN_NULL();
+	}
+
+	hist = rt_sketch_get_histogram(
+		state->sketch,
+		state->bin_count, state->bin_width, state->bin_width_count,
+		state->right, 0, 0, &count
+	);
+	if (NULL == hist || !count) {
+		elog(NOTICE, "Unable to compute histogram. Returning NULL");
+		PG_RETURN_NULL();
+	}
+
+	POSTGIS_RT_DEBUGF(3, "%d bins returned", count);
+
+	values = palloc(sizeof(Datum) * values_length * count);
+	nulls = palloc(sizeof(bool) * values_length * count);
+	memset(nulls, FALSE, sizeof(bool) * values_length * count);
+
+	for (i = 0; i < count; i++) {
+		values[(i * values_length)] = Float8GetDatum(hist[i].min);
+		values[(i * values_length) + 1] = Float8GetDatum(hist[i].max);
+		values[(i * values_length) + 2] = Int64GetDatum(hist[i].count);
+		values[(i * values_length) + 3] = Float8GetDatum(hist[i].percent);
+	}
+
+	result = rtpg_aggtuplearray(fcinfo, values, nulls, values_length, count);
+
+	pfree(values);
+	pfree(nulls);
+	pfree(hist);
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 /**
  * Returns quantiles for a band
  */
@@ -5254,7 +5818,7 @@ Datum RASTER_quantile(PG_FUNCTION_ARGS)
 		}
 
 		/* get stats */
-		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1, NULL, NULL, NULL);
+		stats = rt_band_get_summary_stats(band, (int) exclude_nodata_value, sample, 1);
 		rt_band_destroy(band);
 		rt_raster_destroy(raster);
 		if (NULL == stats || NULL == stats->values) {
@@ -5785,6 +6349,118 @@ Datum RASTER_quantileCoverage(PG_FUNCTION_ARGS)
 	}
 }
 
+/**
+ * Accumulate the values of a band of each raster of an aggregate into a
+ * sketch from which to compute their quantiles.
+ * Arguments are the state, raster, band index, exclude_nodata_value,
+ * optionally sample percentage and quantiles
+ */
+PG_FUNCTION_INFO_V1(RASTER_quantile_transfn);
+Datum RASTER_quantile_transfn(PG_FUNCTION_ARGS)
+{
+	rtpg_sketch_state *state = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	bool exclude_nodata_value = TRUE;
+	double sample = 1;
+	int quantilearg = 4;
+	bool first = FALSE;
+	MemoryContext oldcontext;
+	uint32_t i;
+
+	if (!PG_ARGISNULL(0))
+		state = (rtpg_sketch_state *) PG_GETARG_POINTER(0);
+
+	/* exclude_nodata_value flag */
+	if (!PG_ARGISNULL(3))
+		exclude_nodata_value = PG_GETARG_BOOL(3);
+
+	/* sample % */
+	if (PG_NARGS() > 5) {
+		sample = rtpg_aggsample(fcinfo, 4, "RASTER_quantile_transfn");
+		quantilearg = 5;
+	}
+
+	band = rtpg_aggband(fcinfo, "RASTER_quantile_transfn", &raster);
+	if (NULL == band) {
+		if (NULL == state) PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	first = (NULL == state);
+	state = rtpg_sketch_state_add(fcinfo, state, band, exclude_nodata_value, sample, "RASTER_quantile_transfn");
+	rt_band_destroy(band);
+	rt_raster_destroy(raster);
+
+	/* quantiles */
+	if (first) {
+		oldcontext = MemoryContextSwitchTo(rtpg_aggcontext(fcinfo));
+		state->quantiles = rtpg_getarg_float8array(fcinfo, quantilearg, "RASTER_quantile_transfn", &(state->quantiles_count));
+		MemoryContextSwitchTo(oldcontext);
+
+		for (i = 0; i < state->quantiles_count; i++) {
+			if (state->quantiles[i] < 0 || state->quantiles[i] > 1)
+				elog(ERROR, "RASTER_quantile_transfn: Invalid value for quantile (must be between 0 and 1)");
+		}
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+ * Return the quantiles of the values accumulated by
+ * RASTER_quantile_transfn as an array
+ */
+PG_FUNCTION_INFO_V1(RASTER_quantile_finalfn);
+Datum RASTER_quantile_finalfn(PG_FUNCTION_ARGS)
+{
+	rtpg_sketch_state *state = NULL;
+	rt_quantile quant = NULL;
+	uint32_t count = 0;
+	int values_length = 2;
+	Datum *values;
+	bool *nulls;
+	ArrayType *result;
+	uint32_t i;
+
+	if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+	state = (rtpg_sketch_state *) PG_GETARG_POINTER(0);
+
+	if (state->sketch->total < 1) {
+		elog(NOTICE, "Unable to compute quantiles as the rasters have no values. Returning NULL");
+		PG_RETURN_NULL();
+	}
+
+	quant = rt_sketch_get_quantiles(
+		state->sketch,
+		state->quantiles, state->quantiles_count,
+		&count
+	);
+	if (NULL == quant || !count) {
+		elog(NOTICE, "Unable to compute quantiles. Returning NULL");
+		PG_RETURN_NULL();
+	}
+
+	POSTGIS_RT_DEBUGF(3, "%d quantiles returned", count);
+
+	values = palloc(sizeof(Datum) * values_length * count);
+	nulls = palloc(sizeof(bool) * values_length * count);
+	memset(nulls, FALSE, sizeof(bool) * values_length * count);
+
+	for (i = 0; i < count; i++) {
+		values[(i * values_length)] = Float8GetDatum(quant[i].quantile);
+		values[(i * values_length) + 1] = Float8GetDatum(quant[i].value);
+	}
+
+	result = rtpg_aggtuplearray(fcinfo, values, nulls, values_length, count);
+
+	pfree(values);
+	pfree(nulls);
+	pfree(quant);
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 /* get counts of values */
 PG_FUNCTION_INFO_V1(RASTER_valueCount);
 Datum RASTER_valueCount(PG_FUNCTION_ARGS) {
@@ -6442,6 +7118,199 @@ Datum RASTER_valueCountCoverage(PG_FUNCTION_ARGS) {
 	}
 }
 
+/* count of a value over the rasters of the value count aggregate */
+typedef struct {
+	double value; /* hash key */
+	uint64_t count;
+} rtpg_valuecount_entry;
+
+/* state of the value count aggregate */
+typedef struct {
+	/* counts of the values, as rtpg_valuecount_entry keyed by value */
+	HTAB *counts;
+	uint64_t total;
+
+	/* search values and rounding, taken from the first row */
+	double *search_values;
+	uint32_t search_values_count;
+	double roundto;
+} rtpg_valuecount_state;
+
+/**
+ * Accumulate the counts of the values of a band of each raster of an
+ * aggregate in a hash table keyed by value.
+ * Arguments are the state, raster, band index, exclude_nodata_value
+ * and, optionally, search values and roundto
+ */
+PG_FUNCTION_INFO_V1(RASTER_valueCount_transfn);
+Datum RASTER_valueCount_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	rtpg_valuecount_state *state = NULL;
+	rt_raster raster = NULL;
+	rt_band band = NULL;
+	bool exclude_nodata_value = TRUE;
+	rt_valuecount vcnts = NULL;
+	rtpg_valuecount_entry *entry = NULL;
+	uint32_t count = 0;
+	uint32_t total = 0;
+	double value;
+	bool found;
+	HASHCTL ctl;
+	uint32_t i;
+
+	aggcontext = rtpg_aggcontext(fcinfo);
+
+	if (!PG_ARGISNULL(0))
+		state = (rtpg_valuecount_state *) PG_GETARG_POINTER(0);
+
+	/* exclude_nodata_value flag */
+	if (!PG_ARGISNULL(3))
+		exclude_nodata_value = PG_GETARG_BOOL(3);
+
+	band = rtpg_aggband(fcinfo, "RASTER_valueCount_transfn", &raster);
+	if (NULL == band) {
+		if (NULL == state) PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	if (NULL == state) {
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+
+		state = palloc(sizeof(rtpg_valuecount_state));
+		memset(state, 0, sizeof(rtpg_valuecount_state));
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(double);
+		ctl.entrysize = sizeof(rtpg_valuecount_entry);
+		/* Older PostgreSQL versions default to string_hash */
+		ctl.hash = tag_hash;
+		ctl.hcxt = aggcontext;
+		state->counts = hash_create("RASTER_valueCount_transfn", 256, &ctl, (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT));
+
+		if (PG_NARGS() > 4) {
+			/* search values */
+			state->search_values = rtpg_getarg_float8array(fcinfo, 4, "RASTER_valueCount_transfn", &(state->search_values_count));
+
+			/* roundto */
+			if (!PG_ARGISNULL(5)) {
+				state->roundto = PG_GETARG_FLOAT8(5);
+				if (state->roundto < 0.) state->roundto = 0;
+			}
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* get counts of values */
+	vcnts = rt_band_get_value_count(
+		band, (int) exclude_nodata_value,
+		state->search_values, state->search_values_count, state->roundto,
+		&total, &count
+	);
+	rt_band_destroy(band);
+	rt_raster_destroy(raster);
+
+	/* band of only NODATA values */
+	if (NULL == vcnts)
+		PG_RETURN_POINTER(state);
+
+	for (i = 0; i < count; i++) {
+		/* count -0 with 0 */
+		value = vcnts[i].value;
+		if (value == 0) value = 0;
+
+		entry = (rtpg_valuecount_entry *) hash_search(state->counts, &value, HASH_ENTER, &found);
+		if (!found)
+			entry->count = 0;
+		entry->count += vcnts[i].count;
+	}
+	state->total += total;
+	pfree(vcnts);
+
+	PG_RETURN_POINTER(state);
+}
+
+/* qsort comparison of value counts by value, ascending */
+static int
+rtpg_valuecount_cmp(const void *a, const void *b) {
+	double x = ((const rtpg_valuecount_entry *) a)->value;
+	double y = ((const rtpg_valuecount_entry *) b)->value;
+
+	if (x < y)
+		return -1;
+	else if (x > y)
+		return 1;
+	return 0;
+}
+
+/**
+ * Return the counts of the values accumulated by
+ * RASTER_valueCount_transfn as an array, ordered by value
+ */
+PG_FUNCTION_INFO_V1(RASTER_valueCount_finalfn);
+Datum RASTER_valueCount_finalfn(PG_FUNCTION_ARGS)
+{
+	rtpg_valuecount_state *state = NULL;
+	rtpg_valuecount_entry *vcnts = NULL;
+	rtpg_valuecount_entry *entry = NULL;
+	HASH_SEQ_STATUS status;
+	uint32_t count = 0;
+	int values_length = 3;
+	Datum *values;
+	bool *nulls;
+	ArrayType *result;
+	uint32_t i;
+
+	if (PG_ARGISNULL(0)) PG_RETURN_NULL();
+	state = (rtpg_valuecount_state *) PG_GETARG_POINTER(0);
+
+	count = hash_get_num_entries(state->counts);
+	if (!count) {
+		elog(NOTICE, "Unable to count the values as the rasters have no values. Returning NULL");
+		PG_RETURN_NULL();
+	}
+
+	vcnts = palloc(sizeof(rtpg_valuecount_entry) * count);
+	i = 0;
+	hash_seq_init(&status, state->counts);
+	while ((entry = (rtpg_valuecount_entry *) hash_seq_search(&status)) != NULL)
+		vcnts[i++] = *entry;
+	qsort(vcnts, count, sizeof(rtpg_valuecount_entry), rtpg_valuecount_cmp);
+
+	POSTGIS_RT_DEBUGF(3, "%d value counts returned", count);
+
+	values = palloc(sizeof(Datum) * values_length * count);
+	nulls = palloc(sizeof(bool) * values_length * count);
+	memset(nulls, FALSE, sizeof(bool) * values_length * count);
+
+	for (i = 0; i < count; i++) {
+		/* the count column of valuecount is an integer */
+		if (vcnts[i].count > INT_MAX) {
+			ereport(ERROR, (
+				errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				errmsg("RASTER_valueCount_finalfn: Count of value %f is out of range for type integer", vcnts[i].value)
+			));
+		}
+
+		values[(i * values_length)] = Float8GetDatum(vcnts[i].value);
+		values[(i * values_length) + 1] = Int32GetDatum((int32) vcnts[i].count);
+		if (state->total > 0)
+			values[(i * values_length) + 2] = Float8GetDatum((double) vcnts[i].count / state->total);
+		else
+			nulls[(i * values_length) + 2] = TRUE;
+	}
+
+	result = rtpg_aggtuplearray(fcinfo, values, nulls, values_length, count);
+
+	pfree(values);
+	pfree(nulls);
+	pfree(vcnts);
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 /**
  * Reclassify the specified bands of the raster
  */
@@ -8905,6 +9774,9 @@ Datum RASTER_mapAlgebra2(PG_FUNCTION_ARGS)
 	double argval[3] = {0.};
 	int hasnodatanodataval = 0;
 	double nodatanodataval = 0;
+	rt_mapexpr mapexpr[3] = {NULL};
+	rt_pixtype mapexprtypes[8];
+	int native = 0;
 
 	Oid ufc_noid = InvalidOid;
 	FmgrInfo ufl_info;
@@ -9290,6 +10162,70 @@ Datum RASTER_mapAlgebra2(PG_FUNCTION_ARGS)
 		case TEXTOID: {
 			POSTGIS_RT_DEBUG(3, "arg 4 is \"expression\"!");
 
+			/*
+				if rt_mapexpr_compile handles all the expressions, compute
+				the output band a row at a time without SPI
+			*/
+			native = 1;
+			for (i = 0; i < spi_count; i++) {
+				if (PG_ARGISNULL(spi_exprpos[i]))
+					continue;
+
+				/* positions are INT4, values FLOAT8 and NULL for the raster without pixel */
+				for (j = 0; j < argkwcount; j++) {
+					if (j % 4 < 2)
+						mapexprtypes[j] = PT_32BSI;
+					else if ((i == 1 && j < 4) || (i == 2 && j >= 4))
+						mapexprtypes[j] = PT_END;
+					else
+						mapexprtypes[j] = PT_64BF;
+				}
+
+				expr = text_to_cstring(PG_GETARG_TEXT_P(spi_exprpos[i]));
+				mapexpr[i] = rt_mapexpr_compile(expr, argkwcount, (const char **) argkw, mapexprtypes);
+				pfree(expr);
+
+				if (mapexpr[i] == NULL) {
+					native = 0;
+					break;
+				}
+			}
+
+			if (native) {
+				POSTGIS_RT_DEBUG(3, "expressions compiled");
+
+				if (!PG_ARGISNULL(9)) {
+					hasnodatanodataval = 1;
+					nodatanodataval = PG_GETARG_FLOAT8(9);
+				}
+
+				err = rt_band_mapalgebra2(
+					band,
+					_band[0], _band[1], _offset,
+					mapexpr,
+					hasnodatanodataval, nodatanodataval
+				);
+				for (k = 0; k < spi_count; k++) rt_mapexpr_destroy(mapexpr[k]);
+
+				for (k = 0; k < set_count; k++) {
+					if (_rast[k] != NULL) rt_raster_destroy(_rast[k]);
+				}
+
+				if (!err) {
+					rt_raster_destroy(raster);
+					elog(ERROR, "RASTER_mapAlgebra2: Unable to evaluate expressions");
+					PG_RETURN_NULL();
+				}
+
+				pgrast = rt_raster_serialize(raster);
+				rt_raster_destroy(raster);
+				if (!pgrast) PG_RETURN_NULL();
+
+				SET_VARSIZE(pgrast, pgrast->size);
+				PG_RETURN_POINTER(pgrast);
+			}
+			for (k = 0; k < spi_count; k++) rt_mapexpr_destroy(mapexpr[k]);
+
 			/* connect SPI */
 			if (SPI_connect() != SPI_OK_CONNECT) {
 				elog(ERROR, "RASTER_mapAlgebra2: Unable to connect to the SPI manager");
@@ -358,6 +358,35 @@ CREATE OR REPLACE FUNCTION st_approxsummarystats(rastertable text, rastercolumn
 	AS $$ SELECT _st_summarystats($1, $2, 1, TRUE, $3) $$
 	LANGUAGE 'sql' STABLE STRICT;
 
+-- Cannot be strict as the state starts as NULL
+CREATE OR REPLACE FUNCTION _st_summarystats_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_summaryStats_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_summarystats_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, sample_percent double precision)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_summaryStats_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_summarystats_finalfn(state internal)
+	RETURNS summarystats
+	AS 'MODULE_PATHNAME', 'RASTER_summaryStats_finalfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+-- Summary stats of a band over all the rasters aggregated, in one pass
+CREATE AGGREGATE st_summarystatsagg(raster, int, boolean) (
+	SFUNC = _st_summarystats_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_summarystats_finalfn
+);
+
+CREATE AGGREGATE st_summarystatsagg(raster, int, boolean, double precision) (
+	SFUNC = _st_summarystats_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_summarystats_finalfn
+);
+
 -----------------------------------------------------------------------
 -- ST_Count and ST_ApproxCount
 -----------------------------------------------------------------------
@@ -658,6 +687,35 @@ CREATE OR REPLACE FUNCTION st_approxhistogram(rastertable text, rastercolumn tex
 	AS $$ SELECT _st_histogram($1, $2, $3, TRUE, $4, $5, NULL, $6) $$
 	LANGUAGE 'sql' STABLE STRICT;
 
+-- Cannot be strict as the state starts as NULL and "width" can be NULL
+CREATE OR REPLACE FUNCTION _st_histogram_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, bins int)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_histogram_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_histogram_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, sample_percent double precision, bins int, width double precision[], right boolean)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_histogram_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_histogram_finalfn(state internal)
+	RETURNS histogram[]
+	AS 'MODULE_PATHNAME', 'RASTER_histogram_finalfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+-- Histogram of a band over all the rasters aggregated, in one pass
+CREATE AGGREGATE st_histogramagg(raster, int, boolean, int) (
+	SFUNC = _st_histogram_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_histogram_finalfn
+);
+
+CREATE AGGREGATE st_histogramagg(raster, int, boolean, double precision, int, double precision[], boolean) (
+	SFUNC = _st_histogram_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_histogram_finalfn
+);
+
 -----------------------------------------------------------------------
 -- ST_Quantile and ST_ApproxQuantile
 -----------------------------------------------------------------------
@@ -850,6 +908,35 @@ CREATE OR REPLACE FUNCTION st_approxquantile(rastertable text, rastercolumn text
 	AS $$ SELECT (_st_quantile($1, $2, 1, TRUE, 0.1, ARRAY[$3]::double precision[])).value $$
 	LANGUAGE 'sql' STABLE;
 
+-- Cannot be strict as the state starts as NULL and "quantiles" can be NULL
+CREATE OR REPLACE FUNCTION _st_quantile_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, quantiles double precision[])
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_quantile_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_quantile_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, sample_percent double precision, quantiles double precision[])
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_quantile_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_quantile_finalfn(state internal)
+	RETURNS quantile[]
+	AS 'MODULE_PATHNAME', 'RASTER_quantile_finalfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+-- Quantiles of a band over all the rasters aggregated, in one pass
+CREATE AGGREGATE st_quantileagg(raster, int, boolean, double precision[]) (
+	SFUNC = _st_quantile_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_quantile_finalfn
+);
+
+CREATE AGGREGATE st_quantileagg(raster, int, boolean, double precision, double precision[]) (
+	SFUNC = _st_quantile_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_quantile_finalfn
+);
+
 -----------------------------------------------------------------------
 -- ST_ValueCount and ST_ValuePercent
 -----------------------------------------------------------------------
@@ -1018,6 +1105,35 @@ CREATE OR REPLACE FUNCTION st_valuepercent(rastertable text, rastercolumn text,
 	AS $$ SELECT (_st_valuecount($1, $2, 1, TRUE, ARRAY[$3]::double precision[], $4)).percent $$
 	LANGUAGE 'sql' STABLE STRICT;
 
+-- Cannot be strict as the state starts as NULL and "searchvalues" and "roundto" can be NULL
+CREATE OR REPLACE FUNCTION _st_valuecount_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_valueCount_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_valuecount_transfn(state internal, rast raster, nband int, exclude_nodata_value boolean, searchvalues double precision[], roundto double precision)
+	RETURNS internal
+	AS 'MODULE_PATHNAME', 'RASTER_valueCount_transfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION _st_valuecount_finalfn(state internal)
+	RETURNS valuecount[]
+	AS 'MODULE_PATHNAME', 'RASTER_valueCount_finalfn'
+	LANGUAGE 'c' IMMUTABLE;
+
+-- Counts of the values of a band over all the rasters aggregated, in one pass
+CREATE AGGREGATE st_valuecountagg(raster, int, boolean) (
+	SFUNC = _st_valuecount_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_valuecount_finalfn
+);
+
+CREATE AGGREGATE st_valuecountagg(raster, int, boolean, double precision[], double precision) (
+	SFUNC = _st_valuecount_transfn,
+	STYPE = internal,
+	FINALFUNC = _st_valuecount_finalfn
+);
+
 -----------------------------------------------------------------------
 -- ST_Reclass
 -----------------------------------------------------------------------
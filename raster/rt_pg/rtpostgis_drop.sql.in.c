@@ -31,6 +31,14 @@ DROP AGGREGATE IF EXISTS ST_Union(raster, text, text, text, double precision);
 DROP AGGREGATE IF EXISTS ST_Union(raster, text);
 DROP AGGREGATE IF EXISTS ST_Union(raster, integer);
 DROP AGGREGATE IF EXISTS ST_Union(raster);
+DROP AGGREGATE IF EXISTS ST_SummaryStatsAgg(raster, integer, boolean, double precision);
+DROP AGGREGATE IF EXISTS ST_SummaryStatsAgg(raster, integer, boolean);
+DROP AGGREGATE IF EXISTS ST_HistogramAgg(raster, integer, boolean, double precision, integer, double precision[], boolean);
+DROP AGGREGATE IF EXISTS ST_HistogramAgg(raster, integer, boolean, integer);
+DROP AGGREGATE IF EXISTS ST_QuantileAgg(raster, integer, boolean, double precision, double precision[]);
+DROP AGGREGATE IF EXISTS ST_QuantileAgg(raster, integer, boolean, double precision[]);
+DROP AGGREGATE IF EXISTS ST_ValueCountAgg(raster, integer, boolean, double precision[], double precision);
+DROP AGGREGATE IF EXISTS ST_ValueCountAgg(raster, integer, boolean);
 
 DROP FUNCTION IF EXISTS st_summarystats(rastertable text, rastercolumn text, nband integer, exclude_nodata_value boolean, sample_percent double precision) ;
 DROP FUNCTION IF EXISTS st_summarystats(rastertable text, rastercolumn text, exclude_nodata_value boolean) ;
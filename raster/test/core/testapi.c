@@ -1207,8 +1207,61 @@ static void testRasterFromBand() {
 	deepRelease(raster);
 }
 
+static void testBandGetPixelLine() {
+	rt_raster raster;
+	rt_band band;
+	int16_t *data;
+	double vals[4];
+	uint8_t nodata[4];
+	uint32_t x;
+	uint32_t y;
+	int rtn;
+
+	raster = rt_raster_new(5, 3);
+	assert(raster);
+	band = addBand(raster, PT_16BSI, 1, -1);
+	CHECK(band);
+
+	for (y = 0; y < 3; y++) {
+		for (x = 0; x < 5; x++)
+			rt_band_set_pixel(band, x, y, x * 10 - y);
+	}
+	rt_band_set_pixel(band, 2, 1, -1);
+
+	data = (int16_t *) rt_band_get_pixel_line_data(band, 1, 1, 4);
+	CHECK(data);
+	CHECK_EQUALS(data[0], 9);
+	CHECK_EQUALS(data[1], -1);
+	CHECK_EQUALS(data[3], 39);
+
+	rtn = rt_band_get_pixel_line(band, 1, 1, 4, vals, nodata);
+	CHECK_EQUALS(rtn, 0);
+	CHECK_EQUALS_DOUBLE(vals[0], 9);
+	CHECK_EQUALS_DOUBLE(vals[1], -1);
+	CHECK_EQUALS_DOUBLE(vals[2], 29);
+	CHECK_EQUALS_DOUBLE(vals[3], 39);
+	CHECK(!nodata[0]);
+	CHECK(nodata[1]);
+	CHECK(!nodata[2]);
+	CHECK(!nodata[3]);
+
+	/* without NODATA, no value is */
+	rt_band_set_hasnodata_flag(band, 0);
+	rtn = rt_band_get_pixel_line(band, 1, 1, 4, vals, nodata);
+	CHECK_EQUALS(rtn, 0);
+	CHECK(!nodata[1]);
+
+	/* the pixels must all be in the row */
+	rtn = rt_band_get_pixel_line(band, 2, 1, 4, vals, NULL);
+	CHECK_EQUALS(rtn, -1);
+	CHECK(!rt_band_get_pixel_line_data(band, 0, 3, 1));
+
+	deepRelease(raster);
+}
+
 static void testBandStats() {
 	rt_bandstats stats = NULL;
+	rt_bandstats stats2 = NULL;
 	rt_histogram histogram = NULL;
 	double bin_width[] = {100};
 	double quantiles[] = {0.1, 0.3, 0.5, 0.7, 0.9};
@@ -1246,7 +1299,7 @@ static void testBandStats() {
 	nodata = rt_band_get_nodata(band);
 	CHECK_EQUALS(nodata, 0);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0, 1, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0, 1);
 	CHECK(stats);
 	CHECK_EQUALS(stats->min, 1);
 	CHECK_EQUALS(stats->max, 198);
@@ -1270,7 +1323,7 @@ static void testBandStats() {
 	rtdealloc(stats->values);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.1, 1, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.1, 1);
 	CHECK(stats);
 
 	quantile = (rt_quantile) rt_band_get_quantiles(stats, NULL, 0, &count);
@@ -1289,19 +1342,19 @@ static void testBandStats() {
 	rtdealloc(stats->values);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.15, 0, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.15, 0);
 	CHECK(stats);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.2, 0, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.2, 0);
 	CHECK(stats);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.25, 0, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 1, 0.25, 0);
 	CHECK(stats);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0, 1, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0, 1);
 	CHECK(stats);
 	CHECK_EQUALS(stats->min, 0);
 	CHECK_EQUALS(stats->max, 198);
@@ -1313,7 +1366,7 @@ static void testBandStats() {
 	rtdealloc(stats->values);
 	rtdealloc(stats);
 
-	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0.1, 1, NULL, NULL, NULL);
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0.1, 1);
 	CHECK(stats);
 
 	quantile = (rt_quantile) rt_band_get_quantiles(stats, NULL, 0, &count);
@@ -1323,6 +1376,22 @@ static void testBandStats() {
 	rtdealloc(stats->values);
 	rtdealloc(stats);
 
+	/* merging the stats of a band with themselves changes only the count */
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0, 0);
+	CHECK(stats);
+	CHECK_EQUALS_DOUBLE(stats->mean, 99);
+	CHECK_EQUALS_DOUBLE_EX(stats->stddev, sqrt(1666.5), 1e-9);
+	stats2 = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0, 0);
+	CHECK(stats2);
+	rt_bandstats_merge(stats, stats2);
+	CHECK_EQUALS(stats->count, 20000);
+	CHECK_EQUALS(stats->min, 0);
+	CHECK_EQUALS(stats->max, 198);
+	CHECK_EQUALS_DOUBLE(stats->mean, 99);
+	CHECK_EQUALS_DOUBLE_EX(stats->stddev, sqrt(1666.5), 1e-9);
+	rtdealloc(stats2);
+	rtdealloc(stats);
+
 	deepRelease(raster);
 
 	xmax = 4;
@@ -1397,6 +1466,116 @@ static void testBandStats() {
 	deepRelease(raster);
 }
 
+static void testSketch() {
+	rt_raster raster;
+	rt_band band;
+	rt_bandstats stats = NULL;
+	rt_sketch sketch = NULL;
+	rt_sketch sketch2 = NULL;
+	rt_histogram histogram = NULL;
+	rt_histogram histogram2 = NULL;
+	rt_quantile quantile = NULL;
+	rt_quantile quantile2 = NULL;
+	double quantiles[] = {0.1, 0.25, 0.5, 0.75, 0.9};
+	double *values = NULL;
+	uint32_t count = 0;
+	uint32_t count2 = 0;
+	uint32_t half;
+	uint32_t x;
+	uint32_t y;
+	uint32_t i;
+	int rtn;
+
+	raster = rt_raster_new(10, 10);
+	assert(raster);
+	band = addBand(raster, PT_32BUI, 0, 0);
+	CHECK(band);
+
+	for (x = 0; x < 10; x++) {
+		for (y = 0; y < 10; y++) {
+			rtn = rt_band_set_pixel(band, x, y, x * y);
+			CHECK((rtn != -1));
+		}
+	}
+
+	stats = (rt_bandstats) rt_band_get_summary_stats(band, 0, 0, 1);
+	CHECK(stats);
+
+	/* a sketch of few distinct values is exact, however it is built */
+	values = rtalloc(sizeof(double) * stats->count);
+	CHECK(values);
+	memcpy(values, stats->values, sizeof(double) * stats->count);
+	half = stats->count / 2;
+
+	sketch = rt_sketch_new(0);
+	CHECK(sketch);
+	sketch2 = rt_sketch_new(0);
+	CHECK(sketch2);
+	CHECK(rt_sketch_add(sketch, values, half));
+	CHECK(rt_sketch_add(sketch2, values + half, stats->count - half));
+	CHECK(rt_sketch_merge(sketch, sketch2));
+	rt_sketch_destroy(sketch2);
+	rtdealloc(values);
+
+	CHECK_EQUALS(sketch->total, stats->count);
+	CHECK_EQUALS(sketch->min, stats->min);
+	CHECK_EQUALS(sketch->max, stats->max);
+
+	histogram = (rt_histogram) rt_band_get_histogram(stats, 0, NULL, 0, 0, 0, 0, &count);
+	CHECK(histogram);
+	histogram2 = rt_sketch_get_histogram(sketch, 0, NULL, 0, 0, 0, 0, &count2);
+	CHECK(histogram2);
+	CHECK_EQUALS(count2, count);
+	for (i = 0; i < count; i++) {
+		CHECK_EQUALS(histogram2[i].count, histogram[i].count);
+		CHECK_EQUALS_DOUBLE(histogram2[i].min, histogram[i].min);
+		CHECK_EQUALS_DOUBLE(histogram2[i].max, histogram[i].max);
+	}
+	rtdealloc(histogram2);
+	rtdealloc(histogram);
+
+	quantile = (rt_quantile) rt_band_get_quantiles(stats, quantiles, 5, &count);
+	CHECK(quantile);
+	quantile2 = rt_sketch_get_quantiles(sketch, quantiles, 5, &count2);
+	CHECK(quantile2);
+	CHECK_EQUALS(count2, count);
+	for (i = 0; i < count; i++)
+		CHECK_EQUALS_DOUBLE(quantile2[i].value, quantile[i].value);
+	rtdealloc(quantile2);
+	rtdealloc(quantile);
+
+	rt_sketch_destroy(sketch);
+	rtdealloc(stats->values);
+	rtdealloc(stats);
+	deepRelease(raster);
+
+	/* past its size, a sketch stays small and approximates quantiles */
+	values = rtalloc(sizeof(double) * 1000);
+	CHECK(values);
+	sketch = rt_sketch_new(64);
+	CHECK(sketch);
+	for (x = 0; x < 10; x++) {
+		for (i = 0; i < 1000; i++)
+			values[i] = ((x * 1000 + i) * 7919) % 10000;
+		CHECK(rt_sketch_add(sketch, values, 1000));
+		CHECK((sketch->count <= 64));
+	}
+	rtdealloc(values);
+
+	CHECK_EQUALS(sketch->total, 10000);
+	CHECK_EQUALS(sketch->min, 0);
+	CHECK_EQUALS(sketch->max, 9999);
+
+	quantile = rt_sketch_get_quantiles(sketch, quantiles, 5, &count);
+	CHECK(quantile);
+	CHECK_EQUALS(count, 5);
+	for (i = 0; i < count; i++)
+		CHECK((fabs(quantile[i].value - quantiles[i] * 9999) < 250));
+	rtdealloc(quantile);
+
+	rt_sketch_destroy(sketch);
+}
+
 static void testRasterReplaceBand() {
 	rt_raster raster;
 	rt_band band;
@@ -1524,6 +1703,176 @@ static void testBandReclass() {
 	rt_band_destroy(newband);
 }
 
+static void testMapExpr() {
+	const char *varnames[] = {"[rast]", "[rast.x]"};
+	const rt_pixtype vartypes[] = {PT_64BF, PT_32BSI};
+	double rast[4] = {-2, 0, 2.5, 8};
+	double x[4] = {1, 2, 3, 4};
+	double *vars[2];
+	uint8_t mask[4] = {1, 1, 1, 0};
+	double values[4];
+	uint8_t isnull[4];
+	rt_mapexpr mapexpr;
+	int rtn;
+
+	vars[0] = rast;
+	vars[1] = x;
+
+	/* arithmetic, with int4 division for int4 values */
+	mapexpr = rt_mapexpr_compile("[rast] * 2 + [rast.x] / 2", 2, varnames, vartypes);
+	CHECK(mapexpr);
+	rtn = rt_mapexpr_eval(mapexpr, 4, vars, NULL, values, isnull);
+	CHECK(rtn);
+	CHECK(!isnull[0]);
+	CHECK_EQUALS_DOUBLE(values[0], -4.);
+	CHECK_EQUALS_DOUBLE(values[1], 1.);
+	CHECK_EQUALS_DOUBLE(values[2], 6.);
+	CHECK_EQUALS_DOUBLE(values[3], 18.);
+	rt_mapexpr_destroy(mapexpr);
+
+	/* CASE only evaluates the division where [rast] is not zero */
+	mapexpr = rt_mapexpr_compile(
+		"CASE WHEN [rast] = 0 THEN NULL WHEN [rast] BETWEEN 0 AND 5 THEN 1 / [rast] ELSE -1 END",
+		2, varnames, vartypes
+	);
+	CHECK(mapexpr);
+	rtn = rt_mapexpr_eval(mapexpr, 4, vars, mask, values, isnull);
+	CHECK(rtn);
+	CHECK(!isnull[0]);
+	CHECK_EQUALS_DOUBLE(values[0], -1.);
+	CHECK(isnull[1]);
+	CHECK(!isnull[2]);
+	CHECK_EQUALS_DOUBLE(values[2], 0.4);
+	rt_mapexpr_destroy(mapexpr);
+
+	/* errors where PostgreSQL would */
+	mapexpr = rt_mapexpr_compile("sqrt([rast])", 2, varnames, vartypes);
+	CHECK(mapexpr);
+	rtn = rt_mapexpr_eval(mapexpr, 4, vars, NULL, values, isnull);
+	CHECK(!rtn);
+	rt_mapexpr_destroy(mapexpr);
+
+	/* left to PostgreSQL */
+	CHECK(!rt_mapexpr_compile("[rast] || 'a'", 2, varnames, vartypes));
+	CHECK(!rt_mapexpr_compile("[rast.x] * 1.5", 2, varnames, vartypes));
+	CHECK(!rt_mapexpr_compile("CASE WHEN [rast] > 0 THEN 1 / 0 END", 2, varnames, vartypes));
+	CHECK(!rt_mapexpr_compile("[rast.y] + 1", 2, varnames, vartypes));
+	CHECK(!rt_mapexpr_compile("[rast] * 1e400", 2, varnames, vartypes));
+	CHECK(!rt_mapexpr_compile("[rast] + 1e-400", 2, varnames, vartypes));
+}
+
+static void testBandMapAlgebra2() {
+	const char *varnames[] = {"[rast1.x]", "[rast1.y]", "[rast1.val]", "[rast1]", "[rast2.x]", "[rast2.y]", "[rast2.val]", "[rast2]"};
+	const char *exprs[] = {"[rast1] + [rast2]", "greatest([rast1], [rast2]) * 10", "[rast1.x] * 100 + [rast1.y]"};
+	rt_pixtype vartypes[8];
+	rt_mapexpr mapexpr[3];
+	rt_raster rast1;
+	rt_raster rast2;
+	rt_raster rast;
+	rt_band band1;
+	rt_band band2;
+	rt_band band;
+	double offset[4] = {0.};
+	double value;
+	int err;
+	int rtn;
+	int i;
+	int j;
+	int x;
+	int y;
+
+	/* 3x3 raster of 0 to 8, 0 being NODATA */
+	rast1 = rt_raster_new(3, 3);
+	assert(rast1);
+	rt_raster_set_scale(rast1, 1, 1);
+	band1 = addBand(rast1, PT_8BUI, 1, 0);
+	for (x = 0; x < 3; x++) {
+		for (y = 0; y < 3; y++)
+			rt_band_set_pixel(band1, x, y, x + y * 3);
+	}
+
+	/* 2x2 raster over the last pixel of rast1, without NODATA */
+	rast2 = rt_raster_new(2, 2);
+	assert(rast2);
+	rt_raster_set_scale(rast2, 1, 1);
+	rt_raster_set_offsets(rast2, 2, 2);
+	band2 = addBand(rast2, PT_32BF, 0, 0);
+	for (x = 0; x < 2; x++) {
+		for (y = 0; y < 2; y++)
+			rt_band_set_pixel(band2, x, y, x + 0.5);
+	}
+
+	/* values of the raster without pixel are NULL */
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 8; j++) {
+			if (j % 4 < 2)
+				vartypes[j] = PT_32BSI;
+			else if ((i == 1 && j < 4) || (i == 2 && j >= 4))
+				vartypes[j] = PT_END;
+			else
+				vartypes[j] = PT_64BF;
+		}
+		mapexpr[i] = rt_mapexpr_compile(exprs[i], 8, varnames, vartypes);
+		CHECK(mapexpr[i]);
+	}
+
+	rast = rt_raster_from_two_rasters(rast1, rast2, ET_UNION, &err, offset);
+	CHECK(err);
+	CHECK((rt_raster_get_width(rast) == 4));
+	band = addBand(rast, PT_64BF, 1, -1);
+	for (x = 0; x < 4; x++) {
+		for (y = 0; y < 4; y++)
+			rt_band_set_pixel(band, x, y, -1);
+	}
+
+	rtn = rt_band_mapalgebra2(band, band1, band2, offset, mapexpr, 1, -5);
+	CHECK(rtn);
+
+	/* neither */
+	rt_band_get_pixel(band, 0, 0, &value);
+	CHECK_EQUALS_DOUBLE(value, -5.);
+	rt_band_get_pixel(band, 3, 0, &value);
+	CHECK_EQUALS_DOUBLE(value, -5.);
+	/* first only */
+	rt_band_get_pixel(band, 1, 0, &value);
+	CHECK_EQUALS_DOUBLE(value, 201.);
+	rt_band_get_pixel(band, 1, 2, &value);
+	CHECK_EQUALS_DOUBLE(value, 203.);
+	/* both */
+	rt_band_get_pixel(band, 2, 2, &value);
+	CHECK_EQUALS_DOUBLE(value, 8.5);
+	/* second only */
+	rt_band_get_pixel(band, 3, 3, &value);
+	CHECK_EQUALS_DOUBLE(value, 15.);
+	deepRelease(rast);
+
+	/* a NULL expression leaves the pixels as they are */
+	rast = rt_raster_from_two_rasters(rast1, rast2, ET_INTERSECTION, &err, offset);
+	CHECK(err);
+	CHECK((rt_raster_get_width(rast) == 1));
+	band = addBand(rast, PT_64BF, 1, -1);
+	rt_band_set_pixel(band, 0, 0, -1);
+
+	rtn = rt_band_mapalgebra2(band, band1, band2, offset, mapexpr, 0, 0);
+	CHECK(rtn);
+	rt_band_get_pixel(band, 0, 0, &value);
+	CHECK_EQUALS_DOUBLE(value, 8.5);
+
+	rt_mapexpr_destroy(mapexpr[0]);
+	mapexpr[0] = NULL;
+	rt_band_set_pixel(band, 0, 0, -1);
+	rtn = rt_band_mapalgebra2(band, band1, band2, offset, mapexpr, 0, 0);
+	CHECK(rtn);
+	rt_band_get_pixel(band, 0, 0, &value);
+	CHECK_EQUALS_DOUBLE(value, -1.);
+	deepRelease(rast);
+
+	rt_mapexpr_destroy(mapexpr[1]);
+	rt_mapexpr_destroy(mapexpr[2]);
+	deepRelease(rast2);
+	deepRelease(rast1);
+}
+
 static void testGDALDrivers() {
 	int i;
 	uint32_t size;
@@ -2811,10 +3160,18 @@ main()
 		testRasterFromBand();
 		printf("OK\n");
 
+		printf("Testing rt_band_get_pixel_line... ");
+		testBandGetPixelLine();
+		printf("OK\n");
+
 		printf("Testing band stats... ");
 		testBandStats();
 		printf("OK\n");
 
+		printf("Testing rt_sketch... ");
+		testSketch();
+		printf("OK\n");
+
 		printf("Testing rt_raster_replace_band... ");
 		testRasterReplaceBand();
 		printf("OK\n");
@@ -2823,6 +3180,14 @@ main()
 		testBandReclass();
 		printf("OK\n");
 
+		printf("Testing rt_mapexpr... ");
+		testMapExpr();
+		printf("OK\n");
+
+		printf("Testing rt_band_mapalgebra2... ");
+		testBandMapAlgebra2();
+		printf("OK\n");
+
 		printf("Testing rt_raster_to_gdal... ");
 		testRasterToGDAL();
 		printf("OK\n");
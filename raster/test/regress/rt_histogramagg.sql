@@ -0,0 +1,78 @@
+BEGIN;
+CREATE TEMP TABLE test_histogramagg
+	ON COMMIT DROP AS
+	SELECT
+		rid, rast
+	FROM (
+		SELECT 1 AS rid, ST_AddBand(ST_MakeEmptyRaster(2, 2, 0, 0, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0) AS rast
+		UNION ALL
+		SELECT 2, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 2, 0, 1, -1, 0, 0, 0), 1, '8BUI', 2, 0), 1, 1, 1, 5)
+		UNION ALL
+		SELECT 3, ST_AddBand(ST_MakeEmptyRaster(2, 2, 4, 0, 1, -1, 0, 0, 0), 1, '8BUI', 0, 0)
+		UNION ALL
+		SELECT 4, NULL::raster
+		UNION ALL
+		SELECT 5, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 6, 0, 1, -1, 0, 0, 0), 1, '8BUI', 3, 0), 1, 2, 2, 0)
+	) AS foo;
+SELECT
+	round((h).min::numeric, 3),
+	round((h).max::numeric, 3),
+	(h).count,
+	round((h).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, TRUE, 4)) AS h FROM test_histogramagg
+) AS foo;
+SELECT
+	round((h).min::numeric, 3),
+	round((h).max::numeric, 3),
+	(h).count,
+	round((h).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, TRUE, 1, 4, NULL, TRUE)) AS h FROM test_histogramagg
+) AS foo;
+SELECT
+	round((h).min::numeric, 3),
+	round((h).max::numeric, 3),
+	(h).count,
+	round((h).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, FALSE, 5)) AS h FROM test_histogramagg
+) AS foo;
+SELECT count(*) FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, TRUE, 4)) AS h FROM test_histogramagg
+) AS foo
+FULL JOIN ST_Histogram('test_histogramagg', 'rast', 1, TRUE, 4) AS cov
+	ON (foo.h).min = cov.min
+	AND (foo.h).max = cov.max
+	AND (foo.h).count = cov.count
+	AND round((foo.h).percent::numeric, 6) = round(cov.percent::numeric, 6)
+WHERE foo.h IS NULL OR cov.count IS NULL;
+SELECT count(*) FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, TRUE, 1, 4, NULL, TRUE)) AS h FROM test_histogramagg
+) AS foo
+FULL JOIN ST_Histogram('test_histogramagg', 'rast', 1, TRUE, 4, TRUE) AS cov
+	ON (foo.h).min = cov.min
+	AND (foo.h).max = cov.max
+	AND (foo.h).count = cov.count
+	AND round((foo.h).percent::numeric, 6) = round(cov.percent::numeric, 6)
+WHERE foo.h IS NULL OR cov.count IS NULL;
+SELECT count(*) FROM (
+	SELECT unnest(ST_HistogramAgg(rast, 1, FALSE, 5)) AS h FROM test_histogramagg
+) AS foo
+FULL JOIN ST_Histogram('test_histogramagg', 'rast', 1, FALSE, 5) AS cov
+	ON (foo.h).min = cov.min
+	AND (foo.h).max = cov.max
+	AND (foo.h).count = cov.count
+	AND round((foo.h).percent::numeric, 6) = round(cov.percent::numeric, 6)
+WHERE foo.h IS NULL OR cov.count IS NULL;
+SELECT ST_HistogramAgg(rast, 1, TRUE, 4) IS NULL FROM test_histogramagg WHERE rid IN (3, 4);
+SELECT ST_HistogramAgg(rast, 1, TRUE, 4) IS NULL FROM test_histogramagg WHERE rast IS NULL;
+SAVEPOINT test;
+SELECT ST_HistogramAgg(rast, 2, TRUE, 4) FROM test_histogramagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+SAVEPOINT test;
+SELECT ST_HistogramAgg(rast, 1, TRUE, 1, 4, ARRAY[-1]::double precision[], FALSE) FROM test_histogramagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+ROLLBACK;
@@ -0,0 +1,58 @@
+BEGIN;
+CREATE TEMP TABLE test_quantileagg
+	ON COMMIT DROP AS
+	SELECT
+		rid, rast
+	FROM (
+		SELECT 1 AS rid, ST_AddBand(ST_MakeEmptyRaster(2, 2, 0, 0, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0) AS rast
+		UNION ALL
+		SELECT 2, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 2, 0, 1, -1, 0, 0, 0), 1, '8BUI', 2, 0), 1, 1, 1, 5)
+		UNION ALL
+		SELECT 3, ST_AddBand(ST_MakeEmptyRaster(2, 2, 4, 0, 1, -1, 0, 0, 0), 1, '8BUI', 0, 0)
+		UNION ALL
+		SELECT 4, NULL::raster
+		UNION ALL
+		SELECT 5, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 6, 0, 1, -1, 0, 0, 0), 1, '8BUI', 3, 0), 1, 2, 2, 0)
+	) AS foo;
+SELECT
+	round((q).quantile::numeric, 3),
+	round((q).value::numeric, 3)
+FROM (
+	SELECT unnest(ST_QuantileAgg(rast, 1, TRUE, NULL::double precision[])) AS q FROM test_quantileagg
+) AS foo;
+SELECT
+	round((q).quantile::numeric, 3),
+	round((q).value::numeric, 3)
+FROM (
+	SELECT unnest(ST_QuantileAgg(rast, 1, FALSE, NULL::double precision[])) AS q FROM test_quantileagg
+) AS foo;
+SELECT
+	round((q).quantile::numeric, 3),
+	round((q).value::numeric, 3)
+FROM (
+	SELECT unnest(ST_QuantileAgg(rast, 1, TRUE, ARRAY[0.1, 0.5, 0.9]::double precision[])) AS q FROM test_quantileagg
+) AS foo;
+SELECT
+	round((q).quantile::numeric, 3),
+	round((q).value::numeric, 3)
+FROM (
+	SELECT unnest(ST_QuantileAgg(rast, 1, TRUE, 0, ARRAY[0.5]::double precision[])) AS q FROM test_quantileagg
+) AS foo;
+SELECT count(*) FROM (
+	SELECT unnest(ST_QuantileAgg(rast, 1, TRUE, NULL::double precision[])) AS q FROM test_quantileagg
+) AS foo
+FULL JOIN ST_Quantile('test_quantileagg', 'rast', 1, TRUE, NULL::double precision[]) AS cov
+	ON (foo.q).quantile = cov.quantile
+	AND (foo.q).value = cov.value
+WHERE foo.q IS NULL OR cov.quantile IS NULL;
+SELECT ST_QuantileAgg(rast, 1, TRUE, NULL::double precision[]) IS NULL FROM test_quantileagg WHERE rid IN (3, 4);
+SELECT ST_QuantileAgg(rast, 1, TRUE, NULL::double precision[]) IS NULL FROM test_quantileagg WHERE rast IS NULL;
+SAVEPOINT test;
+SELECT ST_QuantileAgg(rast, 2, TRUE, NULL::double precision[]) FROM test_quantileagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+SAVEPOINT test;
+SELECT ST_QuantileAgg(rast, 1, TRUE, ARRAY[1.5]::double precision[]) FROM test_quantileagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+ROLLBACK;
@@ -0,0 +1,88 @@
+BEGIN;
+CREATE TEMP TABLE test_summarystatsagg
+	ON COMMIT DROP AS
+	SELECT
+		rid, rast
+	FROM (
+		SELECT 1 AS rid, ST_AddBand(ST_MakeEmptyRaster(2, 2, 0, 0, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0) AS rast
+		UNION ALL
+		SELECT 2, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 2, 0, 1, -1, 0, 0, 0), 1, '8BUI', 2, 0), 1, 1, 1, 5)
+		UNION ALL
+		SELECT 3, ST_AddBand(ST_MakeEmptyRaster(2, 2, 4, 0, 1, -1, 0, 0, 0), 1, '8BUI', 0, 0)
+		UNION ALL
+		SELECT 4, NULL::raster
+		UNION ALL
+		SELECT 5, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 6, 0, 1, -1, 0, 0, 0), 1, '8BUI', 3, 0), 1, 2, 2, 0)
+	) AS foo;
+SELECT
+	(stats).count,
+	round((stats).sum::numeric, 3),
+	round((stats).mean::numeric, 3),
+	round((stats).stddev::numeric, 3),
+	round((stats).min::numeric, 3),
+	round((stats).max::numeric, 3)
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, TRUE) AS stats FROM test_summarystatsagg
+) AS foo;
+SELECT
+	(stats).count,
+	round((stats).sum::numeric, 3),
+	round((stats).mean::numeric, 3),
+	round((stats).stddev::numeric, 3),
+	round((stats).min::numeric, 3),
+	round((stats).max::numeric, 3)
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, FALSE) AS stats FROM test_summarystatsagg
+) AS foo;
+SELECT
+	(stats).count,
+	round((stats).sum::numeric, 3),
+	round((stats).mean::numeric, 3),
+	round((stats).stddev::numeric, 3),
+	round((stats).min::numeric, 3),
+	round((stats).max::numeric, 3)
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, TRUE, 0) AS stats FROM test_summarystatsagg
+) AS foo;
+SELECT
+	(stats).count,
+	round((stats).sum::numeric, 3),
+	round((stats).mean::numeric, 3),
+	round((stats).stddev::numeric, 3),
+	round((stats).min::numeric, 3),
+	round((stats).max::numeric, 3)
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, TRUE) AS stats FROM test_summarystatsagg
+		WHERE rid IN (3, 4)
+) AS foo;
+SELECT
+	(agg).count = cov.count,
+	round((agg).sum::numeric, 6) = round(cov.sum::numeric, 6),
+	round((agg).mean::numeric, 6) = round(cov.mean::numeric, 6),
+	round((agg).stddev::numeric, 6) = round(cov.stddev::numeric, 6),
+	(agg).min = cov.min,
+	(agg).max = cov.max
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, TRUE) AS agg FROM test_summarystatsagg
+) AS foo, ST_SummaryStats('test_summarystatsagg', 'rast', 1, TRUE) AS cov;
+SELECT
+	(agg).count = cov.count,
+	round((agg).sum::numeric, 6) = round(cov.sum::numeric, 6),
+	round((agg).mean::numeric, 6) = round(cov.mean::numeric, 6),
+	round((agg).stddev::numeric, 6) = round(cov.stddev::numeric, 6),
+	(agg).min = cov.min,
+	(agg).max = cov.max
+FROM (
+	SELECT ST_SummaryStatsAgg(rast, 1, FALSE) AS agg FROM test_summarystatsagg
+) AS foo, ST_SummaryStats('test_summarystatsagg', 'rast', 1, FALSE) AS cov;
+SELECT ST_SummaryStatsAgg(rast, 1, TRUE) IS NULL FROM test_summarystatsagg WHERE rast IS NULL;
+SELECT ST_SummaryStatsAgg(rast, 1, TRUE) IS NULL FROM test_summarystatsagg WHERE FALSE;
+SAVEPOINT test;
+SELECT ST_SummaryStatsAgg(rast, 2, TRUE) FROM test_summarystatsagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+SAVEPOINT test;
+SELECT ST_SummaryStatsAgg(rast, 1, TRUE, 2) FROM test_summarystatsagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+ROLLBACK;
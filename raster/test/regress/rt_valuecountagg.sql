@@ -0,0 +1,80 @@
+BEGIN;
+CREATE TEMP TABLE test_valuecountagg
+	ON COMMIT DROP AS
+	SELECT
+		rid, rast
+	FROM (
+		SELECT 1 AS rid, ST_AddBand(ST_MakeEmptyRaster(2, 2, 0, 0, 1, -1, 0, 0, 0), 1, '8BUI', 1, 0) AS rast
+		UNION ALL
+		SELECT 2, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 2, 0, 1, -1, 0, 0, 0), 1, '8BUI', 2, 0), 1, 1, 1, 5)
+		UNION ALL
+		SELECT 3, ST_AddBand(ST_MakeEmptyRaster(2, 2, 4, 0, 1, -1, 0, 0, 0), 1, '8BUI', 0, 0)
+		UNION ALL
+		SELECT 4, NULL::raster
+		UNION ALL
+		SELECT 5, ST_SetValue(ST_AddBand(ST_MakeEmptyRaster(2, 2, 6, 0, 1, -1, 0, 0, 0), 1, '8BUI', 3, 0), 1, 2, 2, 0)
+	) AS foo;
+SELECT
+	(c).value,
+	(c).count,
+	round((c).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE)) AS c FROM test_valuecountagg
+) AS foo;
+SELECT
+	(c).value,
+	(c).count,
+	round((c).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, FALSE)) AS c FROM test_valuecountagg
+) AS foo;
+SELECT
+	(c).value,
+	(c).count,
+	round((c).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE, ARRAY[1, 3, 4]::double precision[], 0)) AS c FROM test_valuecountagg
+) AS foo;
+SELECT
+	(c).value,
+	(c).count,
+	round((c).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE, ARRAY[2.6]::double precision[], 1)) AS c FROM test_valuecountagg
+) AS foo;
+SELECT
+	(c).value,
+	(c).count,
+	round((c).percent::numeric, 3)
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE, NULL::double precision[], 0)) AS c FROM test_valuecountagg
+) AS foo;
+SELECT count(*) FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, FALSE)) AS c FROM test_valuecountagg
+) AS foo
+FULL JOIN ST_ValueCount('test_valuecountagg', 'rast', 1, FALSE) AS cov
+	ON (foo.c).value = cov.value
+	AND (foo.c).count = cov.count
+WHERE foo.c IS NULL OR cov.value IS NULL;
+SELECT count(*) FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE, ARRAY[1, 3, 4]::double precision[], 0)) AS c FROM test_valuecountagg
+) AS foo
+FULL JOIN ST_ValueCount('test_valuecountagg', 'rast', 1, TRUE, ARRAY[1, 3, 4]::double precision[], 0) AS cov
+	ON (foo.c).value = cov.value
+	AND (foo.c).count = cov.count
+WHERE foo.c IS NULL OR cov.value IS NULL;
+SELECT
+	(c).value,
+	(c).count,
+	(c).percent IS NULL
+FROM (
+	SELECT unnest(ST_ValueCountAgg(rast, 1, TRUE, ARRAY[1, 3, 4]::double precision[], 0)) AS c FROM test_valuecountagg
+		WHERE rid IN (3, 4)
+) AS foo;
+SELECT ST_ValueCountAgg(rast, 1, TRUE) IS NULL FROM test_valuecountagg WHERE rid IN (3, 4);
+SELECT ST_ValueCountAgg(rast, 1, TRUE) IS NULL FROM test_valuecountagg WHERE rast IS NULL;
+SAVEPOINT test;
+SELECT ST_ValueCountAgg(rast, 2, TRUE) FROM test_valuecountagg;
+ROLLBACK TO SAVEPOINT test;
+RELEASE SAVEPOINT test;
+ROLLBACK;
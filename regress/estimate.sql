@@ -0,0 +1,39 @@
+-- The histograms of the && estimates have at most 4000 buckets,
+-- whatever the statistics target, as the join estimate compares
+-- every pair of buckets of the two columns.
+CREATE TABLE estimate_geom AS
+	SELECT x * 100 + y AS id, ST_MakePoint(x, y) AS g
+	FROM generate_series(0, 99) AS x, generate_series(0, 79) AS y;
+CREATE TABLE estimate_geog AS
+	SELECT id, ST_SetSRID(ST_Translate(g, -50, -40), 4326)::geography AS g
+	FROM estimate_geom;
+
+ALTER TABLE estimate_geom ALTER COLUMN g SET STATISTICS 10;
+ANALYZE estimate_geom;
+SELECT 'target10', substring(_postgis_stats('estimate_geom', 'g') from 'nbuckets=([0-9]+)')::int <= 40;
+
+ALTER TABLE estimate_geom ALTER COLUMN g SET STATISTICS 10000;
+ALTER TABLE estimate_geog ALTER COLUMN g SET STATISTICS 10000;
+ANALYZE estimate_geom;
+ANALYZE estimate_geog;
+SELECT 'geometry', substring(_postgis_stats('estimate_geom', 'g') from 'nbuckets=([0-9]+)')::int BETWEEN 1000 AND 4000;
+SELECT 'geography', substring(_postgis_stats('estimate_geog', 'g') from 'nbuckets=([0-9]+)')::int BETWEEN 1000 AND 4000;
+
+-- a sample that is not a multiple of the number of buckets still
+-- fits in them
+CREATE TABLE estimate_odd AS
+	SELECT id, g FROM estimate_geom WHERE id < 6001;
+ALTER TABLE estimate_odd ALTER COLUMN g SET STATISTICS 1000;
+ANALYZE estimate_odd;
+SELECT 'odd', substring(_postgis_stats('estimate_odd', 'g') from 'nbuckets=([0-9]+)')::int BETWEEN 1000 AND 4000;
+SELECT 'oddsel', _postgis_selectivity('estimate_odd', 'g', 'POLYGON((-1 -1,-1 100,29.5 100,29.5 -1,-1 -1))'::geometry) BETWEEN 0.4 AND 0.6;
+DROP TABLE estimate_odd;
+
+-- the estimates still follow the data
+SELECT 'sel1', _postgis_selectivity('estimate_geom', 'g', 'POLYGON((-1 -1,-1 100,100 100,100 -1,-1 -1))'::geometry) > 0.99;
+SELECT 'sel2', _postgis_selectivity('estimate_geom', 'g', 'POLYGON((-1 -1,-1 39.5,49.5 39.5,49.5 -1,-1 -1))'::geometry) BETWEEN 0.2 AND 0.3;
+SELECT 'sel3', _postgis_selectivity('estimate_geom', 'g', 'POLYGON((200 200,200 300,300 300,300 200,200 200))'::geometry);
+SELECT 'joinsel', _postgis_join_selectivity('estimate_geom', 'g', 'estimate_geom', 'g') BETWEEN 0 AND 0.01;
+
+DROP TABLE estimate_geog;
+DROP TABLE estimate_geom;
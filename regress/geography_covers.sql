@@ -0,0 +1,25 @@
+-- ST_Covers(geography) gives the same answer whether or not the
+-- repeated polygon argument is served from the cached edge tree,
+-- which only kicks in from its second sighting on.
+CREATE TABLE geog_covers_pts (id integer, g geography);
+INSERT INTO geog_covers_pts VALUES
+	(1, 'MULTIPOINT(1 1,11 1)'),
+	(2, 'MULTIPOINT(1 1,11 1)'),
+	(3, 'MULTIPOINT(1 1,11 1)'),
+	(4, 'POINT(1 1)'),
+	(5, 'POINT(11 1)'),
+	(6, 'MULTIPOINT(1 1,2 2)'),
+	(7, 'POINT(5 5)'),
+	(8, 'GEOMETRYCOLLECTION(POINT(1 1),POINT(2 2))'),
+	(9, 'GEOMETRYCOLLECTION(POINT(1 1),GEOMETRYCOLLECTION EMPTY)'),
+	(10, 'POINT EMPTY'),
+	(11, 'MULTIPOINT(1 1,11 1)');
+
+-- points in two different members are not covered by any one of them
+SELECT 'multipolygon', id, ST_Covers('MULTIPOLYGON(((0 0,0 3,3 3,3 0,0 0)),((10 0,10 3,13 3,13 0,10 0)))'::geography, g)
+	FROM geog_covers_pts ORDER BY id;
+
+SELECT 'polygon', id, ST_Covers('POLYGON((0 0,0 3,3 3,3 0,0 0))'::geography, g)
+	FROM geog_covers_pts ORDER BY id;
+
+DROP TABLE geog_covers_pts;
@@ -0,0 +1,22 @@
+-- ST_Distance(geography) has no answer for inputs with empty members,
+-- whether or not the repeated argument is served from the cached edge
+-- tree, which only kicks in from its second sighting on.
+CREATE TABLE geog_distance_pts (id integer, g geography);
+INSERT INTO geog_distance_pts VALUES
+	(1, 'POINT(0 0)'),
+	(2, 'POINT(0 0)'),
+	(3, 'POINT(0 0)'),
+	(4, 'GEOMETRYCOLLECTION(POINT EMPTY,POINT(1 1))'),
+	(5, 'MULTIPOINT(EMPTY,1 1)'),
+	(6, 'GEOMETRYCOLLECTION(POINT EMPTY,POINT(1 1))'),
+	(7, 'POINT(1 1)');
+
+-- the repeated argument has an empty member
+SELECT 'collection', id, ST_Distance('GEOMETRYCOLLECTION(POINT EMPTY,LINESTRING(0 0,0 2))'::geography, g) IS NULL
+	FROM geog_distance_pts ORDER BY id;
+
+-- the other argument has an empty member
+SELECT 'line', id, ST_Distance('LINESTRING(0 0,0 2)'::geography, g) IS NULL
+	FROM geog_distance_pts ORDER BY id;
+
+DROP TABLE geog_distance_pts;
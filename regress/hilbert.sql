@@ -0,0 +1,55 @@
+-- ST_HilbertKey: the curve starts at the lower left corner of the
+-- extent and ends at the lower right one
+SELECT 'key1', ST_HilbertKey('POINT(0 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'key2', ST_HilbertKey('POINT(10 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+-- centres outside of the extent are clamped to its edges
+SELECT 'key3', ST_HilbertKey('POINT(-5 -5)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'key4', ST_HilbertKey('POINT(15 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+-- the centre of the box is used
+SELECT 'key5', ST_HilbertKey('LINESTRING(0 0,10 0)'::geometry, 'BOX(0 0,10 10)'::box2d)
+	= ST_HilbertKey('POINT(5 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+-- the quadrants are visited lower left, upper left, upper right, lower right
+SELECT 'key6', array_to_string(array_agg(id), ',') FROM (
+	SELECT id FROM (VALUES
+		(1, 'POINT(2 2)'::geometry),
+		(2, 'POINT(2 8)'::geometry),
+		(3, 'POINT(8 8)'::geometry),
+		(4, 'POINT(8 2)'::geometry)) AS t(id, g)
+	ORDER BY ST_HilbertKey(g, 'BOX(0 0,10 10)'::box2d)) AS s;
+-- a degenerate extent still gives an order
+SELECT 'key7', ST_HilbertKey('POINT(3 3)'::geometry, 'BOX(3 3,3 3)'::box2d);
+SELECT 'empty', ST_HilbertKey('POINT EMPTY'::geometry, 'BOX(0 0,10 10)'::box2d) IS NULL;
+SELECT 'emptycoll', ST_HilbertKey('GEOMETRYCOLLECTION EMPTY'::geometry, 'BOX(0 0,10 10)'::box2d) IS NULL;
+SELECT 'null', ST_HilbertKey(NULL::geometry, 'BOX(0 0,10 10)'::box2d) IS NULL;
+
+-- ST_HilbertCluster rewrites the table in key order, keeps the
+-- clustering index it had and leaves the rows of children alone
+CREATE TABLE hilbert_parent (id integer, g geometry);
+CREATE TABLE hilbert_child () INHERITS (hilbert_parent);
+INSERT INTO hilbert_parent VALUES
+	(4, 'POINT(8 2)'),
+	(3, 'POINT(8 8)'),
+	(5, 'POINT EMPTY'),
+	(6, NULL),
+	(2, 'POINT(2 8)'),
+	(1, 'POINT(2 2)');
+INSERT INTO hilbert_child VALUES (7, 'POINT(5 5)');
+CREATE INDEX hilbert_parent_id ON hilbert_parent (id);
+CLUSTER hilbert_parent USING hilbert_parent_id;
+SELECT 'cluster1', ST_HilbertCluster('hilbert_parent', 'g');
+-- empty and NULL geometries have no key and sort after the others
+SELECT 'cluster2', array_to_string(array_agg(id), ',') FROM (SELECT id FROM ONLY hilbert_parent LIMIT 4) AS s;
+SELECT 'cluster3', count(*) FROM ONLY hilbert_child;
+SELECT 'cluster4', c.relname FROM pg_index i JOIN pg_class c ON c.oid = i.indexrelid
+	WHERE i.indrelid = 'hilbert_parent'::regclass AND i.indisclustered;
+SELECT 'cluster5', count(*) FROM pg_class WHERE relname LIKE 'pgis_hilbert_cluster_%';
+DROP TABLE hilbert_child;
+DROP TABLE hilbert_parent;
+
+-- nothing to order in an empty table (with no statistics to estimate
+-- the extent from, which is a notice)
+CREATE TABLE hilbert_empty (g geometry);
+SET client_min_messages TO warning;
+SELECT 'cluster6', ST_HilbertCluster('hilbert_empty', 'g');
+RESET client_min_messages;
+DROP TABLE hilbert_empty;
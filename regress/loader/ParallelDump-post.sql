@@ -0,0 +1,4 @@
+DROP TABLE dump_nogid;
+DROP TABLE dump_gid;
+DROP TABLE dump_child;
+DROP TABLE dump_parent;
@@ -0,0 +1,21 @@
+-- A plain table without gid, cut into ranges of pages, with holes
+CREATE TABLE dump_nogid AS
+	SELECT i AS id, 'p' || i AS name, ST_SetSRID(ST_MakePoint(i % 200, i / 200), 4326) AS the_geom
+	FROM generate_series(1, 25000) AS i;
+DELETE FROM dump_nogid WHERE id % 7 = 0;
+
+-- A table with gid, loaded out of gid order, cut into ranges of gids
+CREATE TABLE dump_gid AS
+	SELECT i AS gid, 'p' || i AS name, ST_SetSRID(ST_MakePoint(i % 200, i / 200), 4326) AS the_geom
+	FROM generate_series(1, 25000) AS i ORDER BY i % 3, i;
+
+-- An inheritance parent without gid, dumped over a single connection,
+-- and its child, a plain table again
+CREATE TABLE dump_parent (id integer, name varchar(16), the_geom geometry);
+CREATE TABLE dump_child () INHERITS (dump_parent);
+INSERT INTO dump_parent
+	SELECT i, 'p' || i, ST_SetSRID(ST_MakePoint(i % 200, i / 200), 4326)
+	FROM generate_series(1, 15000) AS i;
+INSERT INTO dump_child
+	SELECT i, 'c' || i, ST_SetSRID(ST_MakePoint(i % 200, i / 200), 4326)
+	FROM generate_series(15001, 30000) AS i;
@@ -296,3 +296,14 @@ SELECT 'covers311', ST_Covers('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', p) FROM
 ('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)')
 ) AS v(p);
 
+
+-- Two containers taking turns stay prepared: only their first calls miss
+CREATE TEMP TABLE prep_stats AS SELECT * FROM postgis_prepared_cache_stats();
+SELECT 'alternate', count(*) FROM generate_series(1, 10) i
+WHERE ST_Contains(CASE WHEN i % 2 = 0
+  THEN 'POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))'::geometry
+  ELSE 'POLYGON((0 0, 0 20, 20 20, 20 0, 0 0))'::geometry END,
+  ST_MakeLine(ST_MakePoint(1, 1), ST_MakePoint(2, 1 + i / 10.0)));
+SELECT 'alternate_stats', s.hits - p.hits, s.misses - p.misses, s.prepares - p.prepares
+FROM postgis_prepared_cache_stats() s, prep_stats p;
+DROP TABLE prep_stats;
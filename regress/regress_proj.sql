@@ -36,5 +36,9 @@ SELECT ST_transform(ST_GeomFromEWKT('SRID=0;POINT(0 0)'),100002);
 --- test #8: Transforming to same SRID
 SELECT 8,ST_AsEWKT(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(0 0)'),100002));
 
+--- test #9: the cached projection follows spatial_ref_sys changes
+UPDATE spatial_ref_sys SET proj4text = '+proj=tmerc +lat_0=0 +lon_0=15 +k=0.9996 +x_0=600000 +y_0=0 +ellps=WGS84 +datum=WGS84 +units=m +no_defs ' WHERE srid = 100001;
+SELECT 9,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),100001),10));
+
 DELETE FROM spatial_ref_sys WHERE srid >= 100000;
 
@@ -0,0 +1,111 @@
+-- The segment index of a repeated argument (RTREE_POLY_CACHE) is
+-- built on the second call. Every case below runs three times over
+-- the same arguments: the first call takes the plain path, the next
+-- ones the indexed path, and all must agree.
+
+-- point in polygon, with a hole, an empty member and multipoints
+SELECT 'contains1', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(25 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(25 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(25 5)')
+) AS v(a, b);
+SELECT 'contains2', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(5 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(5 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(5 5)')
+) AS v(a, b);
+SELECT 'contains3', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(0 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(0 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(0 5)')
+) AS v(a, b);
+SELECT 'contains4', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'MULTIPOINT(EMPTY,1 1,25 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTIPOINT(EMPTY,1 1,25 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTIPOINT(EMPTY,1 1,25 5)')
+) AS v(a, b);
+SELECT 'contains5', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'MULTIPOINT(1 1,15 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTIPOINT(1 1,15 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTIPOINT(1 1,15 5)')
+) AS v(a, b);
+SELECT 'contains6', ST_Contains(a, b) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT EMPTY'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY')
+) AS v(a, b);
+
+-- distance between the indexed argument and the other one
+SELECT 'distance1', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(15 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)')
+) AS v(a, b);
+SELECT 'distance2', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(5 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(5 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(5 5)')
+) AS v(a, b);
+SELECT 'distance3', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(2 2)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(2 2)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(2 2)')
+) AS v(a, b);
+SELECT 'distance4', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'MULTILINESTRING(EMPTY,(12 12,18 12))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))')
+) AS v(a, b);
+SELECT 'distance5', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POLYGON((1 1,1 2,2 2,2 1,1 1))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((1 1,1 2,2 2,2 1,1 1))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((1 1,1 2,2 2,2 1,1 1))')
+) AS v(a, b);
+SELECT 'distance6', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))')
+) AS v(a, b);
+SELECT 'distance7', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT EMPTY'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY')
+) AS v(a, b);
+-- only the second argument repeats
+SELECT 'distance8', round(ST_Distance(a, b)::numeric, 10) FROM ( VALUES 
+('POINT(15 5)'::geometry, 'MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry),
+('POINT(15 6)', 'MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'),
+('MULTIPOINT(EMPTY,15 4)', 'MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))')
+) AS v(a, b);
+
+-- dwithin stops at the first distance under the tolerance
+SELECT 'dwithin1', ST_DWithin(a, b, 5) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(15 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)')
+) AS v(a, b);
+SELECT 'dwithin2', ST_DWithin(a, b, 4.9) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT(15 5)'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT(15 5)')
+) AS v(a, b);
+SELECT 'dwithin3', ST_DWithin(a, b, 2.8) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'MULTILINESTRING(EMPTY,(12 12,18 12))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))')
+) AS v(a, b);
+SELECT 'dwithin4', ST_DWithin(a, b, 2.9) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'MULTILINESTRING(EMPTY,(12 12,18 12))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'MULTILINESTRING(EMPTY,(12 12,18 12))')
+) AS v(a, b);
+SELECT 'dwithin5', ST_DWithin(a, b, 0.4) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POLYGON((4.5 4.5,4.5 5.5,5.5 5.5,5.5 4.5,4.5 4.5))')
+) AS v(a, b);
+SELECT 'dwithin6', ST_DWithin(a, b, 100) FROM ( VALUES 
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))'::geometry, 'POINT EMPTY'::geometry),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY'),
+('MULTIPOLYGON(EMPTY,((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4)),((20 0,20 10,30 10,30 0,20 0)))', 'POINT EMPTY')
+) AS v(a, b);
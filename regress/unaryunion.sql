@@ -8,3 +8,14 @@ SELECT 2, ST_AsText(ST_UnaryUnion('GEOMETRYCOLLECTION(POLYGON((0 0, 10 0, 10 10,
 -- Unioning an heterogeneous collection of geometries
 SELECT 3, ST_AsText(ST_UnaryUnion('GEOMETRYCOLLECTION(POLYGON((0 0, 10 0, 10 10, 0 10, 0 0)),POLYGON((5 5, 15 5, 15 15, 5 15, 5 5)), MULTIPOINT(5 4, -5 4),LINESTRING(2 -10, 2 20))'));
 
+
+-- The aggregate unions in batches of 1024: an empty-only batch
+-- between two full ones must not lose the first
+CREATE TABLE union_batches AS
+SELECT i, CASE WHEN i BETWEEN 1025 AND 2048 THEN 'POLYGON EMPTY'::geometry
+  ELSE ST_MakeEnvelope(i % 50, i / 50, i % 50 + 1, i / 50 + 1) END AS g
+FROM generate_series(1, 3000) i;
+SELECT 4, ST_Equals(ST_Union(g), ST_Union(ARRAY(SELECT g FROM union_batches ORDER BY i))),
+  ST_Area(ST_Union(g))
+FROM (SELECT g FROM union_batches ORDER BY i) foo;
+DROP TABLE union_batches;
@@ -268,6 +268,31 @@ while(<INPUT>)
 		}
 	}
 
+	# This code handles triggers by creating them unless they exist,
+	# as there is no create or replace trigger
+	if ( /^create trigger\s+(\w+)\s*/i )
+	{
+		my $trigname = $1;
+		my $trigtable = 'unknown';
+		my $def = $_;
+		$trigtable = $1 if ( /\son\s+(\w+)/i );
+		while( ! /\;\s*$/ && ($_ = <INPUT>) )
+		{
+			$def .= $_;
+			$trigtable = $1 if ( /\son\s+(\w+)/i );
+		}
+		print "CREATE OR REPLACE FUNCTION postgis_upgrade_create_trigger()\n";
+		print "RETURNS void AS \$\$\n";
+		print "BEGIN\n";
+		print "\tIF NOT EXISTS ( SELECT 1 FROM pg_trigger WHERE tgname = '$trigname' AND tgrelid = '$trigtable'::regclass ) THEN\n";
+		print $def;
+		print "\tEND IF;\n";
+		print "END\n";
+		print "\$\$ LANGUAGE 'plpgsql';\n";
+		print "SELECT postgis_upgrade_create_trigger();\n";
+		print "DROP FUNCTION postgis_upgrade_create_trigger();\n";
+	}
+
 	# This code handles operator classes by creating them if we are doing a major upgrade
 	if ( /^create operator class\s+(\w+)\s*/i )
 	{
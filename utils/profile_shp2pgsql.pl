@@ -0,0 +1,160 @@
+#!/usr/bin/perl -w
+
+#
+# Compares the time taken by shp2pgsql to load a shapefile straight
+# into the database (-L) with text COPY (hex WKB) and with binary
+# COPY (-B, raw WKB), for each number of parallel connections.
+#
+# The client CPU time is that of shp2pgsql alone, the wall time
+# includes the work of the server parsing the rows.
+#
+
+use Pg;
+use Time::HiRes("gettimeofday");
+
+$VERBOSE = 0;
+$ROUNDS = 3;
+$SHP2PGSQL = 'shp2pgsql';
+
+sub usage
+{
+	local($me) = `basename $0`;
+	chop($me);
+	print STDERR "$me [-v] [-r <rounds>] [-j <jobs>[,<jobs>]] [-shp2pgsql <path>] <conninfo> <shapefile> [<table>]\n";
+}
+
+$CONNINFO='';
+$SHAPEFILE='';
+$TABLE='';
+for ($i=0; $i<@ARGV; $i++)
+{
+	if ( $ARGV[$i] =~ m/^-/ )
+	{
+		if ( $ARGV[$i] eq '-v' )
+		{
+			$VERBOSE++;
+		}
+		elsif ( $ARGV[$i] eq '-r' )
+		{
+			$ROUNDS = $ARGV[++$i];
+		}
+		elsif ( $ARGV[$i] eq '-j' )
+		{
+			$jobs_spec = $ARGV[++$i];
+			push(@jobs_list, split(',', $jobs_spec));
+		}
+		elsif ( $ARGV[$i] eq '-shp2pgsql' )
+		{
+			$SHP2PGSQL = $ARGV[++$i];
+		}
+		else
+		{
+			print STDERR "Unknown option $ARGV[$i]:\n";
+			usage();
+			exit(1);
+		}
+	}
+	elsif ( ! $CONNINFO )
+	{
+		$CONNINFO = $ARGV[$i];
+	}
+	elsif ( ! $SHAPEFILE )
+	{
+		$SHAPEFILE = $ARGV[$i];
+	}
+	elsif ( ! $TABLE )
+	{
+		$TABLE = $ARGV[$i];
+	}
+	else
+	{
+		print STDERR "Too many options:\n";
+		usage();
+		exit(1);
+	}
+}
+
+if ( ! $CONNINFO || ! $SHAPEFILE )
+{
+	usage();
+	exit 1;
+}
+
+$TABLE = 'profile_shp2pgsql' if ( $TABLE eq '' );
+@jobs_list = ( 1 ) if ( ! @jobs_list );
+
+#connect
+$conn = Pg::connectdb($CONNINFO);
+if ( $conn->status != PGRES_CONNECTION_OK ) {
+        print STDERR $conn->errorMessage;
+	exit(1);
+}
+
+print "Shapefile: $SHAPEFILE\n";
+print "    Table: $TABLE\n";
+print "   Rounds: $ROUNDS\n";
+
+print "  jobs\tformat\twall\tclient\trows\twall(text)/wall\n";
+print "----------------------------------------------------------\n";
+
+foreach $jobs (@jobs_list)
+{
+	foreach $format ('text', 'binary')
+	{
+		($wall, $cpu, $rows) = load($jobs, $format);
+		$text_wall = $wall if ( $format eq 'text' );
+
+		printf("  %d\t%s\t%.3f\t%.3f\t%d\t%.2f\n", $jobs, $format,
+			$wall, $cpu, $rows, $text_wall / $wall);
+	}
+}
+
+##################################################################
+
+# Load the shapefile $ROUNDS times, returning the best wall and client
+# CPU times and the number of rows loaded
+sub load
+{
+	local($jobs, $format) = @_;
+	local($cmd, $query, $res, $i);
+	local($t0, $t1, $wall, $cpu, $best_wall, $best_cpu, $rows);
+	local(@times0, @times1);
+
+	$cmd = "$SHP2PGSQL -c -L '$CONNINFO' -j $jobs";
+	$cmd .= ' -B' if ( $format eq 'binary' );
+	$cmd .= " $SHAPEFILE $TABLE";
+
+	for ($i=0; $i<$ROUNDS; $i++)
+	{
+		$query = "DROP TABLE IF EXISTS $TABLE";
+		$res = $conn->exec($query);
+		if ( $res->resultStatus != PGRES_COMMAND_OK )  {
+			print STDERR $conn->errorMessage;
+			exit(1);
+		}
+
+		print "$cmd\n" if ( $VERBOSE );
+
+		@times0 = times();
+		$t0 = gettimeofday();
+		system("$cmd > /dev/null") == 0 or die "$cmd failed\n";
+		$t1 = gettimeofday();
+		@times1 = times();
+
+		$wall = $t1 - $t0;
+		$cpu = ($times1[2] + $times1[3]) - ($times0[2] + $times0[3]);
+
+		$best_wall = $wall if ( ! defined($best_wall) || $wall < $best_wall );
+		$best_cpu = $cpu if ( ! defined($best_cpu) || $cpu < $best_cpu );
+	}
+
+	$query = "SELECT count(*) FROM $TABLE";
+	$res = $conn->exec($query);
+	if ( $res->resultStatus != PGRES_TUPLES_OK )  {
+		print STDERR $conn->errorMessage;
+		exit(1);
+	}
+	$rows = $res->getvalue(0, 0);
+
+	return ($best_wall, $best_cpu, $rows);
+}